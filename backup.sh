@@ -1,3 +1,25 @@
 #!/usr/bin/env bash
-cp recipe.db bak/$(date +%Y%m%d-%H%M%S).db
+# Brian Chrzanowski
+# 2026-10-17 18:02:31
+#
+# Backs up recipe.db into bak/
+#
+# When the server's up, it does the backup itself (src/backup.c), from a consistent snapshot, and
+# this waits for it to finish. When it isn't, nothing's writing to the database, so sqlite3 can just
+# copy it.
 
+URL="http://localhost:2000/api/v1/backup"
+
+if curl -sf "${URL}" > /dev/null; then
+	# a 409 just means there's already one going, and that one's as good as a new one
+	curl -s -d '' "${URL}" > /dev/null
+
+	while curl -sf "${URL}" | grep -q '"running":true'; do
+		sleep 1
+	done
+
+	curl -sf "${URL}" | grep -q '"ok":true'
+else
+	mkdir -p bak
+	sqlite3 recipe.db ".backup bak/$(date +%Y%m%d-%H%M%S).db"
+fi
@@ -0,0 +1,168 @@
+#if !defined(BENCH_H)
+#define BENCH_H
+
+/*
+ * Brian Chrzanowski
+ * 2026-10-18 09:12:44
+ *
+ * Benchmark Harness
+ *
+ * What every program in bench/ needs: clocks, sorting latencies, talking to the server over a
+ * socket, and starting and stopping one against a throwaway database.
+ *
+ * USAGE
+ *
+ * In the benchmark's source file, after common.h, do this:
+ *    #define BENCH_IMPLEMENTATION
+ *    #include "bench.h"
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define PORT   (2000)       // the server always listens here (see PORT in main.c)
+#define SERVER ("./recipe") // relative to the root of the repo, where the benchmarks are run from
+
+// now_us: monotonic clock in microseconds
+i64 now_us();
+// now_ns: monotonic clock in nanoseconds
+i64 now_ns();
+// cmp_i64: qsort comparator for latencies
+int cmp_i64(const void *a, const void *b);
+// open_conn: opens a blocking TCP connection to localhost:port, -1 on error
+int open_conn(int port);
+// server_start: runs the server with 'argv' (NULL terminated) against a database in 'dir', and waits until it's listening
+pid_t server_start(char *dir, char **argv);
+// server_stop: stops the server, and removes the database it was using
+void server_stop(pid_t pid, char *dir);
+
+#if defined(BENCH_IMPLEMENTATION)
+
+// now_us: monotonic clock in microseconds
+i64 now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (i64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// now_ns: monotonic clock in nanoseconds
+i64 now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (i64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// cmp_i64: qsort comparator for latencies
+int cmp_i64(const void *a, const void *b)
+{
+	i64 x = *(i64 *)a, y = *(i64 *)b;
+	return (x > y) - (x < y);
+}
+
+// open_conn: opens a blocking TCP connection to localhost:port, -1 on error
+int open_conn(int port)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	int on = 1;
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+
+	return fd;
+}
+
+// server_start: runs the server with 'argv' (NULL terminated) against a database in 'dir', and waits until it's listening
+pid_t server_start(char *dir, char **argv)
+{
+	char db[BUFSMALL];
+	char *args[32];
+	int nargs = 0;
+	pid_t pid;
+	int fd;
+
+	snprintf(db, sizeof db, "%s/bench.db", dir);
+
+	args[nargs++] = SERVER;
+	for (; argv && *argv && nargs < (int)ARRSIZE(args) - 2; argv++) {
+		args[nargs++] = *argv;
+	}
+	args[nargs++] = db;
+	args[nargs++] = NULL;
+
+	pid = fork();
+	if (pid < 0) {
+		return -1;
+	}
+
+	if (pid == 0) {
+		fd = open("/dev/null", O_WRONLY);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+
+		execv(SERVER, args);
+
+		_exit(127);
+	}
+
+	for (int i = 0; i < 200; i++) {
+		if ((fd = open_conn(PORT)) >= 0) {
+			close(fd);
+			return pid;
+		}
+
+		if (waitpid(pid, NULL, WNOHANG) == pid) {
+			return -1;
+		}
+
+		usleep(50 * 1000);
+	}
+
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+
+	return -1;
+}
+
+// server_stop: stops the server, and removes the database it was using
+void server_stop(pid_t pid, char *dir)
+{
+	char path[BUFSMALL];
+	char *suffixes[] = { "", "-wal", "-shm" };
+
+	kill(pid, SIGINT);
+	waitpid(pid, NULL, 0);
+
+	for (size_t i = 0; i < ARRSIZE(suffixes); i++) {
+		snprintf(path, sizeof path, "%s/bench.db%s", dir, suffixes[i]);
+		unlink(path);
+	}
+
+	rmdir(dir);
+}
+
+#endif // BENCH_IMPLEMENTATION
+
+#endif // BENCH_H
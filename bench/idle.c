@@ -0,0 +1,144 @@
+// Brian Chrzanowski
+// 2026-10-17 11:20:37
+//
+// Idle Connection Benchmark
+//
+// Opens a lot of keep-alive connections to a running server (each one makes a single request, and
+// then just sits there), and then times requests on one more connection. With select() the server
+// tops out at FD_SETSIZE connections, and every poll gets slower as the count goes up. With epoll,
+// neither of those should happen.
+//
+// USAGE: bench/idle [-p port] [-n connections] [-r requests] [-u uri]
+//
+// Results are written to stdout as JSON.
+
+#define _GNU_SOURCE
+#define COMMON_IMPLEMENTATION
+#include "../src/common.h"
+
+#include <sys/resource.h>
+
+#define BENCH_IMPLEMENTATION
+#include "bench.h"
+
+#define USAGE ("USAGE: %s [-p port] [-n connections] [-r requests] [-u uri]\n")
+
+// request: sends a GET, and reads the entire response (headers + Content-Length bytes)
+static int request(int fd, char *uri)
+{
+	char buf[BUFLARGE];
+	size_t len = 0;
+	char *body = NULL;
+	char *cl;
+	long want = -1;
+	ssize_t n;
+
+	n = snprintf(buf, sizeof buf, "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n", uri);
+	if (write(fd, buf, n) != n) {
+		return -1;
+	}
+
+	for (;;) {
+		if (body != NULL && want >= 0 && (long)(len - (body - buf)) >= want) {
+			return 0;
+		}
+
+		n = read(fd, buf + len, sizeof(buf) - len - 1);
+		if (n <= 0) {
+			return -1;
+		}
+
+		len += n;
+		buf[len] = '\0';
+
+		if (body == NULL && (body = strstr(buf, "\r\n\r\n")) != NULL) {
+			body += 4;
+			cl = strcasestr(buf, "Content-Length:");
+			want = cl ? atol(cl + strlen("Content-Length:")) : 0;
+		}
+
+		// we only care about the size of the body, not the content, so just keep the tail around
+		if (body != NULL && len == sizeof(buf) - 1) {
+			want -= len - (body - buf);
+			len = 0;
+			body = buf;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit rl;
+	int port = PORT;
+	int nconns = 10000;
+	int nreqs = 1000;
+	char *uri = "/api/v1/stats";
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:n:r:u:")) != -1) {
+		switch (opt) {
+			case 'p': port = atoi(optarg); break;
+			case 'n': nconns = atoi(optarg); break;
+			case 'r': nreqs = atoi(optarg); break;
+			case 'u': uri = optarg; break;
+			default:
+				fprintf(stderr, USAGE, argv[0]);
+				return 1;
+		}
+	}
+
+	// we need a file descriptor for every connection, plus a few for good measure
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)nconns + 64) {
+		rl.rlim_cur = MIN(rl.rlim_max, (rlim_t)nconns + 64);
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	int *fds = calloc(nconns, sizeof(*fds));
+	i64 *lat = calloc(nreqs, sizeof(*lat));
+	int opened = 0, failed = 0;
+
+	i64 start = now_us();
+
+	for (int i = 0; i < nconns; i++) {
+		fds[i] = open_conn(port);
+		if (fds[i] < 0 || request(fds[i], uri) < 0) {
+			failed++;
+			if (fds[i] >= 0) close(fds[i]);
+			fds[i] = -1;
+		} else {
+			opened++;
+		}
+	}
+
+	i64 open_us = now_us() - start;
+
+	// every idle connection is still open, so now see what a request costs
+	int fd = open_conn(port);
+	int errors = 0;
+
+	for (int i = 0; i < nreqs; i++) {
+		i64 t = now_us();
+		if (fd < 0 || request(fd, uri) < 0) {
+			errors++;
+		}
+		lat[i] = now_us() - t;
+	}
+
+	qsort(lat, nreqs, sizeof(*lat), cmp_i64);
+
+	printf("{\"idle_connections\":%d,\"idle_failed\":%d,\"open_ms\":%.1f,"
+		"\"requests\":%d,\"errors\":%d,\"p50_us\":%ld,\"p99_us\":%ld,\"max_us\":%ld}\n",
+		opened, failed, open_us / 1000.0,
+		nreqs, errors, lat[nreqs / 2], lat[(nreqs * 99) / 100], lat[nreqs - 1]);
+
+	if (fd >= 0) close(fd);
+
+	for (int i = 0; i < nconns; i++) {
+		if (fds[i] >= 0) close(fds[i]);
+	}
+
+	free(fds);
+	free(lat);
+
+	return failed > 0 || errors > 0;
+}
@@ -0,0 +1,583 @@
+// Brian Chrzanowski
+// 2026-10-17 12:41:05
+//
+// REST API Load Generator
+//
+// This is the "PERFORMANCE TESTS" TODO from the top of main.c. It starts the server against a
+// throwaway database, seeds it with synthetic recipes (POST), and then drives every recipe route
+// from a bunch of keep-alive connections at once:
+//
+//   POST   /api/v1/recipe          seeding, N recipes
+//   GET    /api/v1/recipe/:id      random recipes
+//   GET    /api/v1/recipe/list?q=  searches for random words from the vocabulary
+//   ... and again with total=0     the same, without counting the matches (what the count costs)
+//   GET    /api/v1/recipe/list     random pages of the plain listing
+//   PUT    /api/v1/recipe/:id      random recipes, rewritten with new content
+//   DELETE /api/v1/recipe/:id      distinct recipes, from the back of the seed set
+//   POST   /api/v1/recipe/bulk     N more recipes, as one streamed (chunked) NDJSON upload
+//
+// Results are written to stdout as one JSON object, so a run can be saved off and compared against
+// the next release.
+//
+// USAGE: bench/load [-n recipes] [-r requests] [-c concurrency] [-w workers] [-s seed] [-S]
+//
+// It has to be run from the root of the repo (the server wants src/schema.sql and sqlite3_uuid.so
+// relative to where it's run). With -S, it doesn't start a server, and uses the one that's already
+// listening on the port instead (and the database that it has open, so be careful).
+
+#define _GNU_SOURCE
+#define COMMON_IMPLEMENTATION
+#include "../src/common.h"
+
+#include <pthread.h>
+
+#define BENCH_IMPLEMENTATION
+#include "bench.h"
+
+#define USAGE ("USAGE: %s [-n recipes] [-r requests] [-c concurrency] [-w workers] [-s seed] [-S]\n")
+
+#define IDLEN  (36)
+
+typedef struct Client Client;
+
+// Phase: one route being driven, and everything measured about it
+typedef struct Phase {
+	char *name;
+	int (*make)(Client *client, size_t i, char *method, char *uri, size_t urilen, char **body);
+	size_t requests;
+	size_t errors;
+	i64 elapsed_us;
+	i64 *lat;
+} Phase;
+
+// BulkResult: what the bulk import took
+typedef struct BulkResult {
+	size_t recipes;
+	size_t imported;
+	i64 elapsed_us;
+} BulkResult;
+
+// Client: one thread, one keep-alive connection
+struct Client {
+	pthread_t thread;
+	Phase *phase;
+	size_t start, end;
+	size_t errors;
+	u64 rng;
+	int fd;
+	char *buf;
+	size_t cap;
+};
+
+static char (*IDS)[IDLEN + 1];
+static size_t NRECIPES = 1000;
+
+static char *WORDS[] = {
+	"chicken", "beef", "pork", "salmon", "tofu", "rice", "pasta", "potato", "onion", "garlic",
+	"carrot", "celery", "tomato", "pepper", "basil", "thyme", "rosemary", "cumin", "paprika", "ginger",
+	"butter", "flour", "sugar", "egg", "milk", "cream", "cheese", "lemon", "lime", "apple",
+	"spinach", "mushroom", "bean", "lentil", "corn", "broth", "vinegar", "honey", "mustard", "yogurt",
+};
+
+static char *UNITS[] = { "cup", "cups", "tbsp", "tsp", "oz", "lb", "g", "pinch", "clove", "can" };
+
+static char *VERBS[] = { "chop", "stir", "simmer", "bake", "whisk", "fold", "sear", "roast", "season", "rest" };
+
+static char *TAGS[] = { "dinner", "lunch", "breakfast", "dessert", "soup", "quick", "vegetarian", "spicy", "holiday", "snack" };
+
+// rng_next: xorshift64*, each client has its own state so runs are repeatable for a given seed
+static u64 rng_next(u64 *state)
+{
+	u64 x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+// rng_range: returns a number in [lo, hi]
+static size_t rng_range(u64 *state, size_t lo, size_t hi)
+{
+	return lo + rng_next(state) % (hi - lo + 1);
+}
+
+#define PICK(S_, A_) ((A_)[rng_next(S_) % ARRSIZE(A_)])
+
+// response: reads an entire response into client->buf, returns the status code
+static int response(Client *client);
+
+// request: sends a request, reads the entire response into client->buf, returns the status code
+static int request(Client *client, char *method, char *uri, char *body)
+{
+	char head[BUFLARGE];
+	size_t bodylen = body ? strlen(body) : 0;
+	ssize_t n;
+
+	n = snprintf(head, sizeof head,
+		"%s %s HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\nContent-Length: %zu\r\n\r\n",
+		method, uri, bodylen);
+
+	if (write(client->fd, head, n) != n) {
+		return -1;
+	}
+
+	if (bodylen > 0 && write(client->fd, body, bodylen) != (ssize_t)bodylen) {
+		return -1;
+	}
+
+	return response(client);
+}
+
+// response: reads an entire response into client->buf, returns the status code
+static int response(Client *client)
+{
+	size_t len = 0;
+	char *end = NULL;
+	char *cl;
+	long want = 0;
+	ssize_t n;
+
+	for (;;) {
+		if (end != NULL && (long)(len - (end - client->buf)) >= want) {
+			break;
+		}
+
+		if (client->cap - len < BUFLARGE) {
+			size_t off = end ? end - client->buf : 0;
+			client->cap = client->cap * 2 + BUFLARGE;
+			client->buf = realloc(client->buf, client->cap);
+			if (end) end = client->buf + off;
+		}
+
+		n = read(client->fd, client->buf + len, client->cap - len - 1);
+		if (n <= 0) {
+			return -1;
+		}
+
+		len += n;
+		client->buf[len] = '\0';
+
+		if (end == NULL && (end = strstr(client->buf, "\r\n\r\n")) != NULL) {
+			end += 4;
+			cl = strcasestr(client->buf, "Content-Length:");
+			want = cl ? atol(cl + strlen("Content-Length:")) : 0;
+		}
+	}
+
+	if (strncmp(client->buf, "HTTP/1.1 ", 9) != 0) {
+		return -1;
+	}
+
+	return atoi(client->buf + 9);
+}
+
+// make_recipe: writes out a synthetic recipe, with roughly the shape of a real one
+static char *make_recipe(u64 *rng, size_t n)
+{
+	char *s = NULL;
+	size_t len = 0;
+	size_t count;
+
+	FILE *stream = open_memstream(&s, &len);
+
+	fprintf(stream, "{\"name\":\"%s %s %s %zu\"", PICK(rng, WORDS), PICK(rng, WORDS), PICK(rng, TAGS), n);
+	fprintf(stream, ",\"prep_time\":\"%zu min\",\"cook_time\":\"%zu min\",\"servings\":\"%zu\"",
+		rng_range(rng, 5, 45), rng_range(rng, 10, 120), rng_range(rng, 1, 8));
+
+	count = rng_range(rng, 5, 15);
+	fprintf(stream, ",\"ingredients\":[");
+	for (size_t i = 0; i < count; i++) {
+		fprintf(stream, "%s\"%zu %s %s\"", i ? "," : "", rng_range(rng, 1, 4), PICK(rng, UNITS), PICK(rng, WORDS));
+	}
+
+	count = rng_range(rng, 3, 10);
+	fprintf(stream, "],\"steps\":[");
+	for (size_t i = 0; i < count; i++) {
+		fprintf(stream, "%s\"%s the %s", i ? "," : "", PICK(rng, VERBS), PICK(rng, WORDS));
+		for (size_t j = rng_range(rng, 3, 12); j > 0; j--) {
+			fprintf(stream, " %s %s", PICK(rng, VERBS), PICK(rng, WORDS));
+		}
+		fprintf(stream, "\"");
+	}
+
+	count = rng_range(rng, 1, 5);
+	fprintf(stream, "],\"tags\":[");
+	for (size_t i = 0; i < count; i++) {
+		fprintf(stream, "%s\"%s\"", i ? "," : "", PICK(rng, TAGS));
+	}
+
+	fprintf(stream, "]}");
+	fclose(stream);
+
+	return s;
+}
+
+// make_post: seeds recipe 'i'
+static int make_post(Client *client, size_t i, char *method, char *uri, size_t urilen, char **body)
+{
+	strcpy(method, "POST");
+	snprintf(uri, urilen, "/api/v1/recipe");
+	*body = make_recipe(&client->rng, i);
+	return 0;
+}
+
+// make_get: fetches a random recipe
+static int make_get(Client *client, size_t i, char *method, char *uri, size_t urilen, char **body)
+{
+	strcpy(method, "GET");
+	snprintf(uri, urilen, "/api/v1/recipe/%s", IDS[rng_next(&client->rng) % NRECIPES]);
+	return 0;
+}
+
+// make_search: searches for a random word
+static int make_search(Client *client, size_t i, char *method, char *uri, size_t urilen, char **body)
+{
+	strcpy(method, "GET");
+	snprintf(uri, urilen, "/api/v1/recipe/list?q=%s&siz=20&num=0", PICK(&client->rng, WORDS));
+	return 0;
+}
+
+// make_search_nototal: searches for a random word, without asking for the total
+static int make_search_nototal(Client *client, size_t i, char *method, char *uri, size_t urilen, char **body)
+{
+	strcpy(method, "GET");
+	snprintf(uri, urilen, "/api/v1/recipe/list?q=%s&siz=20&num=0&total=0", PICK(&client->rng, WORDS));
+	return 0;
+}
+
+// make_list: fetches a random page of the listing
+static int make_list(Client *client, size_t i, char *method, char *uri, size_t urilen, char **body)
+{
+	strcpy(method, "GET");
+	snprintf(uri, urilen, "/api/v1/recipe/list?siz=20&num=%zu", rng_next(&client->rng) % (NRECIPES / 20 + 1));
+	return 0;
+}
+
+// make_put: rewrites a random recipe (from the front half, the back half gets deleted)
+static int make_put(Client *client, size_t i, char *method, char *uri, size_t urilen, char **body)
+{
+	size_t n = rng_next(&client->rng) % MAX(NRECIPES / 2, 1);
+	strcpy(method, "PUT");
+	snprintf(uri, urilen, "/api/v1/recipe/%s", IDS[n]);
+	*body = make_recipe(&client->rng, n);
+	return 0;
+}
+
+// make_delete: deletes recipes from the back of the seed set, each one exactly once
+static int make_delete(Client *client, size_t i, char *method, char *uri, size_t urilen, char **body)
+{
+	strcpy(method, "DELETE");
+	snprintf(uri, urilen, "/api/v1/recipe/%s", IDS[NRECIPES - 1 - i]);
+	return 0;
+}
+
+// client_run: thread entry, runs [start, end) of the phase's requests on one connection
+static void *client_run(void *arg)
+{
+	Client *client = arg;
+	Phase *phase = client->phase;
+	char method[16];
+	char uri[BUFSMALL];
+	char *body;
+	int code;
+
+	for (size_t i = client->start; i < client->end; i++) {
+		body = NULL;
+		phase->make(client, i, method, uri, sizeof uri, &body);
+
+		i64 t = now_us();
+		code = client->fd < 0 ? -1 : request(client, method, uri, body);
+		phase->lat[i] = now_us() - t;
+
+		free(body);
+
+		if (code < 200 || code > 299) {
+			client->errors++;
+
+			// a broken connection stays broken, so get a new one
+			if (code < 0) {
+				if (client->fd >= 0) close(client->fd);
+				client->fd = open_conn(PORT);
+			}
+			continue;
+		}
+
+		// hold on to the ids that the seeding gives back, everything after this works on them
+		if (phase->make == make_post) {
+			char *id = strstr(client->buf, "\"id\":\"");
+			if (id != NULL) {
+				snprintf(IDS[i], sizeof IDS[i], "%.*s", IDLEN, id + 6);
+			} else {
+				client->errors++;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+// phase_run: runs all of the phase's requests across 'nclients' connections
+static int phase_run(Phase *phase, Client *clients, size_t nclients, u64 seed)
+{
+	size_t per = (phase->requests + nclients - 1) / nclients;
+
+	phase->lat = calloc(MAX(phase->requests, 1), sizeof(*phase->lat));
+
+	i64 start = now_us();
+
+	for (size_t i = 0; i < nclients; i++) {
+		clients[i].phase = phase;
+		clients[i].start = MIN(i * per, phase->requests);
+		clients[i].end = MIN(clients[i].start + per, phase->requests);
+		clients[i].errors = 0;
+		clients[i].rng = seed * 0x9E3779B97F4A7C15ULL + i + 1;
+
+		if (pthread_create(&clients[i].thread, NULL, client_run, &clients[i]) != 0) {
+			return -1;
+		}
+	}
+
+	for (size_t i = 0; i < nclients; i++) {
+		pthread_join(clients[i].thread, NULL);
+		phase->errors += clients[i].errors;
+	}
+
+	phase->elapsed_us = now_us() - start;
+
+	qsort(phase->lat, phase->requests, sizeof(*phase->lat), cmp_i64);
+
+	return 0;
+}
+
+// write_chunk: writes one chunk of a chunked request body, -1 on error
+static int write_chunk(int fd, char *buf, size_t len)
+{
+	char head[32];
+	int n = snprintf(head, sizeof head, "%zx\r\n", len);
+
+	if (write(fd, head, n) != n) {
+		return -1;
+	}
+
+	if (len > 0 && write(fd, buf, len) != (ssize_t)len) {
+		return -1;
+	}
+
+	return write(fd, "\r\n", 2) == 2 ? 0 : -1;
+}
+
+// bulk_run: imports 'n' more recipes through one streamed POST /api/v1/recipe/bulk
+static int bulk_run(BulkResult *result, size_t n, u64 seed)
+{
+	static char head[] = "POST /api/v1/recipe/bulk HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n";
+	Client client = { .rng = seed * 0x9E3779B97F4A7C15ULL + 1 };
+	char *buf = malloc(BUFLARGE * 16);
+	size_t len = 0;
+	int code = -1;
+	char *s;
+
+	result->recipes = n;
+
+	client.fd = open_conn(PORT);
+	if (client.fd < 0) {
+		free(buf);
+		return -1;
+	}
+
+	i64 start = now_us();
+
+	if (write(client.fd, head, sizeof(head) - 1) != sizeof(head) - 1) {
+		goto bulk_run_done;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		s = make_recipe(&client.rng, NRECIPES + i);
+		size_t slen = strlen(s);
+
+		if (len + slen + 1 > BUFLARGE * 16) {
+			if (write_chunk(client.fd, buf, len) < 0) {
+				free(s);
+				goto bulk_run_done;
+			}
+			len = 0;
+		}
+
+		memcpy(buf + len, s, slen);
+		buf[len + slen] = '\n';
+		len += slen + 1;
+
+		free(s);
+	}
+
+	if (write_chunk(client.fd, buf, len) < 0 || write_chunk(client.fd, NULL, 0) < 0) {
+		goto bulk_run_done;
+	}
+
+	code = response(&client);
+
+	if ((s = strstr(client.buf, "\"imported\":")) != NULL) {
+		result->imported = strtoull(s + strlen("\"imported\":"), NULL, 10);
+	}
+
+bulk_run_done:
+	result->elapsed_us = now_us() - start;
+
+	close(client.fd);
+	free(client.buf);
+	free(buf);
+
+	return code == 200 ? 0 : -1;
+}
+
+// phase_print: writes the phase results out as a JSON object member
+static void phase_print(Phase *phase, int last)
+{
+	size_t n = phase->requests;
+	double secs = phase->elapsed_us / 1e6;
+
+	printf("\"%s\":{\"requests\":%zu,\"errors\":%zu,\"seconds\":%.3f,\"rps\":%.1f,"
+		"\"p50_us\":%ld,\"p99_us\":%ld,\"p999_us\":%ld,\"max_us\":%ld}%s",
+		phase->name, n, phase->errors, secs, secs > 0 ? n / secs : 0.0,
+		n ? phase->lat[n / 2] : 0,
+		n ? phase->lat[(n * 99) / 100] : 0,
+		n ? phase->lat[(n * 999) / 1000] : 0,
+		n ? phase->lat[n - 1] : 0,
+		last ? "" : ",");
+}
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/recipe-bench-XXXXXX";
+	size_t nrequests = 5000;
+	size_t nclients = 16;
+	int workers = 0;
+	int external = false;
+	u64 seed = 1;
+	pid_t pid = -1;
+	int opt;
+	int fd;
+
+	while ((opt = getopt(argc, argv, "n:r:c:w:s:S")) != -1) {
+		switch (opt) {
+			case 'n': NRECIPES = strtoull(optarg, NULL, 10); break;
+			case 'r': nrequests = strtoull(optarg, NULL, 10); break;
+			case 'c': nclients = strtoull(optarg, NULL, 10); break;
+			case 'w': workers = atoi(optarg); break;
+			case 's': seed = strtoull(optarg, NULL, 10); break;
+			case 'S': external = true; break;
+			default:
+				fprintf(stderr, USAGE, argv[0]);
+				return 1;
+		}
+	}
+
+	if (NRECIPES == 0 || nclients == 0) {
+		fprintf(stderr, USAGE, argv[0]);
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (!external) {
+		if ((fd = open_conn(PORT)) >= 0) {
+			close(fd);
+			ERR("something is already listening on %d (use -S to benchmark it)\n", PORT);
+			return 1;
+		}
+
+		if (mkdtemp(dir) == NULL) {
+			ERR("couldn't make a temp directory: %s\n", strerror(errno));
+			return 1;
+		}
+
+		char wbuf[32];
+		char *args[3] = {0};
+
+		snprintf(wbuf, sizeof wbuf, "%d", workers);
+		if (workers > 0) {
+			args[0] = "-w";
+			args[1] = wbuf;
+		}
+
+		pid = server_start(dir, args);
+		if (pid < 0) {
+			ERR("couldn't start %s (run this from the root of the repo)\n", SERVER);
+			rmdir(dir);
+			return 1;
+		}
+	}
+
+	IDS = calloc(NRECIPES, sizeof(*IDS));
+
+	Client *clients = calloc(nclients, sizeof(*clients));
+	for (size_t i = 0; i < nclients; i++) {
+		clients[i].fd = open_conn(PORT);
+	}
+
+	Phase phases[] = {
+		{ "POST /api/v1/recipe",        make_post,   NRECIPES },
+		{ "GET /api/v1/recipe/:id",     make_get,    nrequests },
+		{ "GET /api/v1/recipe/list?q=", make_search, nrequests },
+		{ "GET /api/v1/recipe/list?q=&total=0", make_search_nototal, nrequests },
+		{ "GET /api/v1/recipe/list",    make_list,   nrequests },
+		{ "PUT /api/v1/recipe/:id",     make_put,    nrequests },
+		{ "DELETE /api/v1/recipe/:id",  make_delete, MIN(nrequests, NRECIPES / 2) },
+	};
+
+	size_t errors = 0;
+
+	for (size_t i = 0; i < ARRSIZE(phases); i++) {
+		if (phase_run(&phases[i], clients, nclients, seed + i) < 0) {
+			ERR("couldn't start the client threads!\n");
+			return 1;
+		}
+
+		errors += phases[i].errors;
+
+		// without the seed data, nothing after it means anything
+		if (i == 0 && errors > 0) {
+			ERR("%zu recipes failed to seed\n", errors);
+			for (size_t j = 1; j < ARRSIZE(phases); j++) {
+				phases[j].requests = 0;
+			}
+			break;
+		}
+	}
+
+	BulkResult bulk = {0};
+
+	if (errors == 0 && bulk_run(&bulk, NRECIPES, seed + ARRSIZE(phases)) < 0) {
+		ERR("the bulk import failed!\n");
+		errors++;
+	}
+
+	printf("{\"config\":{\"recipes\":%zu,\"requests\":%zu,\"concurrency\":%zu,\"workers\":%d,\"seed\":%lu},\"routes\":{",
+		NRECIPES, nrequests, nclients, workers, seed);
+
+	for (size_t i = 0; i < ARRSIZE(phases); i++) {
+		phase_print(&phases[i], i == ARRSIZE(phases) - 1);
+	}
+
+	printf("},\"bulk\":{\"recipes\":%zu,\"imported\":%zu,\"seconds\":%.3f,\"rps\":%.1f}}\n",
+		bulk.recipes, bulk.imported, bulk.elapsed_us / 1e6,
+		bulk.elapsed_us > 0 ? bulk.imported / (bulk.elapsed_us / 1e6) : 0.0);
+
+	for (size_t i = 0; i < nclients; i++) {
+		if (clients[i].fd >= 0) close(clients[i].fd);
+		free(clients[i].buf);
+	}
+
+	for (size_t i = 0; i < ARRSIZE(phases); i++) {
+		free(phases[i].lat);
+	}
+
+	free(clients);
+	free(IDS);
+
+	if (!external) {
+		server_stop(pid, dir);
+	}
+
+	return errors > 0;
+}
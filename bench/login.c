@@ -0,0 +1,373 @@
+// Brian Chrzanowski
+// 2026-10-17 23:31:12
+//
+// Login Storm Benchmark
+//
+// Every login is a crypto_pwhash (tens of milliseconds, and 64MiB), so a burst of them shouldn't be
+// able to hold up anything else. This starts the server against a throwaway database, makes a user,
+// seeds a few recipes, and then times GETs from one connection twice: once with nothing else going
+// on, and once while a bunch of other connections POST /api/v1/login as fast as they can. If the
+// hashing is properly off to the side, the two sets of GET latencies should look about the same.
+//
+// The logins that come back 503 are the ones the server turned away because its backlog was full
+// (see worker.c), and those are counted on their own. Those connections wait a second before they
+// try again, the way the Retry-After says to.
+//
+// USAGE: bench/login [-c storm connections] [-r gets] [-u uri] [-w workers] [-p pwhashbytes] [-S]
+//
+// It has to be run from the root of the repo, same as bench/load. With -S, it uses the server
+// that's already listening instead (and it'll leave the user, and the recipes, behind).
+//
+// Results are written to stdout as JSON.
+
+#define _GNU_SOURCE
+#define COMMON_IMPLEMENTATION
+#include "../src/common.h"
+
+#include <pthread.h>
+
+#define BENCH_IMPLEMENTATION
+#include "bench.h"
+
+#define USAGE ("USAGE: %s [-c storm connections] [-r gets] [-u uri] [-w workers] [-p pwhashbytes] [-S]\n")
+
+#define RECIPES  (200)
+#define USERNAME ("bench")
+#define PASSWORD ("correct horse battery staple")
+
+// Latency: the spread of a set of requests (microseconds)
+typedef struct Latency {
+	size_t requests;
+	size_t errors;
+	i64 p50, p99, p999, max;
+} Latency;
+
+// Stormer: one thread logging in over and over, on its own connection
+typedef struct Stormer {
+	pthread_t thread;
+	size_t ok;
+	size_t rejected; // 503s
+	size_t errors;
+	i64 *lat; // stb array, the successful ones
+} Stormer;
+
+static volatile int STORMING = false;
+
+// request: sends a request, and reads the entire response (headers + Content-Length bytes), returns the status code
+static int request(int fd, char *method, char *uri, char *body)
+{
+	char buf[BUFLARGE];
+	size_t bodylen = body ? strlen(body) : 0;
+	size_t len = 0;
+	char *end = NULL;
+	char *cl;
+	long want = -1;
+	int code = -1;
+	ssize_t n;
+
+	n = snprintf(buf, sizeof buf,
+		"%s %s HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\nContent-Length: %zu\r\n\r\n%s",
+		method, uri, bodylen, body ? body : "");
+	if (write(fd, buf, n) != n) {
+		return -1;
+	}
+
+	for (;;) {
+		if (end != NULL && want >= 0 && (long)(len - (end - buf)) >= want) {
+			return code;
+		}
+
+		n = read(fd, buf + len, sizeof(buf) - len - 1);
+		if (n <= 0) {
+			return -1;
+		}
+
+		len += n;
+		buf[len] = '\0';
+
+		if (end == NULL && (end = strstr(buf, "\r\n\r\n")) != NULL) {
+			end += 4;
+			cl = strcasestr(buf, "Content-Length:");
+			want = cl ? atol(cl + strlen("Content-Length:")) : 0;
+			code = strncmp(buf, "HTTP/1.1 ", 9) == 0 ? atoi(buf + 9) : -1;
+		}
+
+		// we only care about the size of the body, not the content, so just keep the tail around
+		if (end != NULL && len == sizeof(buf) - 1) {
+			want -= len - (end - buf);
+			len = 0;
+			end = buf;
+		}
+	}
+}
+
+// latency: sorts 'lat', and fills out the percentiles
+static void latency(Latency *result, i64 *lat, size_t n)
+{
+	qsort(lat, n, sizeof(*lat), cmp_i64);
+
+	result->requests = n;
+	result->p50 = n ? lat[n / 2] : 0;
+	result->p99 = n ? lat[MIN(n - 1, n * 99 / 100)] : 0;
+	result->p999 = n ? lat[MIN(n - 1, n * 999 / 1000)] : 0;
+	result->max = n ? lat[n - 1] : 0;
+}
+
+// time_gets: times 'n' GETs of 'uri' on one connection
+static void time_gets(Latency *result, char *uri, size_t n)
+{
+	i64 *lat = calloc(MAX(n, 1), sizeof(*lat));
+	size_t done = 0;
+	int fd;
+
+	memset(result, 0, sizeof *result);
+
+	fd = open_conn(PORT);
+
+	for (size_t i = 0; i < n; i++) {
+		i64 t = now_us();
+		int code = fd < 0 ? -1 : request(fd, "GET", uri, NULL);
+		i64 elapsed = now_us() - t;
+
+		if (code != 200) {
+			result->errors++;
+			if (code < 0) {
+				if (fd >= 0) close(fd);
+				fd = open_conn(PORT);
+			}
+			continue;
+		}
+
+		lat[done++] = elapsed;
+	}
+
+	latency(result, lat, done);
+
+	if (fd >= 0) close(fd);
+	free(lat);
+}
+
+// storm_run: logs in over and over until STORMING goes false
+static void *storm_run(void *arg)
+{
+	Stormer *self = arg;
+	char body[BUFSMALL];
+	int fd;
+
+	snprintf(body, sizeof body, "{\"username\":\"%s\",\"password\":\"%s\"}", USERNAME, PASSWORD);
+
+	fd = open_conn(PORT);
+
+	while (STORMING) {
+		i64 t = now_us();
+		int code = fd < 0 ? -1 : request(fd, "POST", "/api/v1/login", body);
+		i64 elapsed = now_us() - t;
+
+		if (code == 200) {
+			self->ok++;
+			arrput(self->lat, elapsed);
+		} else if (code == 503) {
+			// it says Retry-After: 1, and a client that keeps hammering it isn't what we're measuring
+			self->rejected++;
+			sleep(1);
+		} else {
+			self->errors++;
+			if (code < 0) {
+				if (fd >= 0) close(fd);
+				fd = open_conn(PORT);
+			}
+		}
+	}
+
+	if (fd >= 0) close(fd);
+
+	return NULL;
+}
+
+// seed: makes the user, and a few recipes for the GETs to list
+static int seed()
+{
+	char body[BUFLARGE];
+	int fd;
+	int code;
+
+	fd = open_conn(PORT);
+	if (fd < 0) {
+		return -1;
+	}
+
+	snprintf(body, sizeof body, "{\"username\":\"%s\",\"email\":\"%s@localhost\",\"password\":\"%s\",\"verify\":\"%s\"}",
+		USERNAME, USERNAME, PASSWORD, PASSWORD);
+
+	// 409 is fine, that's a server (-S) that's seen this before
+	code = request(fd, "POST", "/api/v1/newuser", body);
+	if (code != 201 && code != 409) {
+		ERR("couldn't make the user (%d)\n", code);
+		close(fd);
+		return -1;
+	}
+
+	for (size_t i = 0; i < RECIPES; i++) {
+		snprintf(body, sizeof body,
+			"{\"name\":\"Recipe %zu\",\"ingredients\":[\"1 cup flour\",\"2 eggs\"],\"steps\":[\"mix\",\"bake\"],\"tags\":[\"bench\"]}", i);
+
+		code = request(fd, "POST", "/api/v1/recipe", body);
+		if (code < 200 || code > 299) {
+			ERR("couldn't seed recipe %zu\n", i);
+			close(fd);
+			return -1;
+		}
+	}
+
+	close(fd);
+
+	return 0;
+}
+
+// latency_print: writes out one set of latencies as a JSON object
+static void latency_print(char *name, Latency *l, int last)
+{
+	printf("\"%s\":{\"requests\":%zu,\"errors\":%zu,\"p50_us\":%ld,\"p99_us\":%ld,\"p999_us\":%ld,\"max_us\":%ld}%s",
+		name, l->requests, l->errors, l->p50, l->p99, l->p999, l->max, last ? "" : ",");
+}
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/recipe-bench-XXXXXX";
+	char *uri = "/api/v1/recipe/list";
+	char *budget = NULL;
+	size_t nstorm = 32;
+	size_t ngets = 2000;
+	int workers = 0;
+	int external = false;
+	pid_t pid = -1;
+	int opt;
+	int fd;
+
+	while ((opt = getopt(argc, argv, "c:r:u:w:p:S")) != -1) {
+		switch (opt) {
+			case 'c': nstorm = strtoull(optarg, NULL, 10); break;
+			case 'r': ngets = strtoull(optarg, NULL, 10); break;
+			case 'u': uri = optarg; break;
+			case 'w': workers = atoi(optarg); break;
+			case 'p': budget = optarg; break;
+			case 'S': external = true; break;
+			default:
+				fprintf(stderr, USAGE, argv[0]);
+				return 1;
+		}
+	}
+
+	if (nstorm == 0 || ngets == 0) {
+		fprintf(stderr, USAGE, argv[0]);
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (!external) {
+		if ((fd = open_conn(PORT)) >= 0) {
+			close(fd);
+			ERR("something is already listening on %d (use -S to benchmark it)\n", PORT);
+			return 1;
+		}
+
+		if (mkdtemp(dir) == NULL) {
+			ERR("couldn't make a temp directory: %s\n", strerror(errno));
+			return 1;
+		}
+
+		char wbuf[32];
+		char *args[5] = {0};
+		int nargs = 0;
+
+		snprintf(wbuf, sizeof wbuf, "%d", workers);
+		if (workers > 0) {
+			args[nargs++] = "-w";
+			args[nargs++] = wbuf;
+		}
+		if (budget != NULL) {
+			args[nargs++] = "-p";
+			args[nargs++] = budget;
+		}
+
+		pid = server_start(dir, args);
+		if (pid < 0) {
+			ERR("couldn't start %s (run this from the root of the repo)\n", SERVER);
+			rmdir(dir);
+			return 1;
+		}
+	}
+
+	if (seed() < 0) {
+		if (!external) server_stop(pid, dir);
+		return 1;
+	}
+
+	Latency idle, storm, logins = {0};
+
+	time_gets(&idle, uri, ngets);
+
+	Stormer *stormers = calloc(nstorm, sizeof(*stormers));
+
+	STORMING = true;
+
+	i64 start = now_us();
+
+	for (size_t i = 0; i < nstorm; i++) {
+		if (pthread_create(&stormers[i].thread, NULL, storm_run, &stormers[i]) != 0) {
+			ERR("couldn't start the login threads!\n");
+			return 1;
+		}
+	}
+
+	// give the storm a moment to fill up the server's backlog first
+	usleep(250 * 1000);
+
+	time_gets(&storm, uri, ngets);
+
+	i64 elapsed = now_us() - start;
+
+	STORMING = false;
+
+	i64 *lat = NULL;
+	size_t ok = 0, rejected = 0, errors = 0;
+
+	for (size_t i = 0; i < nstorm; i++) {
+		pthread_join(stormers[i].thread, NULL);
+
+		for (ptrdiff_t j = 0; j < arrlen(stormers[i].lat); j++) {
+			arrput(lat, stormers[i].lat[j]);
+		}
+
+		ok += stormers[i].ok;
+		rejected += stormers[i].rejected;
+		errors += stormers[i].errors;
+
+		arrfree(stormers[i].lat);
+	}
+
+	latency(&logins, lat, arrlen(lat));
+	logins.errors = errors;
+
+	printf("{\"config\":{\"uri\":\"%s\",\"gets\":%zu,\"storm_connections\":%zu,\"workers\":%d},",
+		uri, ngets, nstorm, workers);
+
+	printf("\"get\":{");
+	latency_print("idle", &idle, false);
+	latency_print("storm", &storm, true);
+	printf("},");
+
+	printf("\"login\":{\"ok\":%zu,\"rejected\":%zu,\"rps\":%.1f,", ok, rejected, elapsed > 0 ? ok / (elapsed / 1e6) : 0.0);
+	latency_print("latency", &logins, true);
+	printf("}}\n");
+
+	arrfree(lat);
+	free(stormers);
+
+	if (!external) {
+		server_stop(pid, dir);
+	}
+
+	return idle.errors + storm.errors > 0;
+}
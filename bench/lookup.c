@@ -0,0 +1,347 @@
+// Brian Chrzanowski
+// 2026-10-17 15:22:40
+//
+// Recipe Lookup Benchmark
+//
+// Builds a database at version 0 (schema.sql only, no indexes), with enough recipes that the child
+// tables have a lot of rows (10 ingredients, 10 steps and 5 tags each, so 100k recipes puts 1M rows
+// in ingredients). Then it walks the database through the migrations one at a time, and after each
+// one, times the lookups that fetching one recipe does (the metadata row, and the ingredients) and
+// measures how much of the file is actually in use:
+//
+//   v0 - text ids, no indexes
+//   v1 - text ids, with the indexes from 0001
+//   v2 - 16 byte blob ids, and integer (epoch ms) timestamps from 0002
+//
+// After that, it compares fetching an entire recipe as JSON the old way (the base row, the metadata
+// and three child lists as five statements, then jansson) against recipe_get_json (one statement,
+// with SQLite building the JSON).
+//
+// USAGE: bench/lookup [-n recipes] [-l lookups] [-f dbfile]
+//
+// It has to be run from the root of the repo (for src/schema.sql, src/migrations and
+// sqlite3_uuid.so). Results are written to stdout as JSON.
+
+#define _GNU_SOURCE
+#define COMMON_IMPLEMENTATION
+#include "../src/common.h"
+
+#include <unistd.h>
+
+#include <jansson.h>
+
+#include "../src/sqlite3.h"
+
+#include "../src/objects.h"
+#include "../src/migrate.h"
+
+#define BENCH_IMPLEMENTATION
+#include "bench.h"
+
+#define USAGE ("USAGE: %s [-n recipes] [-l lookups] [-f dbfile]\n")
+
+// the objects code works on the thread's connection, same as the server
+__thread sqlite3 *DATABASE;
+
+// recipe_get_json : from recipe.c
+char *recipe_get_json(char *id);
+
+// LookupTimes: the latencies (microseconds) for each part of fetching one recipe, and the file size
+typedef struct LookupTimes {
+	i64 metadata_p50, metadata_max;
+	i64 textlist_p50, textlist_max;
+	i64 used_bytes;
+} LookupTimes;
+
+// NOTE (Brian) the lookups are raw SQL and not the db_* functions, because those only know about
+// the newest layout. 'ID_' is how a text id gets turned into whatever the id column holds.
+#define LOOKUP_METADATA(ID_) \
+	"select id, create_ts, update_ts, delete_ts from recipes where id = " ID_ ";"
+#define LOOKUP_TEXTLIST(ID_) \
+	"select text from ingredients where parent_id = " ID_ " order by sorting;"
+
+// seed: fills the database with 'n' recipes, and their children
+static int seed(size_t n)
+{
+	char sql[BUFLARGE];
+
+	snprintf(sql, sizeof sql,
+		"begin transaction;"
+		"with recursive seq(i) as (select 1 union all select i + 1 from seq where i < %zu)"
+		" insert into recipes (name) select 'recipe ' || i from seq;"
+		"with recursive seq(i) as (select 0 union all select i + 1 from seq where i < 9)"
+		" insert into ingredients (parent_id, sorting, text)"
+		" select r.id, s.i, 'ingredient ' || s.i from recipes r, seq s;"
+		"with recursive seq(i) as (select 0 union all select i + 1 from seq where i < 9)"
+		" insert into steps (parent_id, sorting, text)"
+		" select r.id, s.i, 'step ' || s.i from recipes r, seq s;"
+		"with recursive seq(i) as (select 0 union all select i + 1 from seq where i < 4)"
+		" insert into tags (parent_id, sorting, text)"
+		" select r.id, s.i, 'tag ' || s.i from recipes r, seq s;"
+		"commit transaction;",
+		n);
+
+	if (sqlite3_exec(DATABASE, sql, NULL, NULL, NULL) != SQLITE_OK) {
+		ERR("couldn't seed the database: %s\n", sqlite3_errmsg(DATABASE));
+		return -1;
+	}
+
+	return 0;
+}
+
+// used_bytes: returns the bytes of the database file that are actually holding something
+static i64 used_bytes()
+{
+	sqlite3_stmt *stmt;
+	i64 bytes = 0;
+
+	sqlite3_prepare_v2(DATABASE,
+		"select (p.page_count - f.freelist_count) * s.page_size"
+		" from pragma_page_count p, pragma_freelist_count f, pragma_page_size s;",
+		-1, &stmt, NULL);
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		bytes = sqlite3_column_int64(stmt, 0);
+	}
+
+	sqlite3_finalize(stmt);
+
+	return bytes;
+}
+
+// time_stmt: runs 'stmt' to completion for 'id', returns how long that took in microseconds
+static i64 time_stmt(sqlite3_stmt *stmt, char *id)
+{
+	i64 t = now_us();
+
+	sqlite3_bind_text(stmt, 1, id, -1, NULL);
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		// NOTE (Brian) pull the columns out, like the real code has to
+		for (int i = 0; i < sqlite3_column_count(stmt); i++) {
+			sqlite3_column_text(stmt, i);
+		}
+	}
+	sqlite3_reset(stmt);
+
+	return now_us() - t;
+}
+
+// lookup: fetches the metadata and the ingredients for 'nids' recipes, and times both
+static LookupTimes lookup(char *metadata_sql, char *textlist_sql, char **ids, size_t nids)
+{
+	LookupTimes times = {0};
+	sqlite3_stmt *metadata, *textlist;
+	i64 *meta = calloc(nids, sizeof(*meta));
+	i64 *list = calloc(nids, sizeof(*list));
+
+	sqlite3_prepare_v2(DATABASE, metadata_sql, -1, &metadata, NULL);
+	sqlite3_prepare_v2(DATABASE, textlist_sql, -1, &textlist, NULL);
+
+	for (size_t i = 0; i < nids; i++) {
+		meta[i] = time_stmt(metadata, ids[i]);
+		list[i] = time_stmt(textlist, ids[i]);
+	}
+
+	sqlite3_finalize(metadata);
+	sqlite3_finalize(textlist);
+
+	qsort(meta, nids, sizeof(*meta), cmp_i64);
+	qsort(list, nids, sizeof(*list), cmp_i64);
+
+	times.metadata_p50 = meta[nids / 2];
+	times.metadata_max = meta[nids - 1];
+	times.textlist_p50 = list[nids / 2];
+	times.textlist_max = list[nids - 1];
+	times.used_bytes = used_bytes();
+
+	free(meta);
+	free(list);
+
+	return times;
+}
+
+// print_times: writes one version's results out as a JSON object
+static void print_times(char *name, LookupTimes *times)
+{
+	printf("\"%s\":{\"metadata_p50_us\":%ld,\"metadata_max_us\":%ld,"
+		"\"textlist_p50_us\":%ld,\"textlist_max_us\":%ld,\"used_bytes\":%ld}",
+		name, times->metadata_p50, times->metadata_max, times->textlist_p50, times->textlist_max,
+		times->used_bytes);
+}
+
+// hydrate_five: the way GET /api/v1/recipe/:id used to work, five statements and a jansson tree
+static char *hydrate_five(char *id)
+{
+	DB_Metadata metadata = {0};
+	sqlite3_stmt *stmt;
+	json_t *object;
+	char *s;
+
+	stmt = db_stmt_get("recipes", "bench_get_by_id",
+		"select name, prep_time, cook_time, servings, link, notes from %s where id = uuid_blob(?);");
+
+	sqlite3_bind_text(stmt, 1, id, -1, NULL);
+	sqlite3_step(stmt);
+
+	db_load_metadata_from_id(&metadata, "recipes", id);
+
+	char **lists[3] = {
+		db_get_textlist("ingredients", id),
+		db_get_textlist("steps", id),
+		db_get_textlist("tags", id),
+	};
+
+	json_t *arrays[3];
+	for (int i = 0; i < 3; i++) {
+		arrays[i] = json_array();
+		for (size_t j = 0; j < arrlen(lists[i]); j++) {
+			json_array_append_new(arrays[i], json_string(lists[i][j]));
+			free(lists[i][j]);
+		}
+		arrfree(lists[i]);
+	}
+
+	object = json_pack("{s:s, s:s, s:s?, s:s?, s:s, s:s?, s:s?, s:s?, s:s?, s:s?, s:o, s:o, s:o}",
+		"id", metadata.id,
+		"create_ts", metadata.create_ts,
+		"update_ts", metadata.update_ts,
+		"delete_ts", metadata.delete_ts,
+		"name", (char *)sqlite3_column_text(stmt, 0),
+		"prep_time", (char *)sqlite3_column_text(stmt, 1),
+		"cook_time", (char *)sqlite3_column_text(stmt, 2),
+		"servings", (char *)sqlite3_column_text(stmt, 3),
+		"link", (char *)sqlite3_column_text(stmt, 4),
+		"note", (char *)sqlite3_column_text(stmt, 5),
+		"ingredients", arrays[0],
+		"steps", arrays[1],
+		"tags", arrays[2]);
+
+	s = json_dumps(object, JSON_SORT_KEYS|JSON_COMPACT);
+
+	json_decref(object);
+	db_metadata_free(&metadata);
+	db_stmt_release(stmt);
+
+	return s;
+}
+
+// hydrate: times 'func' fetching each of the recipes, returns the p50 in microseconds
+static i64 hydrate(char *(*func)(char *), char **ids, size_t nids)
+{
+	i64 *lat = calloc(nids, sizeof(*lat));
+
+	for (size_t i = 0; i < nids; i++) {
+		i64 t = now_us();
+		free(func(ids[i]));
+		lat[i] = now_us() - t;
+	}
+
+	qsort(lat, nids, sizeof(*lat), cmp_i64);
+
+	i64 p50 = lat[nids / 2];
+
+	free(lat);
+
+	return p50;
+}
+
+int main(int argc, char **argv)
+{
+	char *fname = "/tmp/recipe-lookup.db";
+	size_t nrecipes = 100000;
+	size_t nlookups = 50;
+	sqlite3_stmt *stmt;
+	char **ids = NULL;
+	size_t len;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:l:f:")) != -1) {
+		switch (opt) {
+			case 'n': nrecipes = strtoull(optarg, NULL, 10); break;
+			case 'l': nlookups = strtoull(optarg, NULL, 10); break;
+			case 'f': fname = optarg; break;
+			default:
+				fprintf(stderr, USAGE, argv[0]);
+				return 1;
+		}
+	}
+
+	if (nrecipes == 0 || nlookups == 0) {
+		fprintf(stderr, USAGE, argv[0]);
+		return 1;
+	}
+
+	unlink(fname);
+
+	if (db_open(fname, false) < 0) {
+		return 1;
+	}
+
+	char *schema = sys_readfile("src/schema.sql", &len);
+	if (schema == NULL || db_exec_script(schema) < 0 || seed(nrecipes) < 0) {
+		return 1;
+	}
+	free(schema);
+
+	// NOTE (Brian) random recipes, so the v0 scans can't just stop early every time
+	sqlite3_prepare_v2(DATABASE, "select id from recipes order by random() limit ?;", -1, &stmt, NULL);
+	sqlite3_bind_int64(stmt, 1, nlookups);
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		arrput(ids, strdup((char *)sqlite3_column_text(stmt, 0)));
+	}
+	sqlite3_finalize(stmt);
+
+	nlookups = arrlen(ids);
+
+	LookupTimes v0 = lookup(LOOKUP_METADATA("?"), LOOKUP_TEXTLIST("?"), ids, nlookups);
+
+	i64 t = now_us();
+	if (migrate_to("src/migrations", 1) < 0) {
+		return 1;
+	}
+	i64 migrate1_us = now_us() - t;
+
+	LookupTimes v1 = lookup(LOOKUP_METADATA("?"), LOOKUP_TEXTLIST("?"), ids, nlookups);
+
+	t = now_us();
+	if (migrate_to("src/migrations", 2) < 0) {
+		return 1;
+	}
+	i64 migrate2_us = now_us() - t;
+
+	LookupTimes v2 = lookup(LOOKUP_METADATA("uuid_blob(?)"), LOOKUP_TEXTLIST("uuid_blob(?)"), ids, nlookups);
+
+	// anything past 2 is applied too, so the recipe_get_json below sees the schema it was written for
+	if (migrate_run("src/migrations") < 0) {
+		return 1;
+	}
+
+	// run both once first, so that neither one pays for preparing its statements
+	free(hydrate_five(ids[0]));
+	free(recipe_get_json(ids[0]));
+
+	i64 five_p50 = hydrate(hydrate_five, ids, nlookups);
+	i64 one_p50 = hydrate(recipe_get_json, ids, nlookups);
+
+	printf("{\"recipes\":%zu,\"ingredients\":%zu,\"lookups\":%zu,"
+		"\"migrate_ms\":{\"v1\":%.1f,\"v2\":%.1f},",
+		nrecipes, nrecipes * 10, nlookups, migrate1_us / 1000.0, migrate2_us / 1000.0);
+	print_times("v0", &v0);
+	printf(",");
+	print_times("v1", &v1);
+	printf(",");
+	print_times("v2", &v2);
+	printf(",\"hydrate\":{\"five_statements_p50_us\":%ld,\"one_statement_p50_us\":%ld}}\n",
+		five_p50, one_p50);
+
+	for (size_t i = 0; i < arrlen(ids); i++) {
+		free(ids[i]);
+	}
+	arrfree(ids);
+
+	db_close();
+
+	unlink(fname);
+
+	return 0;
+}
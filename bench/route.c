@@ -0,0 +1,257 @@
+// Brian Chrzanowski
+// 2026-10-18 05:02:11
+//
+// Routing Benchmark
+//
+// What it costs to find the handler for a request, the server's routes, over a mix of URIs (a
+// literal route, a recipe by id, in either case, an image by hash, one with a query string, and a
+// static file, which doesn't match anything):
+//
+//   trie   - route_match, what the server does now
+//   string - the old way, format_target_string (copy the URI, strtok it, check every piece for a
+//            uuid or a hash, snprintf it back together) and then shgeti, plus the strndup and
+//            sscanf the handler did to get the id back out
+//
+// USAGE: bench/route [-n iterations]
+//
+// Results are nanoseconds per request (the best of 10 runs of each), written to stdout as JSON.
+
+#define _GNU_SOURCE
+#define COMMON_IMPLEMENTATION
+#include "../src/common.h"
+
+#include <unistd.h>
+
+#include "../src/mongoose.h"
+
+#include "../src/route.h"
+
+#define BENCH_IMPLEMENTATION
+#include "bench.h"
+
+#define USAGE ("USAGE: %s [-n iterations]\n")
+
+// every timing is run this many times, and the fastest one is kept, so it's what the code costs,
+// not whatever else the machine was doing
+#define ROUNDS (10)
+
+typedef struct RouteTableEntry {
+	char *key;
+	RouteHandler value;
+} RouteTableEntry;
+
+// bench_handler: stands in for every endpoint
+static int bench_handler(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
+{
+	return 0;
+}
+
+static char *PATTERNS[] = {
+	"POST /api/v1/recipe",
+	"POST /api/v1/recipe/bulk",
+	"GET /api/v1/recipe/export",
+	"GET /api/v1/recipe/list",
+	"GET /api/v1/recipe/:id",
+	"PUT /api/v1/recipe/:id",
+	"DELETE /api/v1/recipe/:id",
+	"POST /api/v1/recipe/:id/image",
+	"GET /api/v1/image/:hash",
+	"HEAD /api/v1/image/:hash",
+	"POST /api/v1/newuser",
+	"POST /api/v1/login",
+	"POST /api/v1/logout",
+	"GET /api/v1/whoami",
+	"GET /api/v1/tags",
+	"GET /api/v1/stats",
+	"GET /api/v1/backup",
+	"POST /api/v1/backup",
+};
+
+static struct { char *method; char *uri; } REQUESTS[] = {
+	{ "GET",    "/api/v1/recipe/list" },
+	{ "GET",    "/api/v1/recipe/9e3dad51-869f-406b-994e-0d8c54838b3d" },
+	{ "PUT",    "/api/v1/recipe/9E3DAD51-869F-406B-994E-0D8C54838B3D" },
+	{ "POST",   "/api/v1/recipe/9e3dad51-869f-406b-994e-0d8c54838b3d/image" },
+	{ "GET",    "/api/v1/image/d40842e6504df15b8e2ee9349e3411ffab825f8df1e2ef40371aee975c02fefc?w=320" },
+	{ "GET",    "/api/v1/whoami" },
+	{ "GET",    "/api/v1/recipe/list?page=2&size=20" },
+	{ "GET",    "/ui.js" },
+};
+
+#define REQUESTS_LEN (sizeof REQUESTS / sizeof REQUESTS[0])
+
+// is_hash: returns true if this string is a content hash (crypto_generichash, as lowercase hex)
+static int is_hash(char *s)
+{
+	size_t i;
+
+	for (i = 0; i < 64; i++) {
+		if (!isdigit(s[i]) && !(s[i] >= 'a' && s[i] <= 'f')) {
+			return false;
+		}
+	}
+
+	return s[i] == '\0' || s[i] == '?';
+}
+
+// is_uuidv4: returns true if this string represents a uuidv4
+static int is_uuidv4(char *s)
+{
+	for (size_t i = 0; i < 36; i++) {
+		if (i == 8 || i == 13 || i == 18 || i == 23) {
+			if (s[i] != '-') return false;
+		} else if (!isxdigit(s[i])) {
+			return false;
+		}
+	}
+
+	return s[14] == '4' && (s[19] == '8' || s[19] == '9' || toupper(s[19]) == 'A' || toupper(s[19]) == 'B');
+}
+
+// format_target_string : format the incomming requets for the routing hashtable
+static int format_target_string(char *s, struct mg_http_message *hm, size_t len)
+{
+	size_t buflen;
+	char *tok;
+	char *hasq;
+	char copy[BUFLARGE];
+	char readfrom[BUFLARGE];
+
+	memset(copy, 0, sizeof copy);
+	memset(readfrom, 0, sizeof readfrom);
+
+	strncpy(readfrom, hm->uri.ptr, MIN(sizeof(readfrom), hm->uri.len));
+
+	buflen = 0;
+
+	for (tok = strtok(readfrom, "/"); tok != NULL && buflen <= len; tok = strtok(NULL, "/")) {
+		if (is_uuidv4(tok)) {
+			buflen += snprintf(copy + buflen, sizeof(copy) - buflen, "/:id");
+		} else if (is_hash(tok)) {
+			buflen += snprintf(copy + buflen, sizeof(copy) - buflen, "/:hash");
+		} else {
+			hasq = strchr(tok, '?');
+			if (hasq) {
+				buflen += snprintf(copy + buflen, sizeof(copy) - buflen, "/%.*s", (int)(hasq - tok), tok);
+			} else {
+				buflen += snprintf(copy + buflen, sizeof(copy) - buflen, "/%s", tok);
+			}
+		}
+	}
+
+	if (copy[0] == '\0') {
+		copy[0] = '/';
+	}
+
+	snprintf(s, len, "%.*s %s", (int)hm->method.len, hm->method.ptr, copy);
+
+	return 0;
+}
+
+// time_trie: ns per route_match over the requests, the best of ROUNDS
+static double time_trie(Router *router, struct mg_http_message *hms, size_t n, size_t *matched)
+{
+	RouteParams params;
+	Route route;
+	i64 best = INT64_MAX;
+	i64 t;
+
+	for (size_t round = 0; round < ROUNDS; round++) {
+		*matched = 0;
+
+		t = now_ns();
+		for (size_t i = 0; i < n; i++) {
+			if (route_match(router, &hms[i % REQUESTS_LEN], &route, &params)) {
+				(*matched)++;
+			}
+		}
+		best = MIN(best, now_ns() - t);
+	}
+
+	return (double)best / n;
+}
+
+// time_string: ns per format_target_string and shgeti (and id sscanf) over the requests, the best of ROUNDS
+static double time_string(RouteTableEntry *table, struct mg_http_message *hms, size_t n, size_t *matched)
+{
+	char buf[BUFLARGE];
+	char id[BUFSMALL];
+	char *url;
+	i64 best = INT64_MAX;
+	i64 t;
+
+	for (size_t round = 0; round < ROUNDS; round++) {
+		*matched = 0;
+
+		t = now_ns();
+		for (size_t i = 0; i < n; i++) {
+			struct mg_http_message *hm = &hms[i % REQUESTS_LEN];
+
+			memset(buf, 0, sizeof buf);
+			format_target_string(buf, hm, sizeof buf);
+
+			if (shgeti(table, buf) >= 0) {
+				(*matched)++;
+
+				// what recipe_api_get did to get its id
+				url = strndup(hm->uri.ptr, hm->uri.len);
+				sscanf(url, "/api/v1/recipe/%36s", id);
+				free(url);
+			}
+		}
+		best = MIN(best, now_ns() - t);
+	}
+
+	return (double)best / n;
+}
+
+int main(int argc, char **argv)
+{
+	struct mg_http_message hms[REQUESTS_LEN];
+	RouteTableEntry *table = NULL;
+	Router router = {0};
+	size_t n = 1000000;
+	size_t trie_matched, string_matched;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+			case 'n': n = strtoull(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, USAGE, argv[0]);
+				return 1;
+		}
+	}
+
+	if (n == 0) {
+		fprintf(stderr, USAGE, argv[0]);
+		return 1;
+	}
+
+	sh_new_strdup(table);
+
+	for (size_t i = 0; i < sizeof PATTERNS / sizeof PATTERNS[0]; i++) {
+		if (route_add(&router, PATTERNS[i], bench_handler) < 0) {
+			return 1;
+		}
+		shput(table, PATTERNS[i], bench_handler);
+	}
+
+	memset(hms, 0, sizeof hms);
+	for (size_t i = 0; i < REQUESTS_LEN; i++) {
+		hms[i].method = (struct mg_str){ REQUESTS[i].method, strlen(REQUESTS[i].method) };
+		hms[i].uri = (struct mg_str){ REQUESTS[i].uri, strlen(REQUESTS[i].uri) };
+	}
+
+	double trie_ns = time_trie(&router, hms, n, &trie_matched);
+	double string_ns = time_string(table, hms, n / 10 + 1, &string_matched);
+
+	printf("{\"iterations\":%zu,\"matched\":{\"trie\":%zu,\"string\":%zu},"
+		"\"ns\":{\"trie\":%.1f,\"string\":%.1f}}\n",
+		n, trie_matched, string_matched, trie_ns, string_ns);
+
+	route_free(&router);
+	shfree(table);
+
+	return 0;
+}
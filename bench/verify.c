@@ -0,0 +1,206 @@
+// Brian Chrzanowski
+// 2026-10-18 03:30:02
+//
+// Session Verify Benchmark
+//
+// What it costs, per request, to find out who's asking, each way there is to do it:
+//
+//   signed  - token_verify on a signed token ('-s'), a base64 decode and one crypto_auth
+//   revoked - token_verify on one that was logged out, which is a bloom hit, and a query
+//   table   - session_lookup on a table token (the default), a BLAKE2b and a probe under a lock
+//   sqlite  - looking the table token's hash up in the sessions table, which is what every request
+//             would pay without either of those
+//
+// USAGE: bench/verify [-n iterations] [-f dbfile]
+//
+// It has to be run from the root of the repo (for src/schema.sql, src/migrations and
+// sqlite3_uuid.so). Results are nanoseconds per verify, written to stdout as JSON.
+
+#define _GNU_SOURCE
+#define COMMON_IMPLEMENTATION
+#include "../src/common.h"
+
+#include <unistd.h>
+
+#include <sodium.h>
+#include <jansson.h>
+
+#include "../src/sqlite3.h"
+
+#include "../src/objects.h"
+#include "../src/migrate.h"
+#include "../src/session.h"
+#include "../src/token.h"
+
+#define BENCH_IMPLEMENTATION
+#include "bench.h"
+
+#define USAGE ("USAGE: %s [-n iterations] [-f dbfile]\n")
+
+#define BENCH_USER "9e3dad51-869f-406b-994e-0d8c54838b3d"
+
+// the objects code works on the thread's connection, same as the server
+__thread sqlite3 *DATABASE;
+
+// time_signed: ns per token_verify of 'token'
+static double time_signed(char *token, size_t n, int want)
+{
+	char id[40];
+	i64 expires;
+	i64 t;
+
+	t = now_ns();
+	for (size_t i = 0; i < n; i++) {
+		if (token_verify(token, TOKEN_LEN, id, sizeof id, &expires) != want) {
+			ERR("token_verify came back wrong!\n");
+			exit(1);
+		}
+	}
+
+	return (double)(now_ns() - t) / n;
+}
+
+// time_table: ns per session_lookup of 'token'
+static double time_table(char *token, size_t n)
+{
+	Session session;
+	i64 t;
+
+	t = now_ns();
+	for (size_t i = 0; i < n; i++) {
+		if (!session_lookup(token, SESSION_TOKEN_LEN, &session)) {
+			ERR("session_lookup came back empty!\n");
+			exit(1);
+		}
+	}
+
+	return (double)(now_ns() - t) / n;
+}
+
+// time_sqlite: ns per lookup of 'token's hash in the sessions table
+static double time_sqlite(char *token, size_t n)
+{
+	sqlite3_stmt *stmt;
+	u8 hash[16];
+	i64 t;
+
+	crypto_generichash(hash, sizeof hash, (u8 *)token, SESSION_TOKEN_LEN, NULL, 0);
+
+	sqlite3_prepare_v2(DATABASE,
+		"select uuid_str(s.user_id), u.username, u.email, s.expires_ts from sessions s"
+		" join users u on u.id = s.user_id where s.hash = ?;", -1, &stmt, NULL);
+
+	t = now_ns();
+	for (size_t i = 0; i < n; i++) {
+		crypto_generichash(hash, sizeof hash, (u8 *)token, SESSION_TOKEN_LEN, NULL, 0);
+		sqlite3_bind_blob(stmt, 1, hash, sizeof hash, SQLITE_STATIC);
+		if (sqlite3_step(stmt) != SQLITE_ROW) {
+			ERR("the session isn't in the table!\n");
+			exit(1);
+		}
+		sqlite3_reset(stmt);
+	}
+	t = now_ns() - t;
+
+	sqlite3_finalize(stmt);
+
+	return (double)t / n;
+}
+
+int main(int argc, char **argv)
+{
+	char *fname = "/tmp/recipe-verify.db";
+	size_t n = 1000000;
+	char signed_token[BUFSMALL];
+	char revoked_token[BUFSMALL];
+	char table_token[BUFSMALL];
+	Session session = {0};
+	size_t len;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:f:")) != -1) {
+		switch (opt) {
+			case 'n': n = strtoull(optarg, NULL, 10); break;
+			case 'f': fname = optarg; break;
+			default:
+				fprintf(stderr, USAGE, argv[0]);
+				return 1;
+		}
+	}
+
+	if (n == 0) {
+		fprintf(stderr, USAGE, argv[0]);
+		return 1;
+	}
+
+	if (sodium_init() < 0) {
+		return 1;
+	}
+
+	unlink(fname);
+
+	if (db_open(fname, false) < 0) {
+		return 1;
+	}
+
+	char *schema = sys_readfile("src/schema.sql", &len);
+	if (schema == NULL || db_exec_script(schema) < 0 || migrate_run("src/migrations") < 0) {
+		return 1;
+	}
+	free(schema);
+
+	if (db_exec_script("insert into users (id, username, email, password, salt) values"
+			" (uuid_blob('" BENCH_USER "'), 'bench', 'bench@example.com', '', '');") < 0) {
+		return 1;
+	}
+
+	// table sessions, the way the server runs by default, with the signing keys loaded next to them
+	if (session_init(false) < 0 || token_init() < 0) {
+		return 1;
+	}
+
+	snprintf(session.id, sizeof session.id, "%s", BENCH_USER);
+	snprintf(session.username, sizeof session.username, "bench");
+
+	if (session_create(&session, table_token, sizeof table_token) < 0) {
+		return 1;
+	}
+
+	i64 expires = session.expires;
+
+	if (token_issue(BENCH_USER, expires, signed_token, sizeof signed_token) < 0) {
+		return 1;
+	}
+
+	// a second one, a ms later so it's a different MAC, to log out
+	if (token_issue(BENCH_USER, expires + 1, revoked_token, sizeof revoked_token) < 0) {
+		return 1;
+	}
+
+	if (token_revoke(revoked_token, TOKEN_LEN) < 0) {
+		return 1;
+	}
+
+	// session_free is what writes the table session out, it's started again after so it can be looked up
+	session_free();
+	if (session_init(false) < 0) {
+		return 1;
+	}
+
+	double signed_ns = time_signed(signed_token, n, true);
+	double revoked_ns = time_signed(revoked_token, n / 100 + 1, false);
+	double table_ns = time_table(table_token, n);
+	double sqlite_ns = time_sqlite(table_token, n / 100 + 1);
+
+	printf("{\"iterations\":%zu,\"token_bytes\":{\"signed\":%d,\"table\":%d},"
+		"\"ns\":{\"signed\":%.1f,\"revoked\":%.1f,\"table\":%.1f,\"sqlite\":%.1f}}\n",
+		n, TOKEN_LEN, SESSION_TOKEN_LEN, signed_ns, revoked_ns, table_ns, sqlite_ns);
+
+	session_free();
+	token_free();
+	db_close();
+
+	unlink(fname);
+
+	return 0;
+}
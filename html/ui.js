@@ -706,7 +706,7 @@ function SearchComponent(vnode) {
     const doSearch = () => {
         // TODO (Brian): we need to have optional parameter things in here
         // Like, you shouldn't always have to send pageSize, or pageNumber
-        const qString = `q=${query.text}&siz=${query.pageSize}&num=${query.pageNumber}`;
+        const qString = `q=${encodeURIComponent(query.text)}&siz=${query.pageSize}&num=${query.pageNumber}`;
 
         isLoading = true;
 
@@ -808,7 +808,7 @@ function SearchComponent(vnode) {
                 }, "\u2039"),
                 m("button", {
                     class: "mui-col-md-1 mui-btn", onclick: (e) => {
-                        if (query.pageNumber < Math.floor(query.total / query.pageSize)) {
+                        if ((query.pageNumber + 1) * query.pageSize < query.total) {
                             query.pageNumber++;
                             enterHandler();
                         }
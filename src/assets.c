@@ -0,0 +1,138 @@
+// Brian Chrzanowski
+// 2026-10-17 22:14:51
+//
+// Static Assets
+//
+// Everything that isn't an API route gets served from here, out of the copy of html/ that
+// tools/pack compiled into the binary (packed.c). The type, the ETag, and the gzip copy were all
+// worked out at build time, so a request is a hash lookup and a memcpy into the send buffer. The
+// server doesn't stat, open, or read anything, and it doesn't matter what directory it's run in.
+//
+// The ETags are hashes of the contents, so a browser that already has a file gets a 304 for it,
+// and that's the same lookup, and a compare against a string we already have.
+//
+// NOTE (Brian) this means an edit to html/ needs a 'make' to show up (make watch does that).
+
+#include "common.h"
+
+#include "mongoose.h"
+
+#include "assets.h"
+#include "gzip.h"
+
+// AssetTableEntry: an asset, by path
+typedef struct AssetTableEntry {
+	char *key;
+	Asset *value;
+} AssetTableEntry;
+
+static AssetTableEntry *ASSET_TABLE = NULL;
+
+// NOTE (Brian) revalidate every time, the URLs stay the same when the files change (it's a 304)
+#define ASSETS_HEADERS "Cache-Control: no-cache\r\n"
+
+// assets_matches : true if the If-None-Match on 'hm' has 'etag' in it
+static int assets_matches(struct mg_http_message *hm, char *etag);
+
+// assets_init : builds the table to look the assets up by path
+int assets_init()
+{
+	char path[BUFSMALL];
+	char *slash;
+	size_t i;
+
+	sh_new_strdup(ASSET_TABLE);
+
+	for (i = 0; i < ASSETS_LEN; i++) {
+		shput(ASSET_TABLE, ASSETS[i].path, &ASSETS[i]);
+
+		// a directory is its index.html
+		slash = strrchr(ASSETS[i].path, '/');
+		if (slash != NULL && streq(slash, "/index.html")) {
+			snprintf(path, sizeof path, "%.*s", (int)(slash - ASSETS[i].path + 1), ASSETS[i].path);
+			shput(ASSET_TABLE, path, &ASSETS[i]);
+		}
+	}
+
+	return 0;
+}
+
+// assets_serve : serves the asset 'hm' asks for (or a 304, or a 404), it never touches the disk
+void assets_serve(struct mg_connection *conn, struct mg_http_message *hm)
+{
+	char uri[BUFLARGE];
+	Asset *asset;
+	char *etag;
+	int gzip;
+	int n;
+
+	if (mg_vcmp(&hm->method, "GET") != 0 && mg_vcmp(&hm->method, "HEAD") != 0) {
+		mg_http_reply(conn, 405, "Allow: GET, HEAD\r\n", "");
+		return;
+	}
+
+	n = mg_url_decode(hm->uri.ptr, hm->uri.len, uri, sizeof uri, 0);
+	if (n <= 0 || (asset = shget(ASSET_TABLE, uri)) == NULL) {
+		mg_http_reply(conn, 404, NULL, "Not found\n");
+		return;
+	}
+
+	gzip = asset->gz != NULL && gzip_accepts(hm);
+	etag = gzip ? asset->etag_gz : asset->etag;
+
+	if (assets_matches(hm, etag)) {
+		mg_printf(conn,
+			"HTTP/1.1 304 Not Modified\r\n"
+			"ETag: %s\r\n"
+			"%s"
+			ASSETS_HEADERS
+			"Content-Length: 0\r\n\r\n",
+			etag, asset->gz != NULL ? "Vary: Accept-Encoding\r\n" : "");
+		return;
+	}
+
+	mg_printf(conn,
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Type: %s\r\n"
+		"ETag: %s\r\n"
+		"%s%s"
+		ASSETS_HEADERS
+		"Content-Length: %zu\r\n\r\n",
+		asset->mime, etag,
+		asset->gz != NULL ? "Vary: Accept-Encoding\r\n" : "",
+		gzip ? "Content-Encoding: gzip\r\n" : "",
+		gzip ? asset->gzlen : asset->len);
+
+	if (mg_vcmp(&hm->method, "HEAD") != 0) {
+		mg_send(conn, gzip ? asset->gz : asset->data, gzip ? asset->gzlen : asset->len);
+	}
+
+	if (gzip) {
+		gzip_record(asset->path, asset->len, asset->gzlen, 0);
+	}
+}
+
+// assets_matches : true if the If-None-Match on 'hm' has 'etag' in it
+static int assets_matches(struct mg_http_message *hm, char *etag)
+{
+	struct mg_str *header;
+
+	header = mg_http_get_header(hm, "If-None-Match");
+	if (header == NULL) {
+		return false;
+	}
+
+	// NOTE (Brian) it can be a list, and the quotes are part of the tag, so this can't match a
+	// piece of some other one
+	if (mg_strstr(*header, mg_str(etag)) != NULL || mg_vcmp(header, "*") == 0) {
+		return true;
+	}
+
+	return false;
+}
+
+// assets_free : frees the lookup table
+void assets_free()
+{
+	shfree(ASSET_TABLE);
+}
@@ -0,0 +1,36 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+// Brian Chrzanowski
+// 2026-10-17 22:14:51
+
+#include "common.h"
+
+#include "mongoose.h"
+
+// Asset: one file from html/, as tools/pack wrote it into packed.c
+typedef struct Asset {
+	char *path; // what it's served at ('/ui.js')
+	char *mime;
+	char *etag; // with the quotes
+	const u8 *data;
+	size_t len;
+	char *etag_gz; // the gzip copy is a different representation, so it gets its own
+	const u8 *gz; // NULL if it didn't come out any smaller
+	size_t gzlen;
+} Asset;
+
+// packed.c
+extern Asset ASSETS[];
+extern size_t ASSETS_LEN;
+
+// assets_init : builds the table to look the assets up by path
+int assets_init();
+
+// assets_serve : serves the asset 'hm' asks for (or a 304, or a 404), it never touches the disk
+void assets_serve(struct mg_connection *conn, struct mg_http_message *hm);
+
+// assets_free : frees the lookup table
+void assets_free();
+
+#endif // ASSETS_H
@@ -0,0 +1,400 @@
+// Brian Chrzanowski
+// 2026-10-17 18:02:31
+//
+// Online Backups
+//
+// 'cp recipe.db' on a live server can catch the file half way through a commit (and it doesn't get
+// the WAL at all). This uses SQLite's backup API instead, from its own thread and its own
+// connection, so a backup is always a consistent copy of the database:
+//
+//   1. open a read-only connection, and start a read transaction on it
+//   2. sqlite3_backup_step BACKUP_PAGES pages at a time into bak/<timestamp>.db.tmp
+//   3. sleep BACKUP_PAUSE between steps, so the requests get the disk (and the cores) back
+//   4. rename the finished file to bak/<timestamp>.db
+//
+// Holding the read transaction across every step is what makes it a point in time copy. Without it,
+// every commit the server makes while the backup is running restarts the backup from page 0. In WAL
+// mode the writer doesn't wait on the reader, so this doesn't hold anything else up (checkpoints
+// just can't get past the backup's snapshot until it's done).
+//
+// A backup gets started with 'POST /api/v1/backup' or 'kill -USR1', one at a time, and
+// 'GET /api/v1/backup' reports how far along it is, and how fast it's going. The endpoints only
+// answer to localhost.
+
+#include "common.h"
+
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include <jansson.h>
+
+#include "mongoose.h"
+#include "sqlite3.h"
+
+#include "objects.h"
+#include "backup.h"
+
+#define BACKUP_PAGES (256)
+#define BACKUP_PAUSE (10) // ms
+
+extern __thread sqlite3 *DATABASE;
+
+// BackupStatus: where the current (or last) backup is at, everything's under 'lock'
+typedef struct BackupStatus {
+	pthread_mutex_t lock;
+	pthread_t thread;
+	int started; // has a thread to join
+	int running;
+	int stopping;
+	int ok;
+	char path[BUFLARGE];
+	char error[BUFSMALL];
+	i64 pages_done;
+	i64 pages_total;
+	i64 page_size;
+	u64 start_ms;
+	u64 end_ms;
+} BackupStatus;
+
+static BackupStatus BACKUP = { PTHREAD_MUTEX_INITIALIZER };
+static char *DBNAME = NULL;
+static char *BACKUP_DIR = NULL;
+
+// backup_thread : thread entry, copies the database into BACKUP.path
+static void *backup_thread(void *arg);
+// backup_copy : runs the backup from DATABASE into 'dest', a few pages at a time
+static int backup_copy(sqlite3 *dest);
+// backup_fail : records why the backup didn't work
+static void backup_fail(char *fmt, ...);
+// backup_is_local : true if the request came from this machine
+static int backup_is_local(struct mg_addr *addr);
+
+// backup_init : remembers the database to back up, and where the backups go
+void backup_init(char *fname, char *dir)
+{
+	DBNAME = fname;
+	BACKUP_DIR = dir;
+}
+
+// backup_start : starts a backup, 0 if it started, 1 if one's already going, -1 on error
+int backup_start()
+{
+	char stamp[32];
+	struct tm tm;
+	time_t now;
+	int rc;
+
+	if (mkdir(BACKUP_DIR, 0755) < 0 && errno != EEXIST) {
+		ERR("couldn't make the backup directory '%s': %s\n", BACKUP_DIR, strerror(errno));
+		return -1;
+	}
+
+	pthread_mutex_lock(&BACKUP.lock);
+
+	if (BACKUP.running) {
+		pthread_mutex_unlock(&BACKUP.lock);
+		return 1;
+	}
+
+	// the last one's thread is finished, it just hasn't been joined
+	if (BACKUP.started) {
+		pthread_join(BACKUP.thread, NULL);
+		BACKUP.started = false;
+	}
+
+	now = time(NULL);
+	localtime_r(&now, &tm);
+	strftime(stamp, sizeof stamp, "%Y%m%d-%H%M%S", &tm);
+
+	snprintf(BACKUP.path, sizeof BACKUP.path, "%s/%s.db", BACKUP_DIR, stamp);
+	BACKUP.error[0] = '\0';
+	BACKUP.ok = false;
+	BACKUP.stopping = false;
+	BACKUP.pages_done = 0;
+	BACKUP.pages_total = 0;
+	BACKUP.page_size = 0;
+	BACKUP.start_ms = mg_millis();
+	BACKUP.end_ms = 0;
+	BACKUP.running = true;
+
+	rc = pthread_create(&BACKUP.thread, NULL, backup_thread, NULL);
+	if (rc != 0) {
+		BACKUP.running = false;
+		pthread_mutex_unlock(&BACKUP.lock);
+		ERR("couldn't start the backup thread!\n");
+		return -1;
+	}
+
+	BACKUP.started = true;
+
+	printf("backup: started %s\n", BACKUP.path);
+
+	pthread_mutex_unlock(&BACKUP.lock);
+
+	return 0;
+}
+
+// backup_free : stops a running backup (it's thrown away), and joins the thread
+void backup_free()
+{
+	pthread_mutex_lock(&BACKUP.lock);
+	BACKUP.stopping = true;
+	pthread_mutex_unlock(&BACKUP.lock);
+
+	if (BACKUP.started) {
+		pthread_join(BACKUP.thread, NULL);
+		BACKUP.started = false;
+	}
+}
+
+// backup_api_post : endpoint, POST - /api/v1/backup
+int backup_api_post(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
+{
+	int rc;
+
+	if (!backup_is_local(&conn->peer)) {
+		mg_http_reply(conn, 403, NULL, "");
+		return 0;
+	}
+
+	rc = backup_start();
+	if (rc < 0) {
+		return -1;
+	}
+
+	// 202 when it started, 409 when there's already one going, the body is the status either way
+	return backup_api_status(conn, rc == 0 ? 202 : 409);
+}
+
+// backup_api_get : endpoint, GET - /api/v1/backup
+int backup_api_get(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
+{
+	if (!backup_is_local(&conn->peer)) {
+		mg_http_reply(conn, 403, NULL, "");
+		return 0;
+	}
+
+	return backup_api_status(conn, 200);
+}
+
+// backup_api_status : replies with where the current (or last) backup is at
+int backup_api_status(struct mg_connection *conn, int code)
+{
+	json_t *object;
+	u64 elapsed;
+	char *s;
+
+	pthread_mutex_lock(&BACKUP.lock);
+
+	elapsed = BACKUP.start_ms == 0 ? 0 : (BACKUP.running ? mg_millis() : BACKUP.end_ms) - BACKUP.start_ms;
+
+	i64 bytes_done = BACKUP.pages_done * BACKUP.page_size;
+
+	object = json_pack(
+		"{s:b, s:b, s:s?, s:s?, s:I, s:I, s:I, s:I, s:I, s:I}",
+		"running", BACKUP.running,
+		"ok", BACKUP.ok,
+		"path", BACKUP.start_ms ? BACKUP.path : NULL,
+		"error", BACKUP.error[0] ? BACKUP.error : NULL,
+		"pages_done", (json_int_t)BACKUP.pages_done,
+		"pages_total", (json_int_t)BACKUP.pages_total,
+		"bytes_done", (json_int_t)bytes_done,
+		"bytes_total", (json_int_t)(BACKUP.pages_total * BACKUP.page_size),
+		"elapsed_ms", (json_int_t)elapsed,
+		"bytes_per_sec", (json_int_t)(elapsed ? bytes_done * 1000 / (i64)elapsed : 0)
+	);
+
+	pthread_mutex_unlock(&BACKUP.lock);
+
+	if (object == NULL) {
+		return -1;
+	}
+
+	s = json_dumps(object, JSON_SORT_KEYS|JSON_COMPACT);
+
+	mg_http_reply(conn, code, NULL, "%s", s);
+
+	json_decref(object);
+	free(s);
+
+	return 0;
+}
+
+// backup_thread : thread entry, copies the database into BACKUP.path
+static void *backup_thread(void *arg)
+{
+	char tmppath[BUFLARGE + 8];
+	char path[BUFLARGE];
+	sqlite3 *dest = NULL;
+	int rc = -1;
+
+	pthread_mutex_lock(&BACKUP.lock);
+	strncpy(path, BACKUP.path, sizeof path);
+	pthread_mutex_unlock(&BACKUP.lock);
+
+	// it's only a backup once it's all there, so it's written under another name first
+	snprintf(tmppath, sizeof tmppath, "%s.tmp", path);
+
+	if (db_open(DBNAME, true) < 0) {
+		backup_fail("couldn't open %s", DBNAME);
+		goto done;
+	}
+
+	if (sqlite3_open_v2(tmppath, &dest, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK) {
+		backup_fail("couldn't open %s: %s", tmppath, sqlite3_errmsg(dest));
+		goto done;
+	}
+
+	rc = backup_copy(dest);
+
+done:
+	if (dest != NULL) {
+		sqlite3_close(dest);
+	}
+
+	if (DATABASE != NULL) {
+		db_close();
+	}
+
+	if (rc == 0) {
+		// the backup is already on disk (SQLite synced it when it committed), and it isn't going
+		// to get read any time soon, so it doesn't need to push the live database out of the page
+		// cache
+		int fd = open(tmppath, O_RDONLY);
+		if (fd >= 0) {
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			close(fd);
+		}
+
+		if (rename(tmppath, path) < 0) {
+			backup_fail("couldn't rename %s: %s", tmppath, strerror(errno));
+			rc = -1;
+		}
+	}
+
+	if (rc < 0) {
+		unlink(tmppath);
+	}
+
+	pthread_mutex_lock(&BACKUP.lock);
+
+	BACKUP.running = false;
+	BACKUP.ok = rc == 0;
+	BACKUP.end_ms = mg_millis();
+
+	if (rc == 0) {
+		double secs = MAX(BACKUP.end_ms - BACKUP.start_ms, 1) / 1000.0;
+		double mb = (double)(BACKUP.pages_done * BACKUP.page_size) / (1024 * 1024);
+		printf("backup: wrote %s, %.1fMB in %.2fs (%.1fMB/s)\n", path, mb, secs, mb / secs);
+	} else {
+		ERR("backup: %s\n", BACKUP.error);
+	}
+
+	pthread_mutex_unlock(&BACKUP.lock);
+
+	return NULL;
+}
+
+// backup_copy : runs the backup from DATABASE into 'dest', a few pages at a time
+static int backup_copy(sqlite3 *dest)
+{
+	sqlite3_backup *backup;
+	sqlite3_stmt *stmt;
+	i64 page_size = 0;
+	int stopping;
+	int rc;
+
+	if (sqlite3_prepare_v2(DATABASE, "pragma page_size;", -1, &stmt, NULL) == SQLITE_OK) {
+		if (sqlite3_step(stmt) == SQLITE_ROW) {
+			page_size = sqlite3_column_int64(stmt, 0);
+		}
+		sqlite3_finalize(stmt);
+	}
+
+	// NOTE (Brian) sqlite3_backup_step uses the read transaction that's already open on the source,
+	// instead of starting (and ending) its own every step. That pins the snapshot for the whole
+	// backup. A read transaction only really starts when it reads something.
+	rc = sqlite3_exec(DATABASE, "begin; select count(*) from sqlite_schema;", NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		backup_fail("couldn't start a read transaction: %s", sqlite3_errmsg(DATABASE));
+		return -1;
+	}
+
+	backup = sqlite3_backup_init(dest, "main", DATABASE, "main");
+	if (backup == NULL) {
+		backup_fail("couldn't start the backup: %s", sqlite3_errmsg(dest));
+		sqlite3_exec(DATABASE, "rollback;", NULL, NULL, NULL);
+		return -1;
+	}
+
+	do {
+		rc = sqlite3_backup_step(backup, BACKUP_PAGES);
+
+		pthread_mutex_lock(&BACKUP.lock);
+		BACKUP.pages_total = sqlite3_backup_pagecount(backup);
+		BACKUP.pages_done = BACKUP.pages_total - sqlite3_backup_remaining(backup);
+		BACKUP.page_size = page_size;
+		stopping = BACKUP.stopping;
+		pthread_mutex_unlock(&BACKUP.lock);
+
+		if (stopping) {
+			break;
+		}
+
+		if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+			sqlite3_sleep(BACKUP_PAUSE);
+		}
+	} while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+
+	sqlite3_backup_finish(backup);
+
+	sqlite3_exec(DATABASE, "rollback;", NULL, NULL, NULL);
+
+	if (stopping) {
+		backup_fail("stopped before it finished");
+		return -1;
+	}
+
+	if (rc != SQLITE_DONE) {
+		backup_fail("backup failed: %s", sqlite3_errstr(rc));
+		return -1;
+	}
+
+	return 0;
+}
+
+// backup_fail : records why the backup didn't work
+static void backup_fail(char *fmt, ...)
+{
+	va_list args;
+
+	pthread_mutex_lock(&BACKUP.lock);
+
+	va_start(args, fmt);
+	vsnprintf(BACKUP.error, sizeof BACKUP.error, fmt, args);
+	va_end(args);
+
+	pthread_mutex_unlock(&BACKUP.lock);
+}
+
+// backup_is_local : true if the request came from this machine
+static int backup_is_local(struct mg_addr *addr)
+{
+	static const u8 loopback6[16] = { [15] = 1 };
+	static const u8 mapped4[12] = { [10] = 0xff, [11] = 0xff };
+
+	if (!addr->is_ip6) {
+		return (ntohl(addr->ip) >> 24) == 127;
+	}
+
+	if (memcmp(addr->ip6, loopback6, sizeof loopback6) == 0) {
+		return true;
+	}
+
+	// ::ffff:127.x.x.x
+	return memcmp(addr->ip6, mapped4, sizeof mapped4) == 0 && addr->ip6[12] == 127;
+}
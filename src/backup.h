@@ -0,0 +1,31 @@
+#ifndef BACKUP_H
+#define BACKUP_H
+
+// Brian Chrzanowski
+// 2026-10-17 18:02:31
+
+#include "common.h"
+
+#include "mongoose.h"
+
+#include "route.h"
+
+// backup_init : remembers the database to back up, and where the backups go
+void backup_init(char *fname, char *dir);
+
+// backup_start : starts a backup, 0 if it started, 1 if one's already going, -1 on error
+int backup_start();
+
+// backup_free : stops a running backup (it's thrown away), and joins the thread
+void backup_free();
+
+// backup_api_post : endpoint, POST - /api/v1/backup
+int backup_api_post(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
+
+// backup_api_get : endpoint, GET - /api/v1/backup
+int backup_api_get(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
+
+// backup_api_status : replies with where the current (or last) backup is at
+int backup_api_status(struct mg_connection *conn, int code);
+
+#endif // BACKUP_H
@@ -0,0 +1,428 @@
+// Brian Chrzanowski
+// 2026-10-17 16:05:12
+//
+// Bulk Recipe Import
+//
+// POST /api/v1/recipe/bulk takes newline delimited JSON, one recipe (the same object that
+// POST /api/v1/recipe takes) per line:
+//
+//   curl -T recipes.ndjson -X POST localhost:2000/api/v1/recipe/bulk?batch=1000
+//
+// Anything that doesn't fit in one read from the socket comes through MG_EV_HTTP_CHUNK instead of
+// MG_EV_HTTP_MSG, so we take the body a piece at a time, split it into lines, parse each line as it
+// finishes, and then delete the piece from the receive buffer. That way the size of the import
+// isn't limited by MG_MAX_RECV_BUF_SIZE, and the memory used only depends on the batch size. Both
+// Content-Length and chunked transfer encoding work.
+//
+// Parsed recipes are held until there are 'batch' of them (default 1000), and then all of them are
+// inserted in one transaction. Each line gets a savepoint inside of that, so one bad recipe only
+// loses itself, and not the rest of its batch. The search index entries for the whole batch are
+// written at the end, after all of the rows (see recipe_fts_insert for why).
+//
+// The response is one JSON object, with a result for every non-blank line, in order:
+//
+//   {"imported":2,"failed":1,"results":[{"line":1,"id":"..."},{"line":2,"error":"invalid recipe"},...]}
+//
+// NOTE (Brian) every batch is its own transaction, so an import that fails part of the way through
+// (the client hangs up, say) keeps the batches that were already committed, and drops the one that
+// wasn't. The results say which lines made it, so resending the rest is on the client.
+//
+// NOTE (Brian) the streaming path runs on the event loop, even with '-w', because that's where the
+// chunks come in. A batch of 1000 is tens of milliseconds of everything else waiting, so keep
+// 'batch' reasonable. Small bodies that arrive all at once go through bulk_api_post and the
+// regular routing, which puts them on the writer thread like any other POST.
+//
+// It doesn't wait on the database's lock, either. A batch that finds it locked keeps collecting
+// lines, and bulk_poll tries it again every time around the loop, for up to DB_BUSY_MS, before
+// those lines fail with "couldn't save". The response waits on the last batch the same way.
+
+#include "common.h"
+
+#include <jansson.h>
+
+#include "mongoose.h"
+#include "sqlite3.h"
+
+#include "objects.h"
+#include "recipe.h"
+#include "bulk.h"
+
+#define BULK_BATCH_DEFAULT (1000)
+#define BULK_BATCH_MAX     (10000)
+#define BULK_LINE_MAX      (1024 * 1024)
+
+extern __thread sqlite3 *DATABASE;
+
+// BulkLine: one line of the import, waiting for its batch to be committed
+typedef struct BulkLine {
+	size_t lineno;
+	Recipe *recipe;
+	char *error;
+} BulkLine;
+
+// BulkImport: the state of one import, hung off of the connection (fn_data) while it streams in
+typedef struct BulkImport {
+	char *line;       // stb array, the line we're in the middle of
+	BulkLine *batch;  // stb array, the lines that haven't been committed yet
+	char *results;    // stb array, the contents of "results" so far
+	size_t batch_size;
+	size_t lineno;
+	size_t imported;
+	size_t failed;
+	size_t received;
+	size_t expected;
+	int chunked;
+	int too_long;
+	int stream;    // it came through bulk_api_chunk, on the event loop
+	int finishing; // the whole body is in, and only the last batch (and the response) is left
+	unsigned long busy_since; // mg_millis() when the batch first found the database locked, 0 if it hasn't
+} BulkImport;
+
+// bulk_new : sets up an import for the request in 'hm'
+static BulkImport *bulk_new(struct mg_http_message *hm);
+// bulk_feed : splits 'len' bytes of body into lines, handling each line as it finishes
+static void bulk_feed(BulkImport *bulk, const char *s, size_t len);
+// bulk_line : parses the line that just finished, and adds it to the batch
+static void bulk_line(BulkImport *bulk);
+// bulk_commit : inserts the batch in one transaction, and writes out its results, -1 if the database was locked and the batch is still waiting
+static int bulk_commit(BulkImport *bulk);
+// bulk_finish : handles whatever is left after the last byte of the body, and sends the response, -1 if the last batch is still waiting
+static int bulk_finish(struct mg_connection *conn, BulkImport *bulk);
+// bulk_result : adds one line's result to the response
+static void bulk_result(BulkImport *bulk, BulkLine *line);
+// bulk_free : frees the import, and anything it still has in its batch
+static void bulk_free(BulkImport *bulk);
+
+// bulk_api_post : endpoint, POST - /api/v1/recipe/bulk (when the whole body showed up at once)
+int bulk_api_post(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
+{
+	BulkImport *bulk = bulk_new(hm);
+
+	bulk_feed(bulk, hm->body.ptr, hm->body.len);
+	bulk_finish(conn, bulk);
+	bulk_free(bulk);
+
+	return 0;
+}
+
+// bulk_api_chunk : streaming endpoint, POST - /api/v1/recipe/bulk (MG_EV_HTTP_CHUNK)
+int bulk_api_chunk(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
+{
+	BulkImport *bulk = conn->fn_data;
+	size_t len;
+	int last;
+
+	if (bulk == NULL) {
+		bulk = conn->fn_data = bulk_new(hm);
+		bulk->stream = true;
+	}
+
+	// without chunked encoding, the "chunk" is everything after the headers, which could run into
+	// a pipelined request (and we don't support those here)
+	len = hm->chunk.len;
+	if (!bulk->chunked) {
+		len = MIN(len, bulk->expected - bulk->received);
+	}
+
+	bulk_feed(bulk, hm->chunk.ptr, len);
+	bulk->received += len;
+
+	if (bulk->chunked) {
+		last = hm->chunk.len == 0;
+	} else {
+		last = bulk->received >= bulk->expected;
+	}
+
+	mg_http_delete_chunk(conn, hm);
+
+	if (last) {
+		// NOTE (Brian) the body is gone, so the headers left in the buffer would never add up to
+		// a complete message (and would be parsed as one when the connection closes)
+		conn->recv.len = 0;
+
+		// bulk_poll answers it, and until then, nothing else on the connection gets parsed
+		if (bulk_finish(conn, bulk) < 0) {
+			bulk->finishing = true;
+			conn->is_resp = 1;
+			conn->is_polling = 1;
+			return 0;
+		}
+
+		bulk_free(bulk);
+		conn->fn_data = NULL;
+		conn->is_polling = 0;
+		return 0;
+	}
+
+	// a batch that found the database locked gets retried from MG_EV_POLL
+	conn->is_polling = bulk->busy_since != 0;
+
+	return 0;
+}
+
+// bulk_poll : tries the batch again on 'conn', if it found the database locked (MG_EV_POLL)
+void bulk_poll(struct mg_connection *conn)
+{
+	BulkImport *bulk = conn->fn_data;
+
+	if (bulk == NULL || bulk->busy_since == 0) {
+		return;
+	}
+
+	if (!bulk->finishing) {
+		bulk_commit(bulk);
+		conn->is_polling = bulk->busy_since != 0;
+		return;
+	}
+
+	if (bulk_finish(conn, bulk) < 0) {
+		return;
+	}
+
+	bulk_free(bulk);
+	conn->fn_data = NULL;
+
+	conn->is_polling = 0;
+	conn->is_resp = 0;
+	if (conn->recv.len > 0 && !conn->is_draining) {
+		conn->pfn(conn, MG_EV_READ, NULL, conn->pfn_data);
+	}
+}
+
+// bulk_close : throws away the import on 'conn', if there is one (MG_EV_CLOSE)
+void bulk_close(struct mg_connection *conn)
+{
+	if (conn->fn_data != NULL) {
+		ERR("bulk import dropped after %zu lines, the last batch wasn't committed\n",
+			((BulkImport *)conn->fn_data)->lineno);
+		bulk_free(conn->fn_data);
+		conn->fn_data = NULL;
+
+		// NOTE (Brian) we get MG_EV_CLOSE before the http code does, and it parses whatever is
+		// left in the buffer as one last message, which here would just be our headers
+		conn->recv.len = 0;
+	}
+}
+
+// bulk_new : sets up an import for the request in 'hm'
+static BulkImport *bulk_new(struct mg_http_message *hm)
+{
+	BulkImport *bulk = calloc(1, sizeof(*bulk));
+	struct mg_str *header;
+	char tbuf[BUFSMALL];
+
+	bulk->batch_size = BULK_BATCH_DEFAULT;
+	if (mg_http_get_var(&hm->query, "batch", tbuf, sizeof tbuf) > 0) {
+		bulk->batch_size = strtoull(tbuf, NULL, 10);
+		bulk->batch_size = MAX(1, MIN(bulk->batch_size, BULK_BATCH_MAX));
+	}
+
+	header = mg_http_get_header(hm, "Transfer-Encoding");
+	bulk->chunked = header != NULL && mg_strstr(*header, mg_str("chunked")) != NULL;
+
+	header = mg_http_get_header(hm, "Content-Length");
+	if (header != NULL) {
+		bulk->expected = mg_to64(*header);
+	}
+
+	return bulk;
+}
+
+// bulk_feed : splits 'len' bytes of body into lines, handling each line as it finishes
+static void bulk_feed(BulkImport *bulk, const char *s, size_t len)
+{
+	const char *nl;
+	size_t n;
+
+	while (len > 0) {
+		nl = memchr(s, '\n', len);
+		n = nl ? (size_t)(nl - s) : len;
+
+		// a line that's never going to end just gets skipped over, instead of eating all of memory
+		if (!bulk->too_long && arrlen(bulk->line) + n > BULK_LINE_MAX) {
+			bulk->too_long = true;
+			arrsetlen(bulk->line, 0);
+		}
+
+		if (!bulk->too_long && n > 0) {
+			memcpy(arraddnptr(bulk->line, n), s, n);
+		}
+
+		if (nl == NULL) {
+			break;
+		}
+
+		bulk_line(bulk);
+
+		s += n + 1;
+		len -= n + 1;
+	}
+}
+
+// bulk_line : parses the line that just finished, and adds it to the batch
+static void bulk_line(BulkImport *bulk)
+{
+	BulkLine line = { .lineno = ++bulk->lineno };
+
+	if (bulk->too_long) {
+		bulk->too_long = false;
+		line.error = "line too long";
+	} else {
+		while (arrlen(bulk->line) > 0 && isspace(arrlast(bulk->line))) {
+			arrsetlen(bulk->line, arrlen(bulk->line) - 1);
+		}
+
+		// blank lines (and the \r from a \r\n) don't count
+		if (arrlen(bulk->line) == 0) {
+			return;
+		}
+
+		arrput(bulk->line, '\0');
+
+		line.recipe = recipe_from_json(bulk->line);
+		if (line.recipe == NULL || recipe_validation(line.recipe) != 0) {
+			recipe_free(line.recipe);
+			line.recipe = NULL;
+			line.error = "invalid recipe";
+		}
+
+		arrsetlen(bulk->line, 0);
+	}
+
+	arrput(bulk->batch, line);
+
+	// (while the database is locked, the batch just keeps growing, and bulk_poll is the one retrying it)
+	if ((size_t)arrlen(bulk->batch) >= bulk->batch_size && bulk->busy_since == 0) {
+		bulk_commit(bulk);
+	}
+}
+
+// bulk_commit : inserts the batch in one transaction, and writes out its results, -1 if the database was locked and the batch is still waiting
+static int bulk_commit(BulkImport *bulk)
+{
+	int rc;
+
+	if (arrlen(bulk->batch) == 0) {
+		return 0;
+	}
+
+	rc = sqlite3_exec(DATABASE, "begin immediate transaction;", NULL, NULL, NULL);
+	if (rc == SQLITE_BUSY && bulk->stream) {
+		if (bulk->busy_since == 0) {
+			bulk->busy_since = mg_millis();
+		}
+		if (mg_millis() - bulk->busy_since < DB_BUSY_MS) {
+			return -1;
+		}
+	}
+
+	bulk->busy_since = 0;
+
+	for (size_t i = 0; rc == SQLITE_OK && i < arrlen(bulk->batch); i++) {
+		BulkLine *line = bulk->batch + i;
+
+		if (line->error != NULL) {
+			continue;
+		}
+
+		sqlite3_exec(DATABASE, "savepoint bulk_line;", NULL, NULL, NULL);
+
+		if (recipe_insert_rows(line->recipe) < 0) {
+			sqlite3_exec(DATABASE, "rollback to bulk_line;", NULL, NULL, NULL);
+			line->error = "couldn't save";
+		}
+
+		sqlite3_exec(DATABASE, "release bulk_line;", NULL, NULL, NULL);
+	}
+
+	// the search index goes last, all at once, see recipe_fts_insert
+	for (size_t i = 0; rc == SQLITE_OK && i < arrlen(bulk->batch); i++) {
+		if (bulk->batch[i].error == NULL && recipe_fts_insert(bulk->batch[i].recipe) < 0) {
+			rc = SQLITE_ERROR;
+		}
+	}
+
+	if (rc == SQLITE_OK) {
+		rc = sqlite3_exec(DATABASE, "commit transaction;", NULL, NULL, NULL);
+	}
+
+	if (rc != SQLITE_OK) {
+		ERR("couldn't commit a bulk import batch! %s\n", sqlite3_errmsg(DATABASE));
+		sqlite3_exec(DATABASE, "rollback transaction;", NULL, NULL, NULL);
+	}
+
+	for (size_t i = 0; i < arrlen(bulk->batch); i++) {
+		BulkLine *line = bulk->batch + i;
+
+		if (rc != SQLITE_OK && line->error == NULL) {
+			line->error = "couldn't save";
+		}
+
+		bulk_result(bulk, line);
+		recipe_free(line->recipe);
+	}
+
+	arrsetlen(bulk->batch, 0);
+
+	return 0;
+}
+
+// bulk_finish : handles whatever is left after the last byte of the body, and sends the response, -1 if the last batch is still waiting
+static int bulk_finish(struct mg_connection *conn, BulkImport *bulk)
+{
+	char head[BUFSMALL];
+	int n;
+
+	// the last line doesn't need a newline after it
+	if (arrlen(bulk->line) > 0 || bulk->too_long) {
+		bulk_line(bulk);
+	}
+
+	if (bulk_commit(bulk) < 0) {
+		return -1;
+	}
+
+	n = snprintf(head, sizeof head, "{\"imported\":%zu,\"failed\":%zu,\"results\":[", bulk->imported, bulk->failed);
+
+	mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n",
+		n + arrlen(bulk->results) + 2);
+	mg_send(conn, head, n);
+	mg_send(conn, bulk->results, arrlen(bulk->results));
+	mg_send(conn, "]}", 2);
+
+	return 0;
+}
+
+// bulk_result : adds one line's result to the response
+static void bulk_result(BulkImport *bulk, BulkLine *line)
+{
+	char tbuf[BUFSMALL];
+	int n;
+
+	// NOTE (Brian) ids and our own error strings never need escaping
+	if (line->error == NULL) {
+		n = snprintf(tbuf, sizeof tbuf, "%s{\"line\":%zu,\"id\":\"%s\"}",
+			arrlen(bulk->results) ? "," : "", line->lineno, line->recipe->metadata.id);
+		bulk->imported++;
+	} else {
+		n = snprintf(tbuf, sizeof tbuf, "%s{\"line\":%zu,\"error\":\"%s\"}",
+			arrlen(bulk->results) ? "," : "", line->lineno, line->error);
+		bulk->failed++;
+	}
+
+	memcpy(arraddnptr(bulk->results, n), tbuf, n);
+}
+
+// bulk_free : frees the import, and anything it still has in its batch
+static void bulk_free(BulkImport *bulk)
+{
+	for (size_t i = 0; i < arrlen(bulk->batch); i++) {
+		recipe_free(bulk->batch[i].recipe);
+	}
+
+	arrfree(bulk->batch);
+	arrfree(bulk->line);
+	arrfree(bulk->results);
+
+	free(bulk);
+}
@@ -0,0 +1,25 @@
+#ifndef BULK_H
+#define BULK_H
+
+// Brian Chrzanowski
+// 2026-10-17 16:05:12
+
+#include "common.h"
+
+#include "mongoose.h"
+
+#include "route.h"
+
+// bulk_api_post : endpoint, POST - /api/v1/recipe/bulk (when the whole body showed up at once)
+int bulk_api_post(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
+
+// bulk_api_chunk : streaming endpoint, POST - /api/v1/recipe/bulk (MG_EV_HTTP_CHUNK)
+int bulk_api_chunk(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
+
+// bulk_poll : tries the batch again on 'conn', if it found the database locked (MG_EV_POLL)
+void bulk_poll(struct mg_connection *conn);
+
+// bulk_close : throws away the import on 'conn', if there is one (MG_EV_CLOSE)
+void bulk_close(struct mg_connection *conn);
+
+#endif // BULK_H
@@ -0,0 +1,288 @@
+// Brian Chrzanowski
+// 2026-10-17 11:20:37
+//
+// Response Cache
+//
+// Recipes change rarely, but fetching one is four queries and a trip through jansson. This keeps
+// the entire HTTP response (headers and all) for recently fetched recipes, so that a hit is just one
+// mg_send of bytes we already have.
+//
+// It's an LRU, bounded by a byte budget instead of a number of entries, because recipes vary wildly
+// in size. Entries live in an stb hashmap (for lookups) and in a doubly linked list (for recency),
+// the head is the most recently used, the tail is what gets evicted first.
+//
+// A response is kept as-is, and gzipped (compressed once, when it's put), as two entries under the
+// same budget, "<key>" and "<key>:gzip". The two are used and evicted together, so if a client that
+// takes gzip only finds the plain one, it's because that response was too small to compress.
+//
+// Everything is behind one mutex, because with '-w' the readers all hit this at once. The critical
+// sections are a hash lookup and a memcpy, so that's fine for now.
+//
+// NOTE (Brian) invalidation vs. a reader racing the writer
+//
+// A reader can fetch a recipe, lose the CPU, and the writer can update + invalidate it before the
+// reader gets around to cache_put. To keep that stale copy out, every invalidation bumps a
+// generation counter, readers grab the generation *before* they read from the database, and
+// cache_put throws the response away if the generation moved in the meantime.
+
+#include "common.h"
+
+#include <pthread.h>
+
+#include "mongoose.h"
+
+#include "cache.h"
+
+typedef struct CacheEntry {
+	struct CacheEntry *prev;
+	struct CacheEntry *next;
+	struct CacheEntry *sibling; // the same response, in the other encoding
+	char *key;
+	char *buf;
+	size_t len;
+} CacheEntry;
+
+typedef struct CacheTableEntry {
+	char *key;
+	CacheEntry *value;
+} CacheTableEntry;
+
+static pthread_mutex_t CACHE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static CacheTableEntry *CACHE = NULL;
+static CacheEntry *HEAD = NULL;
+static CacheEntry *TAIL = NULL;
+static CacheStats STATS = {0};
+static u64 GENERATION = 0;
+
+// cache_key: writes the key for the 'encoding' copy of 'key' into 'buf'
+static void cache_key(char *buf, size_t len, char *key, CacheEncoding encoding);
+// cache_entry_size: the number of bytes an entry counts against the budget
+static size_t cache_entry_size(char *key, size_t len);
+// cache_unlink: removes the entry from the recency list
+static void cache_unlink(CacheEntry *entry);
+// cache_push: puts the entry at the head of the recency list
+static void cache_push(CacheEntry *entry);
+// cache_remove: removes the entry from the cache entirely, and frees it (lock held)
+static void cache_remove(CacheEntry *entry);
+
+// cache_init: sets up the response cache with a byte budget, 0 disables it
+void cache_init(size_t budget)
+{
+	pthread_mutex_lock(&CACHE_LOCK);
+
+	sh_new_strdup(CACHE);
+	STATS.budget = budget;
+
+	pthread_mutex_unlock(&CACHE_LOCK);
+}
+
+// cache_send: sends the cached response for 'key' on 'conn' in 'encoding' (or as-is, if that's all there is), returns 0 on a hit, -1 on a miss
+int cache_send(struct mg_connection *conn, char *key, CacheEncoding encoding)
+{
+	CacheEntry *entry = NULL;
+	char tbuf[BUFSMALL];
+
+	if (STATS.budget == 0) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&CACHE_LOCK);
+
+	// NOTE (Brian) a response too small to be worth compressing never gets a gzip copy, so that's
+	// still a hit, on the plain one
+	if (encoding != CACHE_IDENTITY) {
+		cache_key(tbuf, sizeof tbuf, key, encoding);
+		entry = shget(CACHE, tbuf);
+	}
+
+	if (entry == NULL) {
+		entry = shget(CACHE, key);
+	}
+
+	if (entry == NULL) {
+		STATS.misses++;
+		pthread_mutex_unlock(&CACHE_LOCK);
+		return -1;
+	}
+
+	STATS.hits++;
+
+	cache_unlink(entry);
+	cache_push(entry);
+
+	if (entry->sibling != NULL) {
+		cache_unlink(entry->sibling);
+		cache_push(entry->sibling);
+	}
+
+	mg_send(conn, entry->buf, entry->len);
+
+	pthread_mutex_unlock(&CACHE_LOCK);
+
+	return 0;
+}
+
+// cache_generation: returns the current generation, to be captured before reading from the database
+u64 cache_generation()
+{
+	return __atomic_load_n(&GENERATION, __ATOMIC_ACQUIRE);
+}
+
+// cache_put: stores 'len' bytes of response for 'key' in 'encoding', unless anything was invalidated since 'gen'
+void cache_put(char *key, CacheEncoding encoding, char *buf, size_t len, u64 gen)
+{
+	CacheEntry *entry;
+	char tbuf[BUFSMALL];
+	char sbuf[BUFSMALL];
+
+	cache_key(sbuf, sizeof sbuf, key, encoding == CACHE_GZIP ? CACHE_IDENTITY : CACHE_GZIP);
+	cache_key(tbuf, sizeof tbuf, key, encoding);
+	key = tbuf;
+
+	// NOTE (Brian) something that can't ever fit would just flush everything else on the way in
+	if (cache_entry_size(key, len) > STATS.budget) {
+		return;
+	}
+
+	entry = calloc(1, sizeof(*entry));
+	entry->buf = malloc(len);
+	entry->len = len;
+	memcpy(entry->buf, buf, len);
+
+	pthread_mutex_lock(&CACHE_LOCK);
+
+	if (gen != GENERATION || shget(CACHE, key) != NULL) {
+		pthread_mutex_unlock(&CACHE_LOCK);
+		free(entry->buf);
+		free(entry);
+		return;
+	}
+
+	shput(CACHE, key, entry);
+	entry->key = CACHE[shgeti(CACHE, key)].key;
+
+	cache_push(entry);
+
+	entry->sibling = shget(CACHE, sbuf);
+	if (entry->sibling != NULL) {
+		entry->sibling->sibling = entry;
+	}
+
+	STATS.entries++;
+	STATS.bytes += cache_entry_size(entry->key, entry->len);
+
+	while (STATS.bytes > STATS.budget) {
+		if (TAIL->sibling != NULL) {
+			cache_remove(TAIL->sibling);
+			STATS.evictions++;
+		}
+
+		cache_remove(TAIL);
+		STATS.evictions++;
+	}
+
+	pthread_mutex_unlock(&CACHE_LOCK);
+}
+
+// cache_invalidate: drops the entries for 'key', in every encoding (call after the write has been committed)
+void cache_invalidate(char *key)
+{
+	CacheEntry *entry;
+	char tbuf[BUFSMALL];
+
+	pthread_mutex_lock(&CACHE_LOCK);
+
+	__atomic_add_fetch(&GENERATION, 1, __ATOMIC_RELEASE);
+
+	for (CacheEncoding encoding = CACHE_IDENTITY; encoding <= CACHE_GZIP; encoding++) {
+		cache_key(tbuf, sizeof tbuf, key, encoding);
+
+		entry = shget(CACHE, tbuf);
+		if (entry != NULL) {
+			cache_remove(entry);
+		}
+	}
+
+	pthread_mutex_unlock(&CACHE_LOCK);
+}
+
+// cache_stats: returns a snapshot of the cache counters
+CacheStats cache_stats()
+{
+	CacheStats stats;
+
+	pthread_mutex_lock(&CACHE_LOCK);
+	stats = STATS;
+	pthread_mutex_unlock(&CACHE_LOCK);
+
+	return stats;
+}
+
+// cache_free: frees every entry in the cache
+void cache_free()
+{
+	pthread_mutex_lock(&CACHE_LOCK);
+
+	while (TAIL != NULL) {
+		cache_remove(TAIL);
+	}
+
+	shfree(CACHE);
+
+	pthread_mutex_unlock(&CACHE_LOCK);
+}
+
+// cache_key: writes the key for the 'encoding' copy of 'key' into 'buf'
+static void cache_key(char *buf, size_t len, char *key, CacheEncoding encoding)
+{
+	snprintf(buf, len, "%s%s", key, encoding == CACHE_GZIP ? ":gzip" : "");
+}
+
+// cache_entry_size: the number of bytes an entry counts against the budget
+static size_t cache_entry_size(char *key, size_t len)
+{
+	return sizeof(CacheEntry) + sizeof(CacheTableEntry) + strlen(key) + 1 + len;
+}
+
+// cache_unlink: removes the entry from the recency list
+static void cache_unlink(CacheEntry *entry)
+{
+	if (entry->prev) entry->prev->next = entry->next;
+	else             HEAD = entry->next;
+
+	if (entry->next) entry->next->prev = entry->prev;
+	else             TAIL = entry->prev;
+
+	entry->prev = entry->next = NULL;
+}
+
+// cache_push: puts the entry at the head of the recency list
+static void cache_push(CacheEntry *entry)
+{
+	entry->prev = NULL;
+	entry->next = HEAD;
+
+	if (HEAD) HEAD->prev = entry;
+	HEAD = entry;
+
+	if (TAIL == NULL) TAIL = entry;
+}
+
+// cache_remove: removes the entry from the cache entirely, and frees it (lock held)
+static void cache_remove(CacheEntry *entry)
+{
+	STATS.entries--;
+	STATS.bytes -= cache_entry_size(entry->key, entry->len);
+
+	cache_unlink(entry);
+
+	if (entry->sibling != NULL) {
+		entry->sibling->sibling = NULL;
+	}
+
+	// NOTE (Brian) entry->key is owned by the hashmap, and goes away with the shdel
+	(void)shdel(CACHE, entry->key);
+
+	free(entry->buf);
+	free(entry);
+}
@@ -0,0 +1,42 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+// Brian Chrzanowski
+// 2026-10-17 11:20:37
+
+#include "common.h"
+
+#include "mongoose.h"
+
+// CacheStats: counters for the response cache
+typedef struct CacheStats {
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t entries;
+	size_t bytes;
+	size_t budget;
+} CacheStats;
+
+// CacheEncoding: which copy of a response, each one is its own entry
+typedef enum CacheEncoding {
+	CACHE_IDENTITY,
+	CACHE_GZIP,
+} CacheEncoding;
+
+// cache_init: sets up the response cache with a byte budget, 0 disables it
+void cache_init(size_t budget);
+// cache_send: sends the cached response for 'key' on 'conn' in 'encoding' (or as-is, if that's all there is), returns 0 on a hit, -1 on a miss
+int cache_send(struct mg_connection *conn, char *key, CacheEncoding encoding);
+// cache_generation: returns the current generation, to be captured before reading from the database
+u64 cache_generation();
+// cache_put: stores 'len' bytes of response for 'key' in 'encoding', unless anything was invalidated since 'gen'
+void cache_put(char *key, CacheEncoding encoding, char *buf, size_t len, u64 gen);
+// cache_invalidate: drops the entries for 'key', in every encoding (call after the write has been committed)
+void cache_invalidate(char *key);
+// cache_stats: returns a snapshot of the cache counters
+CacheStats cache_stats();
+// cache_free: frees every entry in the cache
+void cache_free();
+
+#endif // CACHE_H
@@ -0,0 +1,509 @@
+// Brian Chrzanowski
+// 2026-10-17 17:10:44
+//
+// Recipe Export
+//
+// GET /api/v1/recipe/export (and ./recipe --export db) write out every live recipe as newline
+// delimited JSON, one recipe per line, in the same shape GET /api/v1/recipe/:id returns. That's
+// also what POST /api/v1/recipe/bulk takes, so an export can be imported somewhere else as-is.
+//
+// SQLite builds every line (RECIPE_JSON), so the work is all in the queries, and those can run on
+// more than one connection at once. The rowid space is cut up into ranges of EXPORT_RANGE rowids,
+// and the ranges are dealt out to EXPORT_READERS threads, round robin, each with its own read-only
+// connection:
+//
+//   reader 0: ranges 0, 4, 8, ...
+//   reader 1: ranges 1, 5, 9, ...
+//   ...
+//
+// Each reader holds on to one finished range at a time, and the consumer takes them back in order
+// (range 0 from reader 0, range 1 from reader 1, ...), so the output is in rowid order, while the
+// other readers are already working on what comes next. At most EXPORT_READERS ranges are ever in
+// memory, no matter how big the catalog is.
+//
+// Over HTTP, the response is chunked, and it's only topped up when the send buffer runs low
+// (MG_EV_WRITE / MG_EV_POLL, the same way mongoose streams files), so a slow client holds the readers
+// back instead of the whole export piling up in memory.
+//
+// When the client takes gzip, each reader also deflates its range, right after it's done with it, so
+// the compression happens on as many cores as the queries do, and not on the event loop (see gzip.c
+// for how the pieces make one stream).
+//
+// NOTE (Brian) each reader sees its own snapshot of the database, so recipes that are written while
+// an export is running may or may not be in it. Use the backup if you need a point in time.
+//
+// NOTE (Brian) the event loop never waits on a reader. When the range it needs next isn't done yet,
+// it just stops topping up the response, and the reader wakes it back up (through a pipe, the same
+// way the workers do) as soon as that range is ready.
+
+#include "common.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <jansson.h>
+
+#include "mongoose.h"
+#include "sqlite3.h"
+
+#include "objects.h"
+#include "recipe.h"
+#include "gzip.h"
+#include "export.h"
+
+#define EXPORT_READERS   (4)
+#define EXPORT_RANGE     (1024)
+#define EXPORT_LOW_WATER (64 * 1024)
+#define EXPORT_ROUTE     ("GET /api/v1/recipe/export")
+
+extern __thread sqlite3 *DATABASE;
+
+typedef struct Export Export;
+
+// ExportReader: one reader thread, and the range it has ready
+typedef struct ExportReader {
+	pthread_t thread;
+	Export *export;
+	size_t index;
+	char *buf; // stb array, the output for the range it's holding
+	u8 *gz; // stb array, 'buf' deflated, when the export is compressed
+	u32 crc; // of 'buf'
+	size_t len; // of 'buf'
+	int ready;
+	int failed;
+} ExportReader;
+
+// Export: one export, from start to finish
+struct Export {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	i64 first;
+	size_t nranges;
+	size_t next;
+	size_t nreaders;
+	ExportReader *readers;
+	int stopping;
+	int gzip;
+	struct mg_connection *conn; // the connection it's streaming out to, NULL for --export
+	struct mg_connection *wakeup; // the pipe the readers wake the event loop up with, NULL for --export
+	u32 crc; // of everything taken so far
+	u64 size;
+};
+
+// ExportTableEntry: the exports that are streaming out over HTTP, by connection id
+typedef struct ExportTableEntry {
+	unsigned long key;
+	Export *value;
+} ExportTableEntry;
+
+static ExportTableEntry *EXPORTS = NULL;
+static struct mg_connection *WAKEUP = NULL;
+static char *DBNAME = NULL;
+
+// export_new : figures out the ranges, and starts the readers ('gzip' to deflate each range, 'wakeup' is poked as each one is done)
+static Export *export_new(int gzip, struct mg_connection *wakeup);
+// export_wakeup : event handler for the readers' pipe, tops up every export that's streaming out
+static void export_wakeup(struct mg_connection *pipe, int ev, void *ev_data, void *fn_data);
+// export_reader : reader thread entry, runs every range that's dealt to it
+static void *export_reader(void *arg);
+// export_ready : true if export_take has something to hand back right away (a range, the end, or a failure)
+static int export_ready(Export *export);
+// export_take : waits for the next range, 1 if there is one, 0 at the end, -1 if a reader failed
+static int export_take(Export *export, char **buf, size_t *len);
+// export_release : hands the range from export_take back, so its reader can move on
+static void export_release(Export *export);
+// export_free : stops the readers, and frees everything
+static void export_free(Export *export);
+
+// export_init : remembers which database file the export readers should open
+void export_init(char *fname)
+{
+	DBNAME = fname;
+}
+
+// export_api_get : endpoint, GET - /api/v1/recipe/export (has to run on the event loop)
+int export_api_get(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
+{
+	Export *export;
+
+	// made the first time it's needed, mongoose frees it along with every other connection
+	if (WAKEUP == NULL) {
+		WAKEUP = mg_mkpipe(conn->mgr, export_wakeup, NULL);
+		if (WAKEUP == NULL) {
+			ERR("couldn't create the export wakeup pipe!\n");
+			return -1;
+		}
+	}
+
+	export = export_new(gzip_accepts(hm), WAKEUP);
+	if (export == NULL) {
+		return -1;
+	}
+
+	export->conn = conn;
+
+	// nothing pipelined behind the export gets answered until it's done, it'd land in the middle
+	conn->is_resp = 1;
+	conn->is_polling = 1;
+
+	mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: application/x-ndjson\r\n%sTransfer-Encoding: chunked\r\n\r\n",
+		export->gzip ? "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n" : "");
+
+	if (export->gzip) {
+		u8 header[GZIP_HEADER_SIZE];
+		gzip_header(header);
+		mg_http_write_chunk(conn, (char *)header, sizeof header);
+	}
+
+	hmput(EXPORTS, conn->id, export);
+
+	// NOTE (Brian) the first top up goes through the pipe too, not straight from here. This is still
+	// inside of mongoose's http handler, and when the export's done, export_poll hands whatever's
+	// pipelined behind it back to that same handler.
+	mg_mgr_wakeup(WAKEUP);
+
+	return 0;
+}
+
+// export_poll : tops up the response on 'conn', if it has an export going (MG_EV_POLL, MG_EV_WRITE)
+void export_poll(struct mg_connection *conn)
+{
+	Export *export;
+	size_t len;
+	char *buf;
+	int rc;
+
+	if (hmlen(EXPORTS) == 0 || (export = hmget(EXPORTS, conn->id)) == NULL) {
+		return;
+	}
+
+	// the reader this is waiting on wakes the loop back up when it's done (export_wakeup)
+	while (conn->send.len < EXPORT_LOW_WATER && export_ready(export)) {
+		rc = export_take(export, &buf, &len);
+		if (rc > 0) {
+			if (len > 0) {
+				mg_http_write_chunk(conn, buf, len);
+			}
+			export_release(export);
+			continue;
+		}
+
+		// the status line went out a long time ago, so a failure can only be a truncated response
+		if (rc == 0) {
+			if (export->gzip) {
+				u8 trailer[GZIP_TRAILER_SIZE];
+				gzip_trailer(trailer, export->crc, export->size);
+				mg_http_write_chunk(conn, (char *)trailer, sizeof trailer);
+			}
+			mg_http_write_chunk(conn, "", 0);
+		} else {
+			ERR("export failed part of the way through!\n");
+			conn->is_draining = 1;
+		}
+
+		(void)hmdel(EXPORTS, conn->id);
+		export_free(export);
+
+		conn->is_polling = 0;
+		conn->is_resp = 0;
+		if (conn->recv.len > 0 && !conn->is_draining) {
+			conn->pfn(conn, MG_EV_READ, NULL, conn->pfn_data);
+		}
+		break;
+	}
+}
+
+// export_close : stops the export on 'conn', if there is one (MG_EV_CLOSE)
+void export_close(struct mg_connection *conn)
+{
+	Export *export;
+
+	if (hmlen(EXPORTS) == 0 || (export = hmget(EXPORTS, conn->id)) == NULL) {
+		return;
+	}
+
+	(void)hmdel(EXPORTS, conn->id);
+	export_free(export);
+}
+
+// export_shutdown : stops every export that's still streaming out, before the event loop (and the pipe) go away
+void export_shutdown()
+{
+	for (ptrdiff_t i = 0; i < hmlen(EXPORTS); i++) {
+		export_free(EXPORTS[i].value);
+	}
+
+	hmfree(EXPORTS);
+}
+
+// export_file : writes the entire export out to 'out', for ./recipe --export
+int export_file(FILE *out)
+{
+	Export *export;
+	size_t len;
+	char *buf;
+	int rc;
+
+	export = export_new(false, NULL);
+	if (export == NULL) {
+		return -1;
+	}
+
+	while ((rc = export_take(export, &buf, &len)) > 0) {
+		if (fwrite(buf, 1, len, out) != len) {
+			ERR("couldn't write the export: %s\n", strerror(errno));
+			rc = -1;
+			break;
+		}
+		export_release(export);
+	}
+
+	export_free(export);
+
+	if (rc == 0 && fflush(out) != 0) {
+		rc = -1;
+	}
+
+	return rc;
+}
+
+// export_new : figures out the ranges, and starts the readers ('gzip' to deflate each range, 'wakeup' is poked as each one is done)
+static Export *export_new(int gzip, struct mg_connection *wakeup)
+{
+	sqlite3_stmt *stmt;
+	Export *export;
+	i64 last = 0;
+
+	export = calloc(1, sizeof(*export));
+	if (export == NULL) {
+		return NULL;
+	}
+
+	pthread_mutex_init(&export->lock, NULL);
+	pthread_cond_init(&export->cond, NULL);
+
+	export->gzip = gzip;
+	export->wakeup = wakeup;
+
+	// NOTE (Brian) min / max of the rowid are both a single seek, a 'where' would make it a scan
+	stmt = db_stmt_get("recipes", "export_bounds", "select min(rowid), max(rowid) from %s;");
+	if (stmt == NULL) {
+		export_free(export);
+		return NULL;
+	}
+
+	if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+		export->first = sqlite3_column_int64(stmt, 0);
+		last = sqlite3_column_int64(stmt, 1);
+		export->nranges = (last - export->first) / EXPORT_RANGE + 1;
+	}
+
+	db_stmt_release(stmt);
+
+	// NOTE (Brian) more readers than cores just fight over the cores
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	export->nreaders = MIN(MIN(EXPORT_READERS, export->nranges), (size_t)MAX(ncpus, 1));
+	export->readers = calloc(MAX(export->nreaders, 1), sizeof(*export->readers));
+
+	for (size_t i = 0; i < export->nreaders; i++) {
+		export->readers[i].export = export;
+		export->readers[i].index = i;
+
+		if (pthread_create(&export->readers[i].thread, NULL, export_reader, export->readers + i) != 0) {
+			ERR("couldn't start an export reader!\n");
+			export->nreaders = i;
+			export_free(export);
+			return NULL;
+		}
+	}
+
+	return export;
+}
+
+// export_reader : reader thread entry, runs every range that's dealt to it
+static void *export_reader(void *arg)
+{
+	ExportReader *reader = arg;
+	Export *export = reader->export;
+	sqlite3_stmt *stmt = NULL;
+	int rc = SQLITE_DONE;
+	int zready = false;
+	z_stream z;
+	u64 cpu;
+
+	if (export->gzip) {
+		zready = gzip_block_init(&z) == 0;
+	}
+
+	if ((zready || !export->gzip) && db_open(DBNAME, true) == 0) {
+		stmt = db_stmt_get("recipes", "export",
+			"select " RECIPE_JSON("r") " from %s r"
+			" where r.rowid between ?1 and ?2 and r.delete_ts is null order by r.rowid;");
+	}
+
+	for (size_t range = reader->index; range < export->nranges; range += export->nreaders) {
+		// wait for the consumer to take the last one
+		pthread_mutex_lock(&export->lock);
+		while (reader->ready && !export->stopping) {
+			pthread_cond_wait(&export->cond, &export->lock);
+		}
+		int stopping = export->stopping;
+		pthread_mutex_unlock(&export->lock);
+
+		if (stopping) {
+			break;
+		}
+
+		arrsetlen(reader->buf, 0);
+		arrsetlen(reader->gz, 0);
+
+		if (stmt == NULL) {
+			rc = SQLITE_ERROR;
+		} else {
+			sqlite3_bind_int64(stmt, 1, export->first + (i64)range * EXPORT_RANGE);
+			sqlite3_bind_int64(stmt, 2, export->first + (i64)(range + 1) * EXPORT_RANGE - 1);
+
+			while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+				size_t len = sqlite3_column_bytes(stmt, 0);
+				char *s = arraddnptr(reader->buf, len + 1);
+				memcpy(s, sqlite3_column_text(stmt, 0), len);
+				s[len] = '\n';
+			}
+
+			db_stmt_release(stmt);
+		}
+
+		reader->len = arrlen(reader->buf);
+		reader->crc = 0;
+
+		if (rc == SQLITE_DONE && export->gzip && reader->len > 0) {
+			cpu = gzip_cputime();
+			reader->crc = crc32(0, (u8 *)reader->buf, reader->len);
+			if (gzip_block(&z, reader->buf, reader->len, &reader->gz) < 0) {
+				rc = SQLITE_NOMEM;
+			}
+			gzip_record(EXPORT_ROUTE, reader->len, arrlen(reader->gz), gzip_cputime() - cpu);
+		}
+
+		pthread_mutex_lock(&export->lock);
+		reader->ready = true;
+		reader->failed = rc != SQLITE_DONE;
+		pthread_cond_broadcast(&export->cond);
+		pthread_mutex_unlock(&export->lock);
+
+		if (export->wakeup) {
+			mg_mgr_wakeup(export->wakeup);
+		}
+
+		if (rc != SQLITE_DONE) {
+			ERR("export reader %zu failed: %s\n", reader->index, DATABASE ? sqlite3_errmsg(DATABASE) : "no connection");
+			break;
+		}
+	}
+
+	if (DATABASE != NULL) {
+		db_close();
+	}
+
+	if (zready) {
+		deflateEnd(&z);
+	}
+
+	return NULL;
+}
+
+// export_wakeup : event handler for the readers' pipe, tops up every export that's streaming out
+static void export_wakeup(struct mg_connection *pipe, int ev, void *ev_data, void *fn_data)
+{
+	if (ev != MG_EV_READ) {
+		return;
+	}
+
+	// NOTE (Brian) backwards, because an export that finishes is deleted, and hmdel moves the last
+	// entry (which we've already been to) into its place
+	for (ptrdiff_t i = hmlen(EXPORTS) - 1; i >= 0; i--) {
+		export_poll(EXPORTS[i].value->conn);
+	}
+}
+
+// export_ready : true if export_take has something to hand back right away (a range, the end, or a failure)
+static int export_ready(Export *export)
+{
+	int ready;
+
+	if (export->next >= export->nranges) {
+		return true;
+	}
+
+	pthread_mutex_lock(&export->lock);
+	ready = export->readers[export->next % export->nreaders].ready;
+	pthread_mutex_unlock(&export->lock);
+
+	return ready;
+}
+
+// export_take : waits for the next range, 1 if there is one, 0 at the end, -1 if a reader failed
+static int export_take(Export *export, char **buf, size_t *len)
+{
+	ExportReader *reader;
+	int rc;
+
+	if (export->next >= export->nranges) {
+		return 0;
+	}
+
+	reader = export->readers + (export->next % export->nreaders);
+
+	pthread_mutex_lock(&export->lock);
+	while (!reader->ready) {
+		pthread_cond_wait(&export->cond, &export->lock);
+	}
+	rc = reader->failed ? -1 : 1;
+	pthread_mutex_unlock(&export->lock);
+
+	if (export->gzip) {
+		*buf = (char *)reader->gz;
+		*len = arrlen(reader->gz);
+
+		export->crc = crc32_combine(export->crc, reader->crc, reader->len);
+		export->size += reader->len;
+	} else {
+		*buf = reader->buf;
+		*len = arrlen(reader->buf);
+	}
+
+	return rc;
+}
+
+// export_release : hands the range from export_take back, so its reader can move on
+static void export_release(Export *export)
+{
+	ExportReader *reader = export->readers + (export->next % export->nreaders);
+
+	pthread_mutex_lock(&export->lock);
+	reader->ready = false;
+	export->next++;
+	pthread_cond_broadcast(&export->cond);
+	pthread_mutex_unlock(&export->lock);
+}
+
+// export_free : stops the readers, and frees everything
+static void export_free(Export *export)
+{
+	pthread_mutex_lock(&export->lock);
+	export->stopping = true;
+	pthread_cond_broadcast(&export->cond);
+	pthread_mutex_unlock(&export->lock);
+
+	for (size_t i = 0; i < export->nreaders; i++) {
+		pthread_join(export->readers[i].thread, NULL);
+		arrfree(export->readers[i].buf);
+		arrfree(export->readers[i].gz);
+	}
+
+	pthread_cond_destroy(&export->cond);
+	pthread_mutex_destroy(&export->lock);
+
+	free(export->readers);
+	free(export);
+}
@@ -0,0 +1,31 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+// Brian Chrzanowski
+// 2026-10-17 17:10:44
+
+#include "common.h"
+
+#include "mongoose.h"
+
+#include "route.h"
+
+// export_init : remembers which database file the export readers should open
+void export_init(char *fname);
+
+// export_api_get : endpoint, GET - /api/v1/recipe/export (has to run on the event loop)
+int export_api_get(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
+
+// export_poll : tops up the response on 'conn', if it has an export going (MG_EV_POLL, MG_EV_WRITE)
+void export_poll(struct mg_connection *conn);
+
+// export_close : stops the export on 'conn', if there is one (MG_EV_CLOSE)
+void export_close(struct mg_connection *conn);
+
+// export_shutdown : stops every export that's still streaming out, before the event loop (and the pipe) go away
+void export_shutdown();
+
+// export_file : writes the entire export out to 'out', for ./recipe --export
+int export_file(FILE *out);
+
+#endif // EXPORT_H
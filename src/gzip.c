@@ -0,0 +1,440 @@
+// Brian Chrzanowski
+// 2026-10-17 21:02:40
+//
+// Compression
+//
+// Anything that's sent to a client that says it takes gzip (Accept-Encoding) goes out compressed,
+// one of three ways:
+//
+//   1. static files: tools/pack compresses them at -9 when it compiles them into the binary, and
+//      assets.c sends that copy instead. It's done once, at build time, so it's free here.
+//
+//   2. API responses: the endpoints write their responses the way they always have, and once one's
+//      done (on the event loop, or in the worker that ran it), gzip_response compresses it in place,
+//      if it's JSON, it's a success, and it's at least GZIP_MIN bytes. A chunked response (jsonw.c)
+//      is left alone, jsonw compresses those itself, a buffer at a time, so they still stream.
+//      A response that's cached (cache.c) is compressed once, with gzip_compress, when it's put,
+//      and both copies are kept, so a hit is sent as it is.
+//
+//   3. the export: it's too big to hold on to, so each reader deflates its own range, and they go
+//      out one after another, as one gzip stream (the same trick pigz uses). Each range ends on a
+//      byte boundary (Z_SYNC_FLUSH) without being the last block, so the pieces can just be put
+//      together, and the CRC of the whole thing comes from the CRCs of the pieces (crc32_combine).
+//
+// The level for 2 and 3 comes from how busy the event loop is. The main loop tells us how much CPU
+// it used over each second (gzip_load), and the busier it is, the lower the level, down to 1. At
+// idle it's GZIP_LEVEL_MAX, which for JSON is most of what -9 gets, for a lot less CPU.
+//
+// Every compressed response is counted by route, with the bytes that went in, the bytes that came
+// out, and the CPU it took to do it, so /api/v1/stats can say if it's paying for itself.
+
+#define _GNU_SOURCE
+#include "common.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#include <zlib.h>
+#include <jansson.h>
+
+#include "mongoose.h"
+
+#include "gzip.h"
+
+#define GZIP_MIN       (1024) // bytes, below this the headers eat most of what it saves
+#define GZIP_LEVEL_MAX (6)
+#define GZIP_LEVEL_MIN (1)
+
+// GzipRouteStats: the counters for one route
+typedef struct GzipRouteStats {
+	u64 responses;
+	u64 bytes_in;
+	u64 bytes_out;
+	u64 cpu; // ns
+} GzipRouteStats;
+
+// GzipTableEntry: the counters, by route
+typedef struct GzipTableEntry {
+	char *key;
+	GzipRouteStats value;
+} GzipTableEntry;
+
+static GzipTableEntry *ROUTES = NULL;
+static pthread_mutex_t GZIP_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+// NOTE (Brian) only the main loop writes these, everything else just reads them
+static int LEVEL = GZIP_LEVEL_MAX;
+static int LOAD = 0; // permille of the last second (ish) the event loop was busy
+static double LOAD_AVERAGE = 0.0;
+
+// gzip_header_name : the name of the header on the line from 'line' to 'eol'
+static struct mg_str gzip_header_name(const char *line, const char *eol);
+// gzip_is_text : true if 'type' (a Content-Type) is worth compressing
+static int gzip_is_text(struct mg_str type);
+
+// gzip_accepts : true if the client that sent 'hm' takes gzip (Accept-Encoding)
+int gzip_accepts(struct mg_http_message *hm)
+{
+	struct mg_str *header;
+	struct mg_str coding;
+	const char *s, *end, *next;
+	char tbuf[BUFSMALL];
+	double gzip = -1, star = -1;
+	char *q;
+
+	header = mg_http_get_header(hm, "Accept-Encoding");
+	if (header == NULL) {
+		return false;
+	}
+
+	// e.g. 'gzip, deflate, br' or 'gzip;q=1.0, identity; q=0.5, *;q=0'
+	for (s = header->ptr, end = s + header->len; s < end; s = next + 1) {
+		next = memchr(s, ',', end - s);
+		if (next == NULL) {
+			next = end;
+		}
+
+		snprintf(tbuf, sizeof tbuf, "%.*s", (int)(next - s), s);
+
+		coding = mg_str(tbuf);
+		while (coding.len > 0 && isspace(*coding.ptr)) {
+			coding.ptr++, coding.len--;
+		}
+		coding.len = strcspn(coding.ptr, " \t;");
+
+		q = strstr(tbuf, "q=");
+
+		if (mg_vcasecmp(&coding, "gzip") == 0) {
+			gzip = q ? strtod(q + 2, NULL) : 1;
+		} else if (mg_vcmp(&coding, "*") == 0) {
+			star = q ? strtod(q + 2, NULL) : 1;
+		}
+	}
+
+	// NOTE (Brian) naming gzip outright beats whatever '*' says, and 'q=0' is the client saying
+	// "anything but this"
+	return gzip >= 0 ? gzip > 0 : star > 0;
+}
+
+// gzip_response : compresses the finished response at 'io' + 'start' in place, if 'hm' takes it, and it's worth it
+void gzip_response(struct mg_iobuf *io, size_t start, struct mg_http_message *hm, char *route)
+{
+	if (mg_vcasecmp(&hm->method, "HEAD") == 0 || !gzip_accepts(hm)) {
+		return;
+	}
+
+	gzip_compress(io, start, route);
+}
+
+// gzip_compress : compresses the finished response at 'io' + 'start' in place, if it's worth it, returns true if it did
+int gzip_compress(struct mg_iobuf *io, size_t start, char *route)
+{
+	const char *msg, *head, *body, *line, *eol;
+	size_t len, bodylen, plainlen;
+	u8 *out = NULL;
+	char *newhead = NULL;
+	const u8 *plain;
+	int chunked = false;
+	i64 length = -1;
+	z_stream z;
+	int status;
+	int wbits;
+	u64 cpu;
+
+	if (io->len <= start) {
+		return false;
+	}
+
+	msg = (const char *)io->buf + start;
+	len = io->len - start;
+
+	head = memmem(msg, len, "\r\n\r\n", 4);
+	if (head == NULL || sscanf(msg, "HTTP/1.%*d %d", &status) != 1 || (status != 200 && status != 201)) {
+		return false;
+	}
+
+	body = head + 4;
+	bodylen = msg + len - body;
+
+	for (line = memchr(msg, '\n', head - msg) + 1; line < head; line = eol + 2) {
+		eol = memmem(line, head + 2 - line, "\r\n", 2);
+		if (eol == NULL) {
+			return false;
+		}
+
+		struct mg_str name = gzip_header_name(line, eol);
+		struct mg_str value = mg_str_n(line + name.len + 1, MAX(eol - line - (ptrdiff_t)name.len - 1, 0));
+		while (value.len > 0 && isspace(*value.ptr)) {
+			value.ptr++, value.len--;
+		}
+
+		if (mg_vcasecmp(&name, "Content-Length") == 0) {
+			length = mg_to64(value);
+		} else if (mg_vcasecmp(&name, "Transfer-Encoding") == 0) {
+			chunked = mg_strstr(value, mg_str("chunked")) != NULL;
+		} else if (mg_vcasecmp(&name, "Content-Encoding") == 0) {
+			return false;
+		} else if (mg_vcasecmp(&name, "Content-Type") == 0 && !gzip_is_text(value)) {
+			return false;
+		}
+	}
+
+	// NOTE (Brian) the response has to be all there, and only be the one response. Anything else
+	// (something that streams out over a while, like an image, or jsonw's chunks) is left alone.
+	if (chunked || length < 0 || (size_t)length != bodylen) {
+		return false;
+	}
+
+	plain = (const u8 *)body;
+	plainlen = bodylen;
+
+	if (plainlen < GZIP_MIN) {
+		return false;
+	}
+
+	// a window bigger than the whole body is just memory to set up and throw away
+	for (wbits = 9; wbits < 15 && ((size_t)1 << wbits) < plainlen; wbits++)
+		;
+
+	cpu = gzip_cputime();
+
+	memset(&z, 0, sizeof z);
+	if (deflateInit2(&z, gzip_level(), Z_DEFLATED, 16 + wbits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return false;
+	}
+
+	arrsetlen(out, deflateBound(&z, plainlen));
+
+	z.next_in = (u8 *)plain;
+	z.avail_in = plainlen;
+	z.next_out = out;
+	z.avail_out = arrlen(out);
+
+	if (deflate(&z, Z_FINISH) != Z_STREAM_END || z.total_out >= plainlen) {
+		deflateEnd(&z);
+		arrfree(out);
+		return false;
+	}
+
+	arrsetlen(out, z.total_out);
+	deflateEnd(&z);
+
+	cpu = gzip_cputime() - cpu;
+
+	// the same headers, minus the ones that were about the uncompressed body
+	arrsetcap(newhead, head - msg + BUFSMALL);
+
+	line = memchr(msg, '\n', head - msg) + 1;
+	memcpy(arraddnptr(newhead, line - msg), msg, line - msg);
+
+	for (; line < head; line = eol + 2) {
+		eol = memmem(line, head + 2 - line, "\r\n", 2);
+
+		struct mg_str name = gzip_header_name(line, eol);
+		if (mg_vcasecmp(&name, "Content-Length") == 0 || mg_vcasecmp(&name, "Transfer-Encoding") == 0) {
+			continue;
+		}
+
+		memcpy(arraddnptr(newhead, eol + 2 - line), line, eol + 2 - line);
+	}
+
+	char tbuf[BUFSMALL];
+	int n = snprintf(tbuf, sizeof tbuf, "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\nContent-Length: %zu\r\n\r\n", (size_t)arrlen(out));
+	memcpy(arraddnptr(newhead, n), tbuf, n);
+
+	io->len = start;
+	mg_iobuf_add(io, io->len, newhead, arrlen(newhead), MG_IO_SIZE);
+	mg_iobuf_add(io, io->len, out, arrlen(out), MG_IO_SIZE);
+
+	gzip_record(route, plainlen, arrlen(out), cpu);
+
+	arrfree(newhead);
+	arrfree(out);
+
+	return true;
+}
+
+// gzip_level : the level to compress at right now, it goes down as the event loop gets busier
+int gzip_level()
+{
+	return __atomic_load_n(&LEVEL, __ATOMIC_RELAXED);
+}
+
+// gzip_load : records that the event loop spent 'busy' of the last 'wall' nanoseconds working
+void gzip_load(u64 busy, u64 wall)
+{
+	double sample;
+	int level;
+
+	if (wall == 0) {
+		return;
+	}
+
+	// smoothed a little, so one slow second doesn't swing it all the way
+	sample = MIN((double)busy / wall, 1.0);
+	LOAD_AVERAGE = LOAD_AVERAGE * 0.5 + sample * 0.5;
+
+	level = GZIP_LEVEL_MAX - (int)(LOAD_AVERAGE * GZIP_LEVEL_MAX);
+	level = MAX(GZIP_LEVEL_MIN, MIN(GZIP_LEVEL_MAX, level));
+
+	__atomic_store_n(&LEVEL, level, __ATOMIC_RELAXED);
+	__atomic_store_n(&LOAD, (int)(LOAD_AVERAGE * 1000), __ATOMIC_RELAXED);
+}
+
+// gzip_record : adds one compressed response (or one piece of one) to the counters for 'route'
+void gzip_record(char *route, size_t in, size_t out, u64 cpu)
+{
+	GzipRouteStats *stats;
+	ptrdiff_t i;
+
+	pthread_mutex_lock(&GZIP_LOCK);
+
+	if (ROUTES == NULL) {
+		sh_new_strdup(ROUTES);
+	}
+
+	if ((i = shgeti(ROUTES, route)) < 0) {
+		GzipRouteStats zero = {0};
+		shput(ROUTES, route, zero);
+		i = shgeti(ROUTES, route);
+	}
+
+	stats = &ROUTES[i].value;
+	stats->responses++;
+	stats->bytes_in += in;
+	stats->bytes_out += out;
+	stats->cpu += cpu;
+
+	pthread_mutex_unlock(&GZIP_LOCK);
+}
+
+// gzip_stats : the counters, per route, as JSON for /api/v1/stats
+json_t *gzip_stats()
+{
+	json_t *routes;
+	json_t *object;
+
+	routes = json_object();
+
+	pthread_mutex_lock(&GZIP_LOCK);
+
+	for (ptrdiff_t i = 0; i < shlen(ROUTES); i++) {
+		GzipRouteStats *stats = &ROUTES[i].value;
+
+		json_object_set_new(routes, ROUTES[i].key, json_pack("{s:I, s:I, s:I, s:I, s:f, s:f}",
+			"responses", (json_int_t)stats->responses,
+			"bytes_in", (json_int_t)stats->bytes_in,
+			"bytes_out", (json_int_t)stats->bytes_out,
+			"bytes_saved", (json_int_t)(stats->bytes_in - stats->bytes_out),
+			"ratio", stats->bytes_in ? (double)stats->bytes_out / stats->bytes_in : 0.0,
+			"cpu_ms", stats->cpu / 1e6));
+	}
+
+	pthread_mutex_unlock(&GZIP_LOCK);
+
+	object = json_pack("{s:i, s:f, s:o}",
+		"level", gzip_level(),
+		"load", __atomic_load_n(&LOAD, __ATOMIC_RELAXED) / 1000.0,
+		"routes", routes);
+
+	return object;
+}
+
+// gzip_free : frees the counters
+void gzip_free()
+{
+	pthread_mutex_lock(&GZIP_LOCK);
+	shfree(ROUTES);
+	pthread_mutex_unlock(&GZIP_LOCK);
+}
+
+// gzip_header : writes the GZIP_HEADER_SIZE bytes that start a gzip stream
+void gzip_header(u8 *buf)
+{
+	// magic, deflate, no flags, no mtime, no extra flags, unix
+	static const u8 header[GZIP_HEADER_SIZE] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+
+	memcpy(buf, header, sizeof header);
+}
+
+// gzip_block_init : sets up 'z' for gzip_block (deflateEnd it when you're done)
+int gzip_block_init(z_stream *z)
+{
+	memset(z, 0, sizeof(*z));
+
+	// negative window bits is a raw deflate stream, the header and trailer are ours to write
+	return deflateInit2(z, gzip_level(), Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK ? 0 : -1;
+}
+
+// gzip_block : deflates 'len' bytes into 'out' (an stb array) as a standalone piece of a raw deflate stream
+int gzip_block(z_stream *z, const char *s, size_t len, u8 **out)
+{
+	// NOTE (Brian) every piece starts over, without the previous piece as its dictionary, so that
+	// the pieces can be compressed at the same time, and in any order
+	if (deflateReset(z) != Z_OK || deflateParams(z, gzip_level(), Z_DEFAULT_STRATEGY) != Z_OK) {
+		return -1;
+	}
+
+	// the sync flush marker is on top of the bound
+	arrsetlen(*out, deflateBound(z, len) + 16);
+
+	z->next_in = (u8 *)s;
+	z->avail_in = len;
+	z->next_out = *out;
+	z->avail_out = arrlen(*out);
+
+	if (deflate(z, Z_SYNC_FLUSH) != Z_OK || z->avail_in != 0 || z->avail_out == 0) {
+		arrsetlen(*out, 0);
+		return -1;
+	}
+
+	arrsetlen(*out, arrlen(*out) - z->avail_out);
+
+	return 0;
+}
+
+// gzip_trailer : writes the GZIP_TRAILER_SIZE bytes that end a stream of gzip_block's
+void gzip_trailer(u8 *buf, u32 crc, u64 size)
+{
+	// an empty, final, fixed huffman block, since none of the pieces were the last one
+	buf[0] = 0x03;
+	buf[1] = 0x00;
+
+	// then the CRC and the size (mod 2^32), both little endian
+	for (int i = 0; i < 4; i++) {
+		buf[2 + i] = (crc >> (8 * i)) & 0xff;
+		buf[6 + i] = (size >> (8 * i)) & 0xff;
+	}
+}
+
+// gzip_cputime : nanoseconds of CPU the calling thread has used
+u64 gzip_cputime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// gzip_header_name : the name of the header on the line from 'line' to 'eol'
+static struct mg_str gzip_header_name(const char *line, const char *eol)
+{
+	const char *colon = memchr(line, ':', eol - line);
+
+	return mg_str_n(line, colon ? colon - line : eol - line);
+}
+
+// gzip_is_text : true if 'type' (a Content-Type) is worth compressing
+static int gzip_is_text(struct mg_str type)
+{
+	static char *types[] = { "application/json", "application/x-ndjson", "text/" };
+
+	for (size_t i = 0; i < ARRSIZE(types); i++) {
+		if (type.len >= strlen(types[i]) && mg_ncasecmp(type.ptr, types[i], strlen(types[i])) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
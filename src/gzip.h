@@ -0,0 +1,56 @@
+#ifndef GZIP_H
+#define GZIP_H
+
+// Brian Chrzanowski
+// 2026-10-17 21:02:40
+
+#include "common.h"
+
+#include <zlib.h>
+#include <jansson.h>
+
+#include "mongoose.h"
+
+#define GZIP_HEADER_SIZE  (10)
+#define GZIP_TRAILER_SIZE (10)
+
+// gzip_accepts : true if the client that sent 'hm' takes gzip (Accept-Encoding)
+int gzip_accepts(struct mg_http_message *hm);
+
+// gzip_response : compresses the finished response at 'io' + 'start' in place, if 'hm' takes it, and it's worth it
+void gzip_response(struct mg_iobuf *io, size_t start, struct mg_http_message *hm, char *route);
+
+// gzip_compress : compresses the finished response at 'io' + 'start' in place, if it's worth it, returns true if it did
+int gzip_compress(struct mg_iobuf *io, size_t start, char *route);
+
+// gzip_level : the level to compress at right now, it goes down as the event loop gets busier
+int gzip_level();
+
+// gzip_load : records that the event loop spent 'busy' of the last 'wall' nanoseconds working
+void gzip_load(u64 busy, u64 wall);
+
+// gzip_record : adds one compressed response (or one piece of one) to the counters for 'route'
+void gzip_record(char *route, size_t in, size_t out, u64 cpu);
+
+// gzip_stats : the counters, per route, as JSON for /api/v1/stats
+json_t *gzip_stats();
+
+// gzip_free : frees the counters
+void gzip_free();
+
+// gzip_header : writes the GZIP_HEADER_SIZE bytes that start a gzip stream
+void gzip_header(u8 *buf);
+
+// gzip_block_init : sets up 'z' for gzip_block (deflateEnd it when you're done)
+int gzip_block_init(z_stream *z);
+
+// gzip_block : deflates 'len' bytes into 'out' (an stb array) as a standalone piece of a raw deflate stream
+int gzip_block(z_stream *z, const char *s, size_t len, u8 **out);
+
+// gzip_trailer : writes the GZIP_TRAILER_SIZE bytes that end a stream of gzip_block's
+void gzip_trailer(u8 *buf, u32 crc, u64 size);
+
+// gzip_cputime : nanoseconds of CPU the calling thread has used
+u64 gzip_cputime();
+
+#endif // GZIP_H
@@ -0,0 +1,934 @@
+// Brian Chrzanowski
+// 2026-10-17 18:40:02
+//
+// Recipe Images
+//
+// POST /api/v1/recipe/:id/image takes the raw bytes of one image as the body:
+//
+//   curl --data-binary @pie.jpg localhost:2000/api/v1/recipe/<id>/image
+//
+// Like the bulk import, anything that doesn't show up in one read comes through MG_EV_HTTP_CHUNK,
+// and every piece gets deleted from the receive buffer as soon as it's handled. Each piece is:
+//
+//   1. written to a temp file (<imagedir>/tmp/XXXXXX)
+//   2. fed into the hash (crypto_generichash)
+//   3. and, for the first IMAGE_SNIFF bytes, kept, so libmagic can say what it actually is
+//
+// so an upload only ever has one piece of itself in memory, no matter how big it is. Once the type
+// is known, anything that isn't an image gets a 415, and once it's over IMAGE_MAX, a 413, and in
+// both cases the rest of the body is thrown away as it comes in.
+//
+// When the last byte is in, the file is synced and renamed into the store, and the row goes into
+// 'images', in one transaction. If the insert fails, the file's gone again, and if the rename
+// fails, the insert gets rolled back, so a row always has a file, and a file (outside of tmp/)
+// always has a row.
+//
+// NOTE (Brian) the streaming path runs on the event loop, which can't sit there waiting on the
+// database's lock. If someone else is writing, the upload waits instead, and image_poll tries the
+// transaction again every time around the loop, for up to DB_BUSY_MS, before it gives up with a 503.
+//
+// The response is the new image:
+//
+//   {"id":"...","recipe_id":"...","mime":"image/jpeg","size":12345,"hash":"<hex>","url":"..."}
+//
+// The files are content addressed: <imagedir>/ab/cdef... is the image whose hash is abcdef..., so
+// the same bytes uploaded twice (to the same recipe or not) are one file and two rows. Nothing
+// deletes images yet, but whatever does has to check for other rows with the same hash first.
+//
+// GET /api/v1/image/:hash serves them. Since the URL is the content, the hash is the ETag, and the
+// response can be cached forever. The body goes out with sendfile, straight from the page cache to
+// the socket, a piece at a time as the socket has room, so a big image (or a slow client) doesn't
+// tie up the event loop or memory. Single 'Range's work, for resuming and for seeking.
+//
+// Once thumb.c has gotten to an image, GET /api/v1/image/:hash?w=320 is the 320px wide copy of it.
+// The recipes list the widths that exist (see IMAGE_JSON), anything else is a 404.
+
+#include "common.h"
+
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include <magic.h>
+#include <sodium.h>
+#include <jansson.h>
+
+#include "mongoose.h"
+#include "sqlite3.h"
+
+#include "objects.h"
+#include "cache.h"
+#include "thumb.h"
+#include "image.h"
+
+#define IMAGE_MAX   (32 * 1024 * 1024)
+#define IMAGE_SNIFF (4096)
+#define IMAGE_SEND  (1024 * 1024) // most bytes to hand sendfile at once
+
+#define IMAGE_CACHE_CONTROL ("Cache-Control: public, max-age=31536000, immutable\r\n")
+
+extern __thread sqlite3 *DATABASE;
+
+// ImageUpload: the state of one upload, while it streams in
+typedef struct ImageUpload {
+	crypto_generichash_state hash; // NOTE (Brian) first, it has to be 64 byte aligned
+	char recipe_id[64];
+	char tmppath[BUFLARGE];
+	int fd;
+	u8 head[IMAGE_SNIFF];
+	size_t headlen;
+	size_t size;
+	size_t received;
+	size_t expected;
+	int chunked;
+	int error; // an HTTP status, if it can't go any further
+	int done; // it's been answered, anything else that shows up gets thrown away
+	int stream; // it came through image_api_chunk, on the event loop
+	int hashed; // 'digest' is final ('hash' can only be finished once)
+	u8 digest[crypto_generichash_BYTES];
+	unsigned long busy_since; // mg_millis() when it first found the database locked, 0 if it hasn't
+} ImageUpload;
+
+// ImageSend: an image going out, with the connection's own protocol handler, for when it's done
+typedef struct ImageSend {
+	int fd;
+	off_t offset;
+	off_t end;
+	mg_event_handler_t pfn;
+	void *pfn_data;
+} ImageSend;
+
+// ImageTableEntry: the uploads that are streaming in, by connection id
+typedef struct ImageTableEntry {
+	unsigned long key;
+	ImageUpload *value;
+} ImageTableEntry;
+
+static ImageTableEntry *UPLOADS = NULL;
+static char *IMAGE_DIR = NULL;
+static magic_t MAGIC = NULL;
+
+// NOTE (Brian) libmagic cookies aren't thread safe, and small uploads run on the workers
+static pthread_mutex_t MAGIC_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+// image_new : starts an upload for the request in 'hm', to recipe 'id', check 'error' before using it
+static ImageUpload *image_new(struct mg_http_message *hm, char *id);
+// image_feed : writes 'len' bytes of body to the temp file, 0 if that's fine, or the HTTP error
+static int image_feed(ImageUpload *upload, const char *s, size_t len);
+// image_finish : puts the file in place, and adds the row, replying on 'conn', -1 if the database was locked and it should be tried again later (nothing's been sent)
+static int image_finish(struct mg_connection *conn, ImageUpload *upload);
+// image_store_path : where the bytes with the hash 'hex' go, relative to the image directory
+static void image_store_path(char *s, size_t len, char *hex);
+// image_store_file : moves a file into the store by its contents, for anything left at the top
+static int image_store_file(char *path);
+// image_send_cb : protocol handler while an image is going out, a sendfile at a time
+static void image_send_cb(struct mg_connection *conn, int ev, void *ev_data, void *fn_data);
+// image_range : parses a 'Range' header into [start, end), 0 for a whole file, -1 if it's unsatisfiable
+static int image_range(struct mg_str *header, off_t size, off_t *start, off_t *end);
+// image_new_id : gets a fresh uuid from the database, the same way the id columns get theirs
+static int image_new_id(char *id, size_t len);
+// image_recipe_exists : true if 'id' is a live recipe
+static int image_recipe_exists(char *id);
+// image_sniff : asks libmagic what the first bytes of the upload are, 0 if it's an image we take
+static int image_sniff(ImageUpload *upload, char *mime, size_t len);
+// image_free : closes and removes the temp file (if it's still there), and frees the upload
+static void image_free(ImageUpload *upload);
+
+// image_init : makes the image directories, and cleans out anything a crash left in tmp/
+int image_init(char *dir, magic_t cookie)
+{
+	char path[BUFLARGE];
+	struct dirent *ent;
+	DIR *tmpdir;
+
+	IMAGE_DIR = dir;
+	MAGIC = cookie;
+
+	snprintf(path, sizeof path, "%s/tmp", IMAGE_DIR);
+
+	if ((mkdir(IMAGE_DIR, 0755) < 0 && errno != EEXIST) || (mkdir(path, 0755) < 0 && errno != EEXIST)) {
+		ERR("couldn't make the image directory '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	tmpdir = opendir(path);
+	if (tmpdir == NULL) {
+		return -1;
+	}
+
+	while ((ent = readdir(tmpdir)) != NULL) {
+		if (ent->d_name[0] != '.') {
+			unlinkat(dirfd(tmpdir), ent->d_name, 0);
+		}
+	}
+
+	closedir(tmpdir);
+
+	// anything that's a file at the top level is from before the store was content addressed
+	tmpdir = opendir(IMAGE_DIR);
+	if (tmpdir == NULL) {
+		return -1;
+	}
+
+	while ((ent = readdir(tmpdir)) != NULL) {
+		if (ent->d_type == DT_REG) {
+			snprintf(path, sizeof path, "%s/%s", IMAGE_DIR, ent->d_name);
+			if (image_store_file(path) < 0) {
+				closedir(tmpdir);
+				return -1;
+			}
+		}
+	}
+
+	closedir(tmpdir);
+
+	return 0;
+}
+
+// image_api_get : endpoint, GET / HEAD - /api/v1/image/:hash
+int image_api_get(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
+{
+	u8 *digest = params->digest;
+	char *hex = params->hash;
+	char range[BUFSMALL] = "";
+	char tbuf[BUFSMALL];
+	char path[BUFLARGE];
+	char mime[BUFSMALL];
+	char etag[BUFSMALL];
+	struct mg_str *header;
+	sqlite3_stmt *stmt;
+	struct stat st;
+	ImageSend *send;
+	off_t start, end;
+	int status;
+	int width;
+	int fd;
+	int rc;
+
+	// '?w=320' is one of the smaller copies thumb.c made, if it's made one that wide
+	width = 0;
+	if (mg_http_get_var(&hm->query, "w", tbuf, sizeof tbuf) > 0) {
+		width = atoi(tbuf);
+		if (width <= 0) {
+			mg_http_reply(conn, 404, NULL, "");
+			return 0;
+		}
+	}
+
+	if (width > 0) {
+		stmt = db_stmt_get("image_variants", "get",
+			"select v.mime, v.path from %s v where v.hash = ?1 and v.width = ?2"
+			" and exists (select 1 from images i where i.hash = ?1 and i.delete_ts is null);");
+	} else {
+		stmt = db_stmt_get("images", "get_by_hash",
+			"select mime, path from %s where hash = ?1 and delete_ts is null limit 1;");
+	}
+
+	if (stmt == NULL) {
+		return -1;
+	}
+
+	sqlite3_bind_blob(stmt, 1, digest, sizeof params->digest, SQLITE_STATIC);
+	if (width > 0) {
+		sqlite3_bind_int(stmt, 2, width);
+	}
+
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW) {
+		snprintf(mime, sizeof mime, "%s", sqlite3_column_text(stmt, 0));
+		snprintf(path, sizeof path, "%s/%s", IMAGE_DIR, sqlite3_column_text(stmt, 1));
+	}
+
+	db_stmt_release(stmt);
+
+	if (rc != SQLITE_ROW) {
+		mg_http_reply(conn, rc == SQLITE_DONE ? 404 : 503, NULL, "");
+		return 0;
+	}
+
+	// the hash IS the content, so it's the strongest ETag there is, and the URL never changes what
+	// it points at (a variant is only ever made once, from the same bytes, the same way)
+	if (width > 0) {
+		snprintf(etag, sizeof etag, "\"%s-%d\"", hex, width);
+	} else {
+		snprintf(etag, sizeof etag, "\"%s\"", hex);
+	}
+
+	header = mg_http_get_header(hm, "If-None-Match");
+	if (header != NULL && mg_strstr(*header, mg_str(etag)) != NULL) {
+		mg_printf(conn, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n%sContent-Length: 0\r\n\r\n",
+			etag, IMAGE_CACHE_CONTROL);
+		return 0;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		ERR("image %s has a row, but '%s' isn't readable: %s\n", hex, path, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+
+	status = 200;
+	start = 0;
+	end = st.st_size;
+
+	header = mg_http_get_header(hm, "Range");
+	if (header != NULL) {
+		rc = image_range(header, st.st_size, &start, &end);
+		if (rc < 0) {
+			status = 416;
+			start = end = 0;
+			snprintf(range, sizeof range, "Content-Range: bytes */%lld\r\n", (long long)st.st_size);
+		} else if (rc > 0) {
+			status = 206;
+			snprintf(range, sizeof range, "Content-Range: bytes %lld-%lld/%lld\r\n",
+				(long long)start, (long long)end - 1, (long long)st.st_size);
+		}
+	}
+
+	mg_printf(conn,
+		"HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %lld\r\nETag: %s\r\n%s"
+		"Accept-Ranges: bytes\r\n%s\r\n",
+		status, status == 200 ? "OK" : status == 206 ? "Partial Content" : "Range Not Satisfiable", mime, (long long)(end - start), etag,
+		IMAGE_CACHE_CONTROL, range);
+
+	if (start == end || mg_vcasecmp(&hm->method, "HEAD") == 0) {
+		close(fd);
+		return 0;
+	}
+
+	send = calloc(1, sizeof(*send));
+	if (send == NULL) {
+		close(fd);
+		conn->is_draining = 1;
+		return 0;
+	}
+
+	send->fd = fd;
+	send->offset = start;
+	send->end = end;
+
+	// NOTE (Brian) this is what mg_http_serve_file does: the http handler steps aside until the
+	// file's out, so nothing else gets read off of the connection (and answered) in the middle
+	send->pfn = conn->pfn;
+	send->pfn_data = conn->pfn_data;
+	conn->pfn = image_send_cb;
+	conn->pfn_data = send;
+	conn->is_polling = 1;
+
+	return 0;
+}
+
+// image_api_post : endpoint, POST - /api/v1/recipe/:id/image (when the whole body showed up at once)
+int image_api_post(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
+{
+	ImageUpload *upload;
+	int rc;
+
+	upload = image_new(hm, params->id);
+	if (upload == NULL) {
+		return -1;
+	}
+
+	rc = upload->error ? upload->error : image_feed(upload, hm->body.ptr, hm->body.len);
+	if (rc != 0) {
+		mg_http_reply(conn, rc, NULL, "");
+	} else {
+		image_finish(conn, upload);
+	}
+
+	image_free(upload);
+
+	return 0;
+}
+
+// image_api_chunk : streaming endpoint, POST - /api/v1/recipe/:id/image (MG_EV_HTTP_CHUNK)
+int image_api_chunk(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
+{
+	ImageUpload *upload = NULL;
+	size_t len;
+	int last;
+	int rc;
+
+	if (hmlen(UPLOADS) > 0) {
+		upload = hmget(UPLOADS, conn->id);
+	}
+
+	if (upload == NULL) {
+		upload = image_new(hm, params->id);
+		if (upload == NULL) {
+			mg_http_reply(conn, 503, NULL, "");
+			conn->is_draining = 1;
+			conn->recv.len = 0;
+			return 0;
+		}
+
+		upload->stream = true;
+		hmput(UPLOADS, conn->id, upload);
+	}
+
+	// same as the bulk import, a body with a Content-Length stops there
+	len = hm->chunk.len;
+	if (!upload->chunked) {
+		len = MIN(len, upload->expected - upload->received);
+	}
+
+	if (!upload->done) {
+		rc = upload->error ? upload->error : image_feed(upload, hm->chunk.ptr, len);
+		if (rc != 0) {
+			mg_http_reply(conn, rc, NULL, "");
+			conn->is_draining = 1;
+			upload->done = true;
+		}
+	}
+
+	upload->received += len;
+
+	if (upload->chunked) {
+		last = hm->chunk.len == 0;
+	} else {
+		last = upload->received >= upload->expected;
+	}
+
+	mg_http_delete_chunk(conn, hm);
+
+	if (last) {
+		if (!upload->done && image_finish(conn, upload) < 0) {
+			// NOTE (Brian) image_poll answers it, and until then, nothing else on the connection
+			// gets parsed
+			conn->is_resp = 1;
+			conn->is_polling = 1;
+			conn->recv.len = 0;
+			return 0;
+		}
+
+		(void)hmdel(UPLOADS, conn->id);
+		image_free(upload);
+
+		// NOTE (Brian) see bulk_api_chunk, the headers would get parsed again on close
+		conn->recv.len = 0;
+	}
+
+	return 0;
+}
+
+// image_poll : tries the transaction again for the upload on 'conn', if it found the database locked (MG_EV_POLL)
+void image_poll(struct mg_connection *conn)
+{
+	ImageUpload *upload;
+
+	if (hmlen(UPLOADS) == 0 || (upload = hmget(UPLOADS, conn->id)) == NULL || upload->busy_since == 0) {
+		return;
+	}
+
+	if (image_finish(conn, upload) < 0) {
+		return;
+	}
+
+	(void)hmdel(UPLOADS, conn->id);
+	image_free(upload);
+
+	conn->is_polling = 0;
+	conn->is_resp = 0;
+	if (conn->recv.len > 0 && !conn->is_draining) {
+		conn->pfn(conn, MG_EV_READ, NULL, conn->pfn_data);
+	}
+}
+
+// image_close : throws away the upload on 'conn', if there is one (MG_EV_CLOSE)
+void image_close(struct mg_connection *conn)
+{
+	ImageUpload *upload;
+
+	if (hmlen(UPLOADS) == 0 || (upload = hmget(UPLOADS, conn->id)) == NULL) {
+		return;
+	}
+
+	(void)hmdel(UPLOADS, conn->id);
+	image_free(upload);
+
+	conn->recv.len = 0;
+}
+
+// image_new : starts an upload for the request in 'hm', to recipe 'id', check 'error' before using it
+static ImageUpload *image_new(struct mg_http_message *hm, char *id)
+{
+	ImageUpload *upload;
+	struct mg_str *header;
+
+	upload = aligned_alloc(_Alignof(ImageUpload), sizeof(*upload));
+	if (upload == NULL) {
+		return NULL;
+	}
+
+	memset(upload, 0, sizeof(*upload));
+	upload->fd = -1;
+
+	snprintf(upload->recipe_id, sizeof upload->recipe_id, "%s", id);
+
+	// the insert checks this again at the end, this just saves taking a whole upload for nothing
+	if (!image_recipe_exists(upload->recipe_id)) {
+		upload->error = 404;
+		return upload;
+	}
+
+	header = mg_http_get_header(hm, "Transfer-Encoding");
+	upload->chunked = header != NULL && mg_strstr(*header, mg_str("chunked")) != NULL;
+
+	header = mg_http_get_header(hm, "Content-Length");
+	if (header != NULL) {
+		upload->expected = mg_to64(*header);
+	}
+
+	// no sense taking the whole thing, just to turn it away at the end
+	if (!upload->chunked && upload->expected > IMAGE_MAX) {
+		upload->error = 413;
+		return upload;
+	}
+
+	snprintf(upload->tmppath, sizeof upload->tmppath, "%s/tmp/XXXXXX", IMAGE_DIR);
+
+	upload->fd = mkstemp(upload->tmppath);
+	if (upload->fd < 0) {
+		ERR("couldn't make a temp file for an upload: %s\n", strerror(errno));
+		upload->tmppath[0] = '\0';
+		upload->error = 503;
+		return upload;
+	}
+
+	// mkstemp makes it 0600, and it's going to be served as is
+	fchmod(upload->fd, 0644);
+
+	crypto_generichash_init(&upload->hash, NULL, 0, crypto_generichash_BYTES);
+
+	return upload;
+}
+
+// image_feed : writes 'len' bytes of body to the temp file, 0 if that's fine, or the HTTP error
+static int image_feed(ImageUpload *upload, const char *s, size_t len)
+{
+	char mime[BUFSMALL];
+	size_t n;
+	ssize_t rc;
+
+	if (upload->size + len > IMAGE_MAX) {
+		return 413;
+	}
+
+	// keep the beginning, until there's enough of it to tell what it is
+	if (upload->headlen < IMAGE_SNIFF) {
+		n = MIN(len, IMAGE_SNIFF - upload->headlen);
+		memcpy(upload->head + upload->headlen, s, n);
+		upload->headlen += n;
+
+		if (upload->headlen == IMAGE_SNIFF && image_sniff(upload, mime, sizeof mime) != 0) {
+			return 415;
+		}
+	}
+
+	crypto_generichash_update(&upload->hash, (const u8 *)s, len);
+	upload->size += len;
+
+	for (n = 0; n < len; n += rc) {
+		rc = write(upload->fd, s + n, len - n);
+		if (rc < 0) {
+			if (errno == EINTR) {
+				rc = 0;
+				continue;
+			}
+
+			ERR("couldn't write an upload to '%s': %s\n", upload->tmppath, strerror(errno));
+			return 503;
+		}
+	}
+
+	return 0;
+}
+
+// image_finish : puts the file in place, and adds the row, replying on 'conn', -1 if the database was locked and it should be tried again later (nothing's been sent)
+static int image_finish(struct mg_connection *conn, ImageUpload *upload)
+{
+	char hex[crypto_generichash_BYTES * 2 + 1];
+	char relpath[BUFSMALL];
+	char path[BUFLARGE];
+	char dir[BUFLARGE];
+	char url[BUFSMALL];
+	char mime[BUFSMALL];
+	char id[64];
+	sqlite3_stmt *stmt;
+	json_t *object;
+	size_t size;
+	int created;
+	char *s;
+	int rc;
+
+	size = upload->size;
+
+	// anything smaller than IMAGE_SNIFF hasn't been looked at yet
+	if (size == 0 || image_sniff(upload, mime, sizeof mime) != 0) {
+		mg_http_reply(conn, 415, NULL, "");
+		return 0;
+	}
+
+	if (!upload->hashed) {
+		crypto_generichash_final(&upload->hash, upload->digest, sizeof upload->digest);
+		upload->hashed = true;
+	}
+	sodium_bin2hex(hex, sizeof hex, upload->digest, sizeof upload->digest);
+
+	// it has to be on the disk before there's a row that says it is
+	if (fsync(upload->fd) < 0) {
+		ERR("couldn't sync '%s': %s\n", upload->tmppath, strerror(errno));
+		mg_http_reply(conn, 503, NULL, "");
+		return 0;
+	}
+
+	if (image_new_id(id, sizeof id) < 0) {
+		mg_http_reply(conn, 503, NULL, "");
+		return 0;
+	}
+
+	image_store_path(relpath, sizeof relpath, hex);
+	snprintf(path, sizeof path, "%s/%s", IMAGE_DIR, relpath);
+
+	// the fan out directory, <imagedir>/ab
+	snprintf(dir, sizeof dir, "%s/%.2s", IMAGE_DIR, hex);
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		ERR("couldn't make '%s': %s\n", dir, strerror(errno));
+		mg_http_reply(conn, 503, NULL, "");
+		return 0;
+	}
+
+	// NOTE (Brian) every write holds the database's write lock until it commits, so the file
+	// checks in here can't race with another upload of the same bytes
+	rc = sqlite3_exec(DATABASE, "begin immediate transaction;", NULL, NULL, NULL);
+	if (rc == SQLITE_BUSY && upload->stream) {
+		if (upload->busy_since == 0) {
+			upload->busy_since = mg_millis();
+		}
+		if (mg_millis() - upload->busy_since < DB_BUSY_MS) {
+			return -1;
+		}
+	}
+
+	if (rc != SQLITE_OK) {
+		mg_http_reply(conn, 503, NULL, "");
+		return 0;
+	}
+
+	stmt = db_stmt_get("images", "insert",
+		"insert into %s (id, recipe_id, ordering, mime, size, hash, path)"
+		" select uuid_blob(?1), r.id,"
+		" (select coalesce(max(i.ordering) + 1, 0) from images i where i.recipe_id = r.id and i.delete_ts is null),"
+		" ?3, ?4, ?5, ?6"
+		" from recipes r where r.id = uuid_blob(?2) and r.delete_ts is null;");
+	if (stmt == NULL) {
+		sqlite3_exec(DATABASE, "rollback transaction;", NULL, NULL, NULL);
+		mg_http_reply(conn, 503, NULL, "");
+		return 0;
+	}
+
+	sqlite3_bind_text(stmt, 1, id, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, upload->recipe_id, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 3, mime, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 4, size);
+	sqlite3_bind_blob(stmt, 5, upload->digest, sizeof upload->digest, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 6, relpath, -1, SQLITE_STATIC);
+
+	rc = sqlite3_step(stmt);
+
+	db_stmt_release(stmt);
+
+	if (rc != SQLITE_DONE || sqlite3_changes(DATABASE) == 0) {
+		sqlite3_exec(DATABASE, "rollback transaction;", NULL, NULL, NULL);
+		mg_http_reply(conn, rc == SQLITE_DONE ? 404 : 503, NULL, "");
+		return 0;
+	}
+
+	// the same bytes are already in the store, so this upload is just another row pointing at them
+	created = access(path, F_OK) != 0;
+
+	if (created && rename(upload->tmppath, path) < 0) {
+		ERR("couldn't move '%s' to '%s': %s\n", upload->tmppath, path, strerror(errno));
+		sqlite3_exec(DATABASE, "rollback transaction;", NULL, NULL, NULL);
+		mg_http_reply(conn, 503, NULL, "");
+		return 0;
+	}
+
+	if (sqlite3_exec(DATABASE, "commit transaction;", NULL, NULL, NULL) != SQLITE_OK) {
+		ERR("couldn't commit an image! %s\n", sqlite3_errmsg(DATABASE));
+		// before the rollback, while nothing else can have started using it
+		if (created) {
+			unlink(path);
+		}
+		sqlite3_exec(DATABASE, "rollback transaction;", NULL, NULL, NULL);
+		mg_http_reply(conn, 503, NULL, "");
+		return 0;
+	}
+
+	// the temp file is either the image now, or a duplicate of it (and image_free gets rid of it)
+	if (created) {
+		upload->tmppath[0] = '\0';
+	}
+
+	// the recipe has another image now, and the new image needs thumbnails
+	cache_invalidate(upload->recipe_id);
+	thumb_wake();
+
+	snprintf(url, sizeof url, "/api/v1/image/%s", hex);
+
+	object = json_pack("{s:s, s:s, s:s, s:I, s:s, s:s}",
+		"id", id,
+		"recipe_id", upload->recipe_id,
+		"mime", mime,
+		"size", (json_int_t)size,
+		"hash", hex,
+		"url", url);
+	if (object == NULL) {
+		mg_http_reply(conn, 503, NULL, "");
+		return 0;
+	}
+
+	s = json_dumps(object, JSON_SORT_KEYS|JSON_COMPACT);
+
+	mg_http_reply(conn, 201, NULL, "%s", s);
+
+	json_decref(object);
+	free(s);
+
+	return 0;
+}
+
+// image_new_id : gets a fresh uuid from the database, the same way the id columns get theirs
+static int image_new_id(char *id, size_t len)
+{
+	sqlite3_stmt *stmt;
+	int rc = -1;
+
+	stmt = db_stmt_get("images", "new_id", "select uuid();");
+	if (stmt == NULL) {
+		return -1;
+	}
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		snprintf(id, len, "%s", sqlite3_column_text(stmt, 0));
+		rc = 0;
+	}
+
+	db_stmt_release(stmt);
+
+	return rc;
+}
+
+// image_recipe_exists : true if 'id' is a live recipe
+static int image_recipe_exists(char *id)
+{
+	sqlite3_stmt *stmt;
+	int exists;
+
+	stmt = db_stmt_get("recipes", "exists", "select 1 from %s where id = uuid_blob(?) and delete_ts is null;");
+	if (stmt == NULL) {
+		return false;
+	}
+
+	sqlite3_bind_text(stmt, 1, id, -1, SQLITE_STATIC);
+
+	exists = sqlite3_step(stmt) == SQLITE_ROW;
+
+	db_stmt_release(stmt);
+
+	return exists;
+}
+
+// image_sniff : asks libmagic what the first bytes of the upload are, 0 if it's an image we take
+static int image_sniff(ImageUpload *upload, char *mime, size_t len)
+{
+	static char *allowed[] = { "image/jpeg", "image/png", "image/gif", "image/webp" };
+	const char *type;
+
+	pthread_mutex_lock(&MAGIC_LOCK);
+
+	type = magic_buffer(MAGIC, upload->head, upload->headlen);
+
+	// MAGIC_MIME adds '; charset=binary', and we only want the type
+	snprintf(mime, len, "%.*s", type ? (int)strcspn(type, ";") : 0, type ? type : "");
+
+	pthread_mutex_unlock(&MAGIC_LOCK);
+
+	for (size_t i = 0; i < ARRSIZE(allowed); i++) {
+		if (strcmp(mime, allowed[i]) == 0) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+// image_free : closes and removes the temp file (if it's still there), and frees the upload
+static void image_free(ImageUpload *upload)
+{
+	if (upload->fd >= 0) {
+		close(upload->fd);
+	}
+
+	if (upload->tmppath[0] != '\0') {
+		unlink(upload->tmppath);
+	}
+
+	free(upload);
+}
+
+// image_store_path : where the bytes with the hash 'hex' go, relative to the image directory
+static void image_store_path(char *s, size_t len, char *hex)
+{
+	// NOTE (Brian) 256 directories, so that no one directory ends up with every image in it
+	snprintf(s, len, "%.2s/%s", hex, hex + 2);
+}
+
+// image_store_file : moves a file into the store by its contents, for anything left at the top
+static int image_store_file(char *path)
+{
+	crypto_generichash_state state;
+	u8 digest[crypto_generichash_BYTES];
+	char hex[crypto_generichash_BYTES * 2 + 1];
+	char relpath[BUFSMALL];
+	char newpath[BUFLARGE];
+	char buf[BUFLARGE];
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+
+	crypto_generichash_init(&state, NULL, 0, sizeof digest);
+
+	while ((n = read(fd, buf, sizeof buf)) > 0) {
+		crypto_generichash_update(&state, (u8 *)buf, n);
+	}
+
+	close(fd);
+
+	if (n < 0) {
+		return -1;
+	}
+
+	crypto_generichash_final(&state, digest, sizeof digest);
+	sodium_bin2hex(hex, sizeof hex, digest, sizeof digest);
+
+	image_store_path(relpath, sizeof relpath, hex);
+
+	snprintf(newpath, sizeof newpath, "%s/%.2s", IMAGE_DIR, hex);
+	if (mkdir(newpath, 0755) < 0 && errno != EEXIST) {
+		return -1;
+	}
+
+	snprintf(newpath, sizeof newpath, "%s/%s", IMAGE_DIR, relpath);
+
+	if (rename(path, newpath) < 0) {
+		ERR("couldn't move '%s' into the image store: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	printf("moved %s to %s\n", path, newpath);
+
+	return 0;
+}
+
+// image_send_cb : protocol handler while an image is going out, a sendfile at a time
+static void image_send_cb(struct mg_connection *conn, int ev, void *ev_data, void *fn_data)
+{
+	ImageSend *send = fn_data;
+	ssize_t n;
+
+	if (ev == MG_EV_POLL || ev == MG_EV_WRITE) {
+		// the headers (or anything else ahead of us) have to go out first
+		if (conn->send.len > 0) {
+			return;
+		}
+
+		// NOTE (Brian) the socket's non-blocking, so this stops at EAGAIN, and the epoll is edge
+		// triggered on EPOLLOUT, so the loop wakes back up (MG_EV_POLL) as soon as there's room
+		while (send->offset < send->end) {
+			n = sendfile((int)(size_t)conn->fd, send->fd, &send->offset, MIN(send->end - send->offset, IMAGE_SEND));
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				return;
+			}
+
+			// an error, or the file got shorter, either way the response can't be finished
+			if (n <= 0) {
+				ERR("sendfile failed part of the way through an image: %s\n", n < 0 ? strerror(errno) : "short file");
+				conn->is_draining = 1;
+				break;
+			}
+		}
+	} else if (ev != MG_EV_CLOSE) {
+		return;
+	}
+
+	conn->pfn = send->pfn;
+	conn->pfn_data = send->pfn_data;
+	conn->is_polling = 0;
+
+	close(send->fd);
+	free(send);
+}
+
+// image_range : parses a 'Range' header into [start, end), 0 for a whole file, -1 if it's unsatisfiable
+static int image_range(struct mg_str *header, off_t size, off_t *start, off_t *end)
+{
+	char tbuf[BUFSMALL];
+	long long a, b;
+
+	snprintf(tbuf, sizeof tbuf, "%.*s", (int)header->len, header->ptr);
+
+	// one range, 'bytes=a-b', 'bytes=a-', or 'bytes=-n', anything else gets the whole file. So does an
+	// empty file, there's no range of it to send (and 'bytes=-n' would come out as 0 to -1).
+	if (strchr(tbuf, ',') != NULL || size == 0) {
+		return 0;
+	}
+
+	// the suffix form goes first, %lld would read the '-' as a sign
+	if (strncmp(tbuf, "bytes=-", 7) == 0) {
+		if (sscanf(tbuf, "bytes=-%lld", &b) != 1) {
+			return 0;
+		}
+		if (b <= 0) {
+			return -1;
+		}
+		*start = size - MIN(b, size);
+		*end = size;
+	} else if (sscanf(tbuf, "bytes=%lld-%lld", &a, &b) == 2) {
+		// NOTE (Brian) a > b isn't an unsatisfiable range, it's an invalid one, and RFC 7233 says to
+		// ignore those (a 200, with the whole thing)
+		if (a < 0 || a > b) {
+			return 0;
+		}
+		if (a >= size) {
+			return -1;
+		}
+		*start = a;
+		*end = MIN(b + 1, size);
+	} else if (sscanf(tbuf, "bytes=%lld-", &a) == 1 && a >= 0) {
+		if (a >= size) {
+			return -1;
+		}
+		*start = a;
+		*end = size;
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,50 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+// Brian Chrzanowski
+// 2026-10-17 18:40:02
+
+#include "common.h"
+
+#include <magic.h>
+
+#include "mongoose.h"
+
+#include "route.h"
+
+// IMAGE_JSON : a SQL expression for the image in table alias 'I_', with its variants (see RECIPE_JSON)
+//
+// NOTE (Brian) 'width' / 'height' / 'placeholder' are null until thumb.c gets to it, and so are the
+// sizes of anything it couldn't decode (those are 0 in the table). 'variants' are widest first.
+#define IMAGE_JSON(I_) \
+	"json_object(" \
+	"'height', nullif(" I_ ".height, 0)" \
+	", 'id', uuid_str(" I_ ".id)" \
+	", 'mime', " I_ ".mime" \
+	", 'placeholder', " I_ ".placeholder" \
+	", 'size', " I_ ".size" \
+	", 'url', '/api/v1/image/' || lower(hex(" I_ ".hash))" \
+	", 'variants', json((select json_group_array(json_object('height', v.height, 'url', '/api/v1/image/' || lower(hex(v.hash)) || '?w=' || v.width, 'width', v.width))" \
+	" from (select * from image_variants v where v.hash = " I_ ".hash order by v.width desc) v))" \
+	", 'width', nullif(" I_ ".width, 0)" \
+	")"
+
+// image_init : makes the image directories, and cleans out anything a crash left in tmp/
+int image_init(char *dir, magic_t cookie);
+
+// image_api_post : endpoint, POST - /api/v1/recipe/:id/image (when the whole body showed up at once)
+int image_api_post(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
+
+// image_api_chunk : streaming endpoint, POST - /api/v1/recipe/:id/image (MG_EV_HTTP_CHUNK)
+int image_api_chunk(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
+
+// image_api_get : endpoint, GET / HEAD - /api/v1/image/:hash
+int image_api_get(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
+
+// image_poll : tries the transaction again for the upload on 'conn', if it found the database locked (MG_EV_POLL)
+void image_poll(struct mg_connection *conn);
+
+// image_close : throws away the upload on 'conn', if there is one (MG_EV_CLOSE)
+void image_close(struct mg_connection *conn);
+
+#endif // IMAGE_H
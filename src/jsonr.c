@@ -0,0 +1,465 @@
+// Brian Chrzanowski
+// 2026-10-18 05:41:19
+//
+// Streaming JSON Reader
+//
+// The other half of jsonw.c. Reading a recipe used to be json_loads (which builds a tree of json_t's,
+// with an allocation and a hash table insert for every key and value), then a json_object_get (a
+// hash and a lookup) for every field a recipe can have, then a strdup of every string out of the
+// tree, and then freeing the tree. Nearly all of that was building the tree.
+//
+// This reads the text in place instead, a value at a time, and the caller decides what to do with
+// each one as it comes to it: take a copy of a string, walk into an array, or skip it. Nothing gets
+// allocated but the strings that are kept.
+//
+// It's as strict as jansson was: one value, with nothing after it, strings have to be UTF-8, with no
+// raw control characters, no \u0000, and no unpaired surrogates.
+//
+// NOTE (Brian) numbers are checked, but never converted, nothing here needs them.
+
+#include "common.h"
+
+#include "jsonr.h"
+
+// jsonr_ws: skips whitespace
+static void jsonr_ws(JsonReader *r);
+// jsonr_open: reads past the 'c' that opens an object or array, -1 if that isn't what's next
+static int jsonr_open(JsonReader *r, char c);
+// jsonr_more: reads past the comma before the next item, 1 if there is one, 0 (after 'close') if there isn't, -1 on error
+static int jsonr_more(JsonReader *r, char close);
+// jsonr_span: the number of bytes inside of the string starting at r->s (escaped, as they are), -1 if it doesn't end
+static ssize_t jsonr_span(JsonReader *r);
+// jsonr_decode: reads the string at r->s, writing it unescaped (and NUL terminated) to 'out' if it isn't NULL, -1 on error
+static int jsonr_decode(JsonReader *r, char *out);
+// jsonr_hex4: the value of the 4 hex digits at 's', -1 if they aren't
+static int jsonr_hex4(const char *s);
+// jsonr_number: reads past a number, -1 if it isn't one
+static int jsonr_number(JsonReader *r);
+// jsonr_literal: reads past 'lit', -1 if it isn't next
+static int jsonr_literal(JsonReader *r, const char *lit, size_t len);
+
+// jsonr_init: starts reading the 'len' bytes at 's'
+void jsonr_init(JsonReader *r, const char *s, size_t len)
+{
+	r->s = s;
+	r->end = s + len;
+	r->first = true;
+	r->depth = 0;
+}
+
+// jsonr_peek: the first character of the next value ('{', '[', '"', or anything else for a scalar), 0 at the end
+int jsonr_peek(JsonReader *r)
+{
+	jsonr_ws(r);
+	return r->s < r->end ? (u8)*r->s : 0;
+}
+
+// jsonr_object: starts reading an object, -1 if the next value isn't one
+int jsonr_object(JsonReader *r)
+{
+	return jsonr_open(r, '{');
+}
+
+// jsonr_key: reads the next key of the object into 'key' (as "" if it doesn't fit), 1 if there is one, 0 at the end, -1 on error
+int jsonr_key(JsonReader *r, char *key, size_t len)
+{
+	ssize_t raw;
+	int rc;
+
+	rc = jsonr_more(r, '}');
+	if (rc <= 0) {
+		return rc;
+	}
+
+	if (r->s >= r->end || *r->s != '"' || (raw = jsonr_span(r)) < 0) {
+		return -1;
+	}
+
+	// unescaping never makes a string longer, so if the raw bytes fit, so does the key
+	if ((size_t)raw < len) {
+		rc = jsonr_decode(r, key);
+	} else {
+		rc = jsonr_decode(r, NULL);
+		if (len > 0) {
+			key[0] = '\0';
+		}
+	}
+
+	if (rc < 0) {
+		return -1;
+	}
+
+	jsonr_ws(r);
+
+	if (r->s >= r->end || *r->s != ':') {
+		return -1;
+	}
+	r->s++;
+
+	return 1;
+}
+
+// jsonr_array: starts reading an array, -1 if the next value isn't one
+int jsonr_array(JsonReader *r)
+{
+	return jsonr_open(r, '[');
+}
+
+// jsonr_next: 1 if there's another value in the array, 0 at the end, -1 on error
+int jsonr_next(JsonReader *r)
+{
+	return jsonr_more(r, ']');
+}
+
+// jsonr_string: reads the next value, which has to be a string, into a new allocation, NULL on error
+char *jsonr_string(JsonReader *r)
+{
+	ssize_t raw;
+	char *s;
+
+	jsonr_ws(r);
+
+	if (r->s >= r->end || *r->s != '"' || (raw = jsonr_span(r)) < 0) {
+		return NULL;
+	}
+
+	s = malloc(raw + 1);
+	if (s == NULL) {
+		return NULL;
+	}
+
+	if (jsonr_decode(r, s) < 0) {
+		free(s);
+		return NULL;
+	}
+
+	return s;
+}
+
+// jsonr_skip: reads past the next value, whatever it is, -1 if it isn't valid JSON
+int jsonr_skip(JsonReader *r)
+{
+	int rc;
+
+	switch (jsonr_peek(r)) {
+		case '"':
+			return jsonr_decode(r, NULL);
+
+		case '{':
+			if (jsonr_object(r) < 0) {
+				return -1;
+			}
+			while ((rc = jsonr_key(r, NULL, 0)) > 0) {
+				if (jsonr_skip(r) < 0) {
+					return -1;
+				}
+			}
+			return rc;
+
+		case '[':
+			if (jsonr_array(r) < 0) {
+				return -1;
+			}
+			while ((rc = jsonr_next(r)) > 0) {
+				if (jsonr_skip(r) < 0) {
+					return -1;
+				}
+			}
+			return rc;
+
+		case 't': return jsonr_literal(r, "true", 4);
+		case 'f': return jsonr_literal(r, "false", 5);
+		case 'n': return jsonr_literal(r, "null", 4);
+
+		default:
+			return jsonr_number(r);
+	}
+}
+
+// jsonr_end: 0 if there's nothing but whitespace left, -1 if there is
+int jsonr_end(JsonReader *r)
+{
+	jsonr_ws(r);
+	return r->s == r->end ? 0 : -1;
+}
+
+// jsonr_ws: skips whitespace
+static void jsonr_ws(JsonReader *r)
+{
+	while (r->s < r->end && (*r->s == ' ' || *r->s == '\n' || *r->s == '\r' || *r->s == '\t')) {
+		r->s++;
+	}
+}
+
+// jsonr_open: reads past the 'c' that opens an object or array, -1 if that isn't what's next
+static int jsonr_open(JsonReader *r, char c)
+{
+	jsonr_ws(r);
+
+	if (r->s >= r->end || *r->s != c || r->depth >= JSONR_MAX_DEPTH) {
+		return -1;
+	}
+
+	r->s++;
+	r->depth++;
+	r->first = true;
+
+	return 0;
+}
+
+// jsonr_more: reads past the comma before the next item, 1 if there is one, 0 (after 'close') if there isn't, -1 on error
+static int jsonr_more(JsonReader *r, char close)
+{
+	jsonr_ws(r);
+
+	if (r->s >= r->end) {
+		return -1;
+	}
+
+	// NOTE (Brian) whatever this closes was an item of the one it's in, so that one's not first either
+	if (*r->s == close) {
+		r->s++;
+		r->depth--;
+		r->first = false;
+		return 0;
+	}
+
+	if (!r->first) {
+		if (*r->s != ',') {
+			return -1;
+		}
+		r->s++;
+		jsonr_ws(r);
+	}
+
+	r->first = false;
+
+	return 1;
+}
+
+// jsonr_span: the number of bytes inside of the string starting at r->s (escaped, as they are), -1 if it doesn't end
+static ssize_t jsonr_span(JsonReader *r)
+{
+	const char *p;
+
+	for (p = r->s + 1; p < r->end; p++) {
+		if (*p == '"') {
+			return p - (r->s + 1);
+		} else if (*p == '\\') {
+			p++;
+		}
+	}
+
+	return -1;
+}
+
+// jsonr_decode: reads the string at r->s, writing it unescaped (and NUL terminated) to 'out' if it isn't NULL, -1 on error
+static int jsonr_decode(JsonReader *r, char *out)
+{
+	const char *p = r->s + 1;
+	const char *end = r->end;
+	char *o = out;
+	u8 c;
+	int cp, lo;
+	int n;
+
+	// NOTE (Brian) 'out' only ever gets less than what was read, so it's fine as long as it has room
+	// for what jsonr_span said, and the NUL
+#define PUT(C_) do { if (o) *o++ = (C_); } while (0)
+
+	for (;;) {
+		if (p >= end) {
+			return -1;
+		}
+
+		c = *p;
+
+		if (c == '"') {
+			p++;
+			break;
+		}
+
+		if (c < 0x20) {
+			return -1;
+		}
+
+		if (c < 0x80 && c != '\\') {
+			PUT(c);
+			p++;
+			continue;
+		}
+
+		if (c == '\\') {
+			if (p + 1 >= end) {
+				return -1;
+			}
+
+			switch (p[1]) {
+				case '"':  PUT('"'); break;
+				case '\\': PUT('\\'); break;
+				case '/':  PUT('/'); break;
+				case 'b':  PUT('\b'); break;
+				case 'f':  PUT('\f'); break;
+				case 'n':  PUT('\n'); break;
+				case 'r':  PUT('\r'); break;
+				case 't':  PUT('\t'); break;
+
+				case 'u':
+					if (end - p < 6 || (cp = jsonr_hex4(p + 2)) < 0) {
+						return -1;
+					}
+					p += 4;
+
+					// a high surrogate has to be followed by a low one, and a low one can't be on its own
+					if (cp >= 0xd800 && cp <= 0xdbff) {
+						if (end - p < 8 || p[2] != '\\' || p[3] != 'u' || (lo = jsonr_hex4(p + 4)) < 0 ||
+							lo < 0xdc00 || lo > 0xdfff) {
+							return -1;
+						}
+						cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+						p += 6;
+					} else if ((cp >= 0xdc00 && cp <= 0xdfff) || cp == 0) {
+						return -1;
+					}
+
+					if (cp < 0x80) {
+						PUT(cp);
+					} else if (cp < 0x800) {
+						PUT(0xc0 | (cp >> 6));
+						PUT(0x80 | (cp & 0x3f));
+					} else if (cp < 0x10000) {
+						PUT(0xe0 | (cp >> 12));
+						PUT(0x80 | ((cp >> 6) & 0x3f));
+						PUT(0x80 | (cp & 0x3f));
+					} else {
+						PUT(0xf0 | (cp >> 18));
+						PUT(0x80 | ((cp >> 12) & 0x3f));
+						PUT(0x80 | ((cp >> 6) & 0x3f));
+						PUT(0x80 | (cp & 0x3f));
+					}
+					break;
+
+				default:
+					return -1;
+			}
+
+			p += 2;
+			continue;
+		}
+
+		// UTF-8, the shortest form only, and nothing past U+10FFFF or in the surrogates
+		if (c >= 0xc2 && c <= 0xdf) {
+			n = 2;
+		} else if (c >= 0xe0 && c <= 0xef) {
+			n = 3;
+		} else if (c >= 0xf0 && c <= 0xf4) {
+			n = 4;
+		} else {
+			return -1;
+		}
+
+		if (end - p < n) {
+			return -1;
+		}
+
+		for (int i = 1; i < n; i++) {
+			if (((u8)p[i] & 0xc0) != 0x80) {
+				return -1;
+			}
+		}
+
+		if ((c == 0xe0 && (u8)p[1] < 0xa0) || (c == 0xed && (u8)p[1] > 0x9f) ||
+			(c == 0xf0 && (u8)p[1] < 0x90) || (c == 0xf4 && (u8)p[1] > 0x8f)) {
+			return -1;
+		}
+
+		for (int i = 0; i < n; i++) {
+			PUT(p[i]);
+		}
+		p += n;
+	}
+
+	PUT('\0');
+
+#undef PUT
+
+	r->s = p;
+
+	return 0;
+}
+
+// jsonr_hex4: the value of the 4 hex digits at 's', -1 if they aren't
+static int jsonr_hex4(const char *s)
+{
+	int v = 0;
+
+	for (int i = 0; i < 4; i++) {
+		char c = s[i];
+
+		if (c >= '0' && c <= '9') {
+			v = v << 4 | (c - '0');
+		} else if (c >= 'a' && c <= 'f') {
+			v = v << 4 | (c - 'a' + 10);
+		} else if (c >= 'A' && c <= 'F') {
+			v = v << 4 | (c - 'A' + 10);
+		} else {
+			return -1;
+		}
+	}
+
+	return v;
+}
+
+// jsonr_number: reads past a number, -1 if it isn't one
+static int jsonr_number(JsonReader *r)
+{
+	const char *p = r->s;
+	const char *end = r->end;
+
+	if (p < end && *p == '-') {
+		p++;
+	}
+
+	if (p < end && *p == '0') {
+		p++;
+	} else if (p < end && *p >= '1' && *p <= '9') {
+		while (p < end && isdigit((u8)*p)) p++;
+	} else {
+		return -1;
+	}
+
+	if (p < end && *p == '.') {
+		p++;
+		if (p >= end || !isdigit((u8)*p)) {
+			return -1;
+		}
+		while (p < end && isdigit((u8)*p)) p++;
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		if (p < end && (*p == '+' || *p == '-')) {
+			p++;
+		}
+		if (p >= end || !isdigit((u8)*p)) {
+			return -1;
+		}
+		while (p < end && isdigit((u8)*p)) p++;
+	}
+
+	r->s = p;
+
+	return 0;
+}
+
+// jsonr_literal: reads past 'lit', -1 if it isn't next
+static int jsonr_literal(JsonReader *r, const char *lit, size_t len)
+{
+	if ((size_t)(r->end - r->s) < len || memcmp(r->s, lit, len) != 0) {
+		return -1;
+	}
+
+	r->s += len;
+
+	return 0;
+}
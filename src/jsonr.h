@@ -0,0 +1,38 @@
+#ifndef JSONR_H
+#define JSONR_H
+
+// Brian Chrzanowski
+// 2026-10-18 05:41:19
+
+#include "common.h"
+
+#define JSONR_MAX_DEPTH (2048) // same as jansson's
+
+// JsonReader: reads JSON text one value at a time, without building anything, see jsonr.c
+typedef struct JsonReader {
+	const char *s;
+	const char *end;
+	int first; // nothing's been read out of the object/array we're in yet
+	int depth;
+} JsonReader;
+
+// jsonr_init: starts reading the 'len' bytes at 's'
+void jsonr_init(JsonReader *r, const char *s, size_t len);
+// jsonr_peek: the first character of the next value ('{', '[', '"', or anything else for a scalar), 0 at the end
+int jsonr_peek(JsonReader *r);
+// jsonr_object: starts reading an object, -1 if the next value isn't one
+int jsonr_object(JsonReader *r);
+// jsonr_key: reads the next key of the object into 'key' (as "" if it doesn't fit), 1 if there is one, 0 at the end, -1 on error
+int jsonr_key(JsonReader *r, char *key, size_t len);
+// jsonr_array: starts reading an array, -1 if the next value isn't one
+int jsonr_array(JsonReader *r);
+// jsonr_next: 1 if there's another value in the array, 0 at the end, -1 on error
+int jsonr_next(JsonReader *r);
+// jsonr_string: reads the next value, which has to be a string, into a new allocation, NULL on error
+char *jsonr_string(JsonReader *r);
+// jsonr_skip: reads past the next value, whatever it is, -1 if it isn't valid JSON
+int jsonr_skip(JsonReader *r);
+// jsonr_end: 0 if there's nothing but whitespace left, -1 if there is
+int jsonr_end(JsonReader *r);
+
+#endif // JSONR_H
@@ -0,0 +1,302 @@
+// Brian Chrzanowski
+// 2026-10-17 13:30:52
+//
+// Streaming JSON Writer
+//
+// Search results used to go row -> json_t tree -> json_dumps string -> mg_http_reply, which is three
+// copies of the page, and a handful of tiny allocations per column. This writes the JSON text out
+// directly from sqlite3_column_text instead, through one fixed size buffer.
+//
+// If the whole response fits in that buffer, it goes out as a normal response with a
+// Content-Length. Once the buffer fills up, the response switches over to chunked transfer
+// encoding, and each full buffer becomes one chunk. Either way, the memory used doesn't depend on
+// the size of the page.
+//
+// A client that takes gzip gets the chunked ones compressed as they go: each buffer goes through one
+// deflate stream on its way out, and whatever that's produced by then is the chunk. A response that
+// fits in the buffer is left for gzip_response, like everything else.
+//
+// NOTE (Brian) once the first chunk is out, the status line is gone too, so an error part way
+// through can't be a 500 anymore. In that case we stop writing and hang up without the final
+// chunk, which clients will see as a truncated response (as they should).
+
+#include "common.h"
+
+#include <zlib.h>
+
+#include "mongoose.h"
+#include "sqlite3.h"
+
+#include "gzip.h"
+#include "jsonw.h"
+
+// jsonw_flush: sends the buffer, switching over to chunked encoding if this isn't the end
+static void jsonw_flush(JsonWriter *w, int last);
+// jsonw_deflate: sends the buffer as however much compressed output it makes, finishing the stream if 'last'
+static void jsonw_deflate(JsonWriter *w, int last);
+// jsonw_hex: writes the 'len' bytes at 'p' as a quoted string of lowercase hex
+static void jsonw_hex(JsonWriter *w, const u8 *p, size_t len);
+
+// jsonw_begin: starts a 200 response to 'hm' on 'conn', with compression counted under 'route'
+void jsonw_begin(JsonWriter *w, struct mg_connection *conn, struct mg_http_message *hm, char *route)
+{
+	w->conn = conn;
+	w->chunked = false;
+	w->gzip = mg_vcasecmp(&hm->method, "HEAD") != 0 && gzip_accepts(hm);
+	w->route = route;
+	w->in = 0;
+	w->out = 0;
+	w->cpu = 0;
+	w->len = 0;
+}
+
+// jsonw_raw: writes 'len' bytes as-is
+void jsonw_raw(JsonWriter *w, const char *s, size_t len)
+{
+	while (len > 0) {
+		size_t n = MIN(len, sizeof(w->buf) - w->len);
+
+		memcpy(w->buf + w->len, s, n);
+		w->len += n;
+		s += n;
+		len -= n;
+
+		if (w->len == sizeof(w->buf)) {
+			jsonw_flush(w, false);
+		}
+	}
+}
+
+// jsonw_printf: writes formatted output as-is (keep it short, it goes through a small buffer)
+void jsonw_printf(JsonWriter *w, const char *fmt, ...)
+{
+	char tmp[BUFSMALL];
+	va_list args;
+	int n;
+
+	va_start(args, fmt);
+	n = vsnprintf(tmp, sizeof tmp, fmt, args);
+	va_end(args);
+
+	if (n > 0) {
+		jsonw_raw(w, tmp, MIN((size_t)n, sizeof(tmp) - 1));
+	}
+}
+
+// jsonw_string: writes 's' as a quoted, escaped JSON string
+void jsonw_string(JsonWriter *w, const char *s, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t run = 0;
+	char esc[6];
+
+	jsonw_raw(w, "\"", 1);
+
+	// NOTE (Brian) text out of SQLite is already UTF-8, so only the quote, the backslash, and the
+	// control characters need escaping. Everything else is copied over in runs.
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = s[i];
+
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+
+		jsonw_raw(w, s + run, i - run);
+		run = i + 1;
+
+		switch (c) {
+			case '"':  jsonw_raw(w, "\\\"", 2); break;
+			case '\\': jsonw_raw(w, "\\\\", 2); break;
+			case '\b': jsonw_raw(w, "\\b", 2); break;
+			case '\f': jsonw_raw(w, "\\f", 2); break;
+			case '\n': jsonw_raw(w, "\\n", 2); break;
+			case '\r': jsonw_raw(w, "\\r", 2); break;
+			case '\t': jsonw_raw(w, "\\t", 2); break;
+			default:
+				memcpy(esc, "\\u00", 4);
+				esc[4] = hex[c >> 4];
+				esc[5] = hex[c & 0xf];
+				jsonw_raw(w, esc, sizeof esc);
+				break;
+		}
+	}
+
+	jsonw_raw(w, s + run, len - run);
+	jsonw_raw(w, "\"", 1);
+}
+
+// jsonw_end: finishes the response
+void jsonw_end(JsonWriter *w)
+{
+	jsonw_flush(w, true);
+}
+
+// jsonw_abort: gives up on the response, with a 500 if nothing has been sent yet
+void jsonw_abort(JsonWriter *w)
+{
+	if (w->chunked) {
+		w->conn->is_draining = 1;
+	} else {
+		mg_http_reply(w->conn, 500, NULL, "");
+	}
+
+	if (w->chunked && w->gzip) {
+		deflateEnd(&w->z);
+		w->gzip = false;
+	}
+
+	w->len = 0;
+}
+
+// jsonw_row: writes the current row of 'stmt' as an object, using the first 'ncols' columns
+void jsonw_row(JsonWriter *w, sqlite3_stmt *stmt, int ncols)
+{
+	jsonw_raw(w, "{", 1);
+	jsonw_columns(w, stmt, ncols);
+	jsonw_raw(w, "}", 1);
+}
+
+// jsonw_columns: writes the first 'ncols' columns of the current row as "name":value pairs, without the braces
+void jsonw_columns(JsonWriter *w, sqlite3_stmt *stmt, int ncols)
+{
+	for (int i = 0; i < ncols; i++) {
+		const char *name = sqlite3_column_name(stmt, i);
+
+		if (i > 0) jsonw_raw(w, ",", 1);
+		jsonw_string(w, name, strlen(name));
+		jsonw_raw(w, ":", 1);
+
+		switch (sqlite3_column_type(stmt, i)) {
+			case SQLITE_INTEGER:
+				jsonw_printf(w, "%lld", sqlite3_column_int64(stmt, i));
+				break;
+
+			case SQLITE_FLOAT:
+				jsonw_printf(w, "%.17g", sqlite3_column_double(stmt, i));
+				break;
+
+			case SQLITE_TEXT:
+				jsonw_string(w, (const char *)sqlite3_column_text(stmt, i), sqlite3_column_bytes(stmt, i));
+				break;
+
+			case SQLITE_BLOB:
+				// NOTE (Brian) ids are blobs, and anything going out to the API should select them
+				// through uuid_str, but one that doesn't still has to be valid JSON
+				jsonw_hex(w, sqlite3_column_blob(stmt, i), sqlite3_column_bytes(stmt, i));
+				break;
+
+			case SQLITE_NULL:
+			default:
+				jsonw_raw(w, "null", 4);
+				break;
+		}
+	}
+}
+
+// jsonw_hex: writes the 'len' bytes at 'p' as a quoted string of lowercase hex
+static void jsonw_hex(JsonWriter *w, const u8 *p, size_t len)
+{
+	static const char digits[] = "0123456789abcdef";
+	char tmp[BUFSMALL];
+	size_t n = 0;
+
+	jsonw_raw(w, "\"", 1);
+
+	for (size_t i = 0; i < len; i++) {
+		tmp[n++] = digits[p[i] >> 4];
+		tmp[n++] = digits[p[i] & 0xf];
+
+		if (n == sizeof tmp) {
+			jsonw_raw(w, tmp, n);
+			n = 0;
+		}
+	}
+
+	jsonw_raw(w, tmp, n);
+	jsonw_raw(w, "\"", 1);
+}
+
+// jsonw_flush: sends the buffer, switching over to chunked encoding if this isn't the end
+static void jsonw_flush(JsonWriter *w, int last)
+{
+	if (!w->chunked && last) {
+		mg_printf(w->conn, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n", w->len);
+		mg_send(w->conn, w->buf, w->len);
+		w->len = 0;
+		return;
+	}
+
+	// it's been given up on, nothing else goes out
+	if (w->chunked && w->conn->is_draining) {
+		w->len = 0;
+		return;
+	}
+
+	if (!w->chunked) {
+		if (w->gzip) {
+			memset(&w->z, 0, sizeof w->z);
+			w->gzip = deflateInit2(&w->z, gzip_level(), Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+		}
+
+		mg_printf(w->conn, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n%sTransfer-Encoding: chunked\r\n\r\n",
+			w->gzip ? "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n" : "");
+		w->chunked = true;
+	}
+
+	if (w->gzip) {
+		jsonw_deflate(w, last);
+	} else if (w->len > 0) {
+		mg_http_write_chunk(w->conn, w->buf, w->len);
+		w->len = 0;
+	}
+
+	if (last && !w->conn->is_draining) {
+		mg_http_write_chunk(w->conn, "", 0);
+	}
+}
+
+// jsonw_deflate: sends the buffer as however much compressed output it makes, finishing the stream if 'last'
+static void jsonw_deflate(JsonWriter *w, int last)
+{
+	u64 cpu;
+	size_t n;
+	int rc;
+
+	// NOTE (Brian) there's no flush between buffers, so deflate holds on to what it hasn't made a
+	// block out of yet, and a buffer can come out as nothing at all. Flushing each one would get
+	// the bytes out sooner, but it'd cost a block boundary (and some of the ratio) every 16K.
+
+	cpu = gzip_cputime();
+
+	w->z.next_in = (u8 *)w->buf;
+	w->z.avail_in = w->len;
+	w->in += w->len;
+	w->len = 0;
+
+	do {
+		w->z.next_out = w->zbuf;
+		w->z.avail_out = sizeof(w->zbuf);
+
+		rc = deflate(&w->z, last ? Z_FINISH : Z_NO_FLUSH);
+		if (rc != Z_OK && rc != Z_STREAM_END) {
+			ERR("deflate failed: %d\n", rc);
+			w->conn->is_draining = 1;
+			deflateEnd(&w->z);
+			w->gzip = false;
+			return;
+		}
+
+		n = sizeof(w->zbuf) - w->z.avail_out;
+		if (n > 0) {
+			mg_http_write_chunk(w->conn, (char *)w->zbuf, n);
+			w->out += n;
+		}
+	} while (last ? rc != Z_STREAM_END : w->z.avail_out == 0);
+
+	w->cpu += gzip_cputime() - cpu;
+
+	if (last) {
+		deflateEnd(&w->z);
+		gzip_record(w->route, w->in, w->out, w->cpu);
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef JSONW_H
+#define JSONW_H
+
+// Brian Chrzanowski
+// 2026-10-17 13:30:52
+
+#include "common.h"
+
+#include <zlib.h>
+
+#include "mongoose.h"
+
+struct sqlite3_stmt;
+
+#define JSONW_BUFSIZE (16 * 1024)
+
+// JsonWriter: writes JSON into a connection a buffer at a time, see jsonw.c
+typedef struct JsonWriter {
+	struct mg_connection *conn;
+	int chunked;
+	int gzip;    // the client takes it, so a chunked response goes out compressed
+	char *route; // what the compression is counted under, see gzip_record
+	z_stream z;  // once it's chunked and compressed
+	size_t in;   // bytes that went into 'z'
+	size_t out;  // and came out
+	u64 cpu;     // ns, spent in deflate
+	size_t len;
+	char buf[JSONW_BUFSIZE];
+	u8 zbuf[JSONW_BUFSIZE];
+} JsonWriter;
+
+// jsonw_begin: starts a 200 response to 'hm' on 'conn', with compression counted under 'route'
+void jsonw_begin(JsonWriter *w, struct mg_connection *conn, struct mg_http_message *hm, char *route);
+// jsonw_raw: writes 'len' bytes as-is
+void jsonw_raw(JsonWriter *w, const char *s, size_t len);
+// jsonw_printf: writes formatted output as-is (keep it short, it goes through a small buffer)
+void jsonw_printf(JsonWriter *w, const char *fmt, ...);
+// jsonw_string: writes 's' as a quoted, escaped JSON string
+void jsonw_string(JsonWriter *w, const char *s, size_t len);
+// jsonw_end: finishes the response
+void jsonw_end(JsonWriter *w);
+// jsonw_abort: gives up on the response, with a 500 if nothing has been sent yet
+void jsonw_abort(JsonWriter *w);
+
+// jsonw_row: writes the current row of 'stmt' as an object, using the first 'ncols' columns
+void jsonw_row(JsonWriter *w, struct sqlite3_stmt *stmt, int ncols);
+// jsonw_columns: writes the first 'ncols' columns of the current row as "name":value pairs, without the braces
+void jsonw_columns(JsonWriter *w, struct sqlite3_stmt *stmt, int ncols);
+
+#endif // JSONW_H
@@ -25,6 +25,8 @@
 // 4. DELETE/DELETE Performance
 // 5. SEARCH      Performance (pagination, etc.)
 //
+// NOTE (Brian) bench/load does all of these now (make bench), and spits out JSON that we can diff.
+//
 // UI TODO
 //
 // - tags should be a dropdown.
@@ -44,7 +46,9 @@
 #include "common.h"
 
 #include <unistd.h>
+#include <getopt.h>
 #include <sys/types.h>
+#include <sys/resource.h>
 
 #include <magic.h>
 #include <sodium.h>
@@ -60,12 +64,44 @@
 #include "recipe.h"
 #include "user.h"
 #include "tag.h"
+#include "stats.h"
+#include "worker.h"
+#include "cache.h"
+#include "migrate.h"
+#include "bulk.h"
+#include "export.h"
+#include "backup.h"
+#include "image.h"
+#include "thumb.h"
+#include "gzip.h"
+#include "assets.h"
+#include "session.h"
+#include "route.h"
 
 #define PORT (2000)
 
 static magic_t MAGIC_COOKIE;
 
-sqlite3 *DATABASE;
+// NOTE (Brian) every thread gets its own connection, see worker.c
+__thread sqlite3 *DATABASE;
+
+// the number of read-only worker threads, 0 means everything runs on the event loop
+static int WORKERS = 0;
+
+// the byte budget for the recipe response cache, 0 turns it off
+static size_t CACHE_BUDGET = 16 * 1024 * 1024;
+
+// -b, where online backups (POST /api/v1/backup, SIGUSR1) get written
+static char *BACKUP_DIR = "bak";
+
+// -i, where uploaded images are kept
+static char *IMAGE_DIR = "images";
+
+// -p, the most memory that password hashes can use at once (each one is USER_PWHASH_MEMLIMIT)
+static size_t PWHASH_BUDGET = 256 * 1024 * 1024;
+
+// -s, sessions are signed tokens instead of rows in the session table (see token.c)
+static int STATELESS = false;
 
 // init: initializes the program
 void init(char *fname);
@@ -78,6 +114,9 @@ void event_handler(struct mg_connection *conn, int ev, void *ev_data, void *fn_d
 // request_handler: the http request handler
 void request_handler(struct mg_connection *conn, struct mg_http_message *hm);
 
+// chunk_handler: hands a partial request to its streaming endpoint, if it has one
+void chunk_handler(struct mg_connection *conn, struct mg_http_message *hm);
+
 // send_file_static : sends the static data JSON blob
 int send_file_static(struct mg_connection *conn, struct mg_http_message *hm);
 // send_file_mithriljs : sends the javascript for the ui to the user
@@ -98,16 +137,17 @@ int get_codepoint(char *s);
 // xctoi: converts a hex char (ascii) to the corresponding integer value
 int xctoi(char v);
 
-#define USAGE ("USAGE: %s <dbname>\n")
+#define USAGE ("USAGE: %s [-w workers] [-c cachebytes] [-b backupdir] [-i imagedir] [-p pwhashbytes] [-s] [--export] <dbname>\n")
 #define SCHEMA ("src/schema.sql")
+#define MIGRATIONS ("src/migrations")
 
 int running;
 
-typedef struct RouteTableEntry {
-	char *key;
-	int (*value)(struct mg_connection *, struct mg_http_message *);
-} RouteTableEntry;
-RouteTableEntry *routes = NULL;
+Router routes = {0};
+
+// streaming endpoints get the body a piece at a time, as it comes in (MG_EV_HTTP_CHUNK), everything
+// else waits for the whole message
+Router stream_routes = {0};
 
 // handle_sigint: handles SIGINT so we can write to the database
 void handle_sigint(int sig)
@@ -115,37 +155,96 @@ void handle_sigint(int sig)
 	running = false;
 }
 
+int backup_requested;
+
+// handle_sigusr1: handles SIGUSR1, which asks for an online backup (started from the event loop)
+void handle_sigusr1(int sig)
+{
+	backup_requested = true;
+}
+
 int main(int argc, char **argv)
 {
 	struct mg_mgr mgr;
+	int export = false;
+	int opt;
 
-	if (argc < 2) {
+	static struct option longopts[] = {
+		{ "export", no_argument, NULL, 'e' },
+		{ 0 },
+	};
+
+	while ((opt = getopt_long(argc, argv, "w:c:b:i:p:s", longopts, NULL)) != -1) {
+		switch (opt) {
+			case 'e':
+				export = true;
+				break;
+			case 'w':
+				WORKERS = atoi(optarg);
+				break;
+			case 'c':
+				CACHE_BUDGET = strtoull(optarg, NULL, 10);
+				break;
+			case 'b':
+				BACKUP_DIR = optarg;
+				break;
+			case 'i':
+				IMAGE_DIR = optarg;
+				break;
+			case 'p':
+				PWHASH_BUDGET = strtoull(optarg, NULL, 10);
+				break;
+			case 's':
+				STATELESS = true;
+				break;
+			default:
+				fprintf(stderr, USAGE, argv[0]);
+				return 1;
+		}
+	}
+
+	if (optind >= argc || WORKERS < 0) {
 		fprintf(stderr, USAGE, argv[0]);
 		return 1;
 	}
 
-	init(argv[1]);
+	init(argv[optind]);
+
+	// --export writes every recipe out to stdout as NDJSON, instead of serving anything
+	if (export) {
+		int rc = export_file(stdout);
+		cleanup();
+		return rc < 0;
+	}
 
 	signal(SIGINT, handle_sigint);
+	signal(SIGUSR1, handle_sigusr1);
 
-	sh_new_strdup(routes);
+	route_add(&routes, "POST /api/v1/recipe", recipe_api_post);
+	route_add(&routes, "POST /api/v1/recipe/bulk", bulk_api_post);
+	route_add(&routes, "GET /api/v1/recipe/export", export_api_get);
+	route_add(&routes, "GET /api/v1/recipe/list", recipe_api_getlist);
+	route_add(&routes, "GET /api/v1/recipe/:id", recipe_api_get);
+	route_add(&routes, "PUT /api/v1/recipe/:id", recipe_api_put);
+	route_add(&routes, "DELETE /api/v1/recipe/:id", recipe_api_delete);
+	route_add(&routes, "POST /api/v1/recipe/:id/image", image_api_post);
+	route_add(&routes, "GET /api/v1/image/:hash", image_api_get);
+	route_add(&routes, "HEAD /api/v1/image/:hash", image_api_get);
 
-	shput(routes, "POST /api/v1/recipe", (void *)recipe_api_post);
-	shput(routes, "GET /api/v1/recipe/list", (void *)recipe_api_getlist);
-	shput(routes, "GET /api/v1/recipe/:id", (void *)recipe_api_get);
-	shput(routes, "PUT /api/v1/recipe/:id", (void *)recipe_api_put);
-	shput(routes, "DELETE /api/v1/recipe/:id", (void *)recipe_api_delete);
+	route_add(&routes, "POST /api/v1/newuser", user_api_newuser);
+	route_add(&routes, "POST /api/v1/login", user_api_login);
+	route_add(&routes, "POST /api/v1/logout", user_api_logout);
+	route_add(&routes, "GET /api/v1/whoami", user_api_whoami);
 
-	shput(routes, "POST /api/v1/newuser", (void *)user_api_newuser);
-	shput(routes, "POST /api/v1/login", (void *)user_api_login);
-	shput(routes, "POST /api/v1/logout", (void *)user_api_logout);
-	shput(routes, "GET /api/v1/whoami", (void *)user_api_whoami);
+	route_add(&routes, "GET /api/v1/tags", tag_api_getlist);
 
-	shput(routes, "GET /api/v1/tags", (void *)tag_api_getlist);
+	route_add(&routes, "GET /api/v1/stats", stats_api_get);
 
-    for (size_t i = 0; i < hmlen(routes); i++) {
-        printf("K: '%s', V: %p\n", routes[i].key, routes[i].value);
-    }
+	route_add(&routes, "GET /api/v1/backup", backup_api_get);
+	route_add(&routes, "POST /api/v1/backup", backup_api_post);
+
+	route_add(&stream_routes, "POST /api/v1/recipe/bulk", bulk_api_chunk);
+	route_add(&stream_routes, "POST /api/v1/recipe/:id/image", image_api_chunk);
 
 	mg_mgr_init(&mgr);
 
@@ -155,15 +254,57 @@ int main(int argc, char **argv)
 
 	mg_http_listen(&mgr, url, event_handler, NULL);
 
+	if (WORKERS > 0 && worker_init(&mgr, argv[optind], WORKERS) < 0) {
+		ERR("Couldn't start the worker pool!\n");
+		exit(1);
+	}
+
+	// NOTE (Brian) no more threads than cores either, past that they'd just take turns
+	int hashers = MIN(PWHASH_BUDGET / USER_PWHASH_MEMLIMIT, (size_t)sysconf(_SC_NPROCESSORS_ONLN));
+	if (worker_init_pwhash(&mgr, argv[optind], MAX(hashers, 1), 10) < 0) {
+		ERR("Couldn't start the password hashing workers!\n");
+		exit(1);
+	}
+
+	if (thumb_init(argv[optind], IMAGE_DIR) < 0) {
+		ERR("Couldn't start the thumbnail thread!\n");
+		exit(1);
+	}
+
 	printf("listening on http://localhost:%d\n", PORT);
 
+	u64 loop_cpu = gzip_cputime();
+	unsigned long loop_ms = mg_millis();
+
 	for (running = true; running;) {
 		mg_mgr_poll(&mgr, 1000);
+
+		if (backup_requested) {
+			backup_requested = false;
+			backup_start();
+		}
+
+		// how much of the last second the loop spent working, the compression level follows it
+		if (mg_millis() - loop_ms >= 1000) {
+			u64 cpu = gzip_cputime();
+			gzip_load(cpu - loop_cpu, (u64)(mg_millis() - loop_ms) * 1000000);
+			loop_cpu = cpu;
+			loop_ms = mg_millis();
+		}
 	}
 
+	backup_free();
+
+	thumb_free();
+
+	worker_free();
+
+	export_shutdown();
+
 	mg_mgr_free(&mgr);
 
-	shfree(routes);
+	route_free(&routes);
+	route_free(&stream_routes);
 
     cleanup();
 
@@ -186,89 +327,91 @@ void event_handler(struct mg_connection *conn, int ev, void *ev_data, void *fn_d
 		}
 
 		case MG_EV_HTTP_CHUNK: {
-			ERR("We don't know what to do here yet! Partial Message Chunk\n");
+			chunk_handler(conn, (struct mg_http_message *)ev_data);
 			break;
 		}
 
-		default: {
+		case MG_EV_POLL: {
+			bulk_poll(conn);
+			image_poll(conn);
+			export_poll(conn);
 			break;
 		}
-	}
-}
-
-static int is_uuidv4(char *s);
-
-// format_target_string : format the incomming requets for the routing hashtable
-int format_target_string(char *s, struct mg_http_message *hm, size_t len)
-{
-	size_t buflen;
-	char *tok;
-	char *hasq;
-	char copy[BUFLARGE];
-	char readfrom[BUFLARGE];
-
-	// TODO (Brian):
-	//
-	// - make sure we uppercase (normalize, really) all of the data from the user. HTTP blows.
-	// - ensure 'len' isn't larger than BUFLARGE
 
-	assert(s != NULL);
-	assert(hm != NULL);
-
-	memset(copy, 0, sizeof copy);
-	memset(readfrom, 0, sizeof readfrom);
-
-	strncpy(readfrom, hm->uri.ptr, MIN(sizeof(readfrom), hm->uri.len));
-
-	buflen = 0;
+		case MG_EV_WRITE: {
+			export_poll(conn);
+			break;
+		}
 
-	for (tok = strtok(readfrom, "/"); tok != NULL && buflen <= len; tok = strtok(NULL, "/")) {
-		if (is_uuidv4(tok)) {
-			buflen += snprintf(copy + buflen, sizeof(copy) - buflen, "/:id");
-		} else {
-			hasq = strchr(tok, '?');
-			if (hasq) {
-				buflen += snprintf(copy + buflen, sizeof(copy) - buflen, "/%.*s", (int)(hasq - tok), tok);
-			} else {
-				buflen += snprintf(copy + buflen, sizeof(copy) - buflen, "/%s", tok);
-			}
+		case MG_EV_CLOSE: {
+			bulk_close(conn);
+			export_close(conn);
+			worker_close(conn);
+			image_close(conn);
+			break;
 		}
-	}
 
-	if (copy[0] == '\0') {
-		copy[0] = '/';
+		default: {
+			break;
+		}
 	}
-
-	snprintf(s, len, "%.*s %s", (int)hm->method.len, hm->method.ptr, copy);
-
-	return 0;
 }
 
 // request_handler: the http request handler
 void request_handler(struct mg_connection *conn, struct mg_http_message *hm)
 {
+	RouteParams params;
+	Route route;
 	int rc;
-	int (*func) (struct mg_connection *conn, struct mg_http_message *hm);
-	char buf[BUFLARGE];
-	int route_index = 0;
 
 #define SNDERR(E) send_error(conn, (E))
 #define CHKERR(E) do { if ((rc) < 0) { send_error(conn, (E)); } } while (0)
 
-	memset(buf, 0, sizeof buf);
-
-	rc = format_target_string(buf, hm, sizeof buf);
+	if (route_match(&routes, hm, &route, &params)) {
+		RouteHandler func = route.func;
+		if (func == user_api_newuser || func == user_api_login) {
+			// these hash passwords, which is far too slow for anywhere else (see worker.c), and
+			// when there's too many waiting already, they get told to come back later
+			rc = worker_submit(conn, hm, func, &params, WORKER_PWHASH, route.name);
+			if (rc < 0) {
+				mg_http_reply(conn, 503, "Retry-After: 1\r\n", "");
+				rc = 0;
+			}
+		} else if (WORKERS > 0 && func != export_api_get && func != image_api_get) {
+			// NOTE (Brian) the export and the images stream out over many event loop iterations, so
+			// they can't go through a worker (which hands back one finished response)
+			//
+			// only GETs can run on the read-only connections, everything else is a write
+			rc = worker_submit(conn, hm, func, &params,
+				mg_vcmp(&hm->method, "GET") != 0 ? WORKER_WRITE : WORKER_READ, route.name);
+		} else {
+			size_t start = conn->send.len;
 
-	printf("%s\n", buf);
+			rc = func(conn, hm, &params);
 
-	if ((route_index = shgeti(routes, buf)) >= 0) {
-		func = routes[route_index].value;
-        printf("FUNCTION POINTER: %p\n", func);
-		rc = func(conn, hm);
+			// the export compresses itself as it goes, images already are, and a recipe is sent
+			// from the cache, which keeps one compressed copy of its own
+			if (rc >= 0 && func != export_api_get && func != image_api_get && func != recipe_api_get) {
+				gzip_response(&conn->send, start, hm, route.name);
+			}
+		}
 		CHKERR(503);
 	} else {
-		struct mg_http_serve_opts opts = { .root_dir = "./html" };
-		mg_http_serve_dir(conn, hm, &opts);
+		assets_serve(conn, hm);
+	}
+}
+
+// chunk_handler: hands a partial request to its streaming endpoint, if it has one
+void chunk_handler(struct mg_connection *conn, struct mg_http_message *hm)
+{
+	RouteParams params;
+	Route route;
+
+	// NOTE (Brian) anything that isn't a streaming endpoint is left alone, and mongoose keeps
+	// buffering it until the whole message is here (or it hits MG_MAX_RECV_BUF_SIZE)
+
+	if (route_match(&stream_routes, hm, &route, &params)) {
+		route.func(conn, hm, &params);
 	}
 }
 
@@ -345,57 +488,46 @@ int send_error(struct mg_connection *conn, int errcode)
 // setup_sqlite: sets up sqlite on the global handle (DATABASE)
 int setup_sqlite(char *fname)
 {
-	char *errmsg;
 	int rc;
 
-	rc = sqlite3_open(fname, &DATABASE);
-	if (rc != SQLITE_OK) {
-		ERR("sqlite3_open error: %s\n", sqlite3_errstr(rc));
+	rc = db_open(fname, false);
+	if (rc < 0) {
 		return -1;
 	}
 
-    // read in the schema, and execute it (more involved than I'd like...)
-    {
-        size_t schema_len = 0;
-        char *schema = sys_readfile("./src/schema.sql", &schema_len);
-
-        for (char *sql = trim(schema), *next = NULL; sql && strlen(sql) > 0; sql = trim(next)) {
-            sqlite3_stmt *stmt = NULL;
-
-            rc = sqlite3_prepare_v2(DATABASE, sql, -1, &stmt, (const char **)&next);
-            if (rc != SQLITE_OK) {
-                ERR("SQL Error while bootstrapping database! %s\n", sqlite3_errstr(rc));
-                exit(1);
-            }
+	// WAL lets the read-only workers keep reading while the writer commits. This is stored in the
+	// database file itself, so every connection opened after this one picks it up.
+	rc = sqlite3_exec(DATABASE, "pragma journal_mode = wal;", NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		ERR("Couldn't put the database in WAL mode! %s\n", sqlite3_errstr(rc));
+		return -1;
+	}
 
-            rc = sqlite3_step(stmt);
-            if (rc != SQLITE_DONE) {
-                printf("RC = %d\n", rc);
-                printf("SQL %ld\n%s\n", strlen(sql), sql);
-                ERR("SQL Execution failed while bootstrapping database! %s\n", sqlite3_errstr(rc));
-                exit(1);
-            }
+	// the schema is the baseline, and it's written to be run every time we start up
+	{
+		size_t schema_len = 0;
+		char *schema = sys_readfile(SCHEMA, &schema_len);
 
-            sqlite3_finalize(stmt);
-        }
+		if (schema == NULL) {
+			ERR("Couldn't read %s!\n", SCHEMA);
+			return -1;
+		}
 
-        free(schema);
-    }
+		rc = db_exec_script(schema);
 
-	// load our various extensions
-	{
-		sqlite3_enable_load_extension(DATABASE, true);
+		free(schema);
 
-		rc = sqlite3_load_extension(DATABASE, "./sqlite3_uuid", "sqlite3_uuid_init", &errmsg);
-		if (rc == SQLITE_ERROR) {
-			ERR("Error loading 'uuid' extension: %s\n", errmsg);
-			exit(1);
+		if (rc < 0) {
+			ERR("Couldn't bootstrap the database!\n");
+			return -1;
 		}
-
-		sqlite3_enable_load_extension(DATABASE, false);
 	}
 
-    // TODO (Brian) execute migrations in the future
+	// everything after that (indexes, new columns, etc.) goes through the numbered migrations
+	rc = migrate_run(MIGRATIONS);
+	if (rc < 0) {
+		return -1;
+	}
 
 	return 0;
 }
@@ -403,8 +535,15 @@ int setup_sqlite(char *fname)
 // init : initializes the program
 void init(char *fname)
 {
+	struct rlimit rl;
 	int rc;
 
+	// every connection is a file descriptor, and with epoll we can use all of the ones we're allowed
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
 	// setup libmagic
 	MAGIC_COOKIE = magic_open(MAGIC_MIME);
 	if (MAGIC_COOKIE == NULL) {
@@ -415,6 +554,7 @@ void init(char *fname)
 	if (magic_load(MAGIC_COOKIE, NULL) != 0) {
 		fprintf(stderr, "cannot load magic database - %s\n", magic_error(MAGIC_COOKIE));
 		magic_close(MAGIC_COOKIE);
+		exit(1);
 	}
 
     rc = sodium_init();
@@ -428,68 +568,41 @@ void init(char *fname)
 		ERR("Couldn't initialize sqlite!\n");
 		exit(1);
 	}
+
+	cache_init(CACHE_BUDGET);
+
+	export_init(fname);
+
+	backup_init(fname, BACKUP_DIR);
+
+	rc = image_init(IMAGE_DIR, MAGIC_COOKIE);
+	if (rc < 0) {
+		ERR("Couldn't set up the image directory!\n");
+		exit(1);
+	}
+
+	assets_init();
+
+	if (session_init(STATELESS) < 0) {
+		ERR("Couldn't load the sessions!\n");
+		exit(1);
+	}
+
+	// NOTE (Brian) from here on, the event loop doesn't wait on anyone else's write, since everything
+	// else would wait with it. The session and token writes try again on the next tick, the streaming
+	// uploads from MG_EV_POLL, and a request that runs here (without '-w') just fails.
+	sqlite3_busy_timeout(DATABASE, DB_LOOP_BUSY_MS);
 }
 
 // cleanup: cleans up everything from 'init'
 void cleanup()
 {
-    sqlite3_close(DATABASE);
+    cache_free();
+    gzip_free();
+    assets_free();
+    // nothing's waiting on the loop anymore, and this is the last chance for the sessions to be written
+    sqlite3_busy_timeout(DATABASE, DB_BUSY_MS);
+    session_free();
+    db_close();
     magic_close(MAGIC_COOKIE);
 }
-
-// is_uuidv4: returns true if this string represents a uuidv4
-static int is_uuidv4(char *s)
-{
-    // NOTE (brian) we just write this all out - string UUIDs have a very specific representation
-#define CHECK_CHAR(x)   if (!(isxdigit(*x))) return false; x++;
-
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-
-    if (*s != '-') { return false; } s++;
-
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-
-    if (*s != '-') { return false; } s++;
-
-    // UUIDv4's have a '4' in this position
-    if (*s != '4') { return false; } s++;
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-
-    if (*s != '-') { return false; } s++;
-
-    if (!(*s == '8' || *s == '9' || toupper(*s) == 'A' || toupper(*s) == 'B')) { return false; }
-    s++;
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-
-    if (*s != '-') { return false; } s++;
-
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-    CHECK_CHAR(s);
-
-    return true;
-#undef CHECK_CHAR
-}
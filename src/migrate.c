@@ -0,0 +1,170 @@
+// Brian Chrzanowski
+// 2026-10-17 14:48:19
+//
+// Schema Migrations
+//
+// schema.sql is the baseline, and gets run on every startup (so everything in it has to be safe to
+// run twice). Anything that can't be written that way, or that's expensive enough that we only want
+// to do it once, goes into a numbered file in src/migrations:
+//
+//   src/migrations/0001_indexes.sql
+//   src/migrations/0002_whatever.sql
+//
+// The number is the version. The database remembers the last version it got to in
+// 'pragma user_version', and on startup every file with a bigger number gets run, in order, each in
+// its own transaction, with the user_version bump inside of that same transaction. So a migration
+// either happens completely, or not at all, and a failed one stops the server from starting
+// instead of leaving the database half upgraded.
+//
+// NOTE (Brian) never edit a migration after it's been deployed, write a new one.
+
+#include "common.h"
+
+#include <dirent.h>
+#include <limits.h>
+
+#include <jansson.h>
+
+#include "sqlite3.h"
+
+#include "objects.h"
+#include "migrate.h"
+
+extern __thread sqlite3 *DATABASE;
+
+// migrate_filter: scandir filter, only lets "NNNN_name.sql" through
+static int migrate_filter(const struct dirent *ent);
+// migrate_version: returns the database's user_version, -1 on error
+static int migrate_version();
+// migrate_apply: runs one migration file, and bumps user_version to 'version'
+static int migrate_apply(char *path, int version);
+
+// migrate_run: applies every migration in 'dir' newer than the database's user_version
+int migrate_run(char *dir)
+{
+	return migrate_to(dir, INT_MAX);
+}
+
+// migrate_to: applies the migrations in 'dir' newer than the user_version, up to and including 'target'
+int migrate_to(char *dir, int target)
+{
+	struct dirent **ents = NULL;
+	char path[BUFLARGE];
+	int current, version;
+	int n, rc = 0;
+
+	current = migrate_version();
+	if (current < 0) {
+		return -1;
+	}
+
+	n = scandir(dir, &ents, migrate_filter, alphasort);
+	if (n < 0) {
+		ERR("couldn't read the migrations directory '%s'!\n", dir);
+		return -1;
+	}
+
+	for (int i = 0; i < n; i++) {
+		version = atoi(ents[i]->d_name);
+
+		if (rc == 0 && version > current && version <= target) {
+			snprintf(path, sizeof path, "%s/%s", dir, ents[i]->d_name);
+
+			// NOTE (Brian) stderr, because stdout might be an export (./recipe --export)
+			fprintf(stderr, "migrating database from version %d to %d (%s)\n", current, version, ents[i]->d_name);
+
+			rc = migrate_apply(path, version);
+			if (rc == 0) {
+				current = version;
+			}
+		}
+
+		free(ents[i]);
+	}
+
+	free(ents);
+
+	return rc;
+}
+
+// migrate_filter: scandir filter, only lets "NNNN_name.sql" through
+static int migrate_filter(const struct dirent *ent)
+{
+	const char *s = ent->d_name;
+	size_t len = strlen(s);
+
+	if (len < 5 || strcmp(s + len - 4, ".sql") != 0) {
+		return false;
+	}
+
+	while (isdigit(*s)) s++;
+
+	return s != ent->d_name && *s == '_';
+}
+
+// migrate_version: returns the database's user_version, -1 on error
+static int migrate_version()
+{
+	sqlite3_stmt *stmt;
+	int version = -1;
+
+	if (sqlite3_prepare_v2(DATABASE, "pragma user_version;", -1, &stmt, NULL) != SQLITE_OK) {
+		ERR("couldn't read the database's user_version: %s\n", sqlite3_errmsg(DATABASE));
+		return -1;
+	}
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		version = sqlite3_column_int(stmt, 0);
+	}
+
+	sqlite3_finalize(stmt);
+
+	return version;
+}
+
+// migrate_apply: runs one migration file, and bumps user_version to 'version'
+static int migrate_apply(char *path, int version)
+{
+	char pragma[BUFSMALL];
+	size_t len;
+	char *sql;
+	int rc;
+
+	sql = sys_readfile(path, &len);
+	if (sql == NULL) {
+		ERR("couldn't read migration '%s'!\n", path);
+		return -1;
+	}
+
+	// NOTE (Brian) immediate, so that nothing else can sneak a write in while we're changing things
+	rc = sqlite3_exec(DATABASE, "begin immediate transaction;", NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		ERR("couldn't start the transaction for '%s': %s\n", path, sqlite3_errmsg(DATABASE));
+		free(sql);
+		return -1;
+	}
+
+	rc = db_exec_script(sql);
+
+	free(sql);
+
+	if (rc == 0) {
+		snprintf(pragma, sizeof pragma, "pragma user_version = %d;", version);
+		rc = sqlite3_exec(DATABASE, pragma, NULL, NULL, NULL) == SQLITE_OK ? 0 : -1;
+	}
+
+	if (rc < 0) {
+		ERR("migration '%s' failed, the database is still at the previous version\n", path);
+		sqlite3_exec(DATABASE, "rollback transaction;", NULL, NULL, NULL);
+		return -1;
+	}
+
+	rc = sqlite3_exec(DATABASE, "commit transaction;", NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		ERR("couldn't commit migration '%s': %s\n", path, sqlite3_errmsg(DATABASE));
+		sqlite3_exec(DATABASE, "rollback transaction;", NULL, NULL, NULL);
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef MIGRATE_H
+#define MIGRATE_H
+
+// Brian Chrzanowski
+// 2026-10-17 14:48:19
+
+#include "common.h"
+
+// migrate_run: applies every migration in 'dir' newer than the database's user_version
+int migrate_run(char *dir);
+
+// migrate_to: applies the migrations in 'dir' newer than the user_version, up to and including 'target'
+int migrate_to(char *dir, int target);
+
+#endif // MIGRATE_H
@@ -0,0 +1,22 @@
+-- Brian Chrzanowski
+-- 2026-10-17 14:48:19
+--
+-- 0001: indexes
+--
+-- Until now, there weren't any. Fetching a recipe was a full scan of recipes (for the id), and then
+-- one full scan each of ingredients, steps and tags (for the parent_id).
+
+-- the child tables are only ever read as "every row for this parent, in order", and these cover
+-- that entirely, so the table itself never gets touched on a read
+create index if not exists ingredients_parent_id on ingredients (parent_id, sorting, text);
+create index if not exists steps_parent_id on steps (parent_id, sorting, text);
+create index if not exists tags_parent_id on tags (parent_id, sorting, text);
+
+-- recipes are looked up by their uuid everywhere outside of the search
+create index if not exists recipes_id on recipes (id);
+
+-- the listing is "where delete_ts is null order by rowid", and the rowid comes along for free
+create index if not exists recipes_delete_ts on recipes (delete_ts);
+
+-- pick up the new indexes in the query planner
+analyze;
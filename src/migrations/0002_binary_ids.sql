@@ -0,0 +1,165 @@
+-- Brian Chrzanowski
+-- 2026-10-17 16:05:12
+--
+-- 0002: binary ids, integer timestamps
+--
+-- Every id (and every parent_id) was a 36 character uuid string, and every timestamp was a
+-- 'YYYYMMDD-HHMMSS.SSS' string. Now ids are the 16 byte uuid_blob, and timestamps are milliseconds
+-- since the epoch. That makes every row, and every index on an id, a lot smaller, and makes the
+-- joins between recipes and the child tables compare 16 bytes instead of 36.
+--
+-- Nothing outside of the database sees this: the API still takes and returns the string forms,
+-- the conversion happens in the SQL (uuid_blob(?) going in, uuid_str / strftime coming out).
+--
+-- SQLite can't change the type of a column, so each table gets rebuilt: make the new one, copy
+-- everything over (keeping the rowids, recipes_fts depends on them), drop the old one, and rename.
+-- The indexes and triggers on the old tables go with them, so they get made again at the end.
+--
+-- NOTE (Brian) the space from the old tables goes onto the freelist, the file itself won't shrink
+-- until somebody runs a 'vacuum' on it (which can't happen inside of a migration).
+
+-- nothing reads this, and it would get in the way of the renames
+drop view if exists ui_recipes;
+
+-- users
+create table users_0002 (
+    id             blob not null default (uuid_blob(uuid()))
+    , create_ts    integer not null default (cast((julianday('now') - 2440587.5) * 86400000 as integer))
+    , update_ts    integer null
+    , delete_ts    integer null
+    , username     text not null
+    , email        text not null
+    , password     text not null
+    , salt         text not null
+    , secret       text null -- ?
+);
+
+insert into users_0002 (rowid, id, create_ts, update_ts, delete_ts, username, email, password, salt, secret)
+select
+    rowid
+    , uuid_blob(id)
+    , cast(round((julianday(substr(create_ts, 1, 4) || '-' || substr(create_ts, 5, 2) || '-' || substr(create_ts, 7, 2) || ' ' || substr(create_ts, 10, 2) || ':' || substr(create_ts, 12, 2) || ':' || substr(create_ts, 14)) - 2440587.5) * 86400000) as integer)
+    , cast(round((julianday(substr(update_ts, 1, 4) || '-' || substr(update_ts, 5, 2) || '-' || substr(update_ts, 7, 2) || ' ' || substr(update_ts, 10, 2) || ':' || substr(update_ts, 12, 2) || ':' || substr(update_ts, 14)) - 2440587.5) * 86400000) as integer)
+    , cast(round((julianday(substr(delete_ts, 1, 4) || '-' || substr(delete_ts, 5, 2) || '-' || substr(delete_ts, 7, 2) || ' ' || substr(delete_ts, 10, 2) || ':' || substr(delete_ts, 12, 2) || ':' || substr(delete_ts, 14)) - 2440587.5) * 86400000) as integer)
+    , username
+    , email
+    , password
+    , salt
+    , secret
+from users;
+
+drop table users;
+alter table users_0002 rename to users;
+
+-- recipes
+create table recipes_0002 (
+    id             blob not null default (uuid_blob(uuid()))
+    , create_ts    integer not null default (cast((julianday('now') - 2440587.5) * 86400000 as integer))
+    , update_ts    integer null
+    , delete_ts    integer null
+    , name         text not null
+    , link         text null
+    , prep_time    text null
+    , cook_time    text null
+    , servings     text null
+    , notes        text null
+);
+
+insert into recipes_0002 (rowid, id, create_ts, update_ts, delete_ts, name, link, prep_time, cook_time, servings, notes)
+select
+    rowid
+    , uuid_blob(id)
+    , cast(round((julianday(substr(create_ts, 1, 4) || '-' || substr(create_ts, 5, 2) || '-' || substr(create_ts, 7, 2) || ' ' || substr(create_ts, 10, 2) || ':' || substr(create_ts, 12, 2) || ':' || substr(create_ts, 14)) - 2440587.5) * 86400000) as integer)
+    , cast(round((julianday(substr(update_ts, 1, 4) || '-' || substr(update_ts, 5, 2) || '-' || substr(update_ts, 7, 2) || ' ' || substr(update_ts, 10, 2) || ':' || substr(update_ts, 12, 2) || ':' || substr(update_ts, 14)) - 2440587.5) * 86400000) as integer)
+    , cast(round((julianday(substr(delete_ts, 1, 4) || '-' || substr(delete_ts, 5, 2) || '-' || substr(delete_ts, 7, 2) || ' ' || substr(delete_ts, 10, 2) || ':' || substr(delete_ts, 12, 2) || ':' || substr(delete_ts, 14)) - 2440587.5) * 86400000) as integer)
+    , name
+    , link
+    , prep_time
+    , cook_time
+    , servings
+    , notes
+from recipes;
+
+drop table recipes;
+alter table recipes_0002 rename to recipes;
+
+-- the child tables
+create table ingredients_0002 (
+    parent_id      blob not null
+    , sorting      integer not null default (0)
+    , text         text not null
+    , foreign key (parent_id) references recipes(id)
+);
+
+insert into ingredients_0002 (rowid, parent_id, sorting, text)
+select rowid, uuid_blob(parent_id), sorting, text from ingredients;
+
+drop table ingredients;
+alter table ingredients_0002 rename to ingredients;
+
+create table steps_0002 (
+    parent_id      blob not null
+    , sorting      integer not null default (0)
+    , text         text not null
+    , foreign key (parent_id) references recipes(id)
+);
+
+insert into steps_0002 (rowid, parent_id, sorting, text)
+select rowid, uuid_blob(parent_id), sorting, text from steps;
+
+drop table steps;
+alter table steps_0002 rename to steps;
+
+create table tags_0002 (
+    parent_id      blob not null
+    , sorting      integer not null default (0)
+    , text         text not null
+    , foreign key (parent_id) references recipes(id)
+);
+
+insert into tags_0002 (rowid, parent_id, sorting, text)
+select rowid, uuid_blob(parent_id), sorting, text from tags;
+
+drop table tags;
+alter table tags_0002 rename to tags;
+
+create table images_0002 (
+    user_id        blob null
+    , recipe_id    blob null
+    , ordering     integer not null default 0
+    , data         blob not null
+);
+
+insert into images_0002 (rowid, user_id, recipe_id, ordering, data)
+select rowid, uuid_blob(user_id), uuid_blob(recipe_id), ordering, data from images;
+
+drop table images;
+alter table images_0002 rename to images;
+
+-- everything from 0001 again
+create index ingredients_parent_id on ingredients (parent_id, sorting, text);
+create index steps_parent_id on steps (parent_id, sorting, text);
+create index tags_parent_id on tags (parent_id, sorting, text);
+create index recipes_id on recipes (id);
+create index recipes_delete_ts on recipes (delete_ts);
+
+-- and the counter triggers from schema.sql
+create trigger recipes_count_insert after insert on recipes
+when new.delete_ts is null
+begin
+    update counters set value = value + 1 where name = 'recipes';
+end;
+
+create trigger recipes_count_delete after update of delete_ts on recipes
+when old.delete_ts is null and new.delete_ts is not null
+begin
+    update counters set value = value - 1 where name = 'recipes';
+end;
+
+create trigger recipes_count_undelete after update of delete_ts on recipes
+when old.delete_ts is not null and new.delete_ts is null
+begin
+    update counters set value = value + 1 where name = 'recipes';
+end;
+
+analyze;
@@ -0,0 +1,30 @@
+-- Brian Chrzanowski
+-- 2026-10-17 18:40:02
+--
+-- 0003: images are files, the table only describes them
+--
+-- The bytes of an upload go to a file in the image directory (see image.c), so that an upload never
+-- has to fit in memory, and so that reading a recipe never drags image pages through SQLite's cache.
+-- The row is what the file is, where it is, and what it's attached to.
+--
+-- NOTE (Brian) nothing ever wrote to the old table (there wasn't an endpoint for it), so there's
+-- nothing to carry over.
+
+drop table images;
+
+create table images (
+    id             blob not null default (uuid_blob(uuid()))
+    , create_ts    integer not null default (cast((julianday('now') - 2440587.5) * 86400000 as integer))
+    , delete_ts    integer null
+    , recipe_id    blob not null
+    , user_id      blob null
+    , ordering     integer not null default 0
+    , mime         text not null
+    , size         integer not null
+    , hash         blob not null -- crypto_generichash (BLAKE2b, 32 bytes) of the file
+    , path         text not null -- relative to the image directory
+    , foreign key (recipe_id) references recipes(id)
+);
+
+create index images_id on images (id);
+create index images_recipe_id on images (recipe_id, ordering);
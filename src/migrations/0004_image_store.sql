@@ -0,0 +1,12 @@
+-- Brian Chrzanowski
+-- 2026-10-17 19:21:45
+--
+-- 0004: images are stored by their hash
+--
+-- The files move from <imagedir>/<image id> to <imagedir>/ab/cdef... (the hex of the hash, split
+-- after the first byte), so the same bytes uploaded twice are one file. image_init moves the files
+-- themselves, this is the rows.
+
+update images set path = lower(substr(hex(hash), 1, 2)) || '/' || lower(substr(hex(hash), 3));
+
+create index images_hash on images (hash);
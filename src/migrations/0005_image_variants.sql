@@ -0,0 +1,29 @@
+-- Brian Chrzanowski
+-- 2026-10-17 20:05:13
+--
+-- 0005: smaller copies of every image, for the list views
+--
+-- thumb.c decodes each new image in the background, and writes a few fixed width copies of it next
+-- to the original (<imagedir>/ab/cdef...-320), along with a tiny, blurry placeholder that's small
+-- enough to go inline, as a data: URI. The variants are of the bytes, not of the row, so they're by
+-- hash, like the files.
+--
+-- NOTE (Brian) a null width means it hasn't been looked at yet, and 0 means it was, but it couldn't
+-- be decoded (or it's a type we don't decode), so it doesn't get tried again on every startup.
+
+alter table images add column width integer null;
+alter table images add column height integer null;
+alter table images add column placeholder text null;
+
+create table image_variants (
+    hash           blob not null
+    , width        integer not null
+    , height       integer not null
+    , mime         text not null
+    , size         integer not null
+    , path         text not null -- relative to the image directory
+    , primary key (hash, width)
+) without rowid;
+
+-- what the thumbnail thread looks for, every time it wakes up
+create index images_thumb_pending on images (hash) where width is null;
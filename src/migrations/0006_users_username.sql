@@ -0,0 +1,9 @@
+-- Brian Chrzanowski
+-- 2026-10-17 23:02:37
+--
+-- 0006: usernames are unique, and logins look users up by them
+--
+-- Signups used to be a stub, so there shouldn't be anything in here that breaks this. If there is,
+-- the migration fails, and the duplicates have to be sorted out by hand.
+
+create unique index users_username on users (username) where delete_ts is null;
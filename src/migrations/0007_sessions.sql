@@ -0,0 +1,19 @@
+-- Brian Chrzanowski
+-- 2026-10-18 00:12:05
+--
+-- 0007: login sessions
+--
+-- The sessions themselves live in memory (session.c), this is just so they survive a restart. It's
+-- written behind, in batches, so it can be up to a second behind what's in memory.
+--
+-- NOTE (Brian) the token itself is never stored, only a hash of it, so a copy of the database (or
+-- a backup) can't be used to log in as anyone.
+
+create table sessions (
+    hash           blob not null primary key -- crypto_generichash of the cookie, 16 bytes
+    , user_id      blob not null
+    , create_ts    integer not null default (cast((julianday('now') - 2440587.5) * 86400000 as integer))
+    , expires_ts   integer not null
+) without rowid;
+
+create index sessions_expires on sessions (expires_ts);
@@ -0,0 +1,24 @@
+-- Brian Chrzanowski
+-- 2026-10-18 02:41:17
+--
+-- 0008: signing keys for stateless sessions, and the ones that were logged out
+--
+-- With '-s', a session cookie is signed instead of being looked up (token.c), so the only state is
+-- the keys that sign them, and the tokens that were logged out before they ran out.
+--
+-- NOTE (Brian) unlike the sessions table, this one *is* enough to log in as anyone, with any key that
+-- hasn't been rotated out yet. A backup taken with '-s' on is as sensitive as the server itself, for
+-- as long as the newest key in it is still around (SESSION_TTL_MS plus TOKEN_ROTATE_MS).
+
+create table session_keys (
+    epoch          integer not null primary key
+    , key          blob not null -- crypto_auth_KEYBYTES
+    , create_ts    integer not null default (cast((julianday('now') - 2440587.5) * 86400000 as integer))
+);
+
+create table session_revoked (
+    mac            blob not null primary key -- the MAC off the end of the token, crypto_auth_BYTES
+    , expires_ts   integer not null
+) without rowid;
+
+create index session_revoked_expires on session_revoked (expires_ts);
@@ -402,6 +402,22 @@ void mg_error(struct mg_connection *c, const char *fmt, ...) {
   mg_call(c, MG_EV_ERROR, buf);
   if (buf != mem) free(buf);
   c->is_closing = 1;
+  mg_activate(c);
+}
+
+// With epoll, mg_mgr_poll only looks at the connections on the active list:
+// the ones epoll woke up, and the ones something has happened to since. Idle
+// keep-alive connections stay off of it, and cost nothing per poll
+void mg_activate(struct mg_connection *c) {
+#if MG_ENABLE_EPOLL
+  // A connection without a manager is someone's stand-in, not a socket
+  if (c->is_active || c->mgr == NULL) return;
+  c->is_active = 1;
+  c->next_active = c->mgr->active;
+  c->mgr->active = c;
+#else
+  (void) c;
+#endif
 }
 
 #ifdef MG_ENABLE_LINES
@@ -1118,6 +1134,7 @@ static void restore_http_cb(struct mg_connection *c) {
   if (fd != NULL) fd->fs->close(fd);
   c->pfn_data = NULL;
   c->pfn = http_cb;
+  c->is_polling = 0;
 }
 
 char *mg_http_etag(char *buf, size_t len, size_t size, time_t mtime);
@@ -1307,6 +1324,7 @@ void mg_http_serve_file(struct mg_connection *c, struct mg_http_message *hm,
     } else {
       c->pfn = static_cb;
       c->pfn_data = fd;
+      c->is_polling = 1;
     }
   }
 }
@@ -1665,7 +1683,8 @@ void mg_http_delete_chunk(struct mg_connection *c, struct mg_http_message *hm) {
 static void http_cb(struct mg_connection *c, int ev, void *evd, void *fnd) {
   if (ev == MG_EV_READ || ev == MG_EV_CLOSE) {
     struct mg_http_message hm;
-    for (;;) {
+    // Leave the next request in recv until the one before it has been answered
+    while (c->is_resp == 0) {
       int n = mg_http_parse((char *) c->recv.buf, c->recv.len, &hm);
       bool is_chunked = n > 0 && mg_is_chunked(&hm);
       if (ev == MG_EV_CLOSE) {
@@ -2487,10 +2506,16 @@ bool mg_aton(struct mg_str str, struct mg_addr *addr) {
 
 void mg_mgr_free(struct mg_mgr *mgr) {
   struct mg_connection *c;
-  for (c = mgr->conns; c != NULL; c = c->next) c->is_closing = 1;
+  for (c = mgr->conns; c != NULL; c = c->next) {
+    c->is_closing = 1;
+    mg_activate(c);
+  }
   mg_mgr_poll(mgr, 0);
 #if MG_ARCH == MG_ARCH_FREERTOS_TCP
   FreeRTOS_DeleteSocketSet(mgr->ss);
+#endif
+#if MG_ENABLE_EPOLL
+  if (mgr->epoll_fd >= 0) close(mgr->epoll_fd);
 #endif
   LOG(LL_INFO, ("All connections closed"));
 }
@@ -2507,6 +2532,11 @@ void mg_mgr_init(struct mg_mgr *mgr) {
   // Ignore SIGPIPE signal, so if client cancels the request, it
   // won't kill the whole process.
   signal(SIGPIPE, SIG_IGN);
+#endif
+#if MG_ENABLE_EPOLL
+  if ((mgr->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    LOG(LL_ERROR, ("epoll_create1: %d", errno));
+  }
 #endif
   mgr->dnstimeout = 3000;
   mgr->dns4.url = "udp://8.8.8.8:53";
@@ -2967,6 +2997,11 @@ static long mg_sock_send(struct mg_connection *c, const void *buf, size_t len) {
 }
 
 bool mg_send(struct mg_connection *c, const void *buf, size_t len) {
+#if MG_ENABLE_EPOLL
+  // Writable sockets won't fire another edge, so make the next poll look
+  if (c->is_writable && !c->is_udp) c->mgr->epoll_ready = true;
+  if (!c->is_udp) mg_activate(c);
+#endif
   return c->is_udp ? mg_sock_send(c, buf, len) > 0
                    : mg_iobuf_add(&c->send, c->send.len, buf, len, MG_IO_SIZE);
 }
@@ -3052,6 +3087,22 @@ static SOCKET mg_open_listener(const char *url, struct mg_addr *addr) {
   return fd;
 }
 
+#if MG_ENABLE_EPOLL
+// Sockets are registered once, for both directions. Edge-triggered means we
+// hear about a socket only when it becomes ready, so is_readable/is_writable
+// stay set until a read or write proves the socket has been drained/filled
+static void mg_epoll_add(struct mg_connection *c) {
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  ev.data.ptr = c;
+  if (epoll_ctl(c->mgr->epoll_fd, EPOLL_CTL_ADD, FD(c), &ev) != 0) {
+    LOG(LL_ERROR, ("%lu epoll_ctl: %d", c->id, MG_SOCK_ERRNO));
+  }
+}
+#else
+#define mg_epoll_add(c)
+#endif
+
 static long mg_sock_recv(struct mg_connection *c, void *buf, size_t len) {
   long n = 0;
   if (c->is_udp) {
@@ -3084,6 +3135,12 @@ static long read_conn(struct mg_connection *c) {
          c->is_connecting, c->is_tls, c->is_tls_hs, c->is_udp, c->is_websocket,
          c->is_hexdumping, c->is_draining, c->is_closing, c->is_readable,
          c->is_writable, (long) c->recv.len, n, (long) len, MG_SOCK_ERRNO));
+#if MG_ENABLE_EPOLL
+    // A short stream read means the socket is drained, and the next byte
+    // that arrives fires a new edge
+    if (n == 0 || (n > 0 && (size_t) n < len && !c->is_udp && !c->is_tls))
+      c->is_readable = 0;
+#endif
     if (n == 0) {
       // Do nothing
     } else if (n < 0) {
@@ -3114,6 +3171,10 @@ static void write_conn(struct mg_connection *c) {
        c->is_hexdumping, c->is_draining, c->is_closing, c->is_readable,
        c->is_writable, (long) c->send.len, n, MG_SOCK_ERRNO));
 
+#if MG_ENABLE_EPOLL
+  if (n == 0 || (n > 0 && (size_t) n < len && !c->is_tls)) c->is_writable = 0;
+#endif
+
   if (n == 0) {
     // Do nothing
   } else if (n < 0) {
@@ -3142,6 +3203,9 @@ static void close_conn(struct mg_connection *c) {
   mg_call(c, MG_EV_CLOSE, NULL);
   LOG(LL_DEBUG, ("%lu closed", c->id));
   if (FD(c) != INVALID_SOCKET) {
+#if MG_ENABLE_EPOLL
+    epoll_ctl(c->mgr->epoll_fd, EPOLL_CTL_DEL, FD(c), NULL);
+#endif
     closesocket(FD(c));
 #if MG_ARCH == MG_ARCH_FREERTOS_TCP
     FreeRTOS_FD_CLR(c->fd, c->mgr->ss, eSELECT_ALL);
@@ -3196,6 +3260,7 @@ void mg_connect_resolved(struct mg_connection *c) {
     socklen_t slen = tousa(&c->peer, &usa);
     if (c->is_udp == 0) mg_set_non_blocking_mode(FD(c));
     if (c->is_udp == 0) setsockopts(c);
+    mg_epoll_add(c);
     mg_call(c, MG_EV_RESOLVE, NULL);
     if ((rc = connect(FD(c), &usa.sa, slen)) == 0) {
       mg_call(c, MG_EV_CONNECT, NULL);
@@ -3215,6 +3280,7 @@ struct mg_connection *mg_connect(struct mg_mgr *mgr, const char *url,
   } else {
     struct mg_str host = mg_url_host(url);
     LIST_ADD_HEAD(struct mg_connection, &mgr->conns, c);
+    mg_activate(c);
     c->is_udp = (strncmp(url, "udp:", 4) == 0);
     c->peer.port = mg_htons(mg_url_port(url));
     c->fn = fn;
@@ -3231,6 +3297,13 @@ static void accept_conn(struct mg_mgr *mgr, struct mg_connection *lsn) {
   union usa usa;
   socklen_t sa_len = sizeof(usa);
   SOCKET fd = accept(FD(lsn), &usa.sa, &sa_len);
+#if MG_ENABLE_EPOLL
+  // Keep accepting until the backlog is empty (or accept() fails for good)
+  if (fd == INVALID_SOCKET) lsn->is_readable = 0;
+  if (fd == INVALID_SOCKET && mg_sock_would_block()) {
+    // Backlog drained
+  } else
+#endif
   if (fd == INVALID_SOCKET) {
 #if MG_ARCH == MG_ARCH_AZURERTOS
     // AzureRTOS, in non-block socket mode can mark listening socket readable
@@ -3239,7 +3312,7 @@ static void accept_conn(struct mg_mgr *mgr, struct mg_connection *lsn) {
     if (MG_SOCK_ERRNO != EAGAIN)
 #endif
       LOG(LL_ERROR, ("%lu accept failed, errno %d", lsn->id, MG_SOCK_ERRNO));
-#if (!defined(_WIN32) && (MG_ARCH != MG_ARCH_FREERTOS_TCP))
+#if (!defined(_WIN32) && (MG_ARCH != MG_ARCH_FREERTOS_TCP) && !MG_ENABLE_EPOLL)
   } else if ((long) fd >= FD_SETSIZE) {
     LOG(LL_ERROR, ("%ld > %ld", (long) fd, (long) FD_SETSIZE));
     closesocket(fd);
@@ -3254,7 +3327,9 @@ static void accept_conn(struct mg_mgr *mgr, struct mg_connection *lsn) {
     LOG(LL_DEBUG, ("%lu accepted %s", c->id, buf));
     mg_set_non_blocking_mode(FD(c));
     setsockopts(c);
+    mg_epoll_add(c);
     LIST_ADD_HEAD(struct mg_connection, &mgr->conns, c);
+    mg_activate(c);
     c->is_accepted = 1;
     c->is_hexdumping = lsn->is_hexdumping;
     c->pfn = lsn->pfn;
@@ -3318,12 +3393,14 @@ struct mg_connection *mg_mkpipe(struct mg_mgr *mgr, mg_event_handler_t fn,
     LOG(LL_INFO, ("pipe %lu", (unsigned long) sp[0]));
     tomgaddr(&usa[0], &c->peer, false);
     c->is_udp = 1;
+    mg_epoll_add(c);
     c->pfn = pf1;
     c->pfn_data = (void *) (size_t) sp[0];
     c->fn = fn;
     c->fn_data = fn_data;
     mg_call(c, MG_EV_OPEN, NULL);
     LIST_ADD_HEAD(struct mg_connection, &mgr->conns, c);
+    mg_activate(c);
   }
   return c;
 }
@@ -3344,7 +3421,9 @@ struct mg_connection *mg_listen(struct mg_mgr *mgr, const char *url,
     c->fd = S2PTR(fd);
     c->is_listening = 1;
     c->is_udp = is_udp;
+    mg_epoll_add(c);
     LIST_ADD_HEAD(struct mg_connection, &mgr->conns, c);
+    mg_activate(c);
     c->fn = fn;
     c->fn_data = fn_data;
     mg_call(c, MG_EV_OPEN, NULL);
@@ -3371,6 +3450,26 @@ static void mg_iotest(struct mg_mgr *mgr, int ms) {
     FreeRTOS_FD_CLR(c->fd, mgr->ss,
                     eSELECT_READ | eSELECT_EXCEPT | eSELECT_WRITE);
   }
+#elif MG_ENABLE_EPOLL
+  // Only ready sockets come back, everyone else keeps their flags from the
+  // last poll (see mg_epoll_add)
+  struct epoll_event evs[MG_EPOLL_EVENTS];
+  int i, n;
+
+  n = epoll_wait(mgr->epoll_fd, evs, MG_EPOLL_EVENTS, mgr->epoll_ready ? 0 : ms);
+  if (n < 0) {
+    LOG(LL_DEBUG, ("epoll_wait: %d %d", n, MG_SOCK_ERRNO));
+    n = 0;
+  }
+  mgr->epoll_ready = false;
+
+  for (i = 0; i < n; i++) {
+    struct mg_connection *c = (struct mg_connection *) evs[i].data.ptr;
+    if (evs[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+      c->is_readable = 1;
+    if (evs[i].events & (EPOLLOUT | EPOLLERR)) c->is_writable = 1;
+    mg_activate(c);
+  }
 #else
   struct timeval tv = {ms / 1000, (ms % 1000) * 1000};
   struct mg_connection *c;
@@ -3428,30 +3527,69 @@ void mg_mgr_poll(struct mg_mgr *mgr, int ms) {
   now = mg_millis();
   mg_timer_poll(now);
 
+#if MG_ENABLE_EPOLL
+  // Anything that gets activated while we walk this goes on a fresh list, for
+  // the next poll (a connection that's still on this one just gets walked)
+  c = mgr->active;
+  mgr->active = NULL;
+  for (; c != NULL; c = tmp) {
+    tmp = c->next_active;
+#else
   for (c = mgr->conns; c != NULL; c = tmp) {
     tmp = c->next;
+#endif
     mg_call(c, MG_EV_POLL, &now);
+#if !MG_ENABLE_EPOLL
+    // With epoll this loop is mostly idle connections, and checking the log
+    // spec for every one of them on every poll costs more than the poll does
     LOG(LL_VERBOSE_DEBUG,
         ("%lu %c%c %c%c%c%c%c", c->id, c->is_readable ? 'r' : '-',
          c->is_writable ? 'w' : '-', c->is_tls ? 'T' : 't',
          c->is_connecting ? 'C' : 'c', c->is_tls_hs ? 'H' : 'h',
          c->is_resolving ? 'R' : 'r', c->is_closing ? 'C' : 'c'));
+#endif
     if (c->is_resolving || c->is_closing) {
       // Do nothing
     } else if (c->is_listening && c->is_udp == 0) {
+#if MG_ENABLE_EPOLL
+      while (c->is_readable) accept_conn(mgr, c);
+#else
       if (c->is_readable) accept_conn(mgr, c);
+#endif
     } else if (c->is_connecting) {
       if (c->is_readable || c->is_writable) connect_conn(c);
     } else if (c->is_tls_hs) {
       if ((c->is_readable || c->is_writable)) mg_tls_handshake(c);
     } else {
       if (c->is_readable) read_conn(c);
+#if MG_ENABLE_EPOLL
+      if (c->is_writable && c->send.len > 0) write_conn(c);
+#else
       if (c->is_writable) write_conn(c);
+#endif
       while (c->is_tls && read_conn(c) > 0) (void) 0;  // Read buffered TLS data
     }
 
+#if MG_ENABLE_EPOLL
+    if (!c->is_closing && !c->is_listening &&
+        (c->is_readable || (c->is_writable && c->send.len > 0)))
+      mgr->epoll_ready = true;
+#endif
+
     if (c->is_draining && c->send.len == 0) c->is_closing = 1;
-    if (c->is_closing) close_conn(c);
+    if (c->is_closing) {
+      close_conn(c);
+      continue;
+    }
+
+#if MG_ENABLE_EPOLL
+    // It stays on the list if it has readiness left, or it isn't one of ours
+    // (listeners, the wakeup pipe, DNS), or it asked for MG_EV_POLL
+    c->is_active = 0;
+    if (!c->is_accepted || c->is_polling || c->is_readable ||
+        (c->is_writable && c->send.len > 0))
+      mg_activate(c);
+#endif
   }
 }
 #endif
@@ -70,6 +70,21 @@ extern "C" {
 #define MG_ENABLE_PACKED_FS 0
 #endif
 
+// Use edge-triggered epoll(7) instead of select(2). Linux only, and lifts
+// the FD_SETSIZE cap on the number of connections
+#ifndef MG_ENABLE_EPOLL
+#if defined(__linux__)
+#define MG_ENABLE_EPOLL 1
+#else
+#define MG_ENABLE_EPOLL 0
+#endif
+#endif
+
+// Maximum number of epoll events handled per mg_mgr_poll() call
+#ifndef MG_EPOLL_EVENTS
+#define MG_EPOLL_EVENTS 256
+#endif
+
 // Granularity of the send/recv IO buffer growth
 #ifndef MG_IO_SIZE
 #define MG_IO_SIZE 2048
@@ -410,6 +425,10 @@ struct timeval {
 #include <time.h>
 #include <unistd.h>
 
+#if MG_ENABLE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #define MG_DIRSEP '/'
 #define MG_INT64_FMT "%" PRId64
 #undef MG_ENABLE_DIRLIST
@@ -733,6 +752,7 @@ typedef void (*mg_event_handler_t)(struct mg_connection *, int ev,
                                    void *ev_data, void *fn_data);
 void mg_call(struct mg_connection *c, int ev, void *ev_data);
 void mg_error(struct mg_connection *c, const char *fmt, ...);
+void mg_activate(struct mg_connection *c);
 
 enum {
   MG_EV_ERROR,       // Error                        char *error_message
@@ -784,10 +804,18 @@ struct mg_mgr {
 #if MG_ARCH == MG_ARCH_FREERTOS_TCP
   SocketSet_t ss;  // NOTE(lsm): referenced from socket struct
 #endif
+#if MG_ENABLE_EPOLL
+  int epoll_fd;      // Every socket is registered here once, edge-triggered
+  bool epoll_ready;  // Some connection has readiness left, don't block
+  struct mg_connection *active;  // What the next mg_mgr_poll looks at
+#endif
 };
 
 struct mg_connection {
   struct mg_connection *next;  // Linkage in struct mg_mgr :: connections
+#if MG_ENABLE_EPOLL
+  struct mg_connection *next_active;  // Linkage in struct mg_mgr :: active
+#endif
   struct mg_mgr *mgr;          // Our container
   struct mg_addr peer;         // Remote address. For listeners, local address
   void *fd;                    // Connected socket, or LWIP data
@@ -814,6 +842,9 @@ struct mg_connection {
   unsigned is_closing : 1;     // Close and free the connection immediately
   unsigned is_readable : 1;    // Connection is ready to read
   unsigned is_writable : 1;    // Connection is ready to write
+  unsigned is_resp : 1;        // Response is still being generated
+  unsigned is_polling : 1;     // Wants MG_EV_POLL even while it's idle
+  unsigned is_active : 1;      // In struct mg_mgr :: active
 };
 
 void mg_mgr_poll(struct mg_mgr *, int ms);
@@ -1,206 +1,98 @@
-#include <jansson.h>
-
 #include "common.h"
 #include "objects.h"
 
 #include "sqlite3.h"
 
-extern sqlite3 *DATABASE;
-
-// this is a really bad spot for this function, but I'm not sure where else it should go
-// maybe in a file called 'search.c'
+extern __thread sqlite3 *DATABASE;
 
-// db_search_to_json: takes in a UI_SearchQuery object, and returns a JSON object with search results
-json_t *db_search_to_json(UI_SearchQuery *query)
+// db_open: opens the calling thread's connection (DATABASE), loading our extensions
+int db_open(char *fname, int readonly)
 {
-	// NOTE (Brian) (rewrite this, this is a mess)
-	//
-	// The query that gets executed has the following form:
-	//
-	// select query.results.[columns] from query.results.table o
-	//   inner join (select query.search.[columns] from query.search.table where query.search.[where]) i
-	//     on o.[query.results.pk_column] = i.[query.search.pk_column]
-	//   (order by query.results.sort_field (query.results.sort_order))
-	//   (limit query.page_size offset (query.page_size * query.page_number));
-	//
-	// Once this query gets executed, it will return a JSON structure that looks like this:
-	//
-	// {
-	//   "total": (total results),
-	//   "page": (query.page_number),
-	//   "size": (query.page_size),
-	//   "results": [(each record has name of column from result set)]
-	// }
-
-#define RETURNNOW(V_) \
-    if (query_text) free(query_text); \
-    if (stmt) sqlite3_finalize(stmt); \
-    if (colvalus) free(colvalus); \
-    if (colnames) free(colnames); \
-	if (json && (V_) == NULL) json_decref(json); \
-    return (V_);
-
-    // used while preparing the query
-    char *query_text = NULL;
-    size_t query_sz = 0;
-    sqlite3_stmt *stmt = NULL;
-    int rc;
-
-    // used in results gathering
-    int results_ncols = 0;
-    char **colvalus = NULL;
-    char **colnames = NULL;
-	json_t *json = NULL;
-	json_t *results = NULL;
-
-    // TODO (Brian) check object before we build it
-    assert(query != NULL);
+	char *errmsg = NULL;
+	int flags;
+	int rc;
 
-    FILE *stream = open_memstream(&query_text, &query_sz);
-    if (stream == NULL) {
-        RETURNNOW(NULL);
-    }
+	// NOTE (Brian) DATABASE is thread local, and every connection only ever gets used by the thread
+	// that opened it, so we can skip SQLite's per-connection mutexes.
+	flags = SQLITE_OPEN_NOMUTEX;
+	flags |= readonly ? SQLITE_OPEN_READONLY : (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
 
-    fprintf(stream, "select ");
-    for (char **s = &query->results.columns[0]; *s; s++) {
-        fprintf(stream, "o.%s%s", s[0], s[1] == NULL ? " " : ", ");
+	rc = sqlite3_open_v2(fname, &DATABASE, flags, NULL);
+	if (rc != SQLITE_OK) {
+		ERR("sqlite3_open error: %s\n", sqlite3_errstr(rc));
+		return -1;
 	}
 
-    fprintf(stream, "from %s o ", query->results.table);
-	fprintf(stream, "inner join (");
-
-	fprintf(stream, "select ");
-	for (char **s = &query->search.columns[0]; *s; s++) {
-		fprintf(stream, "%s%s", s[0], s[1] == NULL ? " " : ", ");
-	}
+	sqlite3_busy_timeout(DATABASE, DB_BUSY_MS);
 
-	fprintf(stream, "from %s ", query->search.table);
+	// load our various extensions
+	sqlite3_enable_load_extension(DATABASE, true);
 
-	// NOTE (Brian) Currently the WHERE API has people adding in strings for their entire query.
-	// We probably want to make that not the case in the future. We should make a query builder
-	// or something.
-	fprintf(stream, "where ");
-	for (char **s = &query->search.where[0]; *s; s++) {
-		fprintf(stream, "%s ", s[0]);
+	rc = sqlite3_load_extension(DATABASE, "./sqlite3_uuid", "sqlite3_uuid_init", &errmsg);
+	if (rc == SQLITE_ERROR) {
+		ERR("Error loading 'uuid' extension: %s\n", errmsg);
+		sqlite3_free(errmsg);
+		return -1;
 	}
 
-	fprintf(stream, ") i on o.%s = i.%s ", query->search.pk_column, query->results.pk_column);
+	sqlite3_enable_load_extension(DATABASE, false);
 
-    if (query->results.sort_field) {
-        fprintf(stream, " order by %s %s",
-			query->results.sort_field, COALESCE(query->results.sort_order, ""));
-    }
+	return 0;
+}
 
-    fprintf(stream, " limit %ld offset %ld;",
-        query->page_size, query->page_number * query->page_size);
+// db_close: finalizes the calling thread's statements, and closes its connection
+void db_close()
+{
+	db_stmt_cache_free();
+	sqlite3_close(DATABASE);
+	DATABASE = NULL;
+}
 
-    fclose(stream);
+// db_exec_script: runs every statement in 'sql', one at a time, -1 on the first failure
+int db_exec_script(char *sql)
+{
+	// NOTE (Brian) this is sqlite3_exec, except that when something breaks we can say which
+	// statement it was (it's usually a migration someone is writing)
+	sqlite3_stmt *stmt;
+	char *next = NULL;
+	int rc;
 
-    rc = sqlite3_prepare_v2(DATABASE, query_text, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-		ERR("Query prepare error! %s\n", sqlite3_errmsg(DATABASE));
-		fprintf(stderr, "Query was:\n%s\n", query_text);
-        RETURNNOW(NULL);
-    }
+	for (sql = trim(sql); sql && strlen(sql) > 0; sql = trim(next)) {
+		stmt = NULL;
 
-	// NOTE (Brian) we probably want to bind more than strings at some point. But, it's just
-	// strings for now. It'd also probably be a good idea to check if the number of things in the
-	// bind array matches the number of '?' in the where clause.
-	for (int i = 0; query->search.bind[i]; i++) {
-		rc = sqlite3_bind_text(stmt, i + 1, (const char *)query->search.bind[i], -1, NULL);
+		rc = sqlite3_prepare_v2(DATABASE, sql, -1, &stmt, (const char **)&next);
 		if (rc != SQLITE_OK) {
-			RETURNNOW(NULL);
+			ERR("SQL Error: %s\n%s\n", sqlite3_errmsg(DATABASE), sql);
+			return -1;
 		}
-	}
 
-    json = json_object();
-	results = json_array();
-
-    json_object_set_new(json, "total", json_integer(0));
-    json_object_set_new(json, "page", json_integer(query->page_number));
-    json_object_set_new(json, "size", json_integer(query->page_size));
-
-    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-        if (results_ncols == 0) {
-            results_ncols = sqlite3_column_count(stmt);
-            colvalus = calloc(results_ncols, sizeof(*colvalus));
-            colnames = calloc(results_ncols, sizeof(*colnames));
-
-            for (int i = 0; i < results_ncols; i++) {
-                colnames[i] = (char *)sqlite3_column_name(stmt, i);
-            }
-
-            if (colnames == NULL) {
-                RETURNNOW(NULL);
-            }
-        }
-
-		json_t *elem = json_object();
-
-		for (int i = 0; i < results_ncols; i++) {
-			switch (sqlite3_column_type(stmt, i)) {
-				case SQLITE_INTEGER:
-					json_object_set_new(
-						elem, colnames[i], json_integer(sqlite3_column_int64(stmt, i))
-					);
-					break;
-
-				case SQLITE_FLOAT:
-					json_object_set_new(
-						elem, colnames[i], json_real(sqlite3_column_double(stmt, i))
-					);
-					break;
-
-				case SQLITE_TEXT:
-					json_object_set_new(
-						elem, colnames[i], json_string((char *)sqlite3_column_text(stmt, i))
-					);
-					break;
-
-				case SQLITE_BLOB:
-					assert(0); // we have to base64 encode this one, because it isn't already UTF-8 encoded
-					break;
-
-				case SQLITE_NULL:
-					json_object_set_new(
-						elem, colnames[i], json_null()
-					);
-					break;
-
-				default:
-					break;
-			}
+		// a trailing comment prepares to nothing
+		if (stmt == NULL) {
+			continue;
 		}
 
-		json_array_append_new(results, elem);
-    }
+		rc = sqlite3_step(stmt);
 
-    json_object_set_new(json, "results", results);
+		sqlite3_finalize(stmt);
 
-	if (!(rc == SQLITE_OK || rc == SQLITE_DONE)) {
-		fprintf(stderr, "Query was:\n%s\n", query_text);
-		fprintf(stderr, "SQLITE ERROR: %s\n", sqlite3_errstr(rc));
+		if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+			ERR("SQL Execution failed: %s\n%.*s\n", sqlite3_errmsg(DATABASE), (int)(next - sql), sql);
+			return -1;
+		}
 	}
 
-    RETURNNOW(json);
-
-#undef RETURNING
+	return 0;
 }
 
 // db_load_metadata_from_rowid: fills out the metadata struct given the table and rowid
 int db_load_metadata_from_rowid(DB_Metadata *metadata, char *table, int64_t rowid)
 {
-	char *query;
-	size_t query_sz;
-	sqlite3_stmt *stmt = NULL;
-	int rc;
-
-    FILE *stream = open_memstream(&query, &query_sz);
-	fprintf(stream, "select id, create_ts, update_ts, delete_ts from %s where rowid = ?;", table);
-    fclose(stream);
+	sqlite3_stmt *stmt;
 
-	rc = sqlite3_prepare_v2(DATABASE, query, -1, &stmt, NULL);
-	if (rc != SQLITE_OK) { // TODO log error
+	stmt = db_stmt_get(table, "metadata_from_rowid",
+		"select uuid_str(id), " DB_TS_STR("create_ts") ", " DB_TS_STR("update_ts") ", " DB_TS_STR("delete_ts")
+		" from %s where rowid = ?;");
+	if (stmt == NULL) { // TODO log error
 		return -1;
 	}
 
@@ -208,14 +100,13 @@ int db_load_metadata_from_rowid(DB_Metadata *metadata, char *table, int64_t rowi
 
 	sqlite3_step(stmt);
 
+	metadata->rowid = rowid;
 	metadata->id = strdup_null((char *)sqlite3_column_text(stmt, 0));
 	metadata->create_ts = strdup_null((char *)sqlite3_column_text(stmt, 1));
 	metadata->update_ts = strdup_null((char *)sqlite3_column_text(stmt, 2));
 	metadata->delete_ts = strdup_null((char *)sqlite3_column_text(stmt, 3));
 
-	sqlite3_finalize(stmt);
-
-	free(query);
+	db_stmt_release(stmt);
 
 	return 0;
 }
@@ -223,19 +114,14 @@ int db_load_metadata_from_rowid(DB_Metadata *metadata, char *table, int64_t rowi
 // db_load_metadata_from_id: fetches database metadata from the uuid 'id'
 int db_load_metadata_from_id(DB_Metadata *metadata, char *table, char *id)
 {
-	char *query;
-	size_t query_sz;
-	sqlite3_stmt *stmt = NULL;
+	sqlite3_stmt *stmt;
 	int rc;
 
-    FILE *stream = open_memstream(&query, &query_sz);
-    fprintf(stream, "select id, create_ts, update_ts, delete_ts from %s where id = ?;", table);
-    fclose(stream);
-
-	rc = sqlite3_prepare_v2(DATABASE, query, -1, &stmt, NULL);
-	if (rc != SQLITE_OK) { // TODO log error
+	stmt = db_stmt_get(table, "metadata_from_id",
+		"select uuid_str(id), " DB_TS_STR("create_ts") ", " DB_TS_STR("update_ts") ", " DB_TS_STR("delete_ts")
+		", rowid from %s where id = uuid_blob(?);");
+	if (stmt == NULL) {
         ERR("could not fetch metadata for record with id '%s'", id);
-        free(query);
 		return -1;
 	}
 
@@ -246,11 +132,10 @@ int db_load_metadata_from_id(DB_Metadata *metadata, char *table, char *id)
         metadata->create_ts = strdup_null((char *)sqlite3_column_text(stmt, 1));
         metadata->update_ts = strdup_null((char *)sqlite3_column_text(stmt, 2));
         metadata->delete_ts = strdup_null((char *)sqlite3_column_text(stmt, 3));
+        metadata->rowid = sqlite3_column_int64(stmt, 4);
     }
 
-	sqlite3_finalize(stmt);
-
-    free(query);
+	db_stmt_release(stmt);
 
 	return 0;
 }
@@ -258,21 +143,14 @@ int db_load_metadata_from_id(DB_Metadata *metadata, char *table, char *id)
 // db_insert_textlist: inserts the entire textlist as a single db transaction
 int db_insert_textlist(char *table, char *id, char **list)
 {
-    char *query;
-    size_t query_sz;
     sqlite3_stmt *stmt;
-    int rc;
 
 	// TODO (Brian) put this into a transaction (so we can rollback)
     // TODO (Brian) handle errors in this OR THERE BE DRAGONS
 
-    FILE *stream = open_memstream(&query, &query_sz);
-    fprintf(stream, "insert into %s (parent_id, sorting, text) values (?, ?, ?);", table);
-    fclose(stream);
-
-    rc = sqlite3_prepare_v2(DATABASE, query, -1, &stmt, NULL);
-	if (rc != SQLITE_OK) {
-		fprintf(stderr, "Query prepare error! %s\n", sqlite3_errstr(rc));
+    stmt = db_stmt_get(table, "textlist_insert",
+		"insert into %s (parent_id, sorting, text) values (uuid_blob(?), ?, ?);");
+	if (stmt == NULL) {
 		return -1;
 	}
 
@@ -284,8 +162,7 @@ int db_insert_textlist(char *table, char *id, char **list)
         sqlite3_reset(stmt);
 	}
 
-    sqlite3_finalize(stmt);
-    free(query);
+    db_stmt_release(stmt);
 
     return 0;
 }
@@ -294,19 +171,11 @@ int db_insert_textlist(char *table, char *id, char **list)
 char **db_get_textlist(char *table, char *id)
 {
     char **list = NULL;
-
-    char *query;
-	size_t query_sz;
-    FILE *stream = open_memstream(&query, &query_sz);
-    fprintf(stream, "select parent_id, text from %s where parent_id = ?;", table);
-    fclose(stream);
-
-    sqlite3_stmt *stmt = NULL;
+    sqlite3_stmt *stmt;
     int rc;
 
-    rc = sqlite3_prepare_v2(DATABASE, query, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        free(query);
+    stmt = db_stmt_get(table, "textlist_get", "select parent_id, text from %s where parent_id = uuid_blob(?) order by sorting;");
+    if (stmt == NULL) {
         return NULL;
     }
 
@@ -316,9 +185,7 @@ char **db_get_textlist(char *table, char *id)
 		arrput(list, strdup((const char *)sqlite3_column_text(stmt, 1)));
     }
 
-    sqlite3_finalize(stmt);
-
-    free(query);
+    db_stmt_release(stmt);
 
     return list;
 }
@@ -326,31 +193,114 @@ char **db_get_textlist(char *table, char *id)
 // db_delete_textlist: deletes all of the textlists from the table with parent_id = id
 int db_delete_textlist(char *table, char *id)
 {
-	char *query;
-	size_t query_sz;
+	sqlite3_stmt *stmt;
+	int rc;
+
+	stmt = db_stmt_get(table, "textlist_delete", "delete from %s where parent_id = uuid_blob(?);");
+	if (stmt == NULL) {
+		return -1;
+	}
+
+	sqlite3_bind_text(stmt, 1, id, -1, NULL);
+
+	rc = sqlite3_step(stmt);
+
+	db_stmt_release(stmt);
+
+	return rc == SQLITE_DONE ? 0 : -1;
+}
 
-	FILE *fp = open_memstream(&query, &query_sz);
-	fprintf(fp, "delete from %s where parent_id = ?;", table);
-	fclose(fp);
+// NOTE (Brian) Every query that isn't built on the fly (the search queries are) goes through this
+// cache. Statements are keyed by "op table", prepared the first time they're asked for, and then
+// kept around for the life of the connection. Callers MUST hand the statement back with
+// db_stmt_release, which resets it, so nobody ever sees someone else's bindings or a half-stepped
+// statement holding a read transaction open.
 
+typedef struct DB_StmtCacheEntry {
+	char *key;
+	sqlite3_stmt *value;
+} DB_StmtCacheEntry;
+
+// NOTE (Brian) statements belong to a connection, so the cache is per-thread like DATABASE is. The
+// counters are shared, so the stats endpoint sees every worker.
+static __thread DB_StmtCacheEntry *STMT_CACHE = NULL;
+static DB_StmtCacheStats STMT_STATS;
+
+// db_stmt_get: returns the cached statement for (table, op), preparing 'fmt' on first use
+sqlite3_stmt *db_stmt_get(char *table, char *op, char *fmt)
+{
+	char key[BUFSMALL];
+	char *query;
+	size_t query_sz;
 	sqlite3_stmt *stmt;
+	ptrdiff_t idx;
 	int rc;
 
-	rc = sqlite3_prepare_v2(DATABASE, query, -1, &stmt, NULL);
+	if (STMT_CACHE == NULL) {
+		sh_new_strdup(STMT_CACHE);
+	}
+
+	snprintf(key, sizeof key, "%s %s", op, table);
+
+	if ((idx = shgeti(STMT_CACHE, key)) >= 0) {
+		__atomic_add_fetch(&STMT_STATS.hits, 1, __ATOMIC_RELAXED);
+		return STMT_CACHE[idx].value;
+	}
+
+	__atomic_add_fetch(&STMT_STATS.misses, 1, __ATOMIC_RELAXED);
+
+	// 'fmt' only ever gets the table name, so statements without a '%s' are fine too
+	FILE *stream = open_memstream(&query, &query_sz);
+	fprintf(stream, fmt, table);
+	fclose(stream);
+
+	rc = sqlite3_prepare_v3(DATABASE, query, -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL);
 	if (rc != SQLITE_OK) {
+		ERR("Query prepare error! %s\n", sqlite3_errmsg(DATABASE));
+		fprintf(stderr, "Query was:\n%s\n", query);
 		free(query);
-		return -1;
+		return NULL;
 	}
 
-	sqlite3_bind_text(stmt, 1, id, -1, NULL);
+	free(query);
 
-	rc = sqlite3_step(stmt);
+	shput(STMT_CACHE, key, stmt);
+	__atomic_add_fetch(&STMT_STATS.entries, 1, __ATOMIC_RELAXED);
 
-	sqlite3_finalize(stmt);
+	return stmt;
+}
 
-    free(query);
+// db_stmt_release: resets a statement from db_stmt_get so it can be used again
+void db_stmt_release(sqlite3_stmt *stmt)
+{
+	if (stmt) {
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+	}
+}
 
-	return rc == SQLITE_DONE ? 0 : -1;
+// db_stmt_cache_stats: returns the hit / miss counters for the statement cache
+DB_StmtCacheStats db_stmt_cache_stats()
+{
+	DB_StmtCacheStats stats = {
+		.hits = __atomic_load_n(&STMT_STATS.hits, __ATOMIC_RELAXED),
+		.misses = __atomic_load_n(&STMT_STATS.misses, __ATOMIC_RELAXED),
+		.entries = __atomic_load_n(&STMT_STATS.entries, __ATOMIC_RELAXED),
+	};
+	return stats;
+}
+
+// db_stmt_cache_free: finalizes every cached statement (must happen before sqlite3_close)
+void db_stmt_cache_free()
+{
+	for (size_t i = 0; i < shlen(STMT_CACHE); i++) {
+		sqlite3_finalize(STMT_CACHE[i].value);
+	}
+
+	__atomic_sub_fetch(&STMT_STATS.entries, shlen(STMT_CACHE), __ATOMIC_RELAXED);
+
+	shfree(STMT_CACHE);
+	STMT_CACHE = NULL;
 }
 
 // db_metadata_free: releases the members of 'metadata', but NOT 'metadata' itself
@@ -364,22 +314,31 @@ void db_metadata_free(DB_Metadata *metadata)
 	}
 }
 
-// db_transaction_begin: begins a transaction on the database
-void db_transaction_begin()
+// db_transaction_begin: begins a transaction on the database, returns -1 if it couldn't
+int db_transaction_begin()
 {
-	sqlite3_exec(DATABASE, "begin transaction;", NULL, NULL, NULL);
+	if (sqlite3_exec(DATABASE, "begin transaction;", NULL, NULL, NULL) != SQLITE_OK) {
+		return -1;
+	}
+	return 0;
 }
 
-// db_transaction_commit: commits the currently open transaction
-void db_transaction_commit()
+// db_transaction_commit: commits the currently open transaction, returns -1 if it couldn't
+int db_transaction_commit()
 {
-	sqlite3_exec(DATABASE, "commit transaction;", NULL, NULL, NULL);
+	if (sqlite3_exec(DATABASE, "commit transaction;", NULL, NULL, NULL) != SQLITE_OK) {
+		return -1;
+	}
+	return 0;
 }
 
 // db_transaction_rollback: rolls the currently open transaction back
-void db_transaction_rollback()
+int db_transaction_rollback()
 {
-	sqlite3_exec(DATABASE, "rollback transaction;", NULL, NULL, NULL);
+	if (sqlite3_exec(DATABASE, "rollback transaction;", NULL, NULL, NULL) != SQLITE_OK) {
+		return -1;
+	}
+	return 0;
 }
 
 DB_Metadata metadata_clone(DB_Metadata original)
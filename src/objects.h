@@ -3,6 +3,23 @@
 
 #include "common.h"
 
+struct sqlite3_stmt;
+
+// NOTE (Brian) ids are stored as 16 byte blobs, and timestamps as milliseconds since the epoch (see
+// migrations/0002). The API only ever sees the string forms, so the SQL converts on the way in
+// (uuid_blob(?)) and on the way out (uuid_str / DB_TS_STR). These are for db_stmt_get formats,
+// hence the '%%'.
+
+// DB_NOW_MS: SQL for the current time, the way timestamps are stored
+#define DB_NOW_MS "cast((julianday('now') - 2440587.5) * 86400000 as integer)"
+// DB_TS_STR: SQL that formats the stored timestamp 'C_' the way the API has always shown them
+#define DB_TS_STR(C_) "strftime('%%Y%%m%%d-%%H%%M%%f', " C_ " / 1000.0, 'unixepoch')"
+
+// DB_BUSY_MS: how long a connection waits on someone else's write before it gets SQLITE_BUSY
+#define DB_BUSY_MS (5000)
+// DB_LOOP_BUSY_MS: the same, for the event loop's connection, once it's started (see init)
+#define DB_LOOP_BUSY_MS (10)
+
 // DB_Metadata: every table needs to implement a DB_Metadata as its first member
 typedef struct DB_Metadata {
     int64_t rowid;
@@ -19,27 +36,20 @@ typedef struct DB_ChildTextRecord {
     char *text;
 } DB_ChildTextRecord;
 
-// DB_Query: currently used to abstract query responsibilities for "UI_SearchQuery"
-typedef struct DB_Query {
-    char *pk_column;
-    char **columns;
-    char *table;
-    char **where;
-	char **bind;
-    char *sort_field;
-    char *sort_order;
-} DB_Query;
+// DB_StmtCacheStats: counters for the prepared statement cache
+typedef struct DB_StmtCacheStats {
+    size_t hits;
+    size_t misses;
+    size_t entries;
+} DB_StmtCacheStats;
 
-// UI_SearchQuery: user input for performing search queries
-typedef struct UI_SearchQuery {
-    DB_Query search;
-    DB_Query results;
-    size_t page_size;
-    size_t page_number;
-} UI_SearchQuery;
+// db_open: opens the calling thread's connection (DATABASE), loading our extensions
+int db_open(char *fname, int readonly);
+// db_close: finalizes the calling thread's statements, and closes its connection
+void db_close();
+// db_exec_script: runs every statement in 'sql', one at a time, -1 on the first failure
+int db_exec_script(char *sql);
 
-// db_search_to_json: takes in a UI_SearchQuery object, returns a JSON schema, see func for details
-json_t *db_search_to_json(UI_SearchQuery *query);
 // db_load_metadata_from_rowid: fills out the metadata struct given the table and rowid
 int db_load_metadata_from_rowid(DB_Metadata *metadata, char *table, int64_t rowid);
 // db_load_metadata_from_id: fetches database metadata from the uuid 'id'
@@ -53,12 +63,21 @@ char **db_get_textlist(char *table, char *id);
 // db_delete_textlist: deletes all of the textlists from the table with parent_id = id
 int db_delete_textlist(char *table, char *id);
 
-// db_transaction_begin: begins a transaction on the database
-void db_transaction_begin();
-// db_transaction_commit: commits the currently open transaction
-void db_transaction_commit();
+// db_stmt_get: returns the cached statement for (table, op), preparing 'fmt' on first use
+struct sqlite3_stmt *db_stmt_get(char *table, char *op, char *fmt);
+// db_stmt_release: resets a statement from db_stmt_get so it can be used again
+void db_stmt_release(struct sqlite3_stmt *stmt);
+// db_stmt_cache_stats: returns the hit / miss counters for the statement cache
+DB_StmtCacheStats db_stmt_cache_stats();
+// db_stmt_cache_free: finalizes every cached statement (must happen before sqlite3_close)
+void db_stmt_cache_free();
+
+// db_transaction_begin: begins a transaction on the database, returns -1 if it couldn't
+int db_transaction_begin();
+// db_transaction_commit: commits the currently open transaction, returns -1 if it couldn't
+int db_transaction_commit();
 // db_transaction_rollback: rolls the currently open transaction back
-void db_transaction_rollback();
+int db_transaction_rollback();
 
 // metadata_clone: useful to ensure updated / deleted records have all of the metadata before
 // performing database operations with them.
@@ -26,6 +26,7 @@
 #define _GNU_SOURCE
 #include "common.h"
 
+#include <math.h>
 #include <sodium.h>
 #include <jansson.h>
 
@@ -34,8 +35,12 @@
 
 #include "recipe.h"
 #include "objects.h"
+#include "cache.h"
+#include "gzip.h"
+#include "jsonw.h"
+#include "jsonr.h"
 
-extern sqlite3 *DATABASE;
+extern __thread sqlite3 *DATABASE;
 
 // recipe_free : frees all of the data in the recipe object
 void recipe_free(struct Recipe *recipe);
@@ -46,6 +51,9 @@ struct Recipe *recipe_get_by_id(char *id);
 // recipe_insert : adds a recipe to the backing store
 int recipe_insert(struct Recipe *recipe);
 
+// recipe_insert_rows : writes the recipe and its lists, inside of the caller's transaction (see recipe_fts_insert)
+int recipe_insert_rows(Recipe *recipe);
+
 // recipe_update: updates the recipe in the database
 int recipe_update(Recipe *recipe);
 
@@ -56,19 +64,89 @@ int recipe_delete(char *id);
 int recipe_validation(struct Recipe *recipe);
 
 // recipe_from_json : converts a JSON string into a Recipe
-static struct Recipe *recipe_from_json(char *s);
+struct Recipe *recipe_from_json(char *s);
+
+// recipe_get_json : returns the recipe at 'id' as the JSON the API sends, NULL if there isn't one
+char *recipe_get_json(char *id);
+
+// recipe_textlist_from_json : converts a JSON array of strings into an stb array
+static char **recipe_textlist_from_json(const char *s);
+
+// recipe_text_from_json : sets 'text' to a copy of the next value, if it's a string (and skips it if it isn't), -1 on error
+static int recipe_text_from_json(JsonReader *reader, char **text);
+// recipe_list_from_json : sets 'list' to the strings in the next value, if it's an array, -1 if any of them aren't strings
+static int recipe_list_from_json(JsonReader *reader, char ***list);
+// recipe_list_free : frees the stb array of strings 'list'
+static void recipe_list_free(char **list);
+
+// recipe_bind : binds the TEXT fields of 'recipe' to 'stmt', in order, returns the next parameter's index
+static int recipe_bind(sqlite3_stmt *stmt, Recipe *recipe);
+// recipe_read : reads every field of 'recipe' out of the row 'stmt' is on, starting at column 'col'
+static void recipe_read(sqlite3_stmt *stmt, int col, Recipe *recipe);
+// recipe_lists_insert : writes the LIST fields of 'recipe' to their tables
+static int recipe_lists_insert(Recipe *recipe);
+// recipe_lists_delete : deletes the LIST rows of the recipe at 'id'
+static int recipe_lists_delete(char *id);
+
+// RECIPE_COLUMNS, RECIPE_PARAMS, RECIPE_SETS, RECIPE_SELECT : the pieces of SQL for RECIPE_FIELDS
+//
+// NOTE (Brian) they all start with a comma, so they go after something that's always there, the
+// insert sets create_ts, and the update sets update_ts (the same way the delete sets delete_ts).
+#define RECIPE_COLUMNS RECIPE_FIELDS(RECIPE_COLUMN)
+#define RECIPE_COLUMN(K_, F_, KEY_, C_, ...) RECIPE_COLUMN_##K_(C_)
+#define RECIPE_COLUMN_TEXT(C_) ", " C_
+#define RECIPE_COLUMN_LIST(C_)
+
+#define RECIPE_PARAMS RECIPE_FIELDS(RECIPE_PARAM)
+#define RECIPE_PARAM(K_, F_, KEY_, C_, ...) RECIPE_PARAM_##K_
+#define RECIPE_PARAM_TEXT ", ?"
+#define RECIPE_PARAM_LIST
+
+#define RECIPE_SETS RECIPE_FIELDS(RECIPE_SET)
+#define RECIPE_SET(K_, F_, KEY_, C_, ...) RECIPE_SET_##K_(C_)
+#define RECIPE_SET_TEXT(C_) ", " C_ " = ?"
+#define RECIPE_SET_LIST(C_)
+
+#define RECIPE_SELECT(R_) RECIPE_FIELDS(RECIPE_SELECT_FIELD, R_)
+#define RECIPE_SELECT_FIELD(K_, F_, KEY_, C_, R_) RECIPE_SELECT_##K_(R_, C_)
+#define RECIPE_SELECT_TEXT(R_, C_) ", " R_ "." C_
+#define RECIPE_SELECT_LIST(R_, C_) ", " RECIPE_LIST(R_, C_)
+
+// RecipeCursor : where a keyset page picks up, see recipe_search
+typedef struct RecipeCursor {
+	double score;
+	i64 rowid;
+} RecipeCursor;
+
+// recipe_search : streams a page of search results out to 'conn' (in answer to 'hm'), 'cursor' is NULL for offset paging
+int recipe_search(struct mg_connection *conn, struct mg_http_message *hm, char *query, size_t page_size, size_t page_number, char *cursor, int total);
+
+// recipe_total : returns the number of results 'match' has (every live recipe if NULL), -1 on error
+static i64 recipe_total(char *match);
+
+// recipe_cursor_encode : writes the opaque 'next' token for a page ending at 'cursor'
+static void recipe_cursor_encode(char *s, size_t len, int is_search, RecipeCursor *cursor);
+
+// recipe_cursor_decode : reads a token from recipe_cursor_encode, -1 if it's garbage (or the wrong kind)
+static int recipe_cursor_decode(char *s, int is_search, RecipeCursor *cursor);
+
+// recipe_fts_sync : (re)writes the full text index entry for the recipe
+static int recipe_fts_sync(Recipe *recipe);
 
-// recipe_to_json : converts a Recipe to a JSON string
-static char *recipe_to_json(struct Recipe *recipe);
+// recipe_fts_insert : writes the full text index entry for a recipe that doesn't have one yet
+int recipe_fts_insert(Recipe *recipe);
 
-// recipe_search : fills out a search structure with results
-json_t *recipe_search(char *query, size_t page_size, size_t page_number);
+// recipe_fts_remove : removes the recipe at 'id' from the full text index
+static int recipe_fts_remove(char *id);
+
+// recipe_fts_query : converts user input into an FTS5 prefix query, NULL if there's nothing to search
+static char *recipe_fts_query(char *s);
 
 // NOTE (Brian): I'm putting this here because I'm not sure where else it's really going to be used.
 // Feel free to move it in the future
 
 // recipe_api_post : endpoint, POST - /api/v1/recipe
-int recipe_api_post(struct mg_connection *conn, struct mg_http_message *hm)
+int recipe_api_post(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
 {
 	struct Recipe *recipe;
 	char *body;
@@ -87,12 +165,14 @@ int recipe_api_post(struct mg_connection *conn, struct mg_http_message *hm)
 
 	if (recipe_validation(recipe) < 0) {
 		ERR("recipe record invalid!\n");
+		recipe_free(recipe);
 		return -1;
 	}
 
 	rc = recipe_insert(recipe);
 	if (rc < 0) {
 		ERR("couldn't save the recipe to the disk!\n");
+		recipe_free(recipe);
 		return -1;
 	}
 
@@ -104,21 +184,12 @@ int recipe_api_post(struct mg_connection *conn, struct mg_http_message *hm)
 }
 
 // recipe_api_put : endpoint, PUT - /api/v1/recipe/{id}
-int recipe_api_put(struct mg_connection *conn, struct mg_http_message *hm)
+int recipe_api_put(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
 {
 	int rc;
 	struct Recipe *updated;
-    struct Recipe *recipe;
-	char *url;
 	char *json;
-	char id[128] = {0};
-
-	url = strndup(hm->uri.ptr, hm->uri.len);
-
-	rc = sscanf(url, "/api/v1/recipe/%127s", id);
-	assert(rc == 1);
-
-	free(url);
+	char *id = params->id;
 
 	json = strndup(hm->body.ptr, hm->body.len);
 	if (json == NULL) { // TODO (Brian): HTTP Error
@@ -134,23 +205,23 @@ int recipe_api_put(struct mg_connection *conn, struct mg_http_message *hm)
 		return -1;
 	}
 
-    recipe = recipe_get_by_id(id);
-    if (recipe == NULL) {
-        ERR("couldn't load the recipe with id: '%s'", id);
-        return -1;
-    }
-
-    updated->metadata = metadata_clone(recipe->metadata);
-	recipe_free(recipe);
+	rc = db_load_metadata_from_id(&updated->metadata, "recipes", id);
+	if (rc < 0 || updated->metadata.id == NULL) {
+		ERR("couldn't load the recipe with id: '%s'", id);
+		recipe_free(updated);
+		return -1;
+	}
 
 	if (recipe_validation(updated) < 0) { // TODO (Brian): HTTP Error
 		ERR("updated recipe record invalid!\n");
+		recipe_free(updated);
 		return -1;
 	}
 
 	rc = recipe_update(updated);
 	if (rc < 0) {
 		ERR("couldn't update the recipe!\n");
+		recipe_free(updated);
 		return -1;
 	}
 
@@ -162,49 +233,72 @@ int recipe_api_put(struct mg_connection *conn, struct mg_http_message *hm)
 }
 
 // recipe_api_get : endpoint, GET - /api/v1/recipe/{id}
-int recipe_api_get(struct mg_connection *conn, struct mg_http_message *hm)
+int recipe_api_get(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
 {
-	struct Recipe *recipe;
-	char *url;
+	struct mg_iobuf gz = { 0 };
+	CacheEncoding encoding;
 	char *json;
-	int rc;
-	char id[128] = {0};
+	char *response;
+	u64 gen;
+	int len;
+	char *id = params->id;
 
-	url = strndup(hm->uri.ptr, hm->uri.len);
+	encoding = mg_vcasecmp(&hm->method, "HEAD") != 0 && gzip_accepts(hm) ? CACHE_GZIP : CACHE_IDENTITY;
 
-	rc = sscanf(url, "/api/v1/recipe/%127s", id);
-	assert(rc == 1);
+	if (cache_send(conn, id, encoding) == 0) {
+		return 0;
+	}
 
-	free(url);
+	gen = cache_generation();
 
-	recipe = recipe_get_by_id(id);
-	if (recipe == NULL) { // TODO (Brian): return HTTP error
-		ERR("couldn't fetch the recipe from the database!\n");
-		return -1;
+	json = recipe_get_json(id);
+	if (json == NULL) {
+		mg_http_reply(conn, 404, NULL, "");
+		return 0;
 	}
 
-	json = recipe_to_json(recipe);
-	if (json == NULL) {
-		ERR("couldn't convert the recipe to JSON\n");
+	// NOTE (Brian) this is byte for byte what mg_http_reply sends, but we want to keep a copy
+	len = asprintf(&response, "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n%s", strlen(json), json);
+	if (len < 0) {
 		free(json);
-		recipe_free(recipe);
 		return -1;
 	}
 
-	mg_http_reply(conn, 200, NULL, "%s", json);
+	// both copies go in the cache, so this is the only time this recipe gets compressed (until it
+	// changes, or falls out)
+	mg_iobuf_add(&gz, 0, response, len, MG_IO_SIZE);
+	if (!gzip_compress(&gz, 0, "GET /api/v1/recipe/:id")) {
+		mg_iobuf_free(&gz);
+	}
+
+	if (encoding == CACHE_GZIP && gz.len > 0) {
+		mg_send(conn, gz.buf, gz.len);
+	} else {
+		mg_send(conn, response, len);
+	}
+
+	cache_put(id, CACHE_IDENTITY, response, len, gen);
+	if (gz.len > 0) {
+		cache_put(id, CACHE_GZIP, (char *)gz.buf, gz.len, gen);
+	}
 
+	mg_iobuf_free(&gz);
+	free(response);
 	free(json);
-	recipe_free(recipe);
 
 	return 0;
 }
 
 // recipe_api_getlist : endpoint, GET - /api/v1/recipe/list
-int recipe_api_getlist(struct mg_connection *conn, struct mg_http_message *hm)
+int recipe_api_getlist(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
 {
 	char *query = NULL;
+	char *cursor = NULL;
 	char tbuf[BUFSMALL];
+	char cbuf[BUFSMALL];
+	char flag[8];
 	size_t siz, num;
+	int total;
 	int rc;
 
 	siz = 20;
@@ -217,38 +311,32 @@ int recipe_api_getlist(struct mg_connection *conn, struct mg_http_message *hm)
 	if (rc >= 0 && isdigit(tbuf[0])) { num = atol(tbuf); }
 
 	rc = mg_http_get_var(&hm->query, "q", tbuf, sizeof tbuf);
-	if (rc >= 0 && isdigit(tbuf[0])) { query = tbuf; }
+	if (rc > 0) { query = tbuf; }
 
-	json_t *json = recipe_search(query, siz, num);
-	if (json == NULL) {
-		ERR("search couldn't be performed!\n");
-	}
+	// NOTE (Brian) passing 'cursor' (even empty, for the first page) switches to keyset paging, and
+	// 'num' gets ignored. Without it, it's the old offset paging that the UI uses.
+	rc = mg_http_get_var(&hm->query, "cursor", cbuf, sizeof cbuf);
+	if (rc >= 0) { cursor = cbuf; }
 
-	char *json_str = json_dumps(json, JSON_SORT_KEYS|JSON_COMPACT);
+	// 'total=0' skips counting the results (e.g. for later pages of an infinite scroll)
+	total = true;
+	rc = mg_http_get_var(&hm->query, "total", flag, sizeof flag);
+	if (rc > 0 && flag[0] == '0') { total = false; }
 
-	mg_http_reply(conn, 200, NULL, "%s", json_str);
-
-	free(json_str);
-	json_decref(json);
+	rc = recipe_search(conn, hm, query, siz, num, cursor, total);
+	if (rc < 0) {
+		ERR("search couldn't be performed!\n");
+	}
 
 	return 0;
 }
 
 // recipe_api_delete : endpoint, DELETE - /api/v1/recipe/{id}
-int recipe_api_delete(struct mg_connection *conn, struct mg_http_message *hm)
+int recipe_api_delete(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
 {
-	char *url;
 	int rc;
-	char id[128];
-
-	url = strndup(hm->uri.ptr, hm->uri.len);
 
-	rc = sscanf(url, "/api/v1/recipe/%127s", id);
-	assert(rc == 1);
-
-	free(url);
-
-	rc = recipe_delete(id);
+	rc = recipe_delete(params->id);
 	if (rc < 0) {
 		// TODO (Brian): return HTTP error
 		ERR("couldn't delete the recipe from the database!\n");
@@ -263,59 +351,51 @@ int recipe_api_delete(struct mg_connection *conn, struct mg_http_message *hm)
 // recipe_insert: adds a recipe to the database. writes DB_Metadata into the recipe pointer after add
 int recipe_insert(Recipe *recipe)
 {
-	sqlite3_stmt *stmt;
-	int64_t rowid;
 	int rc;
 
-	sqlite3_exec(DATABASE, "begin transaction;", NULL, NULL, NULL);
-
-	char *query =
-		"insert into recipes (name, prep_time, cook_time, servings, link, notes) values (?, ?, ?, ?, ?, ?);";
-
-	rc = sqlite3_prepare_v2(DATABASE, query, -1, &stmt, NULL);
-	if (rc != SQLITE_OK) {
+	if (db_transaction_begin() < 0) {
+		ERR("couldn't begin the transaction: %s\n", sqlite3_errmsg(DATABASE));
 		return -1;
 	}
 
-	sqlite3_bind_text(stmt, 1, (const char *)recipe->name, -1, NULL);
-
-	if (recipe->prep_time) {
-		sqlite3_bind_text(stmt, 2, (const char *)recipe->prep_time, -1, NULL);
-	} else {
-		sqlite3_bind_null(stmt, 2);
+	rc = recipe_insert_rows(recipe);
+	if (rc == 0) {
+		rc = recipe_fts_insert(recipe);
 	}
 
-	if (recipe->cook_time) {
-		sqlite3_bind_text(stmt, 3, (const char *)recipe->cook_time, -1, NULL);
-	} else {
-		sqlite3_bind_null(stmt, 3);
+	if (rc == 0 && db_transaction_commit() < 0) {
+		ERR("couldn't commit the recipe: %s\n", sqlite3_errmsg(DATABASE));
+		rc = -1;
 	}
 
-	if (recipe->servings) {
-		sqlite3_bind_text(stmt, 4, (const char *)recipe->servings, -1, NULL);
-	} else {
-		sqlite3_bind_null(stmt, 4);
+	if (rc < 0) {
+		db_transaction_rollback();
+		return -1;
 	}
 
-	if (recipe->link) {
-		sqlite3_bind_text(stmt, 5, (const char *)recipe->link, -1, NULL);
-	} else {
-		sqlite3_bind_null(stmt, 5);
-	}
+	return 0;
+}
 
-	if (recipe->notes) {
-		sqlite3_bind_text(stmt, 6, (const char *)recipe->notes, -1, NULL);
-	} else {
-		sqlite3_bind_null(stmt, 6);
+// recipe_insert_rows : writes the recipe and its lists, inside of the caller's transaction (see recipe_fts_insert)
+int recipe_insert_rows(Recipe *recipe)
+{
+	sqlite3_stmt *stmt;
+	int64_t rowid;
+	int rc;
+
+	stmt = db_stmt_get("recipes", "insert",
+		"insert into %s (create_ts" RECIPE_COLUMNS ") values (" DB_NOW_MS RECIPE_PARAMS ");");
+	if (stmt == NULL) {
+		return -1;
 	}
 
+	recipe_bind(stmt, recipe);
+
 	rc = sqlite3_step(stmt);
 
-	sqlite3_finalize(stmt);
-	stmt = NULL;
+	db_stmt_release(stmt);
 
 	if (rc != SQLITE_DONE) { // deal with error
-		sqlite3_finalize(stmt);
 		ERR("error inserting recipe record! %s", sqlite3_errstr(rc));
 		return -1;
 	}
@@ -325,32 +405,10 @@ int recipe_insert(Recipe *recipe)
 
 	rc = db_load_metadata_from_rowid(&recipe->metadata, "recipes", rowid);
 	if (rc < 0) {
-		goto recipe_insert_fail;
-	}
-
-	rc = db_insert_textlist("ingredients", recipe->metadata.id, recipe->ingredients);
-	if (rc < 0) {
-		goto recipe_insert_fail;
-	}
-
-	rc = db_insert_textlist("steps", recipe->metadata.id, recipe->steps);
-	if (rc < 0) { // ?
-		goto recipe_insert_fail;
-	}
-
-	rc = db_insert_textlist("tags", recipe->metadata.id, recipe->tags);
-	if (rc < 0) { // ?
-		goto recipe_insert_fail;
+		return -1;
 	}
 
-	sqlite3_exec(DATABASE, "commit transaction;", NULL, NULL, NULL);
-
-	return 0;
-
-recipe_insert_fail:
-	if (stmt != NULL) sqlite3_finalize(stmt);
-	sqlite3_exec(DATABASE, "rollback transaction;", NULL, NULL, NULL);
-	return -1;
+	return recipe_lists_insert(recipe);
 }
 
 // recipe_update: updates the recipe in the database
@@ -359,130 +417,258 @@ int recipe_update(Recipe *recipe)
 	// NOTE (Brian) Deleting a recipe deletes all children tables (ingredients, steps, tags),
 	// updates the main table, then adds all of the new child text lists again.
 
+	sqlite3_stmt *stmt = NULL;
 	int rc;
 
-	db_transaction_begin();
+	if (db_transaction_begin() < 0) {
+		ERR("couldn't begin the transaction: %s\n", sqlite3_errmsg(DATABASE));
+		return -1;
+	}
 
-	rc = db_delete_textlist("ingredients", recipe->metadata.id);
+	rc = recipe_lists_delete(recipe->metadata.id);
 	if (rc < 0) goto recipe_update_fail;
-	rc = db_delete_textlist("steps", recipe->metadata.id);
+
+	stmt = db_stmt_get("recipes", "update",
+		"update %s set update_ts = " DB_NOW_MS RECIPE_SETS " where id = uuid_blob(?);");
+	if (stmt == NULL) {
+        rc = -1;
+		goto recipe_update_fail;
+	}
+
+	sqlite3_bind_text(stmt, recipe_bind(stmt, recipe), (const char *)recipe->metadata.id, -1, NULL);
+
+	rc = sqlite3_step(stmt);
+
+	db_stmt_release(stmt);
+
+	if (rc != SQLITE_DONE) {
+		ERR("error updating recipe record! %s", sqlite3_errstr(rc));
+		rc = -1;
+		goto recipe_update_fail;
+	}
+
+	rc = recipe_lists_insert(recipe);
 	if (rc < 0) goto recipe_update_fail;
-	rc = db_delete_textlist("tags", recipe->metadata.id);
+
+	rc = recipe_fts_sync(recipe);
 	if (rc < 0) goto recipe_update_fail;
 
-	char *query = "update recipes set name = ?, prep_time = ?, cook_time = ?, servings = ?, link = ?, notes = ? where id = ?;";
+	rc = db_transaction_commit();
+	if (rc < 0) {
+		ERR("couldn't commit the update: %s\n", sqlite3_errmsg(DATABASE));
+		goto recipe_update_fail;
+	}
+
+	cache_invalidate(recipe->metadata.id);
+
+recipe_update_fail:
+	if (rc) db_transaction_rollback();
 
+	return rc;
+}
+
+// recipe_get_by_id : fetches a recipe object from the store by id, and parses it
+struct Recipe *recipe_get_by_id(char *id)
+{
+	Recipe *recipe;
 	sqlite3_stmt *stmt;
+	int rc;
 
-	rc = sqlite3_prepare_v2(DATABASE, query, -1, &stmt, NULL);
-	if (rc != SQLITE_OK) {
-        rc = -1;
-		goto recipe_update_fail;
+	// NOTE (Brian) one statement for the whole thing, the child lists come back as JSON arrays
+	// (already in order), see recipe_get_json
+	stmt = db_stmt_get("recipes", "get_by_id",
+		"select uuid_str(r.id), " DB_TS_STR("r.create_ts") ", " DB_TS_STR("r.update_ts") ", " DB_TS_STR("r.delete_ts")
+		", r.rowid" RECIPE_SELECT("r") " from %s r where r.id = uuid_blob(?);");
+	if (stmt == NULL) {
+		return NULL;
 	}
 
-	sqlite3_bind_text(stmt, 1, (const char *)recipe->name, -1, NULL);
+	sqlite3_bind_text(stmt, 1, id, -1, NULL);
 
-	if (recipe->prep_time) {
-		sqlite3_bind_text(stmt, 2, (const char *)recipe->prep_time, -1, NULL);
-	} else {
-		sqlite3_bind_null(stmt, 2);
+	if ((rc = sqlite3_step(stmt)) != SQLITE_ROW) {
+		db_stmt_release(stmt);
+		return NULL;
 	}
 
-	if (recipe->cook_time) {
-		sqlite3_bind_text(stmt, 3, (const char *)recipe->cook_time, -1, NULL);
-	} else {
-		sqlite3_bind_null(stmt, 3);
+	recipe = calloc(1, sizeof(*recipe));
+	if (recipe == NULL) {
+		db_stmt_release(stmt);
+		return NULL;
 	}
 
-	if (recipe->servings) {
-		sqlite3_bind_text(stmt, 4, (const char *)recipe->servings, -1, NULL);
-	} else {
-		sqlite3_bind_null(stmt, 4);
+	recipe->metadata.id        = strdup_null((char *)sqlite3_column_text(stmt, 0));
+	recipe->metadata.create_ts = strdup_null((char *)sqlite3_column_text(stmt, 1));
+	recipe->metadata.update_ts = strdup_null((char *)sqlite3_column_text(stmt, 2));
+	recipe->metadata.delete_ts = strdup_null((char *)sqlite3_column_text(stmt, 3));
+	recipe->metadata.rowid     = sqlite3_column_int64(stmt, 4);
+
+	recipe_read(stmt, 5, recipe);
+
+	db_stmt_release(stmt);
+
+	return recipe;
+}
+
+// recipe_get_json : returns the recipe at 'id' as the JSON the API sends, NULL if there isn't one
+char *recipe_get_json(char *id)
+{
+	// NOTE (Brian) SQLite builds the entire response here (see RECIPE_JSON), so a GET never builds
+	// a Recipe, or a jansson tree.
+
+	sqlite3_stmt *stmt;
+	char *json = NULL;
+
+	stmt = db_stmt_get("recipes", "get_json",
+		"select " RECIPE_JSON("r") " from %s r where r.id = uuid_blob(?);");
+	if (stmt == NULL) {
+		return NULL;
 	}
 
-	if (recipe->link) {
-		sqlite3_bind_text(stmt, 5, (const char *)recipe->link, -1, NULL);
-	} else {
-		sqlite3_bind_null(stmt, 5);
+	sqlite3_bind_text(stmt, 1, id, -1, NULL);
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		json = strdup_null((char *)sqlite3_column_text(stmt, 0));
 	}
 
-	if (recipe->notes) {
-		sqlite3_bind_text(stmt, 6, (const char *)recipe->notes, -1, NULL);
-	} else {
-		sqlite3_bind_null(stmt, 6);
+	db_stmt_release(stmt);
+
+	return json;
+}
+
+// recipe_textlist_from_json : converts a JSON array of strings into an stb array
+static char **recipe_textlist_from_json(const char *s)
+{
+	JsonReader reader;
+	char **list = NULL;
+
+	if (s == NULL) {
+		return NULL;
 	}
 
-    sqlite3_bind_text(stmt, 7, (const char *)recipe->metadata.id, -1, NULL);
+	jsonr_init(&reader, s, strlen(s));
 
-	rc = sqlite3_step(stmt);
+	if (jsonr_peek(&reader) != '[' || recipe_list_from_json(&reader, &list) < 0 || jsonr_end(&reader) < 0) {
+		recipe_list_free(list);
+		return NULL;
+	}
 
-	sqlite3_finalize(stmt);
-	stmt = NULL;
+	return list;
+}
 
-	rc = db_insert_textlist("ingredients", recipe->metadata.id, recipe->ingredients);
-	if (rc < 0) goto recipe_update_fail;
-	rc = db_insert_textlist("steps", recipe->metadata.id, recipe->steps);
-	if (rc < 0) goto recipe_update_fail;
-	rc = db_insert_textlist("tags", recipe->metadata.id, recipe->tags);
-	if (rc < 0) goto recipe_update_fail;
+// recipe_text_from_json : sets 'text' to a copy of the next value, if it's a string (and skips it if it isn't), -1 on error
+static int recipe_text_from_json(JsonReader *reader, char **text)
+{
+	char *s;
 
-	db_transaction_commit();
+	// everything but the name is optional, so anything that isn't a string is just left out
+	if (jsonr_peek(reader) != '"') {
+		return jsonr_skip(reader);
+	}
 
-	rc = 0;
+	s = jsonr_string(reader);
+	if (s == NULL) {
+		return -1;
+	}
 
-recipe_update_fail:
-	if (rc) db_transaction_rollback();
-	if (stmt != NULL) sqlite3_finalize(stmt);
+	// a key that's there twice is the last one, like it was with jansson
+	free(*text);
+	*text = s;
 
-	return rc;
+	return 0;
 }
 
-// recipe_get_by_id : fetches a recipe object from the store by id, and parses it
-struct Recipe *recipe_get_by_id(char *id)
+// recipe_list_from_json : sets 'list' to the strings in the next value, if it's an array, -1 if any of them aren't strings
+static int recipe_list_from_json(JsonReader *reader, char ***list)
 {
-	Recipe *recipe = calloc(1, sizeof(*recipe));
-	if (recipe == NULL) {
-		return NULL;
+	char *s;
+	int rc;
+
+	if (jsonr_peek(reader) != '[') {
+		return jsonr_skip(reader);
 	}
 
-	size_t query_sz;
-	char *query;
-	sqlite3_stmt *stmt;
-	int rc;
+	recipe_list_free(*list);
+	*list = NULL;
 
-	FILE *stream = open_memstream(&query, &query_sz);
-	fprintf(stream, "select name, prep_time, cook_time, servings, link, notes from recipes where id = ?;");
-	fclose(stream);
+	if (jsonr_array(reader) < 0) {
+		return -1;
+	}
 
-	rc = sqlite3_prepare_v2(DATABASE, query, -1, &stmt, NULL);
-	if (rc != SQLITE_OK) {
-		ERR("%s\n", sqlite3_errmsg(DATABASE));
-		free(query);
-		return NULL;
+	while ((rc = jsonr_next(reader)) > 0) {
+		if (jsonr_peek(reader) != '"' || (s = jsonr_string(reader)) == NULL) {
+			return -1;
+		}
+		arrput(*list, s);
 	}
 
-	sqlite3_bind_text(stmt, 1, id, -1, NULL);
+	return rc;
+}
 
-	if ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-		recipe->name	  = strdup_null((char *)sqlite3_column_text(stmt, 0));
-		recipe->prep_time = strdup_null((char *)sqlite3_column_text(stmt, 1));
-		recipe->cook_time = strdup_null((char *)sqlite3_column_text(stmt, 2));
-		recipe->servings  = strdup_null((char *)sqlite3_column_text(stmt, 3));
-		recipe->link     = strdup_null((char *)sqlite3_column_text(stmt, 4));
-		recipe->notes	 = strdup_null((char *)sqlite3_column_text(stmt, 5));
+// recipe_list_free : frees the stb array of strings 'list'
+static void recipe_list_free(char **list)
+{
+	for (ptrdiff_t i = 0; i < arrlen(list); i++) {
+		free(list[i]);
 	}
+	arrfree(list);
+}
 
-	sqlite3_finalize(stmt);
+// recipe_bind : binds the TEXT fields of 'recipe' to 'stmt', in order, returns the next parameter's index
+static int recipe_bind(sqlite3_stmt *stmt, Recipe *recipe)
+{
+	int i = 1;
+
+	// NOTE (Brian) a NULL binds as null, there's no need to check
+#define RECIPE_BIND(K_, F_, ...) RECIPE_BIND_##K_(F_)
+#define RECIPE_BIND_TEXT(F_) sqlite3_bind_text(stmt, i++, recipe->F_, -1, NULL);
+#define RECIPE_BIND_LIST(F_)
+	RECIPE_FIELDS(RECIPE_BIND)
+#undef RECIPE_BIND
+#undef RECIPE_BIND_TEXT
+#undef RECIPE_BIND_LIST
+
+	return i;
+}
+
+// recipe_read : reads every field of 'recipe' out of the row 'stmt' is on, starting at column 'col'
+static void recipe_read(sqlite3_stmt *stmt, int col, Recipe *recipe)
+{
+	// the columns are in the same order as RECIPE_SELECT put them in
+#define RECIPE_READ(K_, F_, ...) RECIPE_READ_##K_(F_)
+#define RECIPE_READ_TEXT(F_) recipe->F_ = strdup_null((char *)sqlite3_column_text(stmt, col++));
+#define RECIPE_READ_LIST(F_) recipe->F_ = recipe_textlist_from_json((const char *)sqlite3_column_text(stmt, col++));
+	RECIPE_FIELDS(RECIPE_READ)
+#undef RECIPE_READ
+#undef RECIPE_READ_TEXT
+#undef RECIPE_READ_LIST
+}
 
-	db_load_metadata_from_id(&recipe->metadata, "recipes", id);
+// recipe_lists_insert : writes the LIST fields of 'recipe' to their tables
+static int recipe_lists_insert(Recipe *recipe)
+{
+#define RECIPE_INSERT(K_, F_, KEY_, C_, ...) RECIPE_INSERT_##K_(F_, C_)
+#define RECIPE_INSERT_TEXT(F_, C_)
+#define RECIPE_INSERT_LIST(F_, C_) if (db_insert_textlist(C_, recipe->metadata.id, recipe->F_) < 0) return -1;
+	RECIPE_FIELDS(RECIPE_INSERT)
+#undef RECIPE_INSERT
+#undef RECIPE_INSERT_TEXT
+#undef RECIPE_INSERT_LIST
 
-	recipe->ingredients = db_get_textlist("ingredients", recipe->metadata.id);
-	recipe->steps = db_get_textlist("steps", recipe->metadata.id);
-	recipe->tags = db_get_textlist("tags", recipe->metadata.id);
+	return 0;
+}
 
-	free(query);
+// recipe_lists_delete : deletes the LIST rows of the recipe at 'id'
+static int recipe_lists_delete(char *id)
+{
+#define RECIPE_DELETE(K_, F_, KEY_, C_, ...) RECIPE_DELETE_##K_(C_)
+#define RECIPE_DELETE_TEXT(C_)
+#define RECIPE_DELETE_LIST(C_) if (db_delete_textlist(C_, id) < 0) return -1;
+	RECIPE_FIELDS(RECIPE_DELETE)
+#undef RECIPE_DELETE
+#undef RECIPE_DELETE_TEXT
+#undef RECIPE_DELETE_LIST
 
-	return recipe;
+	return 0;
 }
 
 // recipe_delete : updates 'deleted_ts' on the given recipe, such that it is 'deleted'
@@ -490,220 +676,438 @@ int recipe_delete(char *id)
 {
 	sqlite3_stmt *stmt;
 	int rc;
-	char *query = "update recipes set delete_ts = (strftime('%Y%m%d-%H%M%f', 'now')) where id = ?;";
 
-	// TODO (Brian) handle errors
+	if (db_transaction_begin() < 0) {
+		ERR("couldn't begin the transaction: %s\n", sqlite3_errmsg(DATABASE));
+		return -1;
+	}
 
-	rc = sqlite3_prepare_v2(DATABASE, query, -1, &stmt, NULL);
-	if (rc != SQLITE_OK) {
+	stmt = db_stmt_get("recipes", "delete",
+		"update %s set delete_ts = " DB_NOW_MS " where id = uuid_blob(?);");
+	if (stmt == NULL) {
         ERR("could not prepare query!");
+        db_transaction_rollback();
         return -1;
 	}
 
 	rc = sqlite3_bind_text(stmt, 1, (const char *)id, -1, NULL);
 	if (rc != SQLITE_OK) {
         ERR("could not bind id!");
+        db_stmt_release(stmt);
+        db_transaction_rollback();
         return -1;
 	}
 
 	rc = sqlite3_step(stmt);
+
+	db_stmt_release(stmt);
+
 	if (rc != SQLITE_DONE) {
         ERR("could not complete delete query!");
+        db_transaction_rollback();
+        return -1;
+	}
+
+	if (recipe_fts_remove(id) < 0) {
+        ERR("could not remove the recipe from the search index!");
+        db_transaction_rollback();
         return -1;
 	}
 
-	sqlite3_finalize(stmt);
-    stmt = NULL;
+	if (db_transaction_commit() < 0) {
+		ERR("couldn't commit the delete: %s\n", sqlite3_errmsg(DATABASE));
+		db_transaction_rollback();
+		return -1;
+	}
+
+	cache_invalidate(id);
 
 	return 0;
 }
 
-// recipe_search : fills out a search structure with results
-json_t *recipe_search(char *query, size_t page_size, size_t page_number)
+// strjoin : joins the stb array 'list' with 'sep', the caller frees the result
+static char *strjoin(char **list, char *sep)
 {
-	// TODO (Brian) finish updating the 
-	char *search_cols[] = { "id", "search_text", NULL };
-	char *where_clause[] = { "search_text", "like", "?", NULL };
-	char *search_bind_params[] = { COALESCE(query, "%"), NULL };
-	DB_Query search = {
-		.pk_column = "id",
-		.columns = search_cols,
-		.table = "v_recipes",
-		.where = where_clause,
-		.bind = search_bind_params
-	};
-
-	char *results_cols[] = { "id", "name", "prep_time", "cook_time", "servings", NULL };
-	DB_Query results = {
-		.pk_column = "id",
-		.columns = results_cols,
-		.table = "ui_recipes",
-	};
-
-	UI_SearchQuery runme = {
-		.search = search,
-		.results = results,
-		.page_size = page_size,
-		.page_number = page_number
-	};
-
-	return db_search_to_json(&runme);
+	char *s = NULL;
+	size_t len = 0;
+
+	FILE *stream = open_memstream(&s, &len);
+	for (size_t i = 0; i < arrlen(list); i++) {
+		fprintf(stream, "%s%s", i ? sep : "", list[i]);
+	}
+	fclose(stream);
+
+	return s;
 }
 
-// recipe_validation : returns non-zero if the input object is invalid
-int recipe_validation(struct Recipe *recipe)
+// recipe_fts_sync : (re)writes the full text index entry for the recipe
+static int recipe_fts_sync(Recipe *recipe)
 {
-	return recipe == NULL || recipe->name == NULL || 100 < strlen(recipe->name);
+	if (recipe_fts_remove(recipe->metadata.id) < 0) {
+		return -1;
+	}
+
+	return recipe_fts_insert(recipe);
 }
 
-// recipe_from_json : converts a JSON string into a Recipe
-static struct Recipe *recipe_from_json(char *s)
+// recipe_fts_insert : writes the full text index entry for a recipe that doesn't have one yet
+int recipe_fts_insert(Recipe *recipe)
 {
-	struct Recipe *recipe;
-	json_t *root;
-	json_error_t error;
-	size_t i;
+	// NOTE (Brian) FTS5 keeps new entries in memory until the end of the transaction, *unless*
+	// another write statement (or a savepoint) comes along first, then it has to flush them out as a
+	// new segment. The insert into recipes is one of those (it has a trigger), so for a batch of
+	// recipes, write all of their rows first, and then all of their index entries, one after the
+	// other. Interleaving the two means a segment, and eventually a merge, for every single recipe.
 
-	recipe = calloc(1, sizeof(*recipe));
-	if (recipe == NULL) {
-		return NULL;
+	sqlite3_stmt *stmt;
+	char *ingredients, *steps, *tags;
+	int rc;
+
+	stmt = db_stmt_get("recipes_fts", "insert",
+		"insert into %s (rowid, name, ingredients, steps, tags) values (?, ?, ?, ?, ?);");
+	if (stmt == NULL) {
+		return -1;
 	}
 
-	root = json_loads(s, 0, &error);
-	if (root == NULL) {
-		free(recipe);
-		return NULL;
+	ingredients = strjoin(recipe->ingredients, "; ");
+	steps = strjoin(recipe->steps, "; ");
+	tags = strjoin(recipe->tags, "; ");
+
+	sqlite3_bind_int64(stmt, 1, recipe->metadata.rowid);
+	sqlite3_bind_text(stmt, 2, recipe->name, -1, NULL);
+	sqlite3_bind_text(stmt, 3, ingredients, -1, NULL);
+	sqlite3_bind_text(stmt, 4, steps, -1, NULL);
+	sqlite3_bind_text(stmt, 5, tags, -1, NULL);
+
+	rc = sqlite3_step(stmt);
+
+	db_stmt_release(stmt);
+
+	free(ingredients);
+	free(steps);
+	free(tags);
+
+	return rc == SQLITE_DONE ? 0 : -1;
+}
+
+// recipe_fts_remove : removes the recipe at 'id' from the full text index
+static int recipe_fts_remove(char *id)
+{
+	sqlite3_stmt *stmt;
+	int rc;
+
+	stmt = db_stmt_get("recipes_fts", "delete",
+		"delete from %s where rowid = (select rowid from recipes where id = uuid_blob(?));");
+	if (stmt == NULL) {
+		return -1;
 	}
 
-	if (!json_is_object(root)) {
-		json_decref(root);
+	sqlite3_bind_text(stmt, 1, id, -1, NULL);
+
+	rc = sqlite3_step(stmt);
+
+	db_stmt_release(stmt);
+
+	return rc == SQLITE_DONE ? 0 : -1;
+}
+
+// recipe_fts_query : converts user input into an FTS5 prefix query, NULL if there's nothing to search
+static char *recipe_fts_query(char *s)
+{
+	// NOTE (Brian) we don't want to expose the FTS5 query syntax to people (a stray quote or 'NOT'
+	// is a syntax error), so every run of letters / digits becomes its own quoted prefix term:
+	//
+	//   chick soup  ->  "chick"* "soup"*
+	//
+	// which FTS5 ANDs together. Anything that isn't ASCII is kept as part of the word, so that
+	// UTF-8 input makes it to the tokenizer.
+
+	char *query = NULL;
+	size_t len = 0;
+	int terms = 0;
+
+	FILE *stream = open_memstream(&query, &len);
+
+	// NOTE (Brian) the high bit is checked first, isalnum on a (signed) char that's negative is undefined
+	while (*s) {
+		while (*s && !((u8)*s >= 0x80 || isalnum((u8)*s))) s++;
+		if (*s == '\0') break;
+
+		char *start = s;
+		while ((u8)*s >= 0x80 || isalnum((u8)*s)) s++;
+
+		fprintf(stream, "%s\"%.*s\"*", terms++ ? " " : "", (int)(s - start), start);
+	}
+
+	fclose(stream);
+
+	if (terms == 0) {
+		free(query);
 		return NULL;
 	}
 
-	// name is the only required recipe value, everything else is optional
-	json_t *name = json_object_get(root, "name");
-	if (json_is_string(name)) {
-		recipe->name = strdup(json_string_value(name));
+	return query;
+}
+
+// recipe_search : streams a page of search results out to 'conn' (in answer to 'hm'), 'cursor' is NULL for offset paging
+int recipe_search(struct mg_connection *conn, struct mg_http_message *hm, char *query, size_t page_size, size_t page_number, char *cursor, int total)
+{
+	// NOTE (Brian) keyset paging
+	//
+	// Offset paging makes SQLite produce (and throw away) every row before the page, so page 1000
+	// costs a thousand times page 0. With a cursor, each page instead starts right after the sort key
+	// of the last row of the previous page:
+	//
+	//   listing: where rowid > ?5                        (a seek on the table's b-tree)
+	//   search:  where (bm25(...), f.rowid) > (?4, ?5)   (bm25 can't be indexed, but the sort only
+	//                                                     ever keeps page_size rows around)
+	//
+	// Both modes share the same statements, offset paging just starts from the very beginning.
+
+	sqlite3_stmt *stmt;
+	char *match;
+	char next[BUFSMALL];
+	RecipeCursor after = { .score = -INFINITY, .rowid = 0 };
+	JsonWriter writer;
+	size_t rows;
+	i64 count;
+	int ncols;
+	int rc;
+
+	match = query ? recipe_fts_query(query) : NULL;
+
+	if (cursor && *cursor && recipe_cursor_decode(cursor, match != NULL, &after) < 0) {
+		free(match);
+		mg_http_reply(conn, 400, NULL, "");
+		return 0;
+	}
+
+	if (match) {
+		// NOTE (Brian) bm25 weights are per column: name, ingredients, steps, tags. A hit in the
+		// name is worth a whole lot more than a hit in the middle of some step.
+		stmt = db_stmt_get("recipes_fts", "search",
+			"select uuid_str(r.id) as id, r.name, r.prep_time, r.cook_time, r.servings"
+			", snippet(recipes_fts, -1, '<mark>', '</mark>', '...', 12) as snippet"
+			", " RECIPE_COVER("r") " as image"
+			", bm25(recipes_fts, 10.0, 2.0, 1.0, 5.0) as score, f.rowid"
+			" from recipes_fts f inner join recipes r on r.rowid = f.rowid"
+			" where recipes_fts match ?1"
+			" and (bm25(recipes_fts, 10.0, 2.0, 1.0, 5.0), f.rowid) > (?4, ?5)"
+			" order by score, f.rowid"
+			" limit ?2 offset ?3;");
 	} else {
-		json_decref(root);
-		free(recipe);
-		return NULL;
+		stmt = db_stmt_get("recipes", "list",
+			"select uuid_str(r.id) as id, r.name, r.prep_time, r.cook_time, r.servings"
+			", " RECIPE_COVER("r") " as image, r.rowid from %s r"
+			" where r.delete_ts is null and r.rowid > ?5"
+			" order by r.rowid"
+			" limit ?2 offset ?3;");
 	}
 
-	// everything else, we can just check for the key, and if it's present and a string/array,
-	// just add it into the structure
-	json_t *prep_time = json_object_get(root, "prep_time");
-	if (json_is_string(prep_time)) {
-		recipe->prep_time = strdup(json_string_value(prep_time));
+	if (stmt == NULL) {
+		free(match);
+		mg_http_reply(conn, 500, NULL, "");
+		return -1;
 	}
 
-	json_t *cook_time = json_object_get(root, "cook_time");
-	if (json_is_string(cook_time)) {
-		recipe->cook_time = strdup(json_string_value(cook_time));
+	if (match) {
+		sqlite3_bind_text(stmt, 1, match, -1, NULL);
+		sqlite3_bind_double(stmt, 4, after.score);
 	}
 
-	json_t *servings = json_object_get(root, "servings");
-	if (json_is_string(servings)) {
-		recipe->servings = strdup(json_string_value(servings));
+	sqlite3_bind_int64(stmt, 2, page_size);
+	sqlite3_bind_int64(stmt, 3, cursor ? 0 : page_size * page_number);
+	sqlite3_bind_int64(stmt, 5, after.rowid);
+
+	// the sort key columns are on the end, and they don't go out with the results, and the image is
+	// right before them, because it's already JSON
+	ncols = sqlite3_column_count(stmt) - (match ? 3 : 2);
+
+	jsonw_begin(&writer, conn, hm, "GET /api/v1/recipe/list");
+
+	jsonw_printf(&writer, "{\"page\":%zu,\"results\":[", cursor ? 0 : page_number);
+
+	for (rows = 0; (rc = sqlite3_step(stmt)) == SQLITE_ROW; rows++) {
+		if (rows > 0) jsonw_raw(&writer, ",", 1);
+		jsonw_raw(&writer, "{", 1);
+		jsonw_columns(&writer, stmt, ncols);
+		jsonw_raw(&writer, ",\"image\":", 9);
+		if (sqlite3_column_type(stmt, ncols) == SQLITE_NULL) {
+			jsonw_raw(&writer, "null", 4);
+		} else {
+			jsonw_raw(&writer, (const char *)sqlite3_column_text(stmt, ncols), sqlite3_column_bytes(stmt, ncols));
+		}
+		jsonw_raw(&writer, "}", 1);
+
+		if (match) after.score = sqlite3_column_double(stmt, ncols + 1);
+		after.rowid = sqlite3_column_int64(stmt, ncols + (match ? 2 : 1));
 	}
 
-	json_t *notes = json_object_get(root, "note");
-	if (json_is_string(notes)) {
-		recipe->notes = strdup(json_string_value(notes));
+	if (rc != SQLITE_DONE) {
+		ERR("SQLITE ERROR: %s\n", sqlite3_errstr(rc));
+		jsonw_abort(&writer);
+		db_stmt_release(stmt);
+		free(match);
+		return -1;
 	}
 
-	json_t *link = json_object_get(root, "link");
-	if (json_is_string(link)) {
-		recipe->link = strdup(json_string_value(link));
+	jsonw_printf(&writer, "],\"size\":%zu,\"total\":", page_size);
+
+	count = total ? recipe_total(match) : -1;
+	if (count >= 0) {
+		jsonw_printf(&writer, "%ld", count);
+	} else {
+		jsonw_raw(&writer, "null", 4);
 	}
 
-	json_t *ingredients = json_object_get(root, "ingredients");
-	if (json_is_array(ingredients)) {
-		for (i = 0; i < json_array_size(ingredients); i++) {
-			// TODO (Brian): check that this is actually a string value
-			json_t *ingredient = json_array_get(ingredients, i);
-			arrput(recipe->ingredients, strdup(json_string_value(ingredient)));
-		}
+	jsonw_raw(&writer, ",\"next\":", 8);
+
+	// a short page is the last one
+	if (rows > 0 && rows == page_size) {
+		recipe_cursor_encode(next, sizeof next, match != NULL, &after);
+		jsonw_string(&writer, next, strlen(next));
+	} else {
+		jsonw_raw(&writer, "null", 4);
 	}
 
-	json_t *steps = json_object_get(root, "steps");
-	if (json_is_array(steps)) {
-		for (i = 0; i < json_array_size(steps); i++) {
-			// TODO (Brian): check that this is actually a string value
-			json_t *step = json_array_get(steps, i);
-			arrput(recipe->steps, strdup(json_string_value(step)));
-		}
+	jsonw_raw(&writer, "}", 1);
+
+	jsonw_end(&writer);
+
+	db_stmt_release(stmt);
+	free(match);
+
+	return 0;
+}
+
+// recipe_total : returns the number of results 'match' has (every live recipe if NULL), -1 on error
+static i64 recipe_total(char *match)
+{
+	// NOTE (Brian) neither of these goes anywhere near the result rows. The plain listing reads the
+	// counter that the triggers in schema.sql keep up to date, and a search only walks the FTS5
+	// doclists for the terms, without any of the bm25 / snippet / join work the search itself does.
+
+	sqlite3_stmt *stmt;
+	i64 count = -1;
+
+	if (match) {
+		stmt = db_stmt_get("recipes_fts", "count", "select count(*) from %s where recipes_fts match ?;");
+	} else {
+		stmt = db_stmt_get("counters", "recipes", "select value from %s where name = 'recipes';");
 	}
 
-	json_t *tags = json_object_get(root, "tags");
-	if (json_is_array(tags)) {
-		for (i = 0; i < json_array_size(tags); i++) {
-			// TODO (Brian): check that this is actually a string value
-			json_t *tag = json_array_get(tags, i);
-			arrput(recipe->tags, strdup(json_string_value(tag)));
-		}
+	if (stmt == NULL) {
+		return -1;
 	}
 
-	json_decref(root);
+	if (match) {
+		sqlite3_bind_text(stmt, 1, match, -1, NULL);
+	}
 
-	return recipe;
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		count = sqlite3_column_int64(stmt, 0);
+	}
+
+	db_stmt_release(stmt);
+
+	return count;
 }
 
-// recipe_to_json : converts a Recipe to a JSON string
-static char *recipe_to_json(struct Recipe *recipe)
+// recipe_cursor_encode : writes the opaque 'next' token for a page ending at 'cursor'
+static void recipe_cursor_encode(char *s, size_t len, int is_search, RecipeCursor *cursor)
 {
-	json_t *object;
-	json_t *ingredients;
-	json_t *steps;
-	json_t *tags;
-	json_error_t error;
-	char *s;
-	size_t i, len;
+	char tbuf[BUFSMALL];
+	int n;
+
+	// NOTE (Brian) '%a' so that the score makes it through the round trip bit for bit
+	if (is_search) {
+		n = snprintf(tbuf, sizeof tbuf, "s:%a:%ld", cursor->score, cursor->rowid);
+	} else {
+		n = snprintf(tbuf, sizeof tbuf, "r:%ld", cursor->rowid);
+	}
 
-	// we have to setup the arrays of junk first
+	sodium_bin2base64(s, len, (unsigned char *)tbuf, n, sodium_base64_VARIANT_URLSAFE_NO_PADDING);
+}
 
-	ingredients = json_array();
-	for (i = 0, len = arrlen(recipe->ingredients); i < len; i++) {
-		json_array_append_new(ingredients, json_string(recipe->ingredients[i]));
+// recipe_cursor_decode : reads a token from recipe_cursor_encode, -1 if it's garbage (or the wrong kind)
+static int recipe_cursor_decode(char *s, int is_search, RecipeCursor *cursor)
+{
+	char tbuf[BUFSMALL];
+	size_t len;
+	int rc;
+
+	rc = sodium_base642bin((unsigned char *)tbuf, sizeof(tbuf) - 1, s, strlen(s), NULL, &len, NULL,
+		sodium_base64_VARIANT_URLSAFE_NO_PADDING);
+	if (rc < 0) {
+		return -1;
 	}
 
-	steps = json_array();
-	for (i = 0, len = arrlen(recipe->steps); i < len; i++) {
-		json_array_append_new(steps, json_string(recipe->steps[i]));
+	tbuf[len] = '\0';
+
+	if (is_search) {
+		rc = sscanf(tbuf, "s:%la:%ld", &cursor->score, &cursor->rowid) == 2 ? 0 : -1;
+	} else {
+		rc = sscanf(tbuf, "r:%ld", &cursor->rowid) == 1 ? 0 : -1;
 	}
 
-	tags = json_array();
-	for (i = 0, len = arrlen(recipe->tags); i < len; i++) {
-		json_array_append_new(tags, json_string(recipe->tags[i]));
+	return rc;
+}
+
+// recipe_validation : returns non-zero if the input object is invalid
+int recipe_validation(struct Recipe *recipe)
+{
+	return recipe == NULL || recipe->name == NULL || 100 < strlen(recipe->name);
+}
+
+// recipe_from_json : converts a JSON string into a Recipe
+struct Recipe *recipe_from_json(char *s)
+{
+	struct Recipe *recipe;
+	JsonReader reader;
+	char key[BUFSMALL];
+	int rc;
+
+	recipe = calloc(1, sizeof(*recipe));
+	if (recipe == NULL) {
+		return NULL;
 	}
 
-	object = json_pack_ex(
-		&error, 0,
-		"{s:s, s:s, s:s?, s:s?, s:s, s:s?, s:s?, s:s?, s:s?, s:s?, s:o, s:o, s:o}",
-		"id", recipe->metadata.id,
-		"create_ts", recipe->metadata.create_ts,
-		"update_ts", recipe->metadata.update_ts,
-		"delete_ts", recipe->metadata.delete_ts,
-		"name", recipe->name,
-		"prep_time", recipe->prep_time,
-		"cook_time", recipe->cook_time,
-		"servings", recipe->servings,
-		"link", recipe->link,
-		"note", recipe->notes,
-		"ingredients", ingredients,
-		"steps", steps,
-		"tags", tags
-	);
+	jsonr_init(&reader, s, strlen(s));
 
-	if (object == NULL) {
-		fprintf(stderr, "%s %d\n", error.text, error.position);
+	if (jsonr_object(&reader) < 0) {
+		free(recipe);
+		return NULL;
 	}
 
-	s = json_dumps(object, JSON_SORT_KEYS|JSON_COMPACT);
+	// NOTE (Brian) one pass over the text, each key is matched against RECIPE_FIELDS (by its first
+	// character before anything else) as it's read, and its value goes straight into the recipe. Keys
+	// that aren't fields (or are too long to be one) are skipped over.
+	while ((rc = jsonr_key(&reader, key, sizeof key)) > 0) {
+#define RECIPE_PARSE(K_, F_, KEY_, ...) \
+		if (key[0] == KEY_[0] && strcmp(key, KEY_) == 0) { rc = RECIPE_PARSE_##K_(F_); } else
+#define RECIPE_PARSE_TEXT(F_) recipe_text_from_json(&reader, &recipe->F_)
+#define RECIPE_PARSE_LIST(F_) recipe_list_from_json(&reader, &recipe->F_)
+		RECIPE_FIELDS(RECIPE_PARSE) { rc = jsonr_skip(&reader); }
+#undef RECIPE_PARSE
+#undef RECIPE_PARSE_TEXT
+#undef RECIPE_PARSE_LIST
+
+		if (rc < 0) {
+			break;
+		}
+	}
 
-	json_decref(object);
+	if (rc == 0) {
+		rc = jsonr_end(&reader);
+	}
 
-	return s;
+	// name is the only required recipe value, everything else is optional
+	if (rc < 0 || recipe->name == NULL) {
+		recipe_free(recipe);
+		return NULL;
+	}
+
+	return recipe;
 }
 
 // recipe_free : frees all of the data in the recipe object
@@ -712,22 +1116,13 @@ void recipe_free(struct Recipe *recipe)
 	if (recipe) {
 		db_metadata_free(&recipe->metadata);
 
-		free(recipe->name);
-		free(recipe->prep_time);
-		free(recipe->cook_time);
-		free(recipe->servings);
-		free(recipe->notes);
-		free(recipe->link);
-
-		for (size_t i = 0; i < arrlen(recipe->ingredients); i++)
-			free(recipe->ingredients[i]);
-		arrfree(recipe->ingredients);
-		for (size_t i = 0; i < arrlen(recipe->steps); i++)
-			free(recipe->steps[i]);
-		arrfree(recipe->steps);
-		for (size_t i = 0; i < arrlen(recipe->tags); i++)
-			free(recipe->tags[i]);
-		arrfree(recipe->tags);
+#define RECIPE_FREE(K_, F_, ...) RECIPE_FREE_##K_(recipe->F_)
+#define RECIPE_FREE_TEXT(V_) free(V_);
+#define RECIPE_FREE_LIST(V_) recipe_list_free(V_);
+		RECIPE_FIELDS(RECIPE_FREE)
+#undef RECIPE_FREE
+#undef RECIPE_FREE_TEXT
+#undef RECIPE_FREE_LIST
 
 		free(recipe);
 	}
@@ -6,22 +6,40 @@
 
 #include "mongoose.h"
 
+#include "route.h"
+
+#include "image.h"
+
+// RECIPE_FIELDS : every field a recipe has (besides its DB_Metadata), X(kind, field, key, column, ...)
+//
+//   kind   - TEXT, a nullable text column on recipes (char *), or LIST, a child table of text rows
+//            (parent_id, sorting, text), kept as an stb array of char *
+//   field  - the member on Recipe
+//   key    - the key it has in the JSON
+//   column - the column on recipes, or the child table, it's stored in
+//
+// Anything after X is passed along to it. The struct below, RECIPE_JSON, and reading a recipe from
+// JSON, binding it to the insert and the update, reading it back, and freeing it (in recipe.c), are
+// all expanded from this, so a new field is one line here, and a migration for its column.
+#define RECIPE_FIELDS(X, ...) \
+	X(TEXT, name,        "name",        "name",        __VA_ARGS__) \
+	X(TEXT, prep_time,   "prep_time",   "prep_time",   __VA_ARGS__) \
+	X(TEXT, cook_time,   "cook_time",   "cook_time",   __VA_ARGS__) \
+	X(TEXT, servings,    "servings",    "servings",    __VA_ARGS__) \
+	X(TEXT, notes,       "note",        "notes",       __VA_ARGS__) \
+	X(TEXT, link,        "link",        "link",        __VA_ARGS__) \
+	X(LIST, ingredients, "ingredients", "ingredients", __VA_ARGS__) \
+	X(LIST, steps,       "steps",       "steps",       __VA_ARGS__) \
+	X(LIST, tags,        "tags",        "tags",        __VA_ARGS__)
+
+#define RECIPE_MEMBER(K_, F_, ...) RECIPE_MEMBER_##K_(F_)
+#define RECIPE_MEMBER_TEXT(F_) char *F_;
+#define RECIPE_MEMBER_LIST(F_) char **F_;
+
 // Recipe: the recipe structure
 typedef struct Recipe {
 	DB_Metadata metadata;
-
-	// base fields
-    char *name;
-    char *prep_time;
-    char *cook_time;
-    char *servings;
-    char *notes;
-	char *link;
-
-	// child tables
-	char **ingredients;
-	char **steps;
-	char **tags;
+	RECIPE_FIELDS(RECIPE_MEMBER)
 } Recipe;
 
 // V_Recipe: the recipe search view
@@ -34,19 +52,64 @@ typedef struct V_Recipe {
 	char *link;
 } V_Recipe;
 
+// RECIPE_LIST : a SQL expression for the child table 'T_' of the recipe in table alias 'R_', as a JSON array
+#define RECIPE_LIST(R_, T_) \
+	"(select json_group_array(text) from (select text from " T_ " where parent_id = " R_ ".id order by sorting))"
+
+// RECIPE_JSON : a SQL expression for the recipe in table alias 'R_' as the JSON the API sends
+//
+// NOTE (Brian) the keys come out in this order (the metadata, RECIPE_FIELDS, then the images). The
+// json() around each subquery is there because a subquery drops the "this is JSON" subtype, and
+// without it, the arrays would get quoted as strings. Like DB_TS_STR, this is meant for db_stmt_get
+// formats.
+#define RECIPE_JSON(R_) \
+	"json_object(" \
+	"'id', uuid_str(" R_ ".id)" \
+	", 'create_ts', " DB_TS_STR(R_ ".create_ts") \
+	", 'update_ts', " DB_TS_STR(R_ ".update_ts") \
+	", 'delete_ts', " DB_TS_STR(R_ ".delete_ts") \
+	RECIPE_FIELDS(RECIPE_JSON_FIELD, R_) \
+	", 'images', json((select json_group_array(" IMAGE_JSON("i") ") from (select * from images i where i.recipe_id = " R_ ".id and i.delete_ts is null order by i.ordering) i))" \
+	")"
+
+#define RECIPE_JSON_FIELD(K_, F_, KEY_, C_, R_) RECIPE_JSON_##K_(KEY_, R_, C_)
+#define RECIPE_JSON_TEXT(KEY_, R_, C_) ", '" KEY_ "', " R_ "." C_
+#define RECIPE_JSON_LIST(KEY_, R_, C_) ", '" KEY_ "', json(" RECIPE_LIST(R_, C_) ")"
+
+// RECIPE_COVER : a SQL expression for the first image of the recipe in table alias 'R_' (IMAGE_JSON), or null
+//
+// NOTE (Brian) this is what the list views show, it's one seek on images_recipe_id per recipe
+#define RECIPE_COVER(R_) \
+	"(select " IMAGE_JSON("i") " from images i where i.recipe_id = " R_ ".id and i.delete_ts is null order by i.ordering limit 1)"
+
+// recipe_from_json : converts a JSON string into a Recipe
+struct Recipe *recipe_from_json(char *s);
+
+// recipe_validation : returns non-zero if the input object is invalid
+int recipe_validation(struct Recipe *recipe);
+
+// recipe_insert_rows : writes the recipe and its lists, inside of the caller's transaction (see recipe_fts_insert)
+int recipe_insert_rows(Recipe *recipe);
+
+// recipe_fts_insert : writes the full text index entry for a recipe that doesn't have one yet
+int recipe_fts_insert(Recipe *recipe);
+
+// recipe_free : frees all of the data in the recipe object
+void recipe_free(struct Recipe *recipe);
+
 // recipe_api_post : endpoint, POST - /api/v1/recipe
-int recipe_api_post(struct mg_connection *conn, struct mg_http_message *hm);
+int recipe_api_post(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
 
 // recipe_api_put : endpoint, PUT - /api/v1/recipe/{id}
-int recipe_api_put(struct mg_connection *conn, struct mg_http_message *hm);
+int recipe_api_put(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
 
 // recipe_api_get : endpoint, GET - /api/v1/recipe/{id}
-int recipe_api_get(struct mg_connection *conn, struct mg_http_message *hm);
+int recipe_api_get(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
 
 // recipe_api_delete : endpoint, DELETE - /api/v1/recipe/{id}
-int recipe_api_delete(struct mg_connection *conn, struct mg_http_message *hm);
+int recipe_api_delete(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
 
 // recipe_api_getlist : endpoint, GET - /api/v1/recipe/list
-int recipe_api_getlist(struct mg_connection *conn, struct mg_http_message *hm);
+int recipe_api_getlist(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
 
 #endif // RECIPE_H_
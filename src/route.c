@@ -0,0 +1,350 @@
+// Brian Chrzanowski
+// 2026-10-18 04:20:36
+//
+// Request Routing
+//
+// Routes used to be found by rewriting the URI into a string ("GET /api/v1/recipe/:id", by copying
+// it, strtok'ing it apart, checking every piece for a uuid or a hash, and snprintf'ing it back
+// together), and looking that up in an stb hashmap. Then the handler would copy the URI again, and
+// sscanf the id back out of it.
+//
+// Now the routes are a trie, one node per path segment, that's built when they're added. Matching
+// walks the URI once, in place, a segment at a time:
+//
+//   - a literal segment ("api", "recipe") is compared against the node's children
+//   - if none of them are it, and the node has a :id (or :hash) child, the segment's checked, and
+//     parsed, as one, right into the RouteParams the handler gets
+//   - at the end, the method picks the handler off the last node
+//
+// NOTE (Brian) same as before, empty segments don't count ("/api//v1/recipe/" is "/api/v1/recipe"),
+// and a :id has to be a v4 uuid, in either case.
+
+#include "common.h"
+
+#include "mongoose.h"
+
+#include "route.h"
+
+// RouteMethod: the methods there are routes for
+enum {
+	ROUTE_GET,
+	ROUTE_HEAD,
+	ROUTE_POST,
+	ROUTE_PUT,
+	ROUTE_DELETE,
+	ROUTE_METHODS,
+};
+
+// RouteEdge: a literal segment, and the node it goes to
+typedef struct RouteEdge {
+	char *segment;
+	size_t len;
+	int node;
+} RouteEdge;
+
+struct RouteNode {
+	RouteEdge *edges; // stb array
+	int id;           // the :id child, or -1
+	int hash;         // the :hash child, or -1
+	RouteHandler funcs[ROUTE_METHODS];
+	char *names[ROUTE_METHODS];
+};
+
+// route_method : the RouteMethod for 'method', -1 if there aren't any routes for it
+static int route_method(const char *method, size_t len);
+// route_node : adds an empty node to 'router', and returns its index
+static int route_node(Router *router);
+// route_child : the child of node 'node' for 'segment', making it if 'make' (and it isn't there yet), -1 if there isn't one
+static int route_child(Router *router, int node, const char *segment, size_t len, int make);
+// route_edge : the child of 'node' whose segment 's' ('left' bytes of path) starts with, -1 if there isn't one
+static int route_edge(RouteNode *node, const char *s, size_t left, size_t *len);
+// route_ends : true if the first 'n' of the 'left' bytes at 's' are a whole segment
+static int route_ends(const char *s, size_t n, size_t left);
+// route_uuid : 1 if the ROUTE_ID_LEN bytes at 's' are a v4 uuid (and puts it in 'params'), 0 if they aren't
+static int route_uuid(const char *s, RouteParams *params);
+// route_hash : 1 if the ROUTE_HASH_LEN bytes at 's' are a content hash (and puts it in 'params'), 0 if they aren't
+static int route_hash(const char *s, RouteParams *params);
+
+// ROUTE_HEX: the value of every hex digit, 0x10 on top of it if it's uppercase, 0x80 if it isn't one
+// NOTE (Brian) a table, so parsing an id is 32 loads, and one check at the end, not 32 branches
+static const u8 ROUTE_HEX[256] = {
+	[0 ... 255] = 0x80,
+	['0'] = 0x0, ['1'] = 0x1, ['2'] = 0x2, ['3'] = 0x3, ['4'] = 0x4,
+	['5'] = 0x5, ['6'] = 0x6, ['7'] = 0x7, ['8'] = 0x8, ['9'] = 0x9,
+	['a'] = 0xa, ['b'] = 0xb, ['c'] = 0xc, ['d'] = 0xd, ['e'] = 0xe, ['f'] = 0xf,
+	['A'] = 0x1a, ['B'] = 0x1b, ['C'] = 0x1c, ['D'] = 0x1d, ['E'] = 0x1e, ['F'] = 0x1f,
+};
+
+// ROUTE_UUID_HEX: where each of a uuid's 16 bytes is, in its 36 characters
+static const u8 ROUTE_UUID_HEX[16] = { 0, 2, 4, 6, 9, 11, 14, 16, 19, 21, 24, 26, 28, 30, 32, 34 };
+
+// route_add : adds 'func' to 'router' at 'pattern' ("METHOD /path/:id/more"), -1 if it can't be
+int route_add(Router *router, char *pattern, RouteHandler func)
+{
+	char *path, *end, *segment;
+	int method;
+	int node;
+
+	path = strchr(pattern, ' ');
+	if (path == NULL || (method = route_method(pattern, path - pattern)) < 0) {
+		ERR("'%s' isn't a route!\n", pattern);
+		return -1;
+	}
+
+	if (arrlen(router->nodes) == 0) {
+		route_node(router);
+	}
+
+	node = 0;
+
+	for (segment = path + 1; *segment != '\0'; segment = end) {
+		if (*segment == '/') {
+			end = segment + 1;
+			continue;
+		}
+
+		end = segment + strcspn(segment, "/");
+
+		node = route_child(router, node, segment, end - segment, true);
+	}
+
+	if (router->nodes[node].funcs[method] != NULL) {
+		ERR("'%s' is already a route!\n", pattern);
+		return -1;
+	}
+
+	router->nodes[node].funcs[method] = func;
+	router->nodes[node].names[method] = strdup(pattern);
+
+	return 0;
+}
+
+// route_match : finds the route for 'hm' in 'router', and parses its parameters into 'params', 1 if there is one, 0 if not
+int route_match(Router *router, struct mg_http_message *hm, Route *route, RouteParams *params)
+{
+	const char *s = hm->uri.ptr;
+	const char *end = hm->uri.ptr + hm->uri.len;
+	RouteNode *node;
+	size_t left, len;
+	int method;
+	int next;
+
+	method = route_method(hm->method.ptr, hm->method.len);
+	if (method < 0 || arrlen(router->nodes) == 0) {
+		return false;
+	}
+
+	node = &router->nodes[0];
+
+	while (s < end && *s != '?') {
+		if (*s == '/') {
+			s++;
+			continue;
+		}
+
+		// NOTE (Brian) the segment isn't scanned for its end first, the edges are compared against
+		// what's left of the path, and all that's checked is that they stop where it does
+		left = end - s;
+
+		next = route_edge(node, s, left, &len);
+
+		if (next < 0 && node->id >= 0 && route_ends(s, ROUTE_ID_LEN, left) && route_uuid(s, params)) {
+			next = node->id;
+			len = ROUTE_ID_LEN;
+		} else if (next < 0 && node->hash >= 0 && route_ends(s, ROUTE_HASH_LEN, left) && route_hash(s, params)) {
+			next = node->hash;
+			len = ROUTE_HASH_LEN;
+		}
+
+		if (next < 0) {
+			return false;
+		}
+
+		node = &router->nodes[next];
+		s += len;
+	}
+
+	if (node->funcs[method] == NULL) {
+		return false;
+	}
+
+	route->func = node->funcs[method];
+	route->name = node->names[method];
+
+	return true;
+}
+
+// route_free : frees the routing table
+void route_free(Router *router)
+{
+	for (ptrdiff_t i = 0; i < arrlen(router->nodes); i++) {
+		RouteNode *node = &router->nodes[i];
+
+		for (ptrdiff_t j = 0; j < arrlen(node->edges); j++) {
+			free(node->edges[j].segment);
+		}
+		arrfree(node->edges);
+
+		for (size_t j = 0; j < ROUTE_METHODS; j++) {
+			free(node->names[j]);
+		}
+	}
+
+	arrfree(router->nodes);
+}
+
+// route_method : the RouteMethod for 'method', -1 if there aren't any routes for it
+static int route_method(const char *method, size_t len)
+{
+	switch (len) {
+		case 3:
+			if (memcmp(method, "GET", 3) == 0) return ROUTE_GET;
+			if (memcmp(method, "PUT", 3) == 0) return ROUTE_PUT;
+			return -1;
+		case 4:
+			if (memcmp(method, "HEAD", 4) == 0) return ROUTE_HEAD;
+			if (memcmp(method, "POST", 4) == 0) return ROUTE_POST;
+			return -1;
+		case 6:
+			if (memcmp(method, "DELETE", 6) == 0) return ROUTE_DELETE;
+			return -1;
+		default:
+			return -1;
+	}
+}
+
+// route_node : adds an empty node to 'router', and returns its index
+static int route_node(Router *router)
+{
+	RouteNode node = { .id = -1, .hash = -1 };
+
+	arrput(router->nodes, node);
+
+	return arrlen(router->nodes) - 1;
+}
+
+// route_child : the child of node 'node' for 'segment', making it if 'make' (and it isn't there yet), -1 if there isn't one
+static int route_child(Router *router, int node, const char *segment, size_t len, int make)
+{
+	RouteEdge edge;
+	int child;
+
+	if (make && len == 3 && memcmp(segment, ":id", 3) == 0) {
+		if (router->nodes[node].id < 0) {
+			child = route_node(router);
+			router->nodes[node].id = child;
+		}
+		return router->nodes[node].id;
+	}
+
+	if (make && len == 5 && memcmp(segment, ":hash", 5) == 0) {
+		if (router->nodes[node].hash < 0) {
+			child = route_node(router);
+			router->nodes[node].hash = child;
+		}
+		return router->nodes[node].hash;
+	}
+
+	child = route_edge(&router->nodes[node], segment, len, &len);
+	if (child >= 0 || !make) {
+		return child;
+	}
+
+	// (route_node can move the nodes, so the edge is put on after)
+	child = route_node(router);
+
+	edge.segment = strndup(segment, len);
+	edge.len = len;
+	edge.node = child;
+
+	arrput(router->nodes[node].edges, edge);
+
+	return child;
+}
+
+// route_edge : the child of 'node' whose segment 's' ('left' bytes of path) starts with, -1 if there isn't one
+static int route_edge(RouteNode *node, const char *s, size_t left, size_t *len)
+{
+	RouteEdge *edges = node->edges;
+
+	// NOTE (Brian) there's only ever a handful of these on a node, so a scan beats anything cleverer
+	for (ptrdiff_t i = 0; i < arrlen(edges); i++) {
+		size_t n = edges[i].len;
+		if (n <= left && edges[i].segment[0] == s[0] && memcmp(edges[i].segment, s, n) == 0 && route_ends(s, n, left)) {
+			*len = n;
+			return edges[i].node;
+		}
+	}
+
+	return -1;
+}
+
+// route_ends : true if the first 'n' of the 'left' bytes at 's' are a whole segment
+static int route_ends(const char *s, size_t n, size_t left)
+{
+	return n == left || (n < left && (s[n] == '/' || s[n] == '?'));
+}
+
+// route_uuid : 1 if the ROUTE_ID_LEN bytes at 's' are a v4 uuid (and puts it in 'params'), 0 if they aren't
+static int route_uuid(const char *s, RouteParams *params)
+{
+	int hi, lo;
+	int bad = 0;
+
+	if (s[8] != '-' || s[13] != '-' || s[18] != '-' || s[23] != '-') {
+		return false;
+	}
+
+	// UUIDv4's have a '4' in this position, and an 8, 9, a or b here
+	if (s[14] != '4' || !(s[19] == '8' || s[19] == '9' || (s[19] | 0x20) == 'a' || (s[19] | 0x20) == 'b')) {
+		return false;
+	}
+
+	for (size_t i = 0; i < sizeof ROUTE_UUID_HEX; i++) {
+		size_t at = ROUTE_UUID_HEX[i];
+
+		hi = ROUTE_HEX[(u8)s[at]];
+		lo = ROUTE_HEX[(u8)s[at + 1]];
+		bad |= hi | lo;
+
+		params->uuid[i] = (hi & 0xf) << 4 | (lo & 0xf);
+	}
+
+	if (bad & 0x80) {
+		return false;
+	}
+
+	// every character left is a digit, a letter or a dash, 0x20 lowercases the letters, and the
+	// others already have it
+	for (size_t i = 0; i < ROUTE_ID_LEN; i++) {
+		params->id[i] = s[i] | 0x20;
+	}
+	params->id[ROUTE_ID_LEN] = '\0';
+
+	return true;
+}
+
+// route_hash : 1 if the ROUTE_HASH_LEN bytes at 's' are a content hash (and puts it in 'params'), 0 if they aren't
+static int route_hash(const char *s, RouteParams *params)
+{
+	int hi, lo;
+	int bad = 0;
+
+	for (size_t i = 0; i < ROUTE_HASH_LEN; i += 2) {
+		hi = ROUTE_HEX[(u8)s[i]];
+		lo = ROUTE_HEX[(u8)s[i + 1]];
+		bad |= hi | lo;
+
+		params->digest[i / 2] = (hi & 0xf) << 4 | (lo & 0xf);
+	}
+
+	// NOTE (Brian) only lowercase, that's how they're written, and it's a file name (see image.c)
+	if (bad & 0x90) {
+		return false;
+	}
+
+	memcpy(params->hash, s, ROUTE_HASH_LEN);
+	params->hash[ROUTE_HASH_LEN] = '\0';
+
+	return true;
+}
@@ -0,0 +1,46 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+
+// Brian Chrzanowski
+// 2026-10-18 04:20:36
+
+#include "common.h"
+
+#include "mongoose.h"
+
+#define ROUTE_ID_LEN   (36) // a uuid, with the dashes
+#define ROUTE_HASH_LEN (64) // a crypto_generichash (32 bytes), as hex
+
+// RouteParams: the typed pieces of the path, parsed while it's matched (a route only fills its own)
+typedef struct RouteParams {
+	char id[ROUTE_ID_LEN + 1];     // :id, lowercased, so it's the same string however it was sent
+	u8 uuid[16];                   // and its bytes
+	char hash[ROUTE_HASH_LEN + 1]; // :hash
+	u8 digest[32];                 // and its bytes
+} RouteParams;
+
+// RouteHandler: every endpoint in the routing table has this signature
+typedef int (*RouteHandler)(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
+
+// Route: what a request matched
+typedef struct Route {
+	RouteHandler func;
+	char *name; // the pattern it was added with ("GET /api/v1/recipe/:id"), for the counters
+} Route;
+
+// RouteNode: one node of the trie, a path segment
+typedef struct RouteNode RouteNode;
+
+// Router: a routing table, a trie of path segments
+typedef struct Router {
+	RouteNode *nodes; // stb array, the root is nodes[0]
+} Router;
+
+// route_add : adds 'func' to 'router' at 'pattern' ("METHOD /path/:id/more"), -1 if it can't be
+int route_add(Router *router, char *pattern, RouteHandler func);
+// route_match : finds the route for 'hm' in 'router', and parses its parameters into 'params', 1 if there is one, 0 if not
+int route_match(Router *router, struct mg_http_message *hm, Route *route, RouteParams *params);
+// route_free : frees the routing table
+void route_free(Router *router);
+
+#endif // ROUTE_H
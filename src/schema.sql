@@ -62,29 +62,59 @@ create table if not exists images (
     , data         blob not null
 );
 
--- ui_recipes: a view for the recipes list page
-create view if not exists ui_recipes
-    (id, name, prep_time, cook_time, servings) as
-select
-    id
-    , name
-    , prep_time
-    , cook_time
-    , servings
-from recipes;
+-- recipes_fts: full text index for the recipe search screen, rowid is recipes.rowid
+--
+-- This is kept up to date by recipe_insert / recipe_update / recipe_delete, NOT by triggers. A
+-- trigger on the child tables would rebuild the whole document once per ingredient / step / tag.
+-- Deleted recipes aren't in here at all.
+create virtual table if not exists recipes_fts using fts5 (
+    name
+    , ingredients
+    , steps
+    , tags
+    , tokenize = 'unicode61 remove_diacritics 2'
+    , prefix = '2 3'
+);
 
--- v_recipe_search: the view for the recipe search screen
-create view if not exists v_recipes
-    (id, search_text) as
+-- v_recipes: replaced by recipes_fts
+drop view if exists v_recipes;
+
+-- backfill recipes_fts for anything that was written before it existed
+insert into recipes_fts (rowid, name, ingredients, steps, tags)
 select
-    r.id as id, concat(r.search_text, '|', i.search_text, '|', s.search_text, '|', t.search_text) as search_text
-from (select id, concat(name, '|', prep_time, '|', cook_time, '|', servings) as search_text from recipes where delete_ts is null) as r
-left join (
-    select distinct parent_id, group_concat(text, '|') over (partition by parent_id) as search_text from ingredients
-) i on r.id = i.parent_id
-left join (
-    select distinct parent_id, group_concat(text, '|') over (partition by parent_id) as search_text from steps
-) s on r.id = s.parent_id
-left join (
-    select distinct parent_id, group_concat(text, '|') over (partition by parent_id) as search_text from tags
-) t on r.id = t.parent_id;
+    r.rowid
+    , r.name
+    , (select group_concat(text, '; ') from (select text from ingredients where parent_id = r.id order by sorting))
+    , (select group_concat(text, '; ') from (select text from steps where parent_id = r.id order by sorting))
+    , (select group_concat(text, '; ') from (select text from tags where parent_id = r.id order by sorting))
+from recipes r
+where r.delete_ts is null and r.rowid not in (select rowid from recipes_fts);
+
+-- counters: running totals, so that we don't have to count(*) a table to know how big it is
+create table if not exists counters (
+    name           text primary key
+    , value        integer not null default (0)
+) without rowid;
+
+-- recipes_count_*: keep counters.recipes equal to the number of live (not deleted) recipes
+create trigger if not exists recipes_count_insert after insert on recipes
+when new.delete_ts is null
+begin
+    update counters set value = value + 1 where name = 'recipes';
+end;
+
+create trigger if not exists recipes_count_delete after update of delete_ts on recipes
+when old.delete_ts is null and new.delete_ts is not null
+begin
+    update counters set value = value - 1 where name = 'recipes';
+end;
+
+create trigger if not exists recipes_count_undelete after update of delete_ts on recipes
+when old.delete_ts is not null and new.delete_ts is null
+begin
+    update counters set value = value + 1 where name = 'recipes';
+end;
+
+-- recount on startup, in case anything ever touched the table with the triggers missing
+insert or replace into counters (name, value)
+select 'recipes', count(*) from recipes where delete_ts is null;
@@ -0,0 +1,639 @@
+// Brian Chrzanowski
+// 2026-10-18 00:12:05
+//
+// Login Sessions
+//
+// Every request that cares who's asking (whoami, logout, and eventually the writes) needs the
+// session that goes with its cookie. Looking that up in SQLite every time would be a query on every
+// authenticated request, so the sessions are kept in memory, and the database is just so they
+// survive a restart:
+//
+//   - the cookie is SESSION_TOKEN_BYTES random bytes (base64url). The table is keyed by a 16 byte
+//     BLAKE2b of it, which is also what goes in the database, so neither one holds a usable token.
+//
+//   - the table is split into SESSION_SHARDS shards by a byte of that hash, each with its own lock,
+//     so the workers (logins happen on the WORKER_PWHASH threads) don't all wait on each other.
+//     Each shard is an open addressing table (linear probing, with tombstones), that's doubled
+//     when it's 3/4 full, and rebuilt in place when it's mostly tombstones.
+//
+//   - new sessions, and logouts, go on a pending list, and a mongoose timer on the event loop writes
+//     that out once a second, in one transaction. The same timer sweeps out the sessions that have
+//     run out every so often, from memory, and from the table.
+//
+// NOTE (Brian) a session that's less than a second old when the server dies is gone, and that person
+// has to log in again. That's fine.
+//
+// With '-s', new sessions are signed tokens instead (token.c), which don't go in the table at all.
+// The two are told apart by their length, so turning '-s' on doesn't log out anyone who's already
+// logged in with a table one (turning it off does log out the signed ones).
+
+#include "common.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#include <sodium.h>
+#include <jansson.h>
+
+#include "mongoose.h"
+#include "sqlite3.h"
+
+#include "objects.h"
+#include "session.h"
+#include "token.h"
+
+#define SESSION_SHARDS    (16)
+#define SESSION_KEY_SIZE  (16)
+#define SESSION_MIN_SLOTS (64)
+#define SESSION_FLUSH_MS  (1000)
+#define SESSION_SWEEP     (60) // flushes between sweeps
+
+extern __thread sqlite3 *DATABASE;
+
+// SessionSlot: one slot in a shard's table
+typedef struct SessionSlot {
+	u8 key[SESSION_KEY_SIZE];
+	u8 state;
+	Session *session;
+} SessionSlot;
+
+enum {
+	SLOT_EMPTY = 0,
+	SLOT_LIVE,
+	SLOT_DEAD, // a tombstone, probes keep going past it
+};
+
+// SessionShard: a piece of the table, and its lock
+typedef struct SessionShard {
+	pthread_mutex_t lock;
+	SessionSlot *slots; // a power of two of them
+	size_t cap;
+	size_t live;
+	size_t dead;
+	size_t lookups;
+	size_t hits;
+	size_t expired;
+} SessionShard;
+
+// SessionOp: a change that hasn't been written to the database yet
+typedef struct SessionOp {
+	u8 key[SESSION_KEY_SIZE];
+	char id[40];
+	i64 expires;
+	int delete;
+} SessionOp;
+
+static SessionShard SHARDS[SESSION_SHARDS];
+
+static pthread_mutex_t PENDING_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static SessionOp *PENDING = NULL;
+
+static int STATELESS = false;
+
+static struct mg_timer TIMER;
+static size_t TICKS = 0;
+static size_t FLUSHES = 0;
+static size_t WRITTEN = 0;
+
+// session_now : ms since the epoch (the way the timestamps are stored)
+static i64 session_now();
+// session_key : hashes 'token' into the table key
+static void session_key(u8 *key, char *token, size_t len);
+// session_shard : the shard that 'key' goes in
+static SessionShard *session_shard(u8 *key);
+// session_find : the slot for 'key' in 'shard', or NULL (lock held)
+static SessionSlot *session_find(SessionShard *shard, u8 *key);
+// session_put : puts 'session' in 'shard' under 'key' (lock held)
+static int session_put(SessionShard *shard, u8 *key, Session *session);
+// session_resize : rebuilds the shard's table with 'cap' slots, which drops the tombstones (lock held)
+static int session_resize(SessionShard *shard, size_t cap);
+// session_pending : queues a change to be written to the database
+static void session_pending(u8 *key, char *id, i64 expires, int delete);
+// session_flush : writes out everything that's pending, in one transaction
+static void session_flush();
+// session_sweep : drops every session that's run out, from memory and from the database
+static void session_sweep();
+// session_timer : the mongoose timer, flushes, and sweeps every SESSION_SWEEP flushes
+static void session_timer(void *arg);
+
+// session_init : loads the sessions that haven't run out yet (on the calling thread's connection), and starts the timer ('stateless' signs new ones instead, see token.c)
+int session_init(int stateless)
+{
+	struct sqlite3_stmt *stmt;
+	Session *session;
+	size_t loaded = 0;
+
+	for (size_t i = 0; i < SESSION_SHARDS; i++) {
+		pthread_mutex_init(&SHARDS[i].lock, NULL);
+		if (session_resize(&SHARDS[i], SESSION_MIN_SLOTS) < 0) {
+			return -1;
+		}
+	}
+
+	stmt = db_stmt_get("sessions", "load",
+		"select s.hash, uuid_str(s.user_id), u.username, u.email, s.expires_ts"
+		" from %s s join users u on u.id = s.user_id"
+		" where s.expires_ts > " DB_NOW_MS " and u.delete_ts is null;");
+	if (stmt == NULL) {
+		return -1;
+	}
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		if (sqlite3_column_bytes(stmt, 0) != SESSION_KEY_SIZE) {
+			continue;
+		}
+
+		session = calloc(1, sizeof(*session));
+		if (session == NULL) {
+			break;
+		}
+
+		snprintf(session->id, sizeof session->id, "%s", sqlite3_column_text(stmt, 1));
+		snprintf(session->username, sizeof session->username, "%s", sqlite3_column_text(stmt, 2));
+		snprintf(session->email, sizeof session->email, "%s", sqlite3_column_text(stmt, 3));
+		session->expires = sqlite3_column_int64(stmt, 4);
+
+		u8 *key = (u8 *)sqlite3_column_blob(stmt, 0);
+
+		if (session_put(session_shard(key), key, session) < 0) {
+			free(session);
+			break;
+		}
+
+		loaded++;
+	}
+
+	db_stmt_release(stmt);
+
+	STATELESS = stateless;
+	if (STATELESS && token_init() < 0) {
+		return -1;
+	}
+
+	mg_timer_init(&TIMER, SESSION_FLUSH_MS, MG_TIMER_REPEAT, session_timer, NULL);
+
+	printf("loaded %zu sessions\n", loaded);
+
+	return 0;
+}
+
+// session_create : starts a session for 'session' (its id, username, and email), and writes its cookie token into 'token'
+int session_create(Session *session, char *token, size_t len)
+{
+	u8 bytes[SESSION_TOKEN_BYTES];
+	u8 key[SESSION_KEY_SIZE];
+	SessionShard *shard;
+	Session *copy;
+	int rc;
+
+	if (STATELESS) {
+		session->expires = session_now() + SESSION_TTL_MS;
+		return token_issue(session->id, session->expires, token, len);
+	}
+
+	if (len < SESSION_TOKEN_LEN + 1) {
+		return -1;
+	}
+
+	randombytes_buf(bytes, sizeof bytes);
+	sodium_bin2base64(token, len, bytes, sizeof bytes, sodium_base64_VARIANT_URLSAFE_NO_PADDING);
+	sodium_memzero(bytes, sizeof bytes);
+
+	session_key(key, token, SESSION_TOKEN_LEN);
+
+	copy = malloc(sizeof(*copy));
+	if (copy == NULL) {
+		return -1;
+	}
+
+	*copy = *session;
+	copy->expires = session->expires = session_now() + SESSION_TTL_MS;
+
+	shard = session_shard(key);
+
+	pthread_mutex_lock(&shard->lock);
+	rc = session_put(shard, key, copy);
+	pthread_mutex_unlock(&shard->lock);
+
+	if (rc < 0) {
+		free(copy);
+		return -1;
+	}
+
+	session_pending(key, copy->id, copy->expires, false);
+
+	return 0;
+}
+
+// session_lookup : copies the session for 'token' into 'session', 1 if there is one, 0 if there isn't
+int session_lookup(char *token, size_t len, Session *session)
+{
+	u8 key[SESSION_KEY_SIZE];
+	SessionShard *shard;
+	SessionSlot *slot;
+	int found = false;
+
+	// a signed one has everything but the names, whoami looks those up itself
+	if (STATELESS && len == TOKEN_LEN) {
+		session->username[0] = session->email[0] = '\0';
+		return token_verify(token, len, session->id, sizeof session->id, &session->expires);
+	}
+
+	// NOTE (Brian) anything that isn't even the right shape doesn't cost a hash
+	if (len != SESSION_TOKEN_LEN) {
+		return false;
+	}
+
+	session_key(key, token, len);
+
+	shard = session_shard(key);
+
+	pthread_mutex_lock(&shard->lock);
+
+	shard->lookups++;
+
+	// the ones that have run out stay until the next sweep, they just don't count
+	slot = session_find(shard, key);
+	if (slot != NULL && slot->session->expires > session_now()) {
+		*session = *slot->session;
+		shard->hits++;
+		found = true;
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+
+	return found;
+}
+
+// session_delete : ends the session for 'token', if there is one
+void session_delete(char *token, size_t len)
+{
+	u8 key[SESSION_KEY_SIZE];
+	SessionShard *shard;
+	SessionSlot *slot;
+	int found = false;
+
+	if (STATELESS && len == TOKEN_LEN) {
+		token_revoke(token, len);
+		return;
+	}
+
+	if (len != SESSION_TOKEN_LEN) {
+		return;
+	}
+
+	session_key(key, token, len);
+
+	shard = session_shard(key);
+
+	pthread_mutex_lock(&shard->lock);
+
+	slot = session_find(shard, key);
+	if (slot != NULL) {
+		free(slot->session);
+		slot->session = NULL;
+		slot->state = SLOT_DEAD;
+		shard->live--;
+		shard->dead++;
+		found = true;
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+
+	if (found) {
+		session_pending(key, NULL, 0, true);
+	}
+}
+
+// session_stats : returns a snapshot of the session counters
+SessionStats session_stats()
+{
+	SessionStats stats = { .shards = SESSION_SHARDS };
+
+	for (size_t i = 0; i < SESSION_SHARDS; i++) {
+		pthread_mutex_lock(&SHARDS[i].lock);
+		stats.entries += SHARDS[i].live;
+		stats.slots += SHARDS[i].cap;
+		stats.lookups += SHARDS[i].lookups;
+		stats.hits += SHARDS[i].hits;
+		stats.expired += SHARDS[i].expired;
+		pthread_mutex_unlock(&SHARDS[i].lock);
+	}
+
+	pthread_mutex_lock(&PENDING_LOCK);
+	stats.flushes = FLUSHES;
+	stats.written = WRITTEN;
+	stats.pending = arrlen(PENDING);
+	pthread_mutex_unlock(&PENDING_LOCK);
+
+	return stats;
+}
+
+// session_free : writes out anything that's pending, and frees every session
+void session_free()
+{
+	mg_timer_free(&TIMER);
+
+	session_flush();
+
+	for (size_t i = 0; i < SESSION_SHARDS; i++) {
+		for (size_t j = 0; j < SHARDS[i].cap; j++) {
+			if (SHARDS[i].slots[j].state == SLOT_LIVE) {
+				free(SHARDS[i].slots[j].session);
+			}
+		}
+
+		free(SHARDS[i].slots);
+		pthread_mutex_destroy(&SHARDS[i].lock);
+	}
+
+	memset(SHARDS, 0, sizeof SHARDS);
+
+	arrfree(PENDING);
+
+	if (STATELESS) {
+		token_flush();
+		token_free();
+	}
+}
+
+// session_now : ms since the epoch (the way the timestamps are stored)
+static i64 session_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (i64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// session_key : hashes 'token' into the table key
+static void session_key(u8 *key, char *token, size_t len)
+{
+	crypto_generichash(key, SESSION_KEY_SIZE, (u8 *)token, len, NULL, 0);
+}
+
+// session_shard : the shard that 'key' goes in
+static SessionShard *session_shard(u8 *key)
+{
+	// NOTE (Brian) the slot comes from the front of the key, so the shard comes from the back
+	return &SHARDS[key[SESSION_KEY_SIZE - 1] % SESSION_SHARDS];
+}
+
+// session_find : the slot for 'key' in 'shard', or NULL (lock held)
+static SessionSlot *session_find(SessionShard *shard, u8 *key)
+{
+	SessionSlot *slot;
+	u64 i;
+
+	memcpy(&i, key, sizeof i);
+
+	for (size_t n = 0; n < shard->cap; n++, i++) {
+		slot = &shard->slots[i & (shard->cap - 1)];
+
+		if (slot->state == SLOT_EMPTY) {
+			return NULL;
+		}
+
+		if (slot->state == SLOT_LIVE && memcmp(slot->key, key, SESSION_KEY_SIZE) == 0) {
+			return slot;
+		}
+	}
+
+	return NULL;
+}
+
+// session_put : puts 'session' in 'shard' under 'key' (lock held)
+static int session_put(SessionShard *shard, u8 *key, Session *session)
+{
+	SessionSlot *slot;
+	u64 i;
+
+	// at 3/4 full (tombstones count, they make the probes longer too), it's doubled if it's the live
+	// ones that are filling it up (past half), otherwise it's rebuilt at the same size to get rid of
+	// the tombstones
+	if ((shard->live + shard->dead + 1) * 4 > shard->cap * 3) {
+		size_t cap = (shard->live + 1) * 2 > shard->cap ? shard->cap * 2 : shard->cap;
+		if (session_resize(shard, cap) < 0) {
+			return -1;
+		}
+	}
+
+	memcpy(&i, key, sizeof i);
+
+	// a token is 256 random bits, so it's never already in here, and the first free slot is it
+	for (;; i++) {
+		slot = &shard->slots[i & (shard->cap - 1)];
+		if (slot->state != SLOT_LIVE) {
+			break;
+		}
+	}
+
+	if (slot->state == SLOT_DEAD) {
+		shard->dead--;
+	}
+
+	memcpy(slot->key, key, SESSION_KEY_SIZE);
+	slot->state = SLOT_LIVE;
+	slot->session = session;
+
+	shard->live++;
+
+	return 0;
+}
+
+// session_resize : rebuilds the shard's table with 'cap' slots, which drops the tombstones (lock held)
+static int session_resize(SessionShard *shard, size_t cap)
+{
+	SessionSlot *old = shard->slots;
+	size_t oldcap = shard->cap;
+
+	shard->slots = calloc(cap, sizeof(*shard->slots));
+	if (shard->slots == NULL) {
+		shard->slots = old;
+		return -1;
+	}
+
+	shard->cap = cap;
+	shard->live = 0;
+	shard->dead = 0;
+
+	for (size_t i = 0; i < oldcap; i++) {
+		if (old[i].state == SLOT_LIVE) {
+			session_put(shard, old[i].key, old[i].session);
+		}
+	}
+
+	free(old);
+
+	return 0;
+}
+
+// session_pending : queues a change to be written to the database
+static void session_pending(u8 *key, char *id, i64 expires, int delete)
+{
+	SessionOp op = { .expires = expires, .delete = delete };
+
+	memcpy(op.key, key, SESSION_KEY_SIZE);
+	if (id != NULL) {
+		snprintf(op.id, sizeof op.id, "%s", id);
+	}
+
+	pthread_mutex_lock(&PENDING_LOCK);
+	arrput(PENDING, op);
+	pthread_mutex_unlock(&PENDING_LOCK);
+}
+
+// session_flush : writes out everything that's pending, in one transaction
+static void session_flush()
+{
+	struct sqlite3_stmt *insert, *delete;
+	SessionOp *ops;
+	int rc;
+
+	// take the whole list, so the logins don't wait on the disk
+	pthread_mutex_lock(&PENDING_LOCK);
+	ops = PENDING;
+	PENDING = NULL;
+	pthread_mutex_unlock(&PENDING_LOCK);
+
+	if (arrlen(ops) == 0) {
+		arrfree(ops);
+		return;
+	}
+
+	insert = db_stmt_get("sessions", "insert",
+		"insert or replace into %s (hash, user_id, expires_ts) values (?, uuid_blob(?), ?);");
+	delete = db_stmt_get("sessions", "delete",
+		"delete from %s where hash = ?;");
+	if (insert == NULL || delete == NULL) {
+		ERR("couldn't write %td sessions out!\n", arrlen(ops));
+		goto retry;
+	}
+
+	if (db_transaction_begin() < 0) {
+		ERR("couldn't write %td sessions out: %s\n", arrlen(ops), sqlite3_errmsg(DATABASE));
+		goto retry;
+	}
+
+	for (ptrdiff_t i = 0; i < arrlen(ops); i++) {
+		struct sqlite3_stmt *stmt = ops[i].delete ? delete : insert;
+
+		sqlite3_bind_blob(stmt, 1, ops[i].key, SESSION_KEY_SIZE, SQLITE_STATIC);
+		if (!ops[i].delete) {
+			sqlite3_bind_text(stmt, 2, ops[i].id, -1, SQLITE_STATIC);
+			sqlite3_bind_int64(stmt, 3, ops[i].expires);
+		}
+
+		rc = sqlite3_step(stmt);
+
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+
+		// NOTE (Brian) a locked database is worth another go, anything else is about this one
+		// op, and it'd fail the same way every time, so it's logged and dropped
+		if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+			ERR("couldn't write %td sessions out: %s\n", arrlen(ops), sqlite3_errstr(rc));
+			db_transaction_rollback();
+			goto retry;
+		} else if (rc != SQLITE_DONE) {
+			ERR("couldn't write a session out: %s\n", sqlite3_errstr(rc));
+		}
+	}
+
+	if (db_transaction_commit() < 0) {
+		ERR("couldn't write %td sessions out: %s\n", arrlen(ops), sqlite3_errmsg(DATABASE));
+		db_transaction_rollback();
+		goto retry;
+	}
+
+	db_stmt_release(insert);
+	db_stmt_release(delete);
+
+	pthread_mutex_lock(&PENDING_LOCK);
+	FLUSHES++;
+	WRITTEN += arrlen(ops);
+	pthread_mutex_unlock(&PENDING_LOCK);
+
+	arrfree(ops);
+	return;
+
+retry:
+	// put them back in front of anything that came in since, so they're still written in order
+	db_stmt_release(insert);
+	db_stmt_release(delete);
+
+	pthread_mutex_lock(&PENDING_LOCK);
+	arrinsn(PENDING, 0, arrlen(ops));
+	memcpy(PENDING, ops, arrlen(ops) * sizeof(*ops));
+	pthread_mutex_unlock(&PENDING_LOCK);
+
+	arrfree(ops);
+}
+
+// session_sweep : drops every session that's run out, from memory and from the database
+static void session_sweep()
+{
+	struct sqlite3_stmt *stmt;
+	i64 now = session_now();
+
+	for (size_t i = 0; i < SESSION_SHARDS; i++) {
+		SessionShard *shard = &SHARDS[i];
+
+		pthread_mutex_lock(&shard->lock);
+
+		for (size_t j = 0; j < shard->cap; j++) {
+			SessionSlot *slot = &shard->slots[j];
+
+			if (slot->state == SLOT_LIVE && slot->session->expires <= now) {
+				free(slot->session);
+				slot->session = NULL;
+				slot->state = SLOT_DEAD;
+				shard->live--;
+				shard->dead++;
+				shard->expired++;
+			}
+		}
+
+		// this is as good a time as any to clear the tombstones out, and to shrink it back down
+		if (shard->dead > 0) {
+			// (no further than half full, so putting them back can't set off another resize)
+			size_t cap = shard->cap;
+			while (cap / 2 >= SESSION_MIN_SLOTS && (shard->live + 1) * 2 <= cap / 2) {
+				cap /= 2;
+			}
+			session_resize(shard, cap);
+		}
+
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	stmt = db_stmt_get("sessions", "sweep", "delete from %s where expires_ts <= ?;");
+	if (stmt == NULL) {
+		return;
+	}
+
+	sqlite3_bind_int64(stmt, 1, now);
+
+	if (sqlite3_step(stmt) != SQLITE_DONE) {
+		ERR("couldn't sweep the sessions: %s\n", sqlite3_errmsg(DATABASE));
+	}
+
+	db_stmt_release(stmt);
+}
+
+// session_timer : the mongoose timer, flushes, and sweeps every SESSION_SWEEP flushes
+static void session_timer(void *arg)
+{
+	(void)arg;
+
+	session_flush();
+	if (STATELESS) {
+		token_flush();
+	}
+
+	if (++TICKS % SESSION_SWEEP == 0) {
+		session_sweep();
+		if (STATELESS) {
+			token_tick();
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+// Brian Chrzanowski
+// 2026-10-18 00:12:05
+
+#include "common.h"
+
+#define SESSION_TOKEN_BYTES (32)
+#define SESSION_TOKEN_LEN   (43) // SESSION_TOKEN_BYTES in base64url, without the padding
+#define SESSION_TTL_MS      (14LL * 24 * 60 * 60 * 1000)
+
+// Session: who a session belongs to, and when it runs out
+typedef struct Session {
+	char id[40];
+	char username[129];
+	char email[129];
+	i64 expires; // ms since the epoch
+} Session;
+
+// SessionStats: counters for the session store
+typedef struct SessionStats {
+	size_t shards;
+	size_t entries;
+	size_t slots;
+	size_t lookups;
+	size_t hits;
+	size_t expired;
+	size_t flushes;
+	size_t written;  // rows written (or deleted) by the flushes
+	size_t pending;
+} SessionStats;
+
+// session_init : loads the sessions that haven't run out yet (on the calling thread's connection), and starts the timer ('stateless' signs new ones instead, see token.c)
+int session_init(int stateless);
+// session_create : starts a session for 'session' (its id, username, and email), and writes its cookie token into 'token'
+int session_create(Session *session, char *token, size_t len);
+// session_lookup : copies the session for 'token' into 'session', 1 if there is one, 0 if there isn't
+int session_lookup(char *token, size_t len, Session *session);
+// session_delete : ends the session for 'token', if there is one
+void session_delete(char *token, size_t len);
+// session_stats : returns a snapshot of the session counters
+SessionStats session_stats();
+// session_free : writes out anything that's pending, and frees every session
+void session_free();
+
+#endif // SESSION_H
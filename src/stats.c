@@ -0,0 +1,89 @@
+// Brian Chrzanowski
+// 2026-10-17 09:12:40
+//
+// Runtime Counters
+//
+// Everything in here is cheap to read, and is meant for figuring out what the server is actually
+// doing while it's under load (e.g. are we still preparing statements in the steady state?).
+
+#include "common.h"
+
+#include <jansson.h>
+
+#include "mongoose.h"
+
+#include "objects.h"
+#include "cache.h"
+#include "gzip.h"
+#include "worker.h"
+#include "session.h"
+#include "token.h"
+#include "stats.h"
+
+// stats_api_get : endpoint, GET - /api/v1/stats
+int stats_api_get(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
+{
+	DB_StmtCacheStats stmts = db_stmt_cache_stats();
+	CacheStats recipes = cache_stats();
+	WorkerPwhashStats pwhash = worker_pwhash_stats();
+	SessionStats sessions = session_stats();
+	TokenStats tokens = token_stats();
+
+	size_t lookups = recipes.hits + recipes.misses;
+
+	json_t *object = json_pack(
+		"{s:{s:I, s:I, s:I}, s:{s:I, s:I, s:f, s:I, s:I, s:I, s:I}, s:o, s:{s:I, s:I, s:I, s:I, s:I, s:I}, s:{s:I, s:I, s:I, s:I, s:I, s:I, s:I, s:I, s:I}, s:{s:I, s:I, s:I, s:I, s:I, s:I, s:I, s:I}}",
+		"stmt_cache",
+			"hits", (json_int_t)stmts.hits,
+			"misses", (json_int_t)stmts.misses,
+			"entries", (json_int_t)stmts.entries,
+		"recipe_cache",
+			"hits", (json_int_t)recipes.hits,
+			"misses", (json_int_t)recipes.misses,
+			"hit_rate", lookups ? (double)recipes.hits / lookups : 0.0,
+			"evictions", (json_int_t)recipes.evictions,
+			"entries", (json_int_t)recipes.entries,
+			"bytes", (json_int_t)recipes.bytes,
+			"budget", (json_int_t)recipes.budget,
+		"gzip", gzip_stats(),
+		"pwhash",
+			"threads", (json_int_t)pwhash.threads,
+			"backlog", (json_int_t)pwhash.backlog,
+			"queued", (json_int_t)pwhash.queued,
+			"submitted", (json_int_t)pwhash.submitted,
+			"completed", (json_int_t)pwhash.completed,
+			"rejected", (json_int_t)pwhash.rejected,
+		"sessions",
+			"shards", (json_int_t)sessions.shards,
+			"entries", (json_int_t)sessions.entries,
+			"slots", (json_int_t)sessions.slots,
+			"lookups", (json_int_t)sessions.lookups,
+			"hits", (json_int_t)sessions.hits,
+			"expired", (json_int_t)sessions.expired,
+			"flushes", (json_int_t)sessions.flushes,
+			"written", (json_int_t)sessions.written,
+			"pending", (json_int_t)sessions.pending,
+		"tokens",
+			"epoch", (json_int_t)tokens.epoch,
+			"keys", (json_int_t)tokens.keys,
+			"issued", (json_int_t)tokens.issued,
+			"verified", (json_int_t)tokens.verified,
+			"rejected", (json_int_t)tokens.rejected,
+			"revoked", (json_int_t)tokens.revoked,
+			"bloom_hits", (json_int_t)tokens.bloom_hits,
+			"bloom_false", (json_int_t)tokens.bloom_false
+	);
+
+	if (object == NULL) {
+		return -1;
+	}
+
+	char *s = json_dumps(object, JSON_SORT_KEYS|JSON_COMPACT);
+
+	mg_http_reply(conn, 200, NULL, "%s", s);
+
+	json_decref(object);
+	free(s);
+
+	return 0;
+}
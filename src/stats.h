@@ -0,0 +1,13 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "common.h"
+
+#include "mongoose.h"
+
+#include "route.h"
+
+// stats_api_get : endpoint, GET - /api/v1/stats
+int stats_api_get(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
+
+#endif
@@ -9,7 +9,7 @@
 
 #include "tag.h"
 
-extern sqlite3 *DATABASE;
+extern __thread sqlite3 *DATABASE;
 
 static int tag_select_cb(void *ptr, int ncols, char ** tcol, char **colnames)
 {
@@ -25,7 +25,7 @@ static int tag_select_cb(void *ptr, int ncols, char ** tcol, char **colnames)
 }
 
 // tag_api_getlist : endpoint, GET - /api/v1/tags
-int tag_api_getlist(struct mg_connection *conn, struct mg_http_message *hm)
+int tag_api_getlist(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
 {
 	char **tags = NULL;
 	char *errmsg = NULL;
@@ -6,8 +6,10 @@
 
 #include "mongoose.h"
 
+#include "route.h"
+
 // tag_api_getlist : endpoint, GET - /api/v1/tags
-int tag_api_getlist(struct mg_connection *conn, struct mg_http_message *hm);
+int tag_api_getlist(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
 
 #endif
 
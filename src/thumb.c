@@ -0,0 +1,953 @@
+// Brian Chrzanowski
+// 2026-10-17 20:05:13
+//
+// Thumbnails
+//
+// The list views only need a small picture of each recipe, and sending them the originals (which
+// can be up to 32MB) is a waste of everyone's bandwidth. Every image that gets uploaded gets, in the
+// background:
+//
+//   1. decoded (libjpeg / libpng)
+//   2. shrunk down to each of THUMB_WIDTHS that it's wider than, and written out as a JPEG next to
+//      the original, <imagedir>/ab/cdef...-320
+//   3. shrunk down again to THUMB_PLACEHOLDER wide, blurred, and kept as a data: URI, which is small
+//      enough to go out inline with the recipe, and be stretched out while the real one loads
+//   4. recorded, its size on 'images', and the variants in 'image_variants' (see 0005)
+//
+// None of that happens on the event loop (or on the workers). There's one thread, with its own
+// connection, and the queue is the 'images' table itself: anything with a null width hasn't been
+// done yet. thumb_wake just tells the thread to go look, so an upload that comes in while the
+// server is down (or one from before this existed) gets caught up the next time it starts.
+//
+// The shrinking is a box filter, every pixel in the output is the average of the pixels it covers.
+// Each width is made from the next bigger one, so only the first pass touches the whole original,
+// and JPEGs get most of the way there for free, by having libjpeg decode at 1/2, 1/4 or 1/8 scale.
+//
+// NOTE (Brian) GIFs and WebPs keep their original, and nothing else (we don't decode them).
+//
+// NOTE (Brian) phones store most JPEGs sideways, with an EXIF orientation tag that says how to turn
+// them. Browsers turn the originals by it, so the thumbnails get turned the same way when they're
+// decoded (thumb_orient), and the width and height that get recorded are the way it's shown.
+
+#include "common.h"
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <jpeglib.h>
+#include <png.h>
+#include <sodium.h>
+#include <jansson.h>
+
+#include "sqlite3.h"
+
+#include "objects.h"
+#include "cache.h"
+#include "thumb.h"
+
+#define THUMB_QUALITY     (80)
+#define THUMB_PLACEHOLDER (16) // px wide
+#define THUMB_BLURRY      (50) // the placeholder's quality, it's going to be a blur anyway
+#define THUMB_MAX_PIXELS  (48 * 1000 * 1000) // decoded, anything bigger is likely a decompression bomb
+#define THUMB_RETRY_MS    (60 * 1000) // how long the images that were left for later wait, at most
+#define THUMB_EXIF_ORIENTATION (0x0112) // the EXIF (TIFF) tag
+
+// THUMB_RETRY: the return value when an image is left waiting for a reason that isn't the image itself
+// (the disk, memory), so it's worth another try later. Anything else that goes wrong with an image is
+// going to go wrong every time.
+#define THUMB_RETRY (-2)
+
+// NOTE (Brian) widest first, each one gets made from the one before it
+static const int THUMB_WIDTHS[] = { 640, 320, 160 };
+
+extern __thread sqlite3 *DATABASE;
+
+// ThumbImage: decoded pixels, 3 bytes (RGB) each, row after row
+typedef struct ThumbImage {
+	u8 *pixels;
+	int width;
+	int height;
+} ThumbImage;
+
+// ThumbVariant: one shrunk down copy, once it's been written out
+typedef struct ThumbVariant {
+	int width;
+	int height;
+	size_t size;
+	char path[BUFSMALL];
+} ThumbVariant;
+
+// ThumbJpegError: libjpeg calls exit() on an error, unless we jump out of it first
+typedef struct ThumbJpegError {
+	struct jpeg_error_mgr pub;
+	jmp_buf jmp;
+} ThumbJpegError;
+
+static pthread_mutex_t THUMB_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t THUMB_COND = PTHREAD_COND_INITIALIZER;
+static pthread_t THUMB_THREAD;
+static int STARTED = false;
+static int STOPPING = false;
+static int PENDING = false;
+
+static char *DBNAME = NULL;
+static char *IMAGE_DIR = NULL;
+
+// thumb_thread : thread entry, does every image that's waiting, then waits for thumb_wake
+static void *thumb_thread(void *arg);
+// thumb_next : makes the thumbnails for the next image after 'after' that doesn't have them, 1 if it did one, THUMB_RETRY if it left one for later, 0 if there are none
+static int thumb_next(i64 *after);
+// thumb_make : decodes the image, and writes out its variants and placeholder, -1 if it can't be decoded, THUMB_RETRY if it couldn't for some other reason
+static int thumb_make(char *path, char *mime, ThumbImage *orig, ThumbVariant *variants, size_t *nvariants, char **placeholder);
+// thumb_save : records the results for the image with 'hash' (all zeroes if it couldn't be decoded)
+static int thumb_save(sqlite3_value *hash, ThumbImage *orig, ThumbVariant *variants, size_t nvariants, char *placeholder);
+// thumb_invalidate : drops the cached responses of the recipes the image with 'hash' is on
+static void thumb_invalidate(sqlite3_value *hash);
+// thumb_unlink : removes the variants that were already written, for an image that's going to be tried again
+static void thumb_unlink(ThumbVariant *variants, size_t nvariants);
+// thumb_decode_jpeg : decodes 'fp', at the smallest scale that's still at least 'want' wide (THUMB_RETRY if there isn't the memory for it)
+static int thumb_decode_jpeg(FILE *fp, int want, ThumbImage *img, int *width, int *height);
+// thumb_decode_png : decodes 'fp', with any transparency flattened onto white (THUMB_RETRY if there isn't the memory for it)
+static int thumb_decode_png(FILE *fp, ThumbImage *img);
+// thumb_exif_orientation : the EXIF orientation (1 - 8) from the JPEG's saved APP1 marker, 1 if there isn't one
+static int thumb_exif_orientation(struct jpeg_decompress_struct *cinfo);
+// thumb_exif_get : reads the 'size' (2 or 4) byte integer at 'p', in the EXIF data's byte order
+static u32 thumb_exif_get(u8 *p, int size, int le);
+// thumb_orient : turns / flips 'img' so it's the way EXIF 'orientation' says it's shown (THUMB_RETRY if there isn't the memory for it)
+static int thumb_orient(ThumbImage *img, int orientation);
+// thumb_resize : shrinks 'src' down to 'width' wide (keeping the aspect ratio), averaging boxes of pixels
+static int thumb_resize(ThumbImage *src, ThumbImage *dst, int width);
+// thumb_blur : 3x3 box blur, in place
+static void thumb_blur(ThumbImage *img);
+// thumb_encode : compresses 'img' into a JPEG, into a buffer libjpeg allocates (free it)
+static int thumb_encode(ThumbImage *img, int quality, u8 **buf, unsigned long *len);
+// thumb_write : writes 'len' bytes to 'path' (relative to the image directory), through a temp file
+static int thumb_write(char *path, u8 *buf, size_t len);
+// thumb_jpeg_error : libjpeg error_exit, logs the error, and jumps back out of the library
+static void thumb_jpeg_error(j_common_ptr cinfo);
+
+// thumb_init : starts the thumbnail thread, which catches up on anything that's waiting right away
+int thumb_init(char *fname, char *dir)
+{
+	DBNAME = fname;
+	IMAGE_DIR = dir;
+
+	STOPPING = false;
+	PENDING = true;
+
+	if (pthread_create(&THUMB_THREAD, NULL, thumb_thread, NULL) != 0) {
+		ERR("couldn't start the thumbnail thread!\n");
+		return -1;
+	}
+
+	STARTED = true;
+
+	return 0;
+}
+
+// thumb_wake : tells the thumbnail thread there's a new image (after the row's been committed)
+void thumb_wake()
+{
+	pthread_mutex_lock(&THUMB_LOCK);
+	PENDING = true;
+	pthread_cond_signal(&THUMB_COND);
+	pthread_mutex_unlock(&THUMB_LOCK);
+}
+
+// thumb_free : stops the thumbnail thread, after the image it's on
+void thumb_free()
+{
+	if (!STARTED) {
+		return;
+	}
+
+	pthread_mutex_lock(&THUMB_LOCK);
+	STOPPING = true;
+	pthread_cond_signal(&THUMB_COND);
+	pthread_mutex_unlock(&THUMB_LOCK);
+
+	pthread_join(THUMB_THREAD, NULL);
+
+	STARTED = false;
+}
+
+// thumb_thread : thread entry, does every image that's waiting, then waits for thumb_wake
+static void *thumb_thread(void *arg)
+{
+	struct timespec deadline;
+	int retry = false;
+	int stopping;
+	i64 after;
+	int rc;
+
+	(void)arg;
+
+	// NOTE (Brian) on Linux, this is just this thread. Decoding is all CPU, and it can wait, so the
+	// requests get first pick of the cores.
+	errno = 0;
+	if (nice(10) < 0 && errno != 0) {
+		ERR("couldn't lower the thumbnail thread's priority: %s\n", strerror(errno));
+	}
+
+	if (db_open(DBNAME, false) < 0) {
+		ERR("the thumbnail thread couldn't open the database!\n");
+		return NULL;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&THUMB_LOCK);
+		while (!PENDING && !STOPPING) {
+			if (!retry) {
+				pthread_cond_wait(&THUMB_COND, &THUMB_LOCK);
+			} else if (pthread_cond_timedwait(&THUMB_COND, &THUMB_LOCK, &deadline) == ETIMEDOUT) {
+				break;
+			}
+		}
+		PENDING = false;
+		pthread_mutex_unlock(&THUMB_LOCK);
+
+		// one image at a time, so a shutdown only ever waits on one, and in order, once, so the ones
+		// that get left for later don't hold up the ones behind them
+		after = 0;
+		retry = false;
+		do {
+			pthread_mutex_lock(&THUMB_LOCK);
+			stopping = STOPPING;
+			pthread_mutex_unlock(&THUMB_LOCK);
+
+			rc = stopping ? 0 : thumb_next(&after);
+			if (rc < 0) {
+				retry = true;
+			}
+		} while (rc > 0 || rc == THUMB_RETRY);
+
+		// NOTE (Brian) on an error, the image is still waiting, and gets tried again on the next wake
+		// up (or in THUMB_RETRY_MS, if nothing wakes us up before then), rather than over and over
+		// again right now
+		if (retry) {
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += THUMB_RETRY_MS / 1000;
+		}
+
+		if (stopping) {
+			break;
+		}
+	}
+
+	db_close();
+
+	return NULL;
+}
+
+// thumb_next : makes the thumbnails for the next image after 'after' that doesn't have them, 1 if it did one, THUMB_RETRY if it left one for later, 0 if there are none
+static int thumb_next(i64 *after)
+{
+	ThumbVariant variants[ARRSIZE(THUMB_WIDTHS)];
+	ThumbImage orig = {0};
+	sqlite3_stmt *stmt;
+	sqlite3_value *hash;
+	char *placeholder = NULL;
+	char path[BUFLARGE];
+	char mime[BUFSMALL];
+	size_t nvariants = 0;
+	int rc;
+
+	stmt = db_stmt_get("images", "thumb_next",
+		"select rowid, hash, path, mime from %s where width is null and delete_ts is null and rowid > ?"
+		" order by rowid limit 1;");
+	if (stmt == NULL) {
+		return -1;
+	}
+
+	sqlite3_bind_int64(stmt, 1, *after);
+
+	rc = sqlite3_step(stmt);
+	if (rc != SQLITE_ROW) {
+		db_stmt_release(stmt);
+		return rc == SQLITE_DONE ? 0 : -1;
+	}
+
+	*after = sqlite3_column_int64(stmt, 0);
+	hash = sqlite3_value_dup(sqlite3_column_value(stmt, 1));
+	snprintf(path, sizeof path, "%s", sqlite3_column_text(stmt, 2));
+	snprintf(mime, sizeof mime, "%s", sqlite3_column_text(stmt, 3));
+
+	db_stmt_release(stmt);
+
+	if (hash == NULL) {
+		return -1;
+	}
+
+	// the same bytes uploaded again (to another recipe, say) already have their thumbnails
+	stmt = db_stmt_get("images", "thumb_copy",
+		"update %s set (width, height, placeholder) ="
+		" (select i.width, i.height, i.placeholder from images i where i.hash = ?1 and i.width is not null limit 1)"
+		" where hash = ?1 and width is null"
+		" and exists (select 1 from images i where i.hash = ?1 and i.width is not null);");
+	if (stmt == NULL) {
+		sqlite3_value_free(hash);
+		return -1;
+	}
+
+	sqlite3_bind_value(stmt, 1, hash);
+
+	rc = sqlite3_step(stmt);
+
+	db_stmt_release(stmt);
+
+	if (rc != SQLITE_DONE || sqlite3_changes(DATABASE) > 0) {
+		if (rc == SQLITE_DONE) {
+			thumb_invalidate(hash);
+		}
+		sqlite3_value_free(hash);
+		return rc == SQLITE_DONE ? 1 : -1;
+	}
+
+	// anything that can't be decoded gets recorded as 0x0, with no variants, so it isn't tried again,
+	// and anything else stays waiting, without whatever it got through before it failed
+	rc = thumb_make(path, mime, &orig, variants, &nvariants, &placeholder);
+	if (rc == THUMB_RETRY) {
+		thumb_unlink(variants, nvariants);
+		sqlite3_value_free(hash);
+		free(placeholder);
+		return THUMB_RETRY;
+	} else if (rc < 0) {
+		orig.width = orig.height = 0;
+		nvariants = 0;
+	}
+
+	rc = thumb_save(hash, &orig, variants, nvariants, placeholder);
+	if (rc == 0) {
+		thumb_invalidate(hash);
+	} else {
+		thumb_unlink(variants, nvariants);
+	}
+
+	sqlite3_value_free(hash);
+	free(placeholder);
+
+	return rc < 0 ? -1 : 1;
+}
+
+// thumb_make : decodes the image, and writes out its variants and placeholder, -1 if it can't be decoded, THUMB_RETRY if it couldn't for some other reason
+static int thumb_make(char *path, char *mime, ThumbImage *orig, ThumbVariant *variants, size_t *nvariants, char **placeholder)
+{
+	ThumbImage img = {0};
+	ThumbImage next;
+	char fullpath[BUFLARGE];
+	unsigned long len;
+	u8 *buf;
+	FILE *fp;
+	size_t i;
+	int rc;
+
+	snprintf(fullpath, sizeof fullpath, "%s/%s", IMAGE_DIR, path);
+
+	fp = fopen(fullpath, "rb");
+	if (fp == NULL) {
+		ERR("couldn't open '%s' to make thumbnails: %s\n", fullpath, strerror(errno));
+		return THUMB_RETRY;
+	}
+
+	if (strcmp(mime, "image/jpeg") == 0) {
+		rc = thumb_decode_jpeg(fp, THUMB_WIDTHS[0], &img, &orig->width, &orig->height);
+	} else if (strcmp(mime, "image/png") == 0) {
+		rc = thumb_decode_png(fp, &img);
+		orig->width = img.width;
+		orig->height = img.height;
+	} else {
+		rc = -1;
+	}
+
+	fclose(fp);
+
+	if (rc < 0) {
+		return rc;
+	}
+
+	for (i = 0; i < ARRSIZE(THUMB_WIDTHS); i++) {
+		if (THUMB_WIDTHS[i] >= orig->width) {
+			continue;
+		}
+
+		if (thumb_resize(&img, &next, THUMB_WIDTHS[i]) < 0) {
+			free(img.pixels);
+			return THUMB_RETRY;
+		}
+
+		free(img.pixels);
+		img = next;
+
+		if (thumb_encode(&img, THUMB_QUALITY, &buf, &len) < 0) {
+			free(img.pixels);
+			return THUMB_RETRY;
+		}
+
+		ThumbVariant *variant = variants + *nvariants;
+
+		variant->width = img.width;
+		variant->height = img.height;
+		variant->size = len;
+		snprintf(variant->path, sizeof variant->path, "%s-%d", path, img.width);
+
+		rc = thumb_write(variant->path, buf, len);
+
+		free(buf);
+
+		if (rc < 0) {
+			free(img.pixels);
+			return THUMB_RETRY;
+		}
+
+		(*nvariants)++;
+	}
+
+	// the placeholder comes from the smallest of them, whatever that ended up being
+	if (thumb_resize(&img, &next, MIN(THUMB_PLACEHOLDER, img.width)) < 0) {
+		free(img.pixels);
+		return THUMB_RETRY;
+	}
+
+	free(img.pixels);
+	img = next;
+
+	thumb_blur(&img);
+
+	rc = thumb_encode(&img, THUMB_BLURRY, &buf, &len);
+
+	free(img.pixels);
+
+	if (rc < 0) {
+		return THUMB_RETRY;
+	}
+
+	static const char prefix[] = "data:image/jpeg;base64,";
+	size_t b64len = sodium_base64_ENCODED_LEN(len, sodium_base64_VARIANT_ORIGINAL);
+
+	*placeholder = malloc(sizeof(prefix) - 1 + b64len);
+	if (*placeholder == NULL) {
+		free(buf);
+		return THUMB_RETRY;
+	}
+
+	memcpy(*placeholder, prefix, sizeof(prefix) - 1);
+	sodium_bin2base64(*placeholder + sizeof(prefix) - 1, b64len, buf, len, sodium_base64_VARIANT_ORIGINAL);
+
+	free(buf);
+
+	return 0;
+}
+
+// thumb_save : records the results for the image with 'hash' (all zeroes if it couldn't be decoded)
+static int thumb_save(sqlite3_value *hash, ThumbImage *orig, ThumbVariant *variants, size_t nvariants, char *placeholder)
+{
+	sqlite3_stmt *stmt;
+	int rc = SQLITE_DONE;
+
+	if (sqlite3_exec(DATABASE, "begin immediate transaction;", NULL, NULL, NULL) != SQLITE_OK) {
+		ERR("couldn't save thumbnails: %s\n", sqlite3_errmsg(DATABASE));
+		return -1;
+	}
+
+	for (size_t i = 0; i < nvariants && rc == SQLITE_DONE; i++) {
+		stmt = db_stmt_get("image_variants", "insert",
+			"insert or replace into %s (hash, width, height, mime, size, path) values (?, ?, ?, 'image/jpeg', ?, ?);");
+		if (stmt == NULL) {
+			rc = SQLITE_ERROR;
+			break;
+		}
+
+		sqlite3_bind_value(stmt, 1, hash);
+		sqlite3_bind_int(stmt, 2, variants[i].width);
+		sqlite3_bind_int(stmt, 3, variants[i].height);
+		sqlite3_bind_int64(stmt, 4, variants[i].size);
+		sqlite3_bind_text(stmt, 5, variants[i].path, -1, SQLITE_STATIC);
+
+		rc = sqlite3_step(stmt);
+
+		db_stmt_release(stmt);
+	}
+
+	if (rc == SQLITE_DONE) {
+		stmt = db_stmt_get("images", "thumb_save", "update %s set width = ?, height = ?, placeholder = ? where hash = ?;");
+		if (stmt == NULL) {
+			rc = SQLITE_ERROR;
+		} else {
+			sqlite3_bind_int(stmt, 1, orig->width);
+			sqlite3_bind_int(stmt, 2, orig->height);
+			sqlite3_bind_text(stmt, 3, placeholder, -1, SQLITE_STATIC);
+			sqlite3_bind_value(stmt, 4, hash);
+
+			rc = sqlite3_step(stmt);
+
+			db_stmt_release(stmt);
+		}
+	}
+
+	if (rc != SQLITE_DONE || sqlite3_exec(DATABASE, "commit transaction;", NULL, NULL, NULL) != SQLITE_OK) {
+		ERR("couldn't save thumbnails: %s\n", sqlite3_errmsg(DATABASE));
+		sqlite3_exec(DATABASE, "rollback transaction;", NULL, NULL, NULL);
+		return -1;
+	}
+
+	return 0;
+}
+
+// thumb_invalidate : drops the cached responses of the recipes the image with 'hash' is on
+static void thumb_invalidate(sqlite3_value *hash)
+{
+	sqlite3_stmt *stmt;
+	char id[64];
+
+	stmt = db_stmt_get("images", "thumb_recipes", "select distinct uuid_str(recipe_id) from %s where hash = ?;");
+	if (stmt == NULL) {
+		return;
+	}
+
+	sqlite3_bind_value(stmt, 1, hash);
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		snprintf(id, sizeof id, "%s", sqlite3_column_text(stmt, 0));
+		cache_invalidate(id);
+	}
+
+	db_stmt_release(stmt);
+}
+
+// thumb_unlink : removes the variants that were already written, for an image that's going to be tried again
+static void thumb_unlink(ThumbVariant *variants, size_t nvariants)
+{
+	char fullpath[BUFLARGE];
+
+	for (size_t i = 0; i < nvariants; i++) {
+		snprintf(fullpath, sizeof fullpath, "%s/%s", IMAGE_DIR, variants[i].path);
+		unlink(fullpath);
+	}
+}
+
+// thumb_decode_jpeg : decodes 'fp', at the smallest scale that's still at least 'want' wide (THUMB_RETRY if there isn't the memory for it)
+static int thumb_decode_jpeg(FILE *fp, int want, ThumbImage *img, int *width, int *height)
+{
+	struct jpeg_decompress_struct cinfo;
+	ThumbJpegError jerr;
+	u8 *volatile pixels = NULL;
+	JSAMPROW row;
+	size_t stride;
+	int orientation;
+	unsigned across;
+	int rc;
+
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = thumb_jpeg_error;
+
+	if (setjmp(jerr.jmp)) {
+		jpeg_destroy_decompress(&cinfo);
+		free(pixels);
+		return -1;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_stdio_src(&cinfo, fp);
+	jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xffff);
+	jpeg_read_header(&cinfo, TRUE);
+
+	// a sideways one is shown as wide as it's stored tall
+	orientation = thumb_exif_orientation(&cinfo);
+	across = orientation >= 5 ? cinfo.image_height : cinfo.image_width;
+
+	*width = across;
+	*height = orientation >= 5 ? cinfo.image_width : cinfo.image_height;
+
+	// NOTE (Brian) the DCT can be cut short to get 1/2, 1/4 or 1/8 of the size, which is a lot
+	// cheaper than decoding the whole thing, just to throw most of it away in the resize
+	cinfo.out_color_space = JCS_RGB;
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = 1;
+	for (unsigned d = 8; d > 1; d /= 2) {
+		if (across / d >= (unsigned)want) {
+			cinfo.scale_denom = d;
+			break;
+		}
+	}
+
+	jpeg_calc_output_dimensions(&cinfo);
+
+	if ((u64)cinfo.output_width * cinfo.output_height > THUMB_MAX_PIXELS) {
+		ERR("not making thumbnails for a %ux%u jpeg, it's too big\n", cinfo.image_width, cinfo.image_height);
+		jpeg_destroy_decompress(&cinfo);
+		return -1;
+	}
+
+	jpeg_start_decompress(&cinfo);
+
+	stride = (size_t)cinfo.output_width * 3;
+
+	pixels = malloc(stride * cinfo.output_height);
+	if (pixels == NULL) {
+		jpeg_destroy_decompress(&cinfo);
+		return THUMB_RETRY;
+	}
+
+	while (cinfo.output_scanline < cinfo.output_height) {
+		row = pixels + stride * cinfo.output_scanline;
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+
+	jpeg_finish_decompress(&cinfo);
+
+	img->pixels = pixels;
+	img->width = cinfo.output_width;
+	img->height = cinfo.output_height;
+
+	jpeg_destroy_decompress(&cinfo);
+
+	rc = thumb_orient(img, orientation);
+	if (rc < 0) {
+		free(img->pixels);
+		img->pixels = NULL;
+	}
+
+	return rc;
+}
+
+// thumb_exif_orientation : the EXIF orientation (1 - 8) from the JPEG's saved APP1 marker, 1 if there isn't one
+static int thumb_exif_orientation(struct jpeg_decompress_struct *cinfo)
+{
+	jpeg_saved_marker_ptr marker;
+	u8 *tiff;
+	size_t len;
+	u32 ifd, count;
+	int le;
+
+	for (marker = cinfo->marker_list; marker != NULL; marker = marker->next) {
+		if (marker->marker == JPEG_APP0 + 1 && marker->data_length > 14 && memcmp(marker->data, "Exif\0\0", 6) == 0) {
+			break;
+		}
+	}
+
+	if (marker == NULL) {
+		return 1;
+	}
+
+	// NOTE (Brian) after the "Exif", it's a TIFF file: the byte order ("II" is little endian, "MM" is
+	// big), 42, and the offset of the first IFD, which is a count, and then that many 12 byte entries
+	// of tag (2), type (2), count (4), and the value itself, if it fits in 4 bytes (orientation does)
+	tiff = marker->data + 6;
+	len = marker->data_length - 6;
+
+	if (memcmp(tiff, "II", 2) == 0) {
+		le = true;
+	} else if (memcmp(tiff, "MM", 2) == 0) {
+		le = false;
+	} else {
+		return 1;
+	}
+
+	ifd = thumb_exif_get(tiff + 4, 4, le);
+	if (thumb_exif_get(tiff + 2, 2, le) != 42 || ifd > len - 2) {
+		return 1;
+	}
+
+	count = thumb_exif_get(tiff + ifd, 2, le);
+
+	for (u32 i = 0; i < count && ifd + 2 + (i + 1) * 12 <= len; i++) {
+		u8 *entry = tiff + ifd + 2 + i * 12;
+
+		if (thumb_exif_get(entry, 2, le) == THUMB_EXIF_ORIENTATION) {
+			u32 orientation = thumb_exif_get(entry + 8, 2, le);
+			return orientation >= 1 && orientation <= 8 ? (int)orientation : 1;
+		}
+	}
+
+	return 1;
+}
+
+// thumb_exif_get : reads the 'size' (2 or 4) byte integer at 'p', in the EXIF data's byte order
+static u32 thumb_exif_get(u8 *p, int size, int le)
+{
+	u32 v = 0;
+
+	for (int i = 0; i < size; i++) {
+		v = (v << 8) | p[le ? size - 1 - i : i];
+	}
+
+	return v;
+}
+
+// thumb_orient : turns / flips 'img' so it's the way EXIF 'orientation' says it's shown (THUMB_RETRY if there isn't the memory for it)
+static int thumb_orient(ThumbImage *img, int orientation)
+{
+	ThumbImage out;
+	int w = img->width;
+	int h = img->height;
+
+	if (orientation <= 1 || orientation > 8) {
+		return 0;
+	}
+
+	// 5 through 8 are the ones that are turned a quarter, so the sides swap
+	out.width = orientation >= 5 ? h : w;
+	out.height = orientation >= 5 ? w : h;
+
+	out.pixels = malloc((size_t)w * h * 3);
+	if (out.pixels == NULL) {
+		return THUMB_RETRY;
+	}
+
+	for (int y = 0; y < out.height; y++) {
+		for (int x = 0; x < out.width; x++) {
+			int sx, sy;
+
+			// where the pixel that's shown at (x, y) is stored
+			switch (orientation) {
+				case 2: sx = w - 1 - x; sy = y; break;             // mirrored
+				case 3: sx = w - 1 - x; sy = h - 1 - y; break;     // upside down
+				case 4: sx = x; sy = h - 1 - y; break;             // flipped
+				case 5: sx = y; sy = x; break;                     // transposed
+				case 6: sx = y; sy = h - 1 - x; break;             // turned clockwise to show it
+				case 7: sx = w - 1 - y; sy = h - 1 - x; break;     // transversed
+				default: sx = w - 1 - y; sy = x; break;            // 8, turned counter-clockwise to show it
+			}
+
+			memcpy(out.pixels + ((size_t)y * out.width + x) * 3, img->pixels + ((size_t)sy * w + sx) * 3, 3);
+		}
+	}
+
+	free(img->pixels);
+	*img = out;
+
+	return 0;
+}
+
+// thumb_decode_png : decodes 'fp', with any transparency flattened onto white (THUMB_RETRY if there isn't the memory for it)
+static int thumb_decode_png(FILE *fp, ThumbImage *img)
+{
+	png_image image;
+	png_color white = { 255, 255, 255 };
+	u8 *pixels;
+
+	memset(&image, 0, sizeof image);
+	image.version = PNG_IMAGE_VERSION;
+
+	if (!png_image_begin_read_from_stdio(&image, fp)) {
+		ERR("couldn't read a png: %s\n", image.message);
+		return -1;
+	}
+
+	if ((u64)image.width * image.height > THUMB_MAX_PIXELS) {
+		ERR("not making thumbnails for a %ux%u png, it's too big\n", image.width, image.height);
+		png_image_free(&image);
+		return -1;
+	}
+
+	// the thumbnails are JPEGs, so there's nowhere for an alpha channel to go
+	image.format = PNG_FORMAT_RGB;
+
+	pixels = malloc(PNG_IMAGE_SIZE(image));
+	if (pixels == NULL) {
+		png_image_free(&image);
+		return THUMB_RETRY;
+	}
+
+	if (!png_image_finish_read(&image, &white, pixels, 0, NULL)) {
+		ERR("couldn't decode a png: %s\n", image.message);
+		png_image_free(&image);
+		free(pixels);
+		return -1;
+	}
+
+	img->pixels = pixels;
+	img->width = image.width;
+	img->height = image.height;
+
+	return 0;
+}
+
+// thumb_resize : shrinks 'src' down to 'width' wide (keeping the aspect ratio), averaging boxes of pixels
+static int thumb_resize(ThumbImage *src, ThumbImage *dst, int width)
+{
+	int height;
+
+	height = MAX(1, (int)(((i64)src->height * width + src->width / 2) / src->width));
+
+	dst->pixels = malloc((size_t)width * height * 3);
+	if (dst->pixels == NULL) {
+		return -1;
+	}
+
+	dst->width = width;
+	dst->height = height;
+
+	for (int y = 0; y < height; y++) {
+		int y0 = (i64)y * src->height / height;
+		int y1 = MAX(y0 + 1, (int)((i64)(y + 1) * src->height / height));
+
+		for (int x = 0; x < width; x++) {
+			int x0 = (i64)x * src->width / width;
+			int x1 = MAX(x0 + 1, (int)((i64)(x + 1) * src->width / width));
+			u32 sum[3] = {0};
+			u32 n = (u32)(y1 - y0) * (x1 - x0);
+
+			for (int sy = y0; sy < y1; sy++) {
+				u8 *p = src->pixels + ((size_t)sy * src->width + x0) * 3;
+				for (int sx = x0; sx < x1; sx++, p += 3) {
+					sum[0] += p[0];
+					sum[1] += p[1];
+					sum[2] += p[2];
+				}
+			}
+
+			u8 *q = dst->pixels + ((size_t)y * width + x) * 3;
+			q[0] = (sum[0] + n / 2) / n;
+			q[1] = (sum[1] + n / 2) / n;
+			q[2] = (sum[2] + n / 2) / n;
+		}
+	}
+
+	return 0;
+}
+
+// thumb_blur : 3x3 box blur, in place
+static void thumb_blur(ThumbImage *img)
+{
+	size_t size = (size_t)img->width * img->height * 3;
+	u8 *copy;
+
+	copy = malloc(size);
+	if (copy == NULL) {
+		return;
+	}
+
+	memcpy(copy, img->pixels, size);
+
+	for (int y = 0; y < img->height; y++) {
+		for (int x = 0; x < img->width; x++) {
+			u32 sum[3] = {0};
+			u32 n = 0;
+
+			for (int sy = MAX(y - 1, 0); sy <= MIN(y + 1, img->height - 1); sy++) {
+				for (int sx = MAX(x - 1, 0); sx <= MIN(x + 1, img->width - 1); sx++) {
+					u8 *p = copy + ((size_t)sy * img->width + sx) * 3;
+					sum[0] += p[0];
+					sum[1] += p[1];
+					sum[2] += p[2];
+					n++;
+				}
+			}
+
+			u8 *q = img->pixels + ((size_t)y * img->width + x) * 3;
+			q[0] = sum[0] / n;
+			q[1] = sum[1] / n;
+			q[2] = sum[2] / n;
+		}
+	}
+
+	free(copy);
+}
+
+// thumb_encode : compresses 'img' into a JPEG, into a buffer libjpeg allocates (free it)
+static int thumb_encode(ThumbImage *img, int quality, u8 **buf, unsigned long *len)
+{
+	struct jpeg_compress_struct cinfo;
+	ThumbJpegError jerr;
+	JSAMPROW row;
+
+	*buf = NULL;
+	*len = 0;
+
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = thumb_jpeg_error;
+
+	if (setjmp(jerr.jmp)) {
+		jpeg_destroy_compress(&cinfo);
+		free(*buf);
+		*buf = NULL;
+		return -1;
+	}
+
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, buf, len);
+
+	cinfo.image_width = img->width;
+	cinfo.image_height = img->height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, quality, TRUE);
+	cinfo.optimize_coding = TRUE;
+
+	jpeg_start_compress(&cinfo, TRUE);
+
+	while (cinfo.next_scanline < cinfo.image_height) {
+		row = img->pixels + (size_t)cinfo.next_scanline * img->width * 3;
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+
+	return 0;
+}
+
+// thumb_write : writes 'len' bytes to 'path' (relative to the image directory), through a temp file
+static int thumb_write(char *path, u8 *buf, size_t len)
+{
+	char tmppath[BUFLARGE];
+	char fullpath[BUFLARGE];
+	ssize_t rc;
+	size_t n;
+	int fd;
+
+	snprintf(tmppath, sizeof tmppath, "%s/tmp/XXXXXX", IMAGE_DIR);
+	snprintf(fullpath, sizeof fullpath, "%s/%s", IMAGE_DIR, path);
+
+	fd = mkstemp(tmppath);
+	if (fd < 0) {
+		ERR("couldn't make a temp file for a thumbnail: %s\n", strerror(errno));
+		return -1;
+	}
+
+	fchmod(fd, 0644);
+
+	for (n = 0; n < len; n += rc) {
+		rc = write(fd, buf + n, len - n);
+		if (rc < 0 && errno == EINTR) {
+			rc = 0;
+			continue;
+		}
+
+		if (rc < 0) {
+			break;
+		}
+	}
+
+	// same as the originals, it's on the disk before there's a row that says it is
+	if (n < len || fsync(fd) < 0 || rename(tmppath, fullpath) < 0) {
+		ERR("couldn't write the thumbnail '%s': %s\n", fullpath, strerror(errno));
+		close(fd);
+		unlink(tmppath);
+		return -1;
+	}
+
+	close(fd);
+
+	return 0;
+}
+
+// thumb_jpeg_error : libjpeg error_exit, logs the error, and jumps back out of the library
+static void thumb_jpeg_error(j_common_ptr cinfo)
+{
+	ThumbJpegError *jerr = (ThumbJpegError *)cinfo->err;
+	char msg[JMSG_LENGTH_MAX];
+
+	(*cinfo->err->format_message)(cinfo, msg);
+
+	ERR("libjpeg: %s\n", msg);
+
+	longjmp(jerr->jmp, 1);
+}
@@ -0,0 +1,18 @@
+#ifndef THUMB_H
+#define THUMB_H
+
+// Brian Chrzanowski
+// 2026-10-17 20:05:13
+
+#include "common.h"
+
+// thumb_init : starts the thumbnail thread, which catches up on anything that's waiting right away
+int thumb_init(char *fname, char *dir);
+
+// thumb_wake : tells the thumbnail thread there's a new image (after the row's been committed)
+void thumb_wake();
+
+// thumb_free : stops the thumbnail thread, after the image it's on
+void thumb_free();
+
+#endif // THUMB_H
@@ -0,0 +1,774 @@
+// Brian Chrzanowski
+// 2026-10-18 02:41:17
+//
+// Signed Session Tokens
+//
+// The other kind of session ('-s'). Instead of a random token that's looked up in session.c's table,
+// the cookie carries everything itself, and checking it is one MAC, with nothing to look up:
+//
+//   version (1) | key epoch (4) | expires, ms (8) | user id (16) | crypto_auth of the rest (32)
+//
+// which is TOKEN_SIZE bytes, and TOKEN_LEN in base64url.
+//
+//   - the keys are numbered (epochs), and a new one is made every TOKEN_ROTATE_MS. New tokens are
+//     signed with the newest one, and a token is only good while the key it names is still around,
+//     which is SESSION_TTL_MS + TOKEN_ROTATE_MS (long enough for anything it signed to run out).
+//     They're in the session_keys table, so a restart doesn't log everyone out. Deleting that table
+//     is how you log *everyone* out.
+//
+//   - logging out can't take a token back, so the MACs of the ones that were logged out go in the
+//     session_revoked table until they'd have run out anyway, and in a bloom filter in memory. A token
+//     that isn't in the filter (nearly all of them) is good without asking the database, one that is
+//     gets checked against the table (so a false positive costs a query, and never a logout). Like
+//     session.c, a logout doesn't wait on the disk: it's in the filter, and a pending list, right
+//     away, and token_flush writes the list out on the next tick (and only then takes them off it).
+//
+// NOTE (Brian) TOKEN_BLOOM_BITS is 8KiB, with TOKEN_BLOOM_K hashes that's about 1 in 100k false
+// positives at 1000 logouts in the last two weeks, and about 1 in 25 at 10k. If this ever gets that
+// many logouts, make it bigger.
+//
+// NOTE (Brian) crypto_auth is HMAC-SHA512-256, which hashes the key (padded out to a block) twice
+// before it gets to the message, every time. The token's only 29 bytes, so that was most of the cost
+// of a verify. Each key keeps its HMAC state from right after that instead, and a verify starts from
+// a copy of it, which is the same MAC for a third of the work (bench/verify).
+//
+// NOTE (Brian) the keys and the filter are behind one rwlock. Verifying takes it shared. Rotating, a
+// logout, and rebuilding the filter take it exclusive, and none of them touch the disk while they
+// hold it, except the rebuild, which is a read of a small table.
+
+#include "common.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#include <sodium.h>
+#include <jansson.h>
+
+#include "sqlite3.h"
+
+#include "objects.h"
+#include "session.h"
+#include "token.h"
+
+#define TOKEN_KEYS (8) // slots, by epoch, only (SESSION_TTL_MS / TOKEN_ROTATE_MS) + 2 are ever used
+
+extern __thread sqlite3 *DATABASE;
+
+// TokenKey: one signing key
+typedef struct TokenKey {
+	u32 epoch;
+	int live;
+	i64 created;
+	u8 key[crypto_auth_KEYBYTES];
+	crypto_auth_hmacsha512256_state state; // already keyed, see above
+} TokenKey;
+
+// TokenRevocation: a logout that hasn't been written to session_revoked yet
+typedef struct TokenRevocation {
+	u8 mac[crypto_auth_BYTES];
+	i64 expires;
+} TokenRevocation;
+
+static pthread_rwlock_t LOCK = PTHREAD_RWLOCK_INITIALIZER;
+static TokenKey KEYS[TOKEN_KEYS];
+static u32 EPOCH = 0; // the newest key, what new tokens are signed with
+static u64 BLOOM[TOKEN_BLOOM_BITS / 64];
+static TokenRevocation *PENDING = NULL; // stb array, revoked, but not in session_revoked yet
+
+static size_t ISSUED = 0;
+static size_t VERIFIED = 0;
+static size_t REJECTED = 0;
+static size_t REVOKED = 0;
+static size_t BLOOM_HITS = 0;
+static size_t BLOOM_FALSE = 0;
+
+// token_now : ms since the epoch (the way the timestamps are stored)
+static i64 token_now();
+// token_count : bumps one of the counters
+static void token_count(size_t *counter);
+// token_decode : base64url decodes 'token' into 'buf' (TOKEN_SIZE bytes), -1 if it's the wrong shape
+static int token_decode(char *token, size_t len, u8 *buf);
+// token_b64 : the 6 bits that base64url character 'c' stands for, -1 if it isn't one
+static int token_b64(char c);
+// token_mac : writes the MAC for the body of 'buf' with 'key' into 'mac' (lock held)
+static void token_mac(TokenKey *key, u8 *buf, u8 *mac);
+// token_check : 1 if the MAC on 'buf' is right for the key it names, and the key is still around (lock held)
+static int token_check(u8 *buf);
+// token_rotate : makes a new key, saves it, and starts signing with it
+static int token_rotate(i64 now);
+// token_retire : forgets the keys that are too old to have signed anything that hasn't run out
+static void token_retire(i64 now);
+// token_bloom_bit : the 'i'th bit in the filter for 'mac'
+static u32 token_bloom_bit(u8 *mac, int i);
+// token_bloom_add : adds 'mac' to the filter (lock held)
+static void token_bloom_add(u8 *mac);
+// token_bloom_test : 1 if 'mac' might be in the filter (lock held)
+static int token_bloom_test(u8 *mac);
+// token_bloom_load : rebuilds the filter from the session_revoked table
+static int token_bloom_load();
+// token_is_revoked : 1 if 'mac' is pending, or in the session_revoked table (what a bloom hit costs)
+static int token_is_revoked(u8 *mac);
+// token_uuid_parse : 16 bytes from the uuid string 'id'
+static int token_uuid_parse(u8 *out, char *id);
+// token_uuid_format : the uuid string for 16 bytes
+static void token_uuid_format(char *out, size_t len, u8 *in);
+// token_put32 : writes 'v' to 'p' little endian
+static void token_put32(u8 *p, u32 v);
+// token_get32 : reads a little endian u32 from 'p'
+static u32 token_get32(u8 *p);
+// token_put64 : writes 'v' to 'p' little endian
+static void token_put64(u8 *p, u64 v);
+// token_get64 : reads a little endian u64 from 'p'
+static u64 token_get64(u8 *p);
+
+// token_init : loads the signing keys (making one if there aren't any, or if it's time), and the revocations
+int token_init()
+{
+	struct sqlite3_stmt *stmt;
+	i64 now = token_now();
+	size_t loaded = 0;
+
+	stmt = db_stmt_get("session_keys", "load",
+		"select epoch, key, create_ts from %s where create_ts > ? order by epoch;");
+	if (stmt == NULL) {
+		return -1;
+	}
+
+	sqlite3_bind_int64(stmt, 1, now - (SESSION_TTL_MS + TOKEN_ROTATE_MS));
+
+	pthread_rwlock_wrlock(&LOCK);
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		if (sqlite3_column_bytes(stmt, 1) != crypto_auth_KEYBYTES) {
+			continue;
+		}
+
+		TokenKey *key = &KEYS[(u32)sqlite3_column_int64(stmt, 0) % TOKEN_KEYS];
+
+		key->epoch = (u32)sqlite3_column_int64(stmt, 0);
+		key->live = true;
+		key->created = sqlite3_column_int64(stmt, 2);
+		memcpy(key->key, sqlite3_column_blob(stmt, 1), crypto_auth_KEYBYTES);
+		crypto_auth_hmacsha512256_init(&key->state, key->key, sizeof key->key);
+
+		EPOCH = key->epoch;
+		loaded++;
+	}
+
+	pthread_rwlock_unlock(&LOCK);
+
+	db_stmt_release(stmt);
+
+	// the epochs keep counting up from the newest one that was ever made, even if it's been retired
+	if (loaded == 0) {
+		stmt = db_stmt_get("session_keys", "newest", "select coalesce(max(epoch), 0) from %s;");
+		if (stmt == NULL) {
+			return -1;
+		}
+
+		if (sqlite3_step(stmt) == SQLITE_ROW) {
+			EPOCH = (u32)sqlite3_column_int64(stmt, 0);
+		}
+
+		db_stmt_release(stmt);
+	}
+
+	if (loaded == 0 || now - KEYS[EPOCH % TOKEN_KEYS].created >= TOKEN_ROTATE_MS) {
+		if (token_rotate(now) < 0) {
+			return -1;
+		}
+	}
+
+	if (token_bloom_load() < 0) {
+		return -1;
+	}
+
+	printf("loaded %zu session keys, signing with epoch %u\n", loaded, EPOCH);
+
+	return 0;
+}
+
+// token_issue : writes a token for user 'id' that runs out at 'expires' (ms since the epoch) into 'token'
+int token_issue(char *id, i64 expires, char *token, size_t len)
+{
+	u8 buf[TOKEN_SIZE];
+	TokenKey *key;
+	int live;
+
+	if (len < TOKEN_LEN + 1) {
+		return -1;
+	}
+
+	buf[0] = TOKEN_VERSION;
+	token_put64(buf + 5, (u64)expires);
+	if (token_uuid_parse(buf + 13, id) < 0) {
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&LOCK);
+
+	key = &KEYS[EPOCH % TOKEN_KEYS];
+	live = key->live;
+
+	token_put32(buf + 1, key->epoch);
+	token_mac(key, buf, buf + TOKEN_BODY_SIZE);
+
+	pthread_rwlock_unlock(&LOCK);
+
+	if (!live) {
+		ERR("there's no key to sign a session with!\n");
+		return -1;
+	}
+
+	sodium_bin2base64(token, len, buf, sizeof buf, sodium_base64_VARIANT_URLSAFE_NO_PADDING);
+
+	token_count(&ISSUED);
+
+	return 0;
+}
+
+// token_verify : 1 if 'token' is signed by a current key, hasn't run out, and wasn't revoked (and fills out 'id' and 'expires'), 0 if not
+int token_verify(char *token, size_t len, char *id, size_t idlen, i64 *expires)
+{
+	u8 buf[TOKEN_SIZE];
+	int ok, maybe = false;
+
+	// NOTE (Brian) this is in the token, and not checked yet, but if it's run out, it doesn't matter
+	// whether it's real
+	if (token_decode(token, len, buf) < 0 || (i64)token_get64(buf + 5) <= token_now()) {
+		token_count(&REJECTED);
+		return false;
+	}
+
+	pthread_rwlock_rdlock(&LOCK);
+
+	ok = token_check(buf);
+	if (ok) {
+		maybe = token_bloom_test(buf + TOKEN_BODY_SIZE);
+	}
+
+	pthread_rwlock_unlock(&LOCK);
+
+	if (!ok) {
+		token_count(&REJECTED);
+		return false;
+	}
+
+	if (maybe) {
+		token_count(&BLOOM_HITS);
+
+		if (token_is_revoked(buf + TOKEN_BODY_SIZE)) {
+			token_count(&REJECTED);
+			return false;
+		}
+
+		token_count(&BLOOM_FALSE);
+	}
+
+	token_uuid_format(id, idlen, buf + 13);
+	*expires = (i64)token_get64(buf + 5);
+
+	token_count(&VERIFIED);
+
+	return true;
+}
+
+// token_revoke : revokes 'token' until it runs out, if it's valid
+int token_revoke(char *token, size_t len)
+{
+	TokenRevocation revocation;
+	u8 buf[TOKEN_SIZE];
+	char id[40];
+
+	// only a token that's good now needs revoking (and anything else would just fill up the table)
+	if (!token_verify(token, len, id, sizeof id, &revocation.expires) || token_decode(token, len, buf) < 0) {
+		return 0;
+	}
+
+	memcpy(revocation.mac, buf + TOKEN_BODY_SIZE, crypto_auth_BYTES);
+
+	pthread_rwlock_wrlock(&LOCK);
+	arrput(PENDING, revocation);
+	token_bloom_add(revocation.mac);
+	pthread_rwlock_unlock(&LOCK);
+
+	token_count(&REVOKED);
+
+	return 0;
+}
+
+// token_flush : writes the pending revocations to session_revoked, in one transaction (from the event loop)
+void token_flush()
+{
+	struct sqlite3_stmt *stmt;
+	TokenRevocation *ops = NULL;
+	ptrdiff_t n;
+	int rc;
+
+	// NOTE (Brian) only the event loop takes them off of PENDING, so the first 'n' are still the
+	// same ones once they're written, whatever got added behind them
+	pthread_rwlock_rdlock(&LOCK);
+	n = arrlen(PENDING);
+	if (n > 0) {
+		memcpy(arraddnptr(ops, n), PENDING, n * sizeof(*ops));
+	}
+	pthread_rwlock_unlock(&LOCK);
+
+	if (n == 0) {
+		return;
+	}
+
+	stmt = db_stmt_get("session_revoked", "insert",
+		"insert or ignore into %s (mac, expires_ts) values (?, ?);");
+	if (stmt == NULL || db_transaction_begin() < 0) {
+		ERR("couldn't write %td revocations out: %s\n", n, sqlite3_errmsg(DATABASE));
+		db_stmt_release(stmt);
+		arrfree(ops);
+		return;
+	}
+
+	for (ptrdiff_t i = 0; i < n; i++) {
+		sqlite3_bind_blob(stmt, 1, ops[i].mac, crypto_auth_BYTES, SQLITE_STATIC);
+		sqlite3_bind_int64(stmt, 2, ops[i].expires);
+
+		rc = sqlite3_step(stmt);
+
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+
+		// same as session_flush, a locked database is another go on the next tick
+		if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+			ERR("couldn't write %td revocations out: %s\n", n, sqlite3_errstr(rc));
+			db_transaction_rollback();
+			db_stmt_release(stmt);
+			arrfree(ops);
+			return;
+		} else if (rc != SQLITE_DONE) {
+			ERR("couldn't revoke a session: %s\n", sqlite3_errstr(rc));
+		}
+	}
+
+	db_stmt_release(stmt);
+
+	if (db_transaction_commit() < 0) {
+		ERR("couldn't write %td revocations out: %s\n", n, sqlite3_errmsg(DATABASE));
+		db_transaction_rollback();
+		arrfree(ops);
+		return;
+	}
+
+	pthread_rwlock_wrlock(&LOCK);
+	arrdeln(PENDING, 0, n);
+	pthread_rwlock_unlock(&LOCK);
+
+	arrfree(ops);
+}
+
+// token_tick : rotates the key if it's time, and drops the revocations that have run out (from the event loop)
+void token_tick()
+{
+	struct sqlite3_stmt *stmt;
+	i64 now = token_now();
+	i64 created;
+	int swept;
+
+	pthread_rwlock_rdlock(&LOCK);
+	created = KEYS[EPOCH % TOKEN_KEYS].created;
+	pthread_rwlock_unlock(&LOCK);
+
+	if (now - created >= TOKEN_ROTATE_MS) {
+		token_rotate(now);
+	}
+
+	token_retire(now);
+
+	stmt = db_stmt_get("session_revoked", "sweep", "delete from %s where expires_ts <= ?;");
+	if (stmt == NULL) {
+		return;
+	}
+
+	sqlite3_bind_int64(stmt, 1, now);
+
+	swept = 0;
+	if (sqlite3_step(stmt) == SQLITE_DONE) {
+		swept = sqlite3_changes(DATABASE);
+	} else {
+		ERR("couldn't sweep the revoked sessions: %s\n", sqlite3_errmsg(DATABASE));
+	}
+
+	db_stmt_release(stmt);
+
+	// a bloom filter can't have things taken out, so it's rebuilt without them
+	if (swept > 0) {
+		token_bloom_load();
+	}
+}
+
+// token_stats : returns a snapshot of the token counters
+TokenStats token_stats()
+{
+	TokenStats stats = {0};
+
+	pthread_rwlock_rdlock(&LOCK);
+	stats.epoch = EPOCH;
+	for (size_t i = 0; i < TOKEN_KEYS; i++) {
+		stats.keys += KEYS[i].live;
+	}
+	pthread_rwlock_unlock(&LOCK);
+
+	stats.issued = __atomic_load_n(&ISSUED, __ATOMIC_RELAXED);
+	stats.verified = __atomic_load_n(&VERIFIED, __ATOMIC_RELAXED);
+	stats.rejected = __atomic_load_n(&REJECTED, __ATOMIC_RELAXED);
+	stats.revoked = __atomic_load_n(&REVOKED, __ATOMIC_RELAXED);
+	stats.bloom_hits = __atomic_load_n(&BLOOM_HITS, __ATOMIC_RELAXED);
+	stats.bloom_false = __atomic_load_n(&BLOOM_FALSE, __ATOMIC_RELAXED);
+
+	return stats;
+}
+
+// token_free : forgets the keys
+void token_free()
+{
+	pthread_rwlock_wrlock(&LOCK);
+	sodium_memzero(KEYS, sizeof KEYS);
+	memset(BLOOM, 0, sizeof BLOOM);
+	EPOCH = 0;
+	arrfree(PENDING);
+	pthread_rwlock_unlock(&LOCK);
+}
+
+// token_now : ms since the epoch (the way the timestamps are stored)
+static i64 token_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (i64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// token_count : bumps one of the counters
+static void token_count(size_t *counter)
+{
+	__atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+// token_decode : base64url decodes 'token' into 'buf' (TOKEN_SIZE bytes), -1 if it's the wrong shape
+static int token_decode(char *token, size_t len, u8 *buf)
+{
+	size_t i, o = 0;
+	int a, b;
+	u32 v;
+
+	// NOTE (Brian) not sodium_base642bin, which is constant time, and as slow as the MAC that comes
+	// after it. Nothing secret goes through here (it's what the client sent us), so it doesn't need to be.
+
+	if (len != TOKEN_LEN) {
+		return -1;
+	}
+
+	for (i = 0; i + 4 <= len; i += 4) {
+		v = 0;
+		for (size_t j = 0; j < 4; j++) {
+			a = token_b64(token[i + j]);
+			if (a < 0) {
+				return -1;
+			}
+			v = v << 6 | a;
+		}
+
+		buf[o++] = v >> 16;
+		buf[o++] = v >> 8;
+		buf[o++] = v;
+	}
+
+	// TOKEN_SIZE is one more than a multiple of 3, so that last byte is two characters (and the last 4
+	// bits of the second one are always 0)
+	a = token_b64(token[i]);
+	b = token_b64(token[i + 1]);
+	if (a < 0 || b < 0 || (b & 0xf) != 0) {
+		return -1;
+	}
+
+	buf[o++] = a << 2 | b >> 4;
+
+	return buf[0] == TOKEN_VERSION ? 0 : -1;
+}
+
+// token_b64 : the 6 bits that base64url character 'c' stands for, -1 if it isn't one
+static int token_b64(char c)
+{
+	if (c >= 'A' && c <= 'Z') {
+		return c - 'A';
+	} else if (c >= 'a' && c <= 'z') {
+		return c - 'a' + 26;
+	} else if (c >= '0' && c <= '9') {
+		return c - '0' + 52;
+	} else if (c == '-') {
+		return 62;
+	} else if (c == '_') {
+		return 63;
+	} else {
+		return -1;
+	}
+}
+
+// token_mac : writes the MAC for the body of 'buf' with 'key' into 'mac' (lock held)
+static void token_mac(TokenKey *key, u8 *buf, u8 *mac)
+{
+	crypto_auth_hmacsha512256_state state = key->state;
+
+	crypto_auth_hmacsha512256_update(&state, buf, TOKEN_BODY_SIZE);
+	crypto_auth_hmacsha512256_final(&state, mac);
+}
+
+// token_check : 1 if the MAC on 'buf' is right for the key it names, and the key is still around (lock held)
+static int token_check(u8 *buf)
+{
+	u32 epoch = token_get32(buf + 1);
+	TokenKey *key = &KEYS[epoch % TOKEN_KEYS];
+
+	u8 mac[crypto_auth_BYTES];
+
+	if (!key->live || key->epoch != epoch) {
+		return false;
+	}
+
+	token_mac(key, buf, mac);
+
+	return sodium_memcmp(mac, buf + TOKEN_BODY_SIZE, sizeof mac) == 0;
+}
+
+// token_rotate : makes a new key, saves it, and starts signing with it
+static int token_rotate(i64 now)
+{
+	struct sqlite3_stmt *stmt;
+	TokenKey key = { .live = true, .created = now };
+	int rc;
+
+	// NOTE (Brian) only the event loop rotates, so EPOCH can't move under us here
+	key.epoch = EPOCH + 1;
+	crypto_auth_keygen(key.key);
+	crypto_auth_hmacsha512256_init(&key.state, key.key, sizeof key.key);
+
+	stmt = db_stmt_get("session_keys", "insert", "insert into %s (epoch, key, create_ts) values (?, ?, ?);");
+	if (stmt == NULL) {
+		sodium_memzero(&key, sizeof key);
+		return -1;
+	}
+
+	sqlite3_bind_int64(stmt, 1, key.epoch);
+	sqlite3_bind_blob(stmt, 2, key.key, sizeof key.key, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 3, key.created);
+
+	rc = sqlite3_step(stmt);
+
+	db_stmt_release(stmt);
+
+	if (rc != SQLITE_DONE) {
+		ERR("couldn't save a new session key: %s\n", sqlite3_errmsg(DATABASE));
+		sodium_memzero(&key, sizeof key);
+		return -1;
+	}
+
+	pthread_rwlock_wrlock(&LOCK);
+	KEYS[key.epoch % TOKEN_KEYS] = key;
+	EPOCH = key.epoch;
+	pthread_rwlock_unlock(&LOCK);
+
+	sodium_memzero(&key, sizeof key);
+
+	return 0;
+}
+
+// token_retire : forgets the keys that are too old to have signed anything that hasn't run out
+static void token_retire(i64 now)
+{
+	struct sqlite3_stmt *stmt;
+	i64 cutoff = now - (SESSION_TTL_MS + TOKEN_ROTATE_MS);
+
+	pthread_rwlock_wrlock(&LOCK);
+
+	for (size_t i = 0; i < TOKEN_KEYS; i++) {
+		if (KEYS[i].live && KEYS[i].epoch != EPOCH && KEYS[i].created <= cutoff) {
+			sodium_memzero(&KEYS[i], sizeof KEYS[i]);
+		}
+	}
+
+	pthread_rwlock_unlock(&LOCK);
+
+	stmt = db_stmt_get("session_keys", "retire", "delete from %s where create_ts <= ? and epoch != ?;");
+	if (stmt == NULL) {
+		return;
+	}
+
+	sqlite3_bind_int64(stmt, 1, cutoff);
+	sqlite3_bind_int64(stmt, 2, EPOCH);
+
+	if (sqlite3_step(stmt) != SQLITE_DONE) {
+		ERR("couldn't retire the old session keys: %s\n", sqlite3_errmsg(DATABASE));
+	}
+
+	db_stmt_release(stmt);
+}
+
+// token_bloom_bit : the 'i'th bit in the filter for 'mac'
+static u32 token_bloom_bit(u8 *mac, int i)
+{
+	// the MAC is already as random as it gets (and nobody without the key can pick one), so the bits
+	// are just pieces of it
+	return (mac[i * 2] | (u32)mac[i * 2 + 1] << 8) & (TOKEN_BLOOM_BITS - 1);
+}
+
+// token_bloom_add : adds 'mac' to the filter (lock held)
+static void token_bloom_add(u8 *mac)
+{
+	for (int i = 0; i < TOKEN_BLOOM_K; i++) {
+		u32 bit = token_bloom_bit(mac, i);
+		BLOOM[bit / 64] |= 1ULL << (bit % 64);
+	}
+}
+
+// token_bloom_test : 1 if 'mac' might be in the filter (lock held)
+static int token_bloom_test(u8 *mac)
+{
+	for (int i = 0; i < TOKEN_BLOOM_K; i++) {
+		u32 bit = token_bloom_bit(mac, i);
+		if ((BLOOM[bit / 64] & (1ULL << (bit % 64))) == 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// token_bloom_load : rebuilds the filter from the session_revoked table
+static int token_bloom_load()
+{
+	struct sqlite3_stmt *stmt;
+
+	stmt = db_stmt_get("session_revoked", "load", "select mac from %s where expires_ts > ?;");
+	if (stmt == NULL) {
+		return -1;
+	}
+
+	sqlite3_bind_int64(stmt, 1, token_now());
+
+	pthread_rwlock_wrlock(&LOCK);
+
+	memset(BLOOM, 0, sizeof BLOOM);
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		if (sqlite3_column_bytes(stmt, 0) == crypto_auth_BYTES) {
+			token_bloom_add((u8 *)sqlite3_column_blob(stmt, 0));
+		}
+	}
+
+	// and the ones that aren't in the table yet
+	for (ptrdiff_t i = 0; i < arrlen(PENDING); i++) {
+		token_bloom_add(PENDING[i].mac);
+	}
+
+	pthread_rwlock_unlock(&LOCK);
+
+	db_stmt_release(stmt);
+
+	return 0;
+}
+
+// token_is_revoked : 1 if 'mac' is pending, or in the session_revoked table (what a bloom hit costs)
+static int token_is_revoked(u8 *mac)
+{
+	struct sqlite3_stmt *stmt;
+	int revoked = false;
+
+	pthread_rwlock_rdlock(&LOCK);
+	for (ptrdiff_t i = 0; !revoked && i < arrlen(PENDING); i++) {
+		revoked = memcmp(PENDING[i].mac, mac, crypto_auth_BYTES) == 0;
+	}
+	pthread_rwlock_unlock(&LOCK);
+
+	if (revoked) {
+		return true;
+	}
+
+	stmt = db_stmt_get("session_revoked", "find", "select 1 from %s where mac = ?;");
+	if (stmt == NULL) {
+		return true; // if we can't tell, it's safer to turn it away
+	}
+
+	sqlite3_bind_blob(stmt, 1, mac, crypto_auth_BYTES, SQLITE_STATIC);
+
+	revoked = sqlite3_step(stmt) == SQLITE_ROW;
+
+	db_stmt_release(stmt);
+
+	return revoked;
+}
+
+// token_uuid_parse : 16 bytes from the uuid string 'id'
+static int token_uuid_parse(u8 *out, char *id)
+{
+	size_t n;
+
+	if (sodium_hex2bin(out, 16, id, strlen(id), "-", &n, NULL) != 0 || n != 16) {
+		return -1;
+	}
+
+	return 0;
+}
+
+// token_uuid_format : the uuid string for 16 bytes
+static void token_uuid_format(char *out, size_t len, u8 *in)
+{
+	static const char digits[] = "0123456789abcdef";
+	size_t o = 0;
+
+	if (len < 37) {
+		return;
+	}
+
+	for (size_t i = 0; i < 16; i++) {
+		if (i == 4 || i == 6 || i == 8 || i == 10) {
+			out[o++] = '-';
+		}
+		out[o++] = digits[in[i] >> 4];
+		out[o++] = digits[in[i] & 0xf];
+	}
+
+	out[o] = '\0';
+}
+
+// token_put32 : writes 'v' to 'p' little endian
+static void token_put32(u8 *p, u32 v)
+{
+	for (int i = 0; i < 4; i++) {
+		p[i] = v >> (i * 8);
+	}
+}
+
+// token_get32 : reads a little endian u32 from 'p'
+static u32 token_get32(u8 *p)
+{
+	u32 v = 0;
+	for (int i = 0; i < 4; i++) {
+		v |= (u32)p[i] << (i * 8);
+	}
+	return v;
+}
+
+// token_put64 : writes 'v' to 'p' little endian
+static void token_put64(u8 *p, u64 v)
+{
+	for (int i = 0; i < 8; i++) {
+		p[i] = v >> (i * 8);
+	}
+}
+
+// token_get64 : reads a little endian u64 from 'p'
+static u64 token_get64(u8 *p)
+{
+	u64 v = 0;
+	for (int i = 0; i < 8; i++) {
+		v |= (u64)p[i] << (i * 8);
+	}
+	return v;
+}
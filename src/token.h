@@ -0,0 +1,48 @@
+#ifndef TOKEN_H
+#define TOKEN_H
+
+// Brian Chrzanowski
+// 2026-10-18 02:41:17
+
+#include "common.h"
+
+#include <sodium.h>
+
+#define TOKEN_VERSION    (1)
+#define TOKEN_BODY_SIZE  (1 + 4 + 8 + 16) // version, epoch, expires, user id
+#define TOKEN_SIZE       (TOKEN_BODY_SIZE + crypto_auth_BYTES)
+#define TOKEN_LEN        (82) // TOKEN_SIZE in base64url, without the padding
+#define TOKEN_ROTATE_MS  (7LL * 24 * 60 * 60 * 1000)
+#define TOKEN_BLOOM_BITS (1 << 16)
+#define TOKEN_BLOOM_K    (4)
+
+// TokenStats: counters for the signed tokens
+typedef struct TokenStats {
+	u32 epoch;
+	size_t keys;
+	size_t issued;
+	size_t verified;
+	size_t rejected;
+	size_t revoked;
+	size_t bloom_hits;
+	size_t bloom_false; // bloom hits that weren't actually revoked
+} TokenStats;
+
+// token_init : loads the signing keys (making one if there aren't any, or if it's time), and the revocations
+int token_init();
+// token_issue : writes a token for user 'id' that runs out at 'expires' (ms since the epoch) into 'token'
+int token_issue(char *id, i64 expires, char *token, size_t len);
+// token_verify : 1 if 'token' is signed by a current key, hasn't run out, and wasn't revoked (and fills out 'id' and 'expires'), 0 if not
+int token_verify(char *token, size_t len, char *id, size_t idlen, i64 *expires);
+// token_revoke : revokes 'token' until it runs out, if it's valid
+int token_revoke(char *token, size_t len);
+// token_flush : writes the pending revocations to session_revoked, in one transaction (from the event loop)
+void token_flush();
+// token_tick : rotates the key if it's time, and drops the revocations that have run out (from the event loop)
+void token_tick();
+// token_stats : returns a snapshot of the token counters
+TokenStats token_stats();
+// token_free : forgets the keys
+void token_free();
+
+#endif // TOKEN_H
@@ -5,16 +5,25 @@
 
 #include "common.h"
 
+#include <pthread.h>
+
 #include "mongoose.h"
 
 #include <sodium.h>
 #include <jansson.h>
 
+#include "sqlite3.h"
+
 #include "user.h"
 #include "objects.h"
+#include "session.h"
 
 #define COOKIE_KEY ("session")
-#define COOKIE_LEN (32)
+
+// USER_TAKEN: newuser_add's return value when someone already has that username
+#define USER_TAKEN (-2)
+
+extern __thread sqlite3 *DATABASE;
 
 // newuser_verify : returns true if the new user record is valid
 int newuser_verify(UI_NewUser *newuser);
@@ -22,11 +31,23 @@ int newuser_verify(UI_NewUser *newuser);
 // newuser_from_json : converts a JSON string into a NewUser object
 UI_NewUser *newuser_from_json(char *json);
 
-// user_from_session : takes the cookie, scans the user session table, returns user_id
-struct user_t *user_from_session(char *cookie);
+// user_from_session : copies the session for the cookie on 'hm' into 'session', 1 if there is one
+int user_from_session(struct mg_http_message *hm, Session *session);
+
+// user_names : fills out the username and email on 'session' from its id, for the signed ones that don't carry them
+int user_names(Session *session);
 
-// newuser_add : adds the new user into the user table
-int newuser_add(UI_NewUser *newuser);
+// newuser_add : adds the new user into the user table, and writes their id into 'id'
+int newuser_add(UI_NewUser *newuser, char *id, size_t len);
+
+// login_from_json : converts a JSON string into a Login object
+UI_Login *login_from_json(char *json);
+
+// login_verify : 1 if the login's password is right (and fills out 'session' for them), 0 if it isn't
+int login_verify(UI_Login *login, Session *session);
+
+// login_free : frees the login
+void login_free(UI_Login *login);
 
 // newuser_free : frees the new user 
 void newuser_free(UI_NewUser *newuser);
@@ -34,21 +55,21 @@ void newuser_free(UI_NewUser *newuser);
 // whoami_free : frees the strings and children, does not free this structure
 void whoami_free(UI_WhoAmI *who);
 
-// user_set_cookie : write the header to set the user cookie in 's'
-int user_set_cookie(char *s, char *id, size_t len);
-
-// user_to_whoami : converts a user structure to a whoami structure
-UI_WhoAmI *user_to_whoami(struct user_t *user);
+// user_set_cookie : write the header to set the user cookie to 'token' in 's' (NULL clears it)
+int user_set_cookie(char *s, char *token, size_t len);
 
 // whoami_to_json : converts a WhoAmI structure to a json blob
 char *whoami_to_json(UI_WhoAmI *who);
 
 // user_api_newuser: endpoint, POST - /api/v1/newuser
-int user_api_newuser(struct mg_connection *conn, struct mg_http_message *hm)
+int user_api_newuser(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
 {
 	UI_NewUser *user;
+	Session session = {0};
 	char *json;
+	char token[BUFSMALL];
 	char cookie[BUFLARGE];
+	int rc;
 
 	json = strndup(hm->body.ptr, hm->body.len);
 	if (json == NULL) { // return http error
@@ -57,104 +78,185 @@ int user_api_newuser(struct mg_connection *conn, struct mg_http_message *hm)
 	}
 
 	user = newuser_from_json(json);
-	if (user == NULL) {
-		ERR("couldn't convert body into a newuser record\n");
-		return -1;
-	}
 
 	free(json);
 
-	if (newuser_verify(user) < 0) {
-		ERR("user record invalid!\n");
+	if (user == NULL || !newuser_verify(user)) {
+		mg_http_reply(conn, 400, NULL, "");
 		newuser_free(user);
-		return -1;
+		return 0;
 	}
 
-	int rc = newuser_add(user);
-	if (rc < 0) {
+	rc = newuser_add(user, session.id, sizeof session.id);
+
+	snprintf(session.username, sizeof session.username, "%s", user->username);
+	snprintf(session.email, sizeof session.email, "%s", user->email);
+
+	newuser_free(user);
+
+	if (rc == USER_TAKEN) {
+		mg_http_reply(conn, 409, NULL, "");
+		return 0;
+	} else if (rc < 0) {
 		ERR("couldn't save the user to the disk!\n");
-		newuser_free(user);
 		return -1;
 	}
 
-	// TODO (Brian): set the user cookie here to whatever's in the user session
-	// NOT IMPLEMENTED
-#if 0
-	user_set_cookie(cookie, id, sizeof cookie);
+	// and they're logged in
+	if (session_create(&session, token, sizeof token) < 0) {
+		return -1;
+	}
 
-	mg_http_reply(conn, 200, cookie, "{\"id\":%lld}", id);
-#endif
+	user_set_cookie(cookie, token, sizeof cookie);
 
-	newuser_free(user);
+	mg_http_reply(conn, 201, cookie, "{\"id\":\"%s\"}", session.id);
 
 	return 0;
 }
 
 // user_api_login: endpoint, POST - /api/v1/user/login
-int user_api_login(struct mg_connection *conn, struct mg_http_message *hm)
+int user_api_login(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
 {
+	UI_Login *login;
+	Session session = {0};
+	char *json;
+	char token[BUFSMALL];
+	char cookie[BUFLARGE];
+	int rc;
+
+	json = strndup(hm->body.ptr, hm->body.len);
+	if (json == NULL) {
+		return -1;
+	}
+
+	login = login_from_json(json);
+
+	free(json);
+
+	if (login == NULL) {
+		mg_http_reply(conn, 400, NULL, "");
+		return 0;
+	}
+
+	rc = login_verify(login, &session);
+
+	login_free(login);
+
+	if (rc < 0) {
+		return -1;
+	} else if (rc == 0) {
+		mg_http_reply(conn, 401, NULL, "");
+		return 0;
+	}
+
+	if (session_create(&session, token, sizeof token) < 0) {
+		return -1;
+	}
+
+	user_set_cookie(cookie, token, sizeof cookie);
+
+	mg_http_reply(conn, 200, cookie, "{\"id\":\"%s\"}", session.id);
+
 	return 0;
 }
 
 // user_api_logout: endpoint, POST - /api/v1/user/logout
-int user_api_logout(struct mg_connection *conn, struct mg_http_message *hm)
+int user_api_logout(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
 {
+	struct mg_str *header;
+	struct mg_str token;
+	char cookie[BUFLARGE];
+
+	header = mg_http_get_header(hm, "Cookie");
+	if (header != NULL) {
+		token = mg_http_get_header_var(*header, mg_str(COOKIE_KEY));
+		session_delete((char *)token.ptr, token.len);
+	}
+
+	user_set_cookie(cookie, NULL, sizeof cookie);
+
+	mg_http_reply(conn, 200, cookie, "");
+
 	return 0;
 }
 
 // user_api_whoami: endpoint, /api/v1/user/whoami
-int user_api_whoami(struct mg_connection *conn, struct mg_http_message *hm)
+int user_api_whoami(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params)
 {
-	UI_WhoAmI *who;
-	struct user_t *user;
-	struct mg_str *mg_cookie;
-	struct mg_str token;
-	char *cookie;
+	Session session;
+	UI_WhoAmI who;
 	char *json;
 
-	mg_cookie = mg_http_get_header(hm, "Cookie");
-	if (mg_cookie == NULL) {
-		return -1; // cookie must be present
+	// NOTE (Brian) with table sessions, this never touches the database, the session has everything
+	// (see session.c). A signed one only has the id, so that's one lookup, by primary key.
+	if (!user_from_session(hm, &session)) {
+		mg_http_reply(conn, 401, NULL, "");
+		return 0;
 	}
 
-	token = mg_http_get_header_var(*mg_cookie, mg_str("session"));
-	cookie = strndup(token.ptr, token.len);
-
-	user = user_from_session(cookie);
-	if (user == NULL) {
-		free(cookie);
-		return -1;
+	if (session.username[0] == '\0' && user_names(&session) <= 0) {
+		mg_http_reply(conn, 401, NULL, "");
+		return 0;
 	}
 
-	who = user_to_whoami(user);
-	if (user == NULL) {
-		free(cookie);
+	who.id = session.id;
+	who.username = session.username;
+	who.email = session.email;
+
+	json = whoami_to_json(&who);
+	if (json == NULL) {
 		return -1;
 	}
 
-	json = whoami_to_json(who);
+	mg_http_reply(conn, 200, NULL, "%s", json);
 
-	mg_http_reply(conn, 200, NULL, json);
-
-	whoami_free(who);
-	free(cookie);
 	free(json);
 
 	return 0;
 }
 
-// user_to_whoami : converts a user structure to a whoami structure
-UI_WhoAmI *user_to_whoami(struct user_t *user)
+// user_from_session : copies the session for the cookie on 'hm' into 'session', 1 if there is one
+int user_from_session(struct mg_http_message *hm, Session *session)
 {
-	// NOT IMPLEMENTED (Brian)
-	return NULL;
+	struct mg_str *header;
+	struct mg_str token;
+
+	header = mg_http_get_header(hm, "Cookie");
+	if (header == NULL) {
+		return false;
+	}
+
+	token = mg_http_get_header_var(*header, mg_str(COOKIE_KEY));
+	if (token.ptr == NULL) {
+		return false;
+	}
+
+	return session_lookup((char *)token.ptr, token.len, session);
 }
 
-// user_from_session : takes the cookie, scans the user session table, returns user_id
-struct user_t *user_from_session(char *cookie)
+// user_names : fills out the username and email on 'session' from its id, for the signed ones that don't carry them
+int user_names(Session *session)
 {
-	// NOT IMPLEMENTED (Brian)
-	return NULL;
+	struct sqlite3_stmt *stmt;
+	int found;
+
+	stmt = db_stmt_get("users", "names",
+		"select username, email from %s where id = uuid_blob(?) and delete_ts is null;");
+	if (stmt == NULL) {
+		return -1;
+	}
+
+	sqlite3_bind_text(stmt, 1, session->id, -1, NULL);
+
+	found = sqlite3_step(stmt) == SQLITE_ROW;
+	if (found) {
+		snprintf(session->username, sizeof session->username, "%s", sqlite3_column_text(stmt, 0));
+		snprintf(session->email, sizeof session->email, "%s", sqlite3_column_text(stmt, 1));
+	}
+
+	db_stmt_release(stmt);
+
+	return found;
 }
 
 // newuser_verify : returns false if the newuser doesn't pass validation
@@ -186,124 +288,113 @@ int newuser_verify(UI_NewUser *newuser)
 	return 1;
 }
 
-// newuser_add : adds the new user into the user table
-int newuser_add(UI_NewUser *newuser)
+// newuser_add : adds the new user into the user table, and writes their id into 'id'
+int newuser_add(UI_NewUser *newuser, char *id, size_t len)
 {
-	// NOT IMPLEMENTED
-	return -1;
-#if 0
-	user_t *user_record;
+	struct sqlite3_stmt *stmt;
+	char hash[crypto_pwhash_STRBYTES];
 	int rc;
 
-	string_128_t *username;
-	string_128_t *email;
-	string_128_t *password;
-	string_128_t *salt;
-	string_128_t *session_secret;
-
-	unsigned char tbuf[BUFSMALL];
-
-	// NOTE (Brian): There's a lot that's going on in here, and I hope I can convey it all to you
-	// (me).
-	//
-	// First, clearly, we store the username and email address in plain text. I feel like there's a
-	// universe where you may be able to hash those, but I'm not sure. Especially if you want to put
-	// who created the recipe with the recipe, that begins to be kind of hard.
-	//
-	// After those are stored, we have to deal with the user's password.
-	//
-	// To adequately handle this with our crypto library, look at this page:
-	//
-	//     https://doc.libsodium.org/password_hashing
-	//
-	// To store a User record, you must
+	// NOTE (Brian) crypto_pwhash_str does all of the salt business from the old notes here: it picks
+	// a random salt, and the string it hands back has the salt, the algorithm, and the limits in it,
+	// along with the hash. So, that string is all that's needed to check a password later, even
+	// after the limits change. The 'salt' column is from before that, and stays empty.
 	//
-	//     - generate random bytes to be used as the salt
-	//     - take the salt and the user's plaintext password and derive a key
-	//     - store the key
-	//
-	// You can use the entered password, the key, and the salt to determine if the password is
-	// what's in the key, later (?).
-	//
-	// So, here, we generate the secret, and hash the password to be used as the key for later.
-	//
-	// However, once we've done that, we need to also add a UserSession record for the user.
-	// As of now, we use the OBJECT_FLAG_LOCKED flag on the usersession_t object to denote if the
-	// user's session is used.
-	//
-	// FURTHER NOTES
-	//
-	// The documentation for libsodium suggests to store all of the parameters for crypto_pwhash
-	// together.
+	// This is the expensive part (USER_PWHASH_MEMLIMIT of memory, and tens of milliseconds), which
+	// is why this only ever runs on a WORKER_PWHASH thread.
+	if (crypto_pwhash_str(hash, newuser->password, strlen(newuser->password),
+			USER_PWHASH_OPSLIMIT, USER_PWHASH_MEMLIMIT) != 0) {
+		ERR("couldn't hash the password (out of memory?)\n");
+		return -1;
+	}
 
-	user_record = store_addobj(RT_USER);
+	stmt = db_stmt_get("users", "insert",
+		"insert into %s (username, email, password, salt) values (?, ?, ?, '') returning uuid_str(id);");
+	if (stmt == NULL) {
+		return -1;
+	}
 
-	username = store_addobj(RT_STRING128);
-	strncpy(username->string, newuser->username, sizeof(username->string));
-	user_record->username = username->base.id;
+	sqlite3_bind_text(stmt, 1, newuser->username, -1, NULL);
+	sqlite3_bind_text(stmt, 2, newuser->email, -1, NULL);
+	sqlite3_bind_text(stmt, 3, hash, -1, NULL);
+
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW) {
+		snprintf(id, len, "%s", sqlite3_column_text(stmt, 0));
+		rc = 0;
+	} else if (rc == SQLITE_CONSTRAINT) {
+		rc = USER_TAKEN; // users_username
+	} else {
+		ERR("couldn't insert the user: %s\n", sqlite3_errmsg(DATABASE));
+		rc = -1;
+	}
 
-	email = store_addobj(RT_STRING128);
-	strncpy(email->string, newuser->email, sizeof(email->string));
-	user_record->email = email->base.id;
+	db_stmt_release(stmt);
 
-	// REMOVE ME
-	assert(sizeof(salt->string) <= crypto_pwhash_STRBYTES);
+	sodium_memzero(hash, sizeof hash);
 
-	password = store_addobj(RT_STRING128);
-	user_record->password = password->base.id;
+	return rc;
+}
 
-	salt = store_addobj(RT_STRING128);
-	randombytes_buf(salt->string, sizeof(salt->string));
-	user_record->salt = salt->base.id;
+// what login_verify checks the password against, when there's no such user
+static char LOGIN_DUMMY[crypto_pwhash_STRBYTES];
+static pthread_once_t LOGIN_DUMMY_ONCE = PTHREAD_ONCE_INIT;
 
-	rc = crypto_pwhash(
-		(unsigned char *)password->string, sizeof(password->string),
-		newuser->password, strlen(newuser->password),
-		(unsigned char *)salt->string,
-		crypto_pwhash_OPSLIMIT_INTERACTIVE,
-		crypto_pwhash_MEMLIMIT_INTERACTIVE,
-		crypto_pwhash_ALG_DEFAULT
-		);
+// login_dummy_init : hashes a random password into LOGIN_DUMMY (pthread_once)
+static void login_dummy_init()
+{
+	char password[32];
 
-	// TODO (Brian): replace with an 'if' that returns some kind of server error
-	assert(rc == 0);
+	randombytes_buf(password, sizeof password);
 
-	randombytes_buf(tbuf, COOKIE_LEN);
+	if (crypto_pwhash_str(LOGIN_DUMMY, password, sizeof password, USER_PWHASH_OPSLIMIT, USER_PWHASH_MEMLIMIT) != 0) {
+		ERR("couldn't hash the dummy password!\n");
+	}
+}
 
-	session_secret = store_addobj(RT_STRING128);
-	user_record->session_secret = session_secret->base.id;
+// login_verify : 1 if the login's password is right (and fills out 'session' for them), 0 if it isn't
+int login_verify(UI_Login *login, Session *session)
+{
+	struct sqlite3_stmt *stmt;
+	char hash[crypto_pwhash_STRBYTES];
+	int found;
+	int rc;
 
-	sodium_bin2base64(session_secret->string, sizeof(session_secret->string),
-		tbuf, COOKIE_LEN, sodium_base64_VARIANT_URLSAFE_NO_PADDING);
+	stmt = db_stmt_get("users", "login",
+		"select uuid_str(id), password, username, email from %s where username = ? and delete_ts is null;");
+	if (stmt == NULL) {
+		return -1;
+	}
 
-	return user_record->base.id;
-#endif
-}
+	sqlite3_bind_text(stmt, 1, login->username, -1, NULL);
 
-// user_set_cookie : write the header to set the user cookie in 's'
-int user_set_cookie(char *s, char *id, size_t len)
-{
-	// NOT IMPLEMENTED (Brian)
-	return -1;
-#if 0
-	user_t *user;
-	string_128_t *secret;
-	string_128_id secret_id;
-
-	user = store_getobj(RT_USER, id);
-	if (user == NULL) {
-		return 0;
+	found = sqlite3_step(stmt) == SQLITE_ROW;
+	if (found) {
+		snprintf(session->id, sizeof session->id, "%s", sqlite3_column_text(stmt, 0));
+		snprintf(hash, sizeof hash, "%s", sqlite3_column_text(stmt, 1));
+		snprintf(session->username, sizeof session->username, "%s", sqlite3_column_text(stmt, 2));
+		snprintf(session->email, sizeof session->email, "%s", sqlite3_column_text(stmt, 3));
 	}
 
-	secret_id = user->session_secret;
+	db_stmt_release(stmt);
 
-	secret = store_getobj(RT_STRING128, secret_id);
-	if (secret == NULL) {
-		return 0;
+	// NOTE (Brian) a username that doesn't exist still costs a hash, otherwise how long the login
+	// takes says whether or not it does
+	if (!found) {
+		pthread_once(&LOGIN_DUMMY_ONCE, login_dummy_init);
+		memcpy(hash, LOGIN_DUMMY, sizeof hash);
 	}
 
-	return snprintf(s, len, "Set-Cookie: %s=%s; SameSite=Strict; HttpOnly\r\n", COOKIE_KEY, secret->string);
-#endif
+	rc = crypto_pwhash_str_verify(hash, login->password, strlen(login->password)) == 0;
+
+	return found && rc;
+}
+
+// user_set_cookie : write the header to set the user cookie to 'token' in 's' (NULL clears it)
+int user_set_cookie(char *s, char *token, size_t len)
+{
+	return snprintf(s, len, "Set-Cookie: %s=%s; Path=/; Max-Age=%lld; SameSite=Strict; HttpOnly\r\n",
+		COOKIE_KEY, token ? token : "", token ? SESSION_TTL_MS / 1000 : 0);
 }
 
 // newuser_from_json : converts a JSON string into a NewUser object
@@ -368,6 +459,40 @@ UI_NewUser *newuser_from_json(char *s)
 	return user;
 }
 
+// login_from_json : converts a JSON string into a Login object
+UI_Login *login_from_json(char *s)
+{
+	UI_Login *login;
+	json_t *root;
+	json_t *username, *password;
+
+	root = json_loads(s, 0, NULL);
+	if (root == NULL) {
+		return NULL;
+	}
+
+	username = json_object_get(root, "username");
+	password = json_object_get(root, "password");
+
+	if (!json_is_string(username) || !json_is_string(password)) {
+		json_decref(root);
+		return NULL;
+	}
+
+	login = calloc(1, sizeof(*login));
+	if (login == NULL) {
+		json_decref(root);
+		return NULL;
+	}
+
+	login->username = strdup(json_string_value(username));
+	login->password = strdup(json_string_value(password));
+
+	json_decref(root);
+
+	return login;
+}
+
 // whoami_to_json : converts a WhoAmI structure to a json blob
 char *whoami_to_json(UI_WhoAmI *who)
 {
@@ -376,8 +501,8 @@ char *whoami_to_json(UI_WhoAmI *who)
 	char *json;
 
 	object = json_pack(
-		"{s:I,s:s,s:s}",
-		"id", (json_int_t)who->id,
+		"{s:s,s:s,s:s}",
+		"id", who->id,
 		"username", who->username,
 		"email", who->email
 		);
@@ -5,6 +5,13 @@
 // 2021-09-08 12:55:50
 
 #include "objects.h"
+#include "route.h"
+
+#include <sodium.h>
+
+// USER_PWHASH_*: the crypto_pwhash limits for every password (worker_init_pwhash is sized by these)
+#define USER_PWHASH_OPSLIMIT (crypto_pwhash_OPSLIMIT_INTERACTIVE)
+#define USER_PWHASH_MEMLIMIT (crypto_pwhash_MEMLIMIT_INTERACTIVE)
 
 // NOTE (Brian): we have different structures of data that the user can input at various points.
 // At no time, do we ever expose a "User" record to anyone. That's just absurd. You get a cookie,
@@ -35,17 +42,19 @@ typedef struct UI_UserSession {
     char *secret;
 } UI_UserSession;
 
+// NOTE (Brian) newuser and login hash passwords, so they always run on the WORKER_PWHASH threads
+
 // user_api_newuser: endpoint, /api/v1/user/create
-int user_api_newuser(struct mg_connection *conn, struct mg_http_message *hm);
+int user_api_newuser(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
 
 // user_api_login: endpoint, /api/v1/user/login
-int user_api_login(struct mg_connection *conn, struct mg_http_message *hm);
+int user_api_login(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
 
 // user_api_logout: endpoint, /api/v1/user/logout
-int user_api_logout(struct mg_connection *conn, struct mg_http_message *hm);
+int user_api_logout(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
 
 // user_api_whoami: endpoint, /api/v1/user/whoami
-int user_api_whoami(struct mg_connection *conn, struct mg_http_message *hm);
+int user_api_whoami(struct mg_connection *conn, struct mg_http_message *hm, RouteParams *params);
 
 #endif // USER_H
 
@@ -0,0 +1,497 @@
+// Brian Chrzanowski
+// 2026-10-17 10:02:11
+//
+// Worker Pool
+//
+// When the server is started with '-w N', requests that hit the routing table don't run on the
+// mongoose thread anymore. Instead:
+//
+//   1. the event loop copies the request, and puts it on a queue
+//   2. a worker pops it, and runs the endpoint against its own SQLite connection
+//   3. the endpoint "replies" into a stand-in mg_connection, which only collects the bytes
+//   4. the worker puts the finished job on the done queue, and wakes the event loop up
+//   5. the event loop looks the real connection up by id, and sends the response
+//
+// While a connection has a request out on a worker, mongoose leaves anything else it sends in the
+// recv buffer (is_resp), and that only gets parsed once the response is sent. So, pipelined requests
+// are still answered in the order they came in, whichever queue they went to.
+//
+// GETs go to the N read-only workers. Everything else goes to a single writer, so writes are
+// serialized without SQLite ever having to return SQLITE_BUSY to us. The database is in WAL mode
+// (see setup_sqlite), so the readers never wait on the writer.
+//
+// The endpoints that hash passwords (signup, login) get their own threads, whether or not there's
+// '-w'. Each crypto_pwhash is tens of milliseconds, and 64MiB, which would stall the event loop (or
+// the writer) for everyone. So, there are only as many of these threads as the memory budget has
+// room for hashes at once (worker_init_pwhash), they run at a lower priority than everything else,
+// and only so many requests can wait for one. Past that, it's a 503 right away, instead of a login
+// storm piling up unbounded copies of requests.
+
+#include "common.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <jansson.h>
+
+#include "mongoose.h"
+#include "sqlite3.h"
+
+#include "objects.h"
+#include "recipe.h"
+#include "gzip.h"
+#include "worker.h"
+
+// WorkerJob: a copied request, and eventually, its response
+typedef struct WorkerJob {
+	struct WorkerJob *next;
+	unsigned long conn_id;
+	struct mg_addr peer;
+	RouteHandler func;
+	RouteParams params;
+	char *route; // the router's, which outlives the workers
+	char *message;
+	struct mg_http_message hm;
+	struct mg_iobuf response;
+	int drain;
+} WorkerJob;
+
+// WorkerQueue: a locked FIFO of jobs
+typedef struct WorkerQueue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	WorkerJob *head;
+	WorkerJob *tail;
+	size_t len;
+} WorkerQueue;
+
+// WorkerThread: what each thread needs to know about itself
+typedef struct WorkerThread {
+	pthread_t thread;
+	WorkerQueue *queue;
+	int readonly;
+	int nice;
+	int started; // it's opened its connection (or tried to)
+	int failed;
+} WorkerThread;
+
+static WorkerQueue READQ = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+static WorkerQueue WRITEQ = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+static WorkerQueue DONEQ = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+static WorkerQueue PWHASHQ = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+// WorkerConnEntry: the connections that have a job out on a worker, by id (only the event loop touches these)
+typedef struct WorkerConnEntry {
+	unsigned long key;
+	struct mg_connection *value;
+} WorkerConnEntry;
+
+// the most password requests that can be waiting for a hashing thread (per thread)
+#define PWHASH_BACKLOG (32)
+
+// the threads say whether they could open the database here, before worker_init returns
+static pthread_mutex_t START_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t START_COND = PTHREAD_COND_INITIALIZER;
+
+static WorkerThread *THREADS = NULL;
+static WorkerThread *PWHASH_THREADS = NULL;
+static WorkerPwhashStats PWHASH_STATS;
+static WorkerConnEntry *CONNS = NULL;
+static struct mg_connection *WAKEUP = NULL;
+static char *DBNAME = NULL;
+static int STOPPING = false;
+
+// queue_push: appends the job to the queue, and wakes one waiting thread
+static void queue_push(WorkerQueue *queue, WorkerJob *job)
+{
+	job->next = NULL;
+
+	pthread_mutex_lock(&queue->lock);
+
+	if (queue->tail) {
+		queue->tail->next = job;
+	} else {
+		queue->head = job;
+	}
+	queue->tail = job;
+	queue->len++;
+
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+// queue_pop: blocks until there's a job on the queue, returns NULL when we're shutting down
+static WorkerJob *queue_pop(WorkerQueue *queue)
+{
+	WorkerJob *job;
+
+	pthread_mutex_lock(&queue->lock);
+
+	while (queue->head == NULL && !STOPPING) {
+		pthread_cond_wait(&queue->cond, &queue->lock);
+	}
+
+	job = queue->head;
+	if (job) {
+		queue->head = job->next;
+		if (queue->head == NULL) {
+			queue->tail = NULL;
+		}
+		queue->len--;
+	}
+
+	pthread_mutex_unlock(&queue->lock);
+
+	return job;
+}
+
+// queue_take_all: removes every job from the queue without blocking
+static WorkerJob *queue_take_all(WorkerQueue *queue)
+{
+	WorkerJob *jobs;
+
+	pthread_mutex_lock(&queue->lock);
+	jobs = queue->head;
+	queue->head = queue->tail = NULL;
+	queue->len = 0;
+	pthread_mutex_unlock(&queue->lock);
+
+	return jobs;
+}
+
+// job_free: releases the job, and the request / response buffers with it
+static void job_free(WorkerJob *job)
+{
+	if (job) {
+		free(job->message);
+		mg_iobuf_free(&job->response);
+		free(job);
+	}
+}
+
+// worker_thread: the loop each worker runs until worker_free
+static void *worker_thread(void *arg)
+{
+	WorkerThread *self = arg;
+	WorkerJob *job;
+	int rc;
+
+	// NOTE (Brian) on Linux, this is just this thread (see thumb.c)
+	errno = 0;
+	if (self->nice && nice(self->nice) < 0 && errno != 0) {
+		ERR("couldn't lower a worker's priority: %s\n", strerror(errno));
+	}
+
+	rc = db_open(DBNAME, self->readonly);
+
+	pthread_mutex_lock(&START_LOCK);
+	self->started = true;
+	self->failed = rc < 0;
+	pthread_cond_broadcast(&START_COND);
+	pthread_mutex_unlock(&START_LOCK);
+
+	if (rc < 0) {
+		ERR("worker couldn't open the database!\n");
+		return NULL;
+	}
+
+	while ((job = queue_pop(self->queue)) != NULL) {
+		// NOTE (Brian) endpoints only ever mg_printf / mg_send / mg_http_reply to their
+		// connection, which for a non-UDP connection just appends to 'send'. That means a zeroed
+		// connection is enough to collect the entire response off of the event loop. The peer
+		// address comes along for the endpoints that only answer to localhost (backup.c).
+		struct mg_connection stub = { .id = job->conn_id, .peer = job->peer };
+
+		rc = job->func(&stub, &job->hm, &job->params);
+		if (rc < 0) {
+			mg_http_reply(&stub, 503, NULL, "");
+		}
+
+		// compressing it here keeps that off of the event loop too (a recipe comes out of the
+		// cache already compressed, if the client takes it)
+		if (job->func != recipe_api_get) {
+			gzip_response(&stub.send, 0, &job->hm, job->route);
+		}
+
+		job->response = stub.send;
+		job->drain = stub.is_draining;
+
+		if (self->queue == &PWHASHQ) {
+			pthread_mutex_lock(&PWHASHQ.lock);
+			PWHASH_STATS.completed++;
+			pthread_mutex_unlock(&PWHASHQ.lock);
+		}
+
+		queue_push(&DONEQ, job);
+		mg_mgr_wakeup(WAKEUP);
+	}
+
+	db_close();
+
+	return NULL;
+}
+
+// worker_wakeup: event handler for the wakeup pipe, sends finished responses
+static void worker_wakeup(struct mg_connection *pipe, int ev, void *ev_data, void *fn_data)
+{
+	WorkerJob *job, *next;
+	struct mg_connection *conn;
+
+	if (ev != MG_EV_READ) {
+		return;
+	}
+
+	for (job = queue_take_all(&DONEQ); job; job = next) {
+		next = job->next;
+
+		// the client may have hung up while we were working (worker_close), in which case this gets
+		// dropped
+		conn = hmget(CONNS, job->conn_id);
+
+		if (conn) {
+			(void)hmdel(CONNS, job->conn_id);
+
+			mg_send(conn, job->response.buf, job->response.len);
+			// a response that got cut off part way through can only be signaled by hanging up
+			if (job->drain) conn->is_draining = 1;
+
+			// and then, whatever was pipelined behind it (which might go right back out to a worker)
+			conn->is_resp = 0;
+			if (conn->recv.len > 0 && !conn->is_draining) {
+				conn->pfn(conn, MG_EV_READ, NULL, conn->pfn_data);
+			}
+		}
+
+		job_free(job);
+	}
+}
+
+// worker_started: waits for every thread in 'threads' to open its connection, -1 if any of them couldn't
+static int worker_started(WorkerThread *threads)
+{
+	int rc = 0;
+
+	// NOTE (Brian) a thread that can't open the database is one nobody's popping the queue for, so
+	// requests would just hang there forever (and for the writer, that's every write)
+	pthread_mutex_lock(&START_LOCK);
+	for (int i = 0; i < arrlen(threads); i++) {
+		while (!threads[i].started) {
+			pthread_cond_wait(&START_COND, &START_LOCK);
+		}
+		if (threads[i].failed) {
+			rc = -1;
+		}
+	}
+	pthread_mutex_unlock(&START_LOCK);
+
+	return rc;
+}
+
+// worker_pipe: makes the pipe the workers wake the event loop up with, if it isn't there yet
+static int worker_pipe(struct mg_mgr *mgr, char *fname)
+{
+	if (WAKEUP != NULL) {
+		return 0;
+	}
+
+	WAKEUP = mg_mkpipe(mgr, worker_wakeup, NULL);
+	if (WAKEUP == NULL) {
+		ERR("couldn't create the worker wakeup pipe!\n");
+		return -1;
+	}
+
+	DBNAME = fname;
+	STOPPING = false;
+
+	return 0;
+}
+
+// worker_init: starts 'nreaders' read-only workers and one writer, each with their own connection
+int worker_init(struct mg_mgr *mgr, char *fname, int nreaders)
+{
+	int rc;
+
+	if (worker_pipe(mgr, fname) < 0) {
+		return -1;
+	}
+
+	// the first thread is always the writer, the rest are readers
+	arrsetlen(THREADS, nreaders + 1);
+
+	for (int i = 0; i < arrlen(THREADS); i++) {
+		THREADS[i] = (WorkerThread){ .readonly = i != 0, .queue = i == 0 ? &WRITEQ : &READQ };
+
+		rc = pthread_create(&THREADS[i].thread, NULL, worker_thread, &THREADS[i]);
+		if (rc != 0) {
+			ERR("couldn't start worker %d!\n", i);
+			arrsetlen(THREADS, i);
+			worker_free();
+			return -1;
+		}
+	}
+
+	if (worker_started(THREADS) < 0) {
+		worker_free();
+		return -1;
+	}
+
+	printf("started %d read workers, and 1 writer\n", nreaders);
+
+	return 0;
+}
+
+// worker_init_pwhash: starts 'nthreads' workers for the endpoints that hash passwords (WORKER_PWHASH)
+int worker_init_pwhash(struct mg_mgr *mgr, char *fname, int nthreads, int niceness)
+{
+	int rc;
+
+	if (worker_pipe(mgr, fname) < 0) {
+		return -1;
+	}
+
+	// signups write to the database, so these are read-write connections
+	arrsetlen(PWHASH_THREADS, nthreads);
+
+	for (int i = 0; i < arrlen(PWHASH_THREADS); i++) {
+		PWHASH_THREADS[i] = (WorkerThread){ .readonly = false, .queue = &PWHASHQ, .nice = niceness };
+
+		rc = pthread_create(&PWHASH_THREADS[i].thread, NULL, worker_thread, &PWHASH_THREADS[i]);
+		if (rc != 0) {
+			ERR("couldn't start password hashing worker %d!\n", i);
+			arrsetlen(PWHASH_THREADS, i);
+			worker_free();
+			return -1;
+		}
+	}
+
+	if (worker_started(PWHASH_THREADS) < 0) {
+		worker_free();
+		return -1;
+	}
+
+	PWHASH_STATS.threads = nthreads;
+	PWHASH_STATS.backlog = (size_t)nthreads * PWHASH_BACKLOG;
+
+	printf("started %d password hashing workers\n", nthreads);
+
+	return 0;
+}
+
+// worker_submit: copies the request (and its 'params'), and queues 'func' to run on the pool ('route' is for the counters)
+int worker_submit(struct mg_connection *conn, struct mg_http_message *hm, RouteHandler func, RouteParams *params, WorkerKind kind, char *route)
+{
+	WorkerQueue *queues[] = { [WORKER_READ] = &READQ, [WORKER_WRITE] = &WRITEQ, [WORKER_PWHASH] = &PWHASHQ };
+	WorkerJob *job;
+
+	// NOTE (Brian) checked before the copy, it's the copies we're trying not to pile up. It can go
+	// over by however many event loops there are (one), which is fine.
+	if (kind == WORKER_PWHASH) {
+		pthread_mutex_lock(&PWHASHQ.lock);
+		if (PWHASHQ.len >= PWHASH_STATS.backlog) {
+			PWHASH_STATS.rejected++;
+			pthread_mutex_unlock(&PWHASHQ.lock);
+			return -1;
+		}
+		PWHASH_STATS.submitted++;
+		pthread_mutex_unlock(&PWHASHQ.lock);
+	}
+
+	// 'hm' points into the connection's recv buffer, which mongoose clears as soon as we return,
+	// so the worker gets its own copy of the raw message, parsed again in place
+	job = calloc(1, sizeof(*job));
+	if (job == NULL) {
+		return -1;
+	}
+
+	job->message = malloc(hm->message.len);
+	if (job->message == NULL) {
+		free(job);
+		return -1;
+	}
+
+	memcpy(job->message, hm->message.ptr, hm->message.len);
+
+	if (mg_http_parse(job->message, hm->message.len, &job->hm) <= 0) {
+		job_free(job);
+		return -1;
+	}
+
+	// the parse takes the body length from Content-Length, but a connection that closed early hands
+	// us less than that (mongoose fires the message anyway), so only trust what we actually copied
+	job->hm.body.len = MIN(job->hm.body.len, hm->body.len);
+
+	job->conn_id = conn->id;
+	job->peer = conn->peer;
+	job->func = func;
+	job->params = *params;
+	job->route = route;
+
+	conn->is_resp = 1;
+
+	// NOTE (Brian) there's only ever one job out per connection (see is_resp), so the id is enough
+	hmput(CONNS, conn->id, conn);
+
+	queue_push(queues[kind], job);
+
+	return 0;
+}
+
+// worker_close: forgets 'conn', so a job that finishes after it's gone is dropped (MG_EV_CLOSE)
+void worker_close(struct mg_connection *conn)
+{
+	if (hmlen(CONNS) > 0) {
+		(void)hmdel(CONNS, conn->id);
+	}
+}
+
+// worker_pwhash_stats: returns the counters for the password hashing workers
+WorkerPwhashStats worker_pwhash_stats()
+{
+	WorkerPwhashStats stats;
+
+	pthread_mutex_lock(&PWHASHQ.lock);
+	stats = PWHASH_STATS;
+	stats.queued = PWHASHQ.len;
+	pthread_mutex_unlock(&PWHASHQ.lock);
+
+	return stats;
+}
+
+// worker_free: stops and joins every worker
+void worker_free()
+{
+	WorkerQueue *queues[] = { &READQ, &WRITEQ, &PWHASHQ };
+
+	for (size_t i = 0; i < ARRSIZE(queues); i++) {
+		pthread_mutex_lock(&queues[i]->lock);
+		STOPPING = true;
+		pthread_cond_broadcast(&queues[i]->cond);
+		pthread_mutex_unlock(&queues[i]->lock);
+	}
+
+	for (int i = 0; i < arrlen(THREADS); i++) {
+		pthread_join(THREADS[i].thread, NULL);
+	}
+
+	for (int i = 0; i < arrlen(PWHASH_THREADS); i++) {
+		pthread_join(PWHASH_THREADS[i].thread, NULL);
+	}
+
+	arrfree(THREADS);
+	arrfree(PWHASH_THREADS);
+
+	// anything that didn't make it out before the shutdown gets dropped
+	for (WorkerQueue **q = queues; q < queues + ARRSIZE(queues); q++) {
+		for (WorkerJob *job = queue_take_all(*q), *next; job; job = next) {
+			next = job->next;
+			job_free(job);
+		}
+	}
+
+	for (WorkerJob *job = queue_take_all(&DONEQ), *next; job; job = next) {
+		next = job->next;
+		job_free(job);
+	}
+
+	hmfree(CONNS);
+}
@@ -0,0 +1,43 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+// Brian Chrzanowski
+// 2026-10-17 10:02:11
+
+#include "common.h"
+
+#include "mongoose.h"
+
+#include "route.h"
+
+// WorkerKind: which of the pools a request runs on
+typedef enum WorkerKind {
+	WORKER_READ,   // the read-only workers (-w)
+	WORKER_WRITE,  // the writer
+	WORKER_PWHASH, // the password hashing workers
+} WorkerKind;
+
+// WorkerPwhashStats: counters for the password hashing workers, for /api/v1/stats
+typedef struct WorkerPwhashStats {
+	size_t threads;
+	size_t backlog; // the most requests that can wait, past this they get a 503
+	size_t queued;
+	u64 submitted;
+	u64 completed;
+	u64 rejected;
+} WorkerPwhashStats;
+
+// worker_init: starts 'nreaders' read-only workers and one writer, each with their own connection
+int worker_init(struct mg_mgr *mgr, char *fname, int nreaders);
+// worker_init_pwhash: starts 'nthreads' workers for the endpoints that hash passwords (WORKER_PWHASH)
+int worker_init_pwhash(struct mg_mgr *mgr, char *fname, int nthreads, int niceness);
+// worker_submit: copies the request (and its 'params'), and queues 'func' to run on the pool ('route' is for the counters)
+int worker_submit(struct mg_connection *conn, struct mg_http_message *hm, RouteHandler func, RouteParams *params, WorkerKind kind, char *route);
+// worker_close: forgets 'conn', so a job that finishes after it's gone is dropped (MG_EV_CLOSE)
+void worker_close(struct mg_connection *conn);
+// worker_pwhash_stats: returns the counters for the password hashing workers
+WorkerPwhashStats worker_pwhash_stats();
+// worker_free: stops and joins every worker
+void worker_free();
+
+#endif // WORKER_H
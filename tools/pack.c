@@ -0,0 +1,209 @@
+// Brian Chrzanowski
+// 2026-10-17 22:14:51
+//
+// Static Asset Packer
+//
+// Turns the files in html/ into a C file, so the server can be one binary that doesn't care what
+// directory it's started in, and so that serving them never touches the disk. Everything the
+// server would have had to work out per request is worked out here, once, at build time:
+//
+//   - the Content-Type, from the extension
+//   - the ETag, from a hash of the bytes (so it only changes when the file does, unlike mongoose's
+//     size + mtime one, which changes on every checkout)
+//   - a gzip -9 copy, when it comes out smaller
+//
+// USAGE: tools/pack root file... > src/packed.c
+//
+// Each file is served at its path with 'root' taken off the front (html/ui.js is /ui.js).
+
+#define COMMON_IMPLEMENTATION
+#include "../src/common.h"
+
+#include <zlib.h>
+#include <sodium.h>
+
+#define USAGE ("USAGE: %s root file...\n")
+
+#define PACK_HASH_SIZE (16) // bytes of BLAKE2b in the ETag
+
+// PackMime: a Content-Type, by extension
+typedef struct PackMime {
+	char *ext;
+	char *type;
+} PackMime;
+
+static PackMime MIME_TYPES[] = {
+	{ "html", "text/html; charset=utf-8" },
+	{ "js",   "text/javascript; charset=utf-8" },
+	{ "css",  "text/css; charset=utf-8" },
+	{ "json", "application/json" },
+	{ "svg",  "image/svg+xml" },
+	{ "txt",  "text/plain; charset=utf-8" },
+	{ "png",  "image/png" },
+	{ "jpg",  "image/jpeg" },
+	{ "ico",  "image/x-icon" },
+};
+
+// pack_mime: the Content-Type for 'path'
+static char *pack_mime(char *path)
+{
+	char *ext;
+	size_t i;
+
+	ext = strrchr(path, '.');
+	if (ext == NULL) {
+		return "application/octet-stream";
+	}
+
+	for (i = 0; i < ARRSIZE(MIME_TYPES); i++) {
+		if (streq(ext + 1, MIME_TYPES[i].ext)) {
+			return MIME_TYPES[i].type;
+		}
+	}
+
+	return "application/octet-stream";
+}
+
+// pack_gzip: gzip -9's 'len' bytes of 's' into 'out' (an stb array), -1 on error
+static int pack_gzip(char *s, size_t len, u8 **out)
+{
+	z_stream z = {0};
+	int rc;
+
+	// NOTE (Brian) 31 is 15 bits of window, and a gzip header (with no name, and no mtime, so the
+	// output only depends on the input)
+	if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, 31, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return -1;
+	}
+
+	arrsetlen(*out, deflateBound(&z, len));
+
+	z.next_in = (u8 *)s;
+	z.avail_in = len;
+	z.next_out = *out;
+	z.avail_out = arrlen(*out);
+
+	rc = deflate(&z, Z_FINISH);
+
+	arrsetlen(*out, z.total_out);
+
+	deflateEnd(&z);
+
+	return rc == Z_STREAM_END ? 0 : -1;
+}
+
+// pack_bytes: writes 'len' bytes of 's' as the body of a C array
+static void pack_bytes(const u8 *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		printf("%s0x%02x,", i % 16 == 0 ? "\n\t" : " ", s[i]);
+	}
+
+	printf("\n");
+}
+
+// PackFile: what goes in the table for one file, once its bytes have been written out
+typedef struct PackFile {
+	char *path;
+	char *mime;
+	char etag[PACK_HASH_SIZE * 2 + 1];
+	size_t len;
+	size_t gzlen; // 0 if it isn't worth it
+} PackFile;
+
+int main(int argc, char **argv)
+{
+	PackFile *files = NULL;
+	PackFile file;
+	char *root, *data;
+	size_t rootlen, i;
+	u8 hash[PACK_HASH_SIZE];
+	u8 *gz = NULL;
+
+	if (argc < 2) {
+		fprintf(stderr, USAGE, argv[0]);
+		return 1;
+	}
+
+	if (sodium_init() < 0) {
+		ERR("couldn't initialize libsodium");
+		return 1;
+	}
+
+	root = argv[1];
+	rootlen = strlen(root);
+
+	printf("// generated by tools/pack, from %s/ (don't edit it, edit those)\n\n", root);
+	printf("#include \"common.h\"\n\n#include \"assets.h\"\n");
+
+	for (i = 2; i < (size_t)argc; i++) {
+		memset(&file, 0, sizeof file);
+
+		data = sys_readfile(argv[i], &file.len);
+		if (data == NULL) {
+			ERR("couldn't read '%s'", argv[i]);
+			return 1;
+		}
+
+		if (pack_gzip(data, file.len, &gz) < 0) {
+			ERR("couldn't compress '%s'", argv[i]);
+			return 1;
+		}
+
+		file.path = argv[i];
+		if (strncmp(file.path, root, rootlen) == 0) {
+			file.path += rootlen;
+		}
+		file.path += strspn(file.path, "/");
+
+		file.mime = pack_mime(file.path);
+
+		crypto_generichash(hash, sizeof hash, (u8 *)data, file.len, NULL, 0);
+		sodium_bin2hex(file.etag, sizeof file.etag, hash, sizeof hash);
+
+		printf("\n// %s\n", argv[i]);
+		printf("static const u8 ASSET_%zu[] = {", i - 2);
+		pack_bytes((u8 *)data, file.len);
+		printf("};\n");
+
+		// NOTE (Brian) things that are already compressed (images) usually come out bigger
+		if ((size_t)arrlen(gz) < file.len) {
+			file.gzlen = arrlen(gz);
+
+			printf("static const u8 ASSET_%zu_GZ[] = {", i - 2);
+			pack_bytes(gz, file.gzlen);
+			printf("};\n");
+		}
+
+		arrput(files, file);
+
+		free(data);
+	}
+
+	printf("\nAsset ASSETS[] = {\n");
+
+	for (i = 0; i < (size_t)arrlen(files); i++) {
+		printf("\t{\n");
+		printf("\t\t.path = \"/%s\",\n", files[i].path);
+		printf("\t\t.mime = \"%s\",\n", files[i].mime);
+		printf("\t\t.etag = \"\\\"%s\\\"\",\n", files[i].etag);
+		printf("\t\t.data = ASSET_%zu,\n", i);
+		printf("\t\t.len = %zu,\n", files[i].len);
+		if (files[i].gzlen > 0) {
+			printf("\t\t.etag_gz = \"\\\"%s-gz\\\"\",\n", files[i].etag);
+			printf("\t\t.gz = ASSET_%zu_GZ,\n", i);
+			printf("\t\t.gzlen = %zu,\n", files[i].gzlen);
+		}
+		printf("\t},\n");
+	}
+
+	printf("};\n\n");
+	printf("size_t ASSETS_LEN = ARRSIZE(ASSETS);\n");
+
+	arrfree(files);
+	arrfree(gz);
+
+	return 0;
+}